@@ -42,10 +42,12 @@ namespace ListFileVersions
 			_fname = Path.GetFileName(filePath);
 			try
 			{
-				_fversion = vi.VersionString;
-				_pname = vi.QueryAttribute("ProductName");
-				_pversion = vi.QueryAttribute("ProductVersion");
-				_fdesc = vi.QueryAttribute("FileDescription");
+				// one call for all four attributes. an attribute the file does not define comes back as null.
+				object[] values = (object[])vi.QueryAttributes("FileVersion,ProductName,ProductVersion,FileDescription");
+				_fversion = values[0] as String;
+				_pname = values[1] as String;
+				_pversion = values[2] as String;
+				_fdesc = values[3] as String;
 			}
 			catch (Exception e)
 			{
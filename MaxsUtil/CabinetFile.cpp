@@ -0,0 +1,371 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "CabinetFile.h"
+#include <string.h>
+
+
+// the file table is read in one go. a larger one is not believed.
+#define CAB_MAX_FILE_TABLE 0x1000000
+
+static uint16_t _get16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+static uint32_t _get32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+CabinetFile::CabinetFile() : _dataReserve(0), _selected(0), _folder(-1), _nextBlock(0), _nextBlockOffset(0), _nextOutput(0), _prefetched(0), _bytesInflated(0)
+{
+}
+
+/* open - opens a cabinet, and reads its folder and file tables. The compressed data is not read until a file is read.
+
+Parameters:
+path - [in] pathname of a cabinet.
+
+Return value:
+ERROR_BAD_FORMAT - the file is not a cabinet, or its tables are malformed.
+*/
+uint32_t CabinetFile::open(LPCPATHSTR path)
+{
+	close();
+	uint32_t errorCode = _file.open(path);
+	if (errorCode == ERROR_HANDLE_EOF)
+		return ERROR_BAD_FORMAT;
+	if (errorCode == ERROR_SUCCESS)
+		errorCode = readTables();
+	if (errorCode != ERROR_SUCCESS)
+		close();
+	return errorCode;
+}
+
+// reads the header, the folder table and the file table.
+uint32_t CabinetFile::readTables()
+{
+	uint8_t h[CAB_HEADER_SIZE + 4];
+	uint32_t len = _file.size() < sizeof(h) ? (uint32_t)_file.size() : (uint32_t)sizeof(h);
+	uint32_t errorCode = _file.read(0, h, len);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	if (len < CAB_HEADER_SIZE || _get32(h) != CAB_SIGNATURE)
+		return ERROR_BAD_FORMAT;
+	uint32_t filesOffset = _get32(h + 16);
+	uint16_t folderCount = _get16(h + 26);
+	uint16_t fileCount = _get16(h + 28);
+	uint16_t flags = _get16(h + 30);
+	uint64_t offset = CAB_HEADER_SIZE;
+	uint32_t folderReserve = 0;
+	if (flags & CAB_FLAG_RESERVE_PRESENT)
+	{
+		if (len < CAB_HEADER_SIZE + 4)
+			return ERROR_BAD_FORMAT;
+		folderReserve = h[CAB_HEADER_SIZE + 2];
+		_dataReserve = h[CAB_HEADER_SIZE + 3];
+		offset += 4 + _get16(h + CAB_HEADER_SIZE);
+	}
+	if (filesOffset <= offset || filesOffset > _file.size())
+		return ERROR_BAD_FORMAT;
+
+	// the optional names of the previous and next cabinets, and the folder table lie between the header and the file table.
+	std::vector<uint8_t> buf((size_t)(filesOffset - offset));
+	errorCode = _file.read(offset, buf.data(), (uint32_t)buf.size());
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	size_t pos = 0;
+	int strings = ((flags & CAB_FLAG_PREV_CABINET) ? 2 : 0) + ((flags & CAB_FLAG_NEXT_CABINET) ? 2 : 0);
+	for (int i = 0; i < strings; i++)
+	{
+		const uint8_t *z = (const uint8_t*)memchr(buf.data() + pos, 0, buf.size() - pos);
+		if (!z)
+			return ERROR_BAD_FORMAT;
+		pos = z - buf.data() + 1;
+	}
+	uint64_t dataStart = _file.size();
+	for (uint16_t i = 0; i < folderCount; i++, pos += CAB_FOLDER_SIZE + folderReserve)
+	{
+		if (pos + CAB_FOLDER_SIZE > buf.size())
+			return ERROR_BAD_FORMAT;
+		CabinetFolder folder;
+		folder.dataOffset = _get32(&buf[pos]);
+		folder.blockCount = _get16(&buf[pos + 4]);
+		folder.compression = _get16(&buf[pos + 6]);
+		if (folder.dataOffset < filesOffset || folder.dataOffset > _file.size())
+			return ERROR_BAD_FORMAT;
+		if (folder.dataOffset < dataStart)
+			dataStart = folder.dataOffset;
+		_folders.push_back(folder);
+	}
+
+	// the file table runs up to the data of the first folder.
+	if (dataStart - filesOffset > CAB_MAX_FILE_TABLE)
+		return ERROR_BAD_FORMAT;
+	buf.resize((size_t)(dataStart - filesOffset));
+	errorCode = _file.read(filesOffset, buf.data(), (uint32_t)buf.size());
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	pos = 0;
+	_files.resize(fileCount);
+	for (uint16_t i = 0; i < fileCount; i++)
+	{
+		if (pos + CAB_FILE_SIZE >= buf.size())
+			return ERROR_BAD_FORMAT;
+		CabinetFileEntry &f = _files[i];
+		f.size = _get32(&buf[pos]);
+		f.folderOffset = _get32(&buf[pos + 4]);
+		f.folder = _get16(&buf[pos + 8]);
+		f.date = _get16(&buf[pos + 10]);
+		f.time = _get16(&buf[pos + 12]);
+		f.attribs = _get16(&buf[pos + 14]);
+		pos += CAB_FILE_SIZE;
+		const uint8_t *z = (const uint8_t*)memchr(buf.data() + pos, 0, buf.size() - pos);
+		if (!z)
+			return ERROR_BAD_FORMAT;
+		size_t nameLen = z - buf.data() - pos;
+		if (f.attribs & CAB_ATTRIB_NAME_IS_UTF)
+			appendUtf16(f.name, (const char*)buf.data() + pos, nameLen);
+		else
+		{
+			// the name is in the codepage of the system that made the cabinet. it is taken as Latin-1.
+			for (size_t j = 0; j < nameLen; j++)
+				f.name.push_back(buf[pos + j]);
+		}
+		pos += nameLen + 1;
+	}
+	_selected = _files.size();
+	return ERROR_SUCCESS;
+}
+
+/* close - closes the cabinet, and frees the tables and the decompressed blocks. */
+void CabinetFile::close()
+{
+	_file.close();
+	_folders.clear();
+	_files.clear();
+	_retained.clear();
+	_selected = 0;
+	_folder = -1;
+	_dataReserve = 0;
+	_bytesInflated = 0;
+}
+
+/* findFile - looks up a file by its pathname in the cabinet. The name is compared without regard to the case of ASCII letters, and a forward slash matches a backslash.
+
+Parameters:
+name - [in] pathname of the file in the cabinet, e.g., 'bin\app.dll'.
+nameLen - [in] number of characters in name.
+index - [out] receives the index of the file.
+
+Return value:
+ERROR_FILE_NOT_FOUND - the cabinet has no such file.
+*/
+uint32_t CabinetFile::findFile(LPCUTF16STR name, size_t nameLen, size_t *index) const
+{
+	for (size_t i = 0; i < _files.size(); i++)
+	{
+		const std::u16string &s = _files[i].name;
+		if (s.size() != nameLen)
+			continue;
+		size_t j;
+		for (j = 0; j < nameLen; j++)
+		{
+			UTF16CHAR c1 = s[j] == '/' ? '\\' : utf16ToLower(s[j]);
+			UTF16CHAR c2 = name[j] == '/' ? '\\' : utf16ToLower(name[j]);
+			if (c1 != c2)
+				break;
+		}
+		if (j == nameLen)
+		{
+			*index = i;
+			return ERROR_SUCCESS;
+		}
+	}
+	return ERROR_FILE_NOT_FOUND;
+}
+
+/* selectFile - makes a file the one read() and size() work on. Decompressed blocks are kept if the file is in the same folder as the one selected before.
+
+Return value:
+ERROR_NOT_SUPPORTED - the file spans cabinets, or its folder uses Quantum or LZX compression.
+*/
+uint32_t CabinetFile::selectFile(size_t index)
+{
+	if (index >= _files.size())
+		return ERROR_INVALID_PARAMETER;
+	uint16_t folder = _files[index].folder;
+	if (folder >= CAB_FOLDER_CONTINUED)
+		return ERROR_NOT_SUPPORTED;
+	if (folder >= _folders.size())
+		return ERROR_BAD_FORMAT;
+	uint16_t compression = _folders[folder].compression & CAB_COMPRESS_MASK;
+	if (compression != CAB_COMPRESS_NONE && compression != CAB_COMPRESS_MSZIP)
+		return ERROR_NOT_SUPPORTED;
+	if (folder != _folder)
+	{
+		_retained.clear();
+		rewind(folder);
+	}
+	_selected = index;
+	return ERROR_SUCCESS;
+}
+
+/* size - returns the uncompressed size of the selected file. */
+uint64_t CabinetFile::size() const
+{
+	return _selected < _files.size() ? _files[_selected].size : 0;
+}
+
+// restarts the decoder at the first block of a folder.
+void CabinetFile::rewind(int folder)
+{
+	_folder = folder;
+	_nextBlock = 0;
+	_nextBlockOffset = _folders[folder].dataOffset;
+	_nextOutput = 0;
+	_prefetched = 0;
+	_inflater.reset();
+}
+
+/* decodeNext - reads and decompresses the next block of the folder. The block is kept in _retained if it ends past a given offset. A stored block that is not kept is skipped without reading its data. The header of the block after it is read together with the data, and saves a read of its own.
+
+Parameters:
+wanted - [in] offset in the folder read() is looking for.
+*/
+uint32_t CabinetFile::decodeNext(uint64_t wanted)
+{
+	const CabinetFolder &folder = _folders[_folder];
+	if (_nextBlock >= folder.blockCount)
+		return ERROR_INVALID_DATA; // a file claims more data than its folder has.
+	uint32_t headerSize = CAB_DATA_SIZE + _dataReserve;
+	uint32_t errorCode;
+	if (_prefetched < headerSize)
+	{
+		_packed.resize(headerSize);
+		errorCode = _file.read(_nextBlockOffset, _packed.data(), headerSize);
+		if (errorCode != ERROR_SUCCESS)
+			return errorCode == ERROR_HANDLE_EOF ? ERROR_INVALID_DATA : errorCode;
+	}
+	_prefetched = 0;
+	uint32_t packedLen = _get16(&_packed[4]);
+	uint32_t outLen = _get16(&_packed[6]);
+	uint64_t dataOffset = _nextBlockOffset + headerSize;
+	bool keep = _nextOutput + outLen > wanted;
+	bool stored = (folder.compression & CAB_COMPRESS_MASK) == CAB_COMPRESS_NONE;
+	if (keep || !stored)
+	{
+		uint32_t readLen = packedLen;
+		if (_nextBlock + 1 < folder.blockCount && dataOffset + packedLen + headerSize <= _file.size())
+			readLen += headerSize;
+		_packed.resize(headerSize + readLen);
+		errorCode = _file.read(dataOffset, _packed.data() + headerSize, readLen);
+		if (errorCode != ERROR_SUCCESS)
+			return errorCode == ERROR_HANDLE_EOF ? ERROR_INVALID_DATA : errorCode;
+		const uint8_t *out;
+		if (stored)
+		{
+			if (packedLen != outLen)
+				return ERROR_INVALID_DATA;
+			out = _packed.data() + headerSize;
+		}
+		else
+		{
+			errorCode = _inflater.inflateBlock(_packed.data() + headerSize, packedLen, outLen, &out);
+			if (errorCode != ERROR_SUCCESS)
+				return errorCode;
+		}
+		if (keep)
+		{
+			if (_retained.size() >= CAB_RETAINED_BLOCKS)
+				_retained.clear();
+			_retained[_nextOutput].assign(out, out + outLen);
+		}
+		if (readLen > packedLen)
+		{
+			memmove(_packed.data(), _packed.data() + headerSize + packedLen, headerSize);
+			_prefetched = headerSize;
+		}
+	}
+	_bytesInflated += outLen;
+	_nextOutput += outLen;
+	_nextBlockOffset = dataOffset + packedLen;
+	_nextBlock++;
+	return ERROR_SUCCESS;
+}
+
+/* read - reads a range of the selected file. The blocks of the folder are decompressed as far as the end of the range. A block read before is served from memory. A range before the blocks decompressed last and not kept makes the folder decompress again from its start.
+
+Parameters:
+offset - [in] offset in the file to read from.
+buf - [out] receives the data.
+len - [in] number of bytes to read.
+*/
+uint32_t CabinetFile::read(uint64_t offset, void *buf, uint32_t len)
+{
+	if (_selected >= _files.size())
+		return ERROR_INVALID_PARAMETER;
+	const CabinetFileEntry &f = _files[_selected];
+	if (offset + len > f.size)
+		return ERROR_HANDLE_EOF;
+	uint64_t pos = f.folderOffset + offset;
+	uint8_t *p = (uint8_t*)buf;
+	while (len)
+	{
+		std::map<uint64_t, std::vector<uint8_t>>::iterator it = _retained.upper_bound(pos);
+		if (it != _retained.begin())
+		{
+			--it;
+			if (pos < it->first + it->second.size())
+			{
+				uint64_t avail = it->first + it->second.size() - pos;
+				uint32_t n = avail < len ? (uint32_t)avail : len;
+				memcpy(p, it->second.data() + (pos - it->first), n);
+				p += n;
+				pos += n;
+				len -= n;
+				continue;
+			}
+		}
+		if (pos < _nextOutput)
+			rewind(_folder);
+		while (_nextOutput <= pos)
+		{
+			uint32_t errorCode = decodeNext(pos);
+			if (errorCode != ERROR_SUCCESS)
+				return errorCode;
+		}
+	}
+	return ERROR_SUCCESS;
+}
+
+/* splitPath - finds the separator in a pathname of a file in a cabinet, e.g., 'setup.cab|bin\app.dll'. Returns its position, or 0 if there is none.
+*/
+size_t CabinetFile::splitPath(LPCPATHSTR path)
+{
+	for (size_t i = 1; path[0] && path[i]; i++)
+	{
+		if (path[i] == CAB_PATH_SEPARATOR)
+			return i;
+	}
+	return 0;
+}
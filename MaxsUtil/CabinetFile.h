@@ -0,0 +1,118 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "PEProbe.h"
+#include "MsZip.h"
+#include <vector>
+#include <map>
+
+
+#define CAB_SIGNATURE 0x4643534D // 'MSCF'
+#define CAB_HEADER_SIZE 36
+#define CAB_FOLDER_SIZE 8
+#define CAB_FILE_SIZE 16
+#define CAB_DATA_SIZE 8
+// CFHEADER flags.
+#define CAB_FLAG_PREV_CABINET 0x0001
+#define CAB_FLAG_NEXT_CABINET 0x0002
+#define CAB_FLAG_RESERVE_PRESENT 0x0004
+// CFFOLDER compression types.
+#define CAB_COMPRESS_MASK 0x000F
+#define CAB_COMPRESS_NONE 0
+#define CAB_COMPRESS_MSZIP 1
+// a CFFILE folder index from this up means the file continues from or into another cabinet of a set.
+#define CAB_FOLDER_CONTINUED 0xFFFD
+// CFFILE attributes. the MS-DOS ones, and one that says the name is in UTF-8 instead of the system codepage.
+#define CAB_ATTRIB_READONLY 0x01
+#define CAB_ATTRIB_ARCHIVE 0x20
+#define CAB_ATTRIB_NAME_IS_UTF 0x80
+// separates the pathname of a cabinet from the pathname of a file in it, e.g., 'setup.cab|bin\app.dll'.
+#define CAB_PATH_SEPARATOR '|'
+// a file read backward past this many decompressed data blocks is decompressed again from the start of its folder.
+#define CAB_RETAINED_BLOCKS 64
+
+struct CabinetFolder
+{
+	uint32_t dataOffset; // file offset of the first CFDATA.
+	uint16_t blockCount;
+	uint16_t compression; // CAB_COMPRESS_*.
+};
+
+struct CabinetFileEntry
+{
+	std::u16string name; // pathname in the cabinet, e.g., 'bin\app.dll'.
+	uint32_t size; // uncompressed size.
+	uint32_t folderOffset; // offset of the file in the uncompressed data of its folder.
+	uint16_t folder;
+	uint16_t date, time, attribs; // MS-DOS date, time and attributes.
+};
+
+/* CabinetFile reads files in a cabinet (.cab) without extracting them. The files of a cabinet are stored back to back in folders, and the data of a folder is cut into blocks of up to 32 KB. Each block is compressed. An MSZIP block can refer to the data of the blocks before it. So, a file is decompressed from the start of its folder, and a read at some offset in a file needs every block up to it.
+
+open() reads the header and the file table. selectFile() makes a file the one read() and size() work on. So, a CabinetFile is a RangeSource, and PEProbe can walk an image in a cabinet as it does a file on disk. read() decompresses blocks only as far as the range asked for, and the blocks it returns data from are kept. For a version resource, that is the blocks up to the end of the resource section, and the blocks after it are not even read.
+
+Only stored and MSZIP folders are supported. Quantum and LZX folders, and files that span cabinets return ERROR_NOT_SUPPORTED.
+*/
+class CabinetFile : public RangeSource
+{
+public:
+	CabinetFile();
+
+	uint32_t open(LPCPATHSTR path);
+	void close();
+
+	size_t fileCount() const { return _files.size(); }
+	const CabinetFileEntry &file(size_t index) const { return _files[index]; }
+	uint32_t findFile(LPCUTF16STR name, size_t nameLen, size_t *index) const;
+	uint32_t selectFile(size_t index);
+
+	virtual uint32_t read(uint64_t offset, void *buf, uint32_t len);
+	virtual uint64_t size() const;
+
+	uint64_t bytesRead() const { return _file.bytesRead(); }
+	uint64_t bytesInflated() const { return _bytesInflated; }
+
+	static size_t splitPath(LPCPATHSTR path);
+
+protected:
+	RangeFile _file;
+	uint32_t _dataReserve; // bytes reserved in each CFDATA.
+	std::vector<CabinetFolder> _folders;
+	std::vector<CabinetFileEntry> _files;
+	size_t _selected; // index of the file read() reads. _files.size() if none.
+	// decoder state of the folder being read.
+	int _folder; // -1 if no folder is being decoded.
+	uint32_t _nextBlock; // index of the next CFDATA of the folder.
+	uint64_t _nextBlockOffset; // file offset of the next CFDATA.
+	uint64_t _nextOutput; // offset in the uncompressed folder data the next block starts at.
+	std::vector<uint8_t> _packed; // CFDATA header and compressed data of a block, plus the header of the next block.
+	uint32_t _prefetched; // bytes of the header of the next block at the start of _packed. 0 if it has not been read.
+	MsZipInflater _inflater;
+	std::map<uint64_t, std::vector<uint8_t>> _retained; // decompressed blocks that read() has returned data from, by their offset in the folder.
+	uint64_t _bytesInflated; // uncompressed bytes produced by the decoder, including those of the blocks skipped over.
+
+	uint32_t readTables();
+	void rewind(int folder);
+	uint32_t decodeNext(uint64_t wanted);
+};
@@ -0,0 +1,467 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "CabinetWriter.h"
+#include "DirectoryWalker.h"
+#include "WorkStealingPool.h"
+#include <iterator>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <stdio.h>
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <time.h>
+#endif
+
+
+static void _append16(std::vector<uint8_t> &out, uint16_t v)
+{
+	out.push_back((uint8_t)v);
+	out.push_back((uint8_t)(v >> 8));
+}
+static void _append32(std::vector<uint8_t> &out, uint32_t v)
+{
+	_append16(out, (uint16_t)v);
+	_append16(out, (uint16_t)(v >> 16));
+}
+static void _set16(uint8_t *p, uint16_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+}
+static void _set32(uint8_t *p, uint32_t v)
+{
+	_set16(p, (uint16_t)v);
+	_set16(p + 2, (uint16_t)(v >> 16));
+}
+
+/* addFile - adds a file to the list of files to compress.
+
+Parameters:
+path - [in] pathname of the file on disk.
+name - [in] pathname of the file in the cabinet, e.g., 'bin\app.dll'. a forward slash is stored as a backslash.
+nameLen - [in] length of name in characters.
+
+Return value:
+ERROR_NOT_SUPPORTED - the file is larger than a folder can hold (2 GB), or the list already has 65535 files, which is as many as a cabinet can hold.
+*/
+uint32_t CabinetWriter::addFile(LPCPATHSTR path, LPCUTF16STR name, size_t nameLen)
+{
+	while (nameLen && (*name == '\\' || *name == '/'))
+	{
+		name++;
+		nameLen--;
+	}
+	if (nameLen == 0)
+		return ERROR_INVALID_PARAMETER;
+	if (_files.size() >= CABWRITER_MAX_FILES)
+		return ERROR_NOT_SUPPORTED;
+	CabinetWriterEntry entry;
+	uint32_t errorCode = getFileInfo(path, entry);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	if (entry.size > CABWRITER_MAX_FOLDER_SIZE)
+		return ERROR_NOT_SUPPORTED;
+	entry.path = path;
+	entry.name.assign(name, nameLen);
+	std::replace(entry.name.begin(), entry.name.end(), (UTF16CHAR)'/', (UTF16CHAR)'\\');
+	_files.push_back(entry);
+	_bytesTotal += entry.size;
+	return ERROR_SUCCESS;
+}
+
+/* _walkOrderLess - orders pathnames of files of a tree the way a depth-first walk of the tree in the order of the names finds them. The files of a directory come before those of its subdirectories, and the subdirectories follow one another in the order of their names. The pathnames start with the same root.
+*/
+static bool _walkOrderLess(const pathstring &a, const pathstring &b)
+{
+	// skip to the first name the pathnames differ in. the directories before it are the same.
+	size_t len = std::min(a.size(), b.size()), pos = 0;
+	while (pos < len && a[pos] == b[pos])
+		pos++;
+	size_t sep = pos ? a.rfind(PATHSEPARATOR, pos - 1) : pathstring::npos;
+	pos = sep == pathstring::npos ? 0 : sep + 1;
+	size_t endA = a.find(PATHSEPARATOR, pos), endB = b.find(PATHSEPARATOR, pos);
+	// a file of the directory comes before a file of a subdirectory.
+	if ((endA == pathstring::npos) != (endB == pathstring::npos))
+		return endA == pathstring::npos;
+	return a.compare(pos, endA == pathstring::npos ? pathstring::npos : endA - pos, b, pos, endB == pathstring::npos ? pathstring::npos : endB - pos) < 0;
+}
+
+/* addDirectory - adds the files of a directory. The files are named by their pathnames relative to the directory. The tree is walked in parallel by a DirectoryWalker. Then, the files are added in the order of their names, directory by directory, so that the same tree makes the same cabinet. A subdirectory that cannot be read and a file that disappears before it is added are skipped.
+
+Parameters:
+dirPath - [in] pathname of the directory.
+recursive - [in] true to add the files of the subdirectories, too.
+*/
+uint32_t CabinetWriter::addDirectory(LPCPATHSTR dirPath, bool recursive)
+{
+	pathstring prefix = dirPath;
+	if (!prefix.empty() && prefix.back() != PATHSEPARATOR)
+		prefix += PATHSEPARATOR;
+	WorkStealingPool pool;
+	// one list per worker. workers append without locking.
+	std::vector<std::vector<pathstring> > found(pool.workerCount());
+	DirectoryWalker walker;
+	uint32_t errorCode = walker.walk(prefix.c_str(), recursive, pool, [&found](const pathstring *files, size_t count, int worker)
+	{
+		found[worker].insert(found[worker].end(), files, files + count);
+	});
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	std::vector<pathstring> files;
+	for (size_t i = 0; i < found.size(); i++)
+	{
+		files.insert(files.end(), std::make_move_iterator(found[i].begin()), std::make_move_iterator(found[i].end()));
+		found[i].clear();
+	}
+	std::sort(files.begin(), files.end(), _walkOrderLess);
+	for (size_t i = 0; i < files.size(); i++)
+	{
+#ifdef _WIN32
+		std::u16string name((LPCUTF16STR)files[i].c_str() + prefix.size(), files[i].size() - prefix.size());
+#else
+		std::u16string name;
+		appendUtf16(name, files[i].c_str() + prefix.size(), files[i].size() - prefix.size());
+#endif
+		errorCode = addFile(files[i].c_str(), name.c_str(), name.size());
+		if (errorCode != ERROR_SUCCESS && errorCode != ERROR_FILE_NOT_FOUND)
+			return errorCode;
+	}
+	return ERROR_SUCCESS;
+}
+
+/* clear - empties the list of files. */
+void CabinetWriter::clear()
+{
+	_files.clear();
+	_fileOffsets.clear();
+	_folders.clear();
+	_bytesTotal = 0;
+	_bytesCompressed = 0;
+	_bytesWritten = 0;
+}
+
+/* write - compresses the listed files into a cabinet. The workers compress batches of data blocks in parallel, and the calling thread writes the batches to the cabinet in order. A worker does not start a batch more than a few batches ahead of the one being written. So, the memory in use does not grow with the size of the input.
+
+Parameters:
+cabPath - [in] pathname of the cabinet to create. an existing file is replaced.
+workerCount - [in] number of threads to compress with. 0 for one per logical processor.
+
+Return value:
+ERROR_FILE_NOT_FOUND - no file has been added.
+ERROR_CANCELLED - cancel() was called. the partial cabinet is deleted.
+ERROR_NOT_SUPPORTED - the cabinet would be larger than 4 GB.
+ERROR_HANDLE_EOF - a file has shrunk since it was added.
+*/
+uint32_t CabinetWriter::write(LPCPATHSTR cabPath, int workerCount)
+{
+	_canceled = false;
+	_bytesCompressed = 0;
+	_bytesWritten = 0;
+	if (_files.empty())
+		return ERROR_FILE_NOT_FOUND;
+	planFolders();
+
+	std::vector<Batch> batches;
+	for (size_t i = 0; i < _folders.size(); i++)
+	{
+		for (uint64_t offset = 0; offset < _folders[i].size; offset += CABWRITER_BATCH_BLOCKS * MSZIP_BLOCK_SIZE)
+		{
+			uint64_t len = std::min<uint64_t>(_folders[i].size - offset, CABWRITER_BATCH_BLOCKS * MSZIP_BLOCK_SIZE);
+			Batch batch = { i, offset, (uint32_t)len };
+			batches.push_back(batch);
+		}
+	}
+
+#ifdef _WIN32
+	FILE *fp = _wfopen(cabPath, L"wb");
+	if (!fp)
+		return GetLastError();
+#else//#ifdef _WIN32
+	FILE *fp = fopen(cabPath, "wb");
+	if (!fp)
+		return errno == EACCES ? ERROR_ACCESS_DENIED : ERROR_PATH_NOT_FOUND;
+#endif//#ifdef _WIN32
+	// the tables are written again at the end, when the offsets of the data are known. they are the same size then.
+	std::vector<uint8_t> tables;
+	buildTables(tables, 0);
+	uint32_t errorCode = fwrite(tables.data(), 1, tables.size(), fp) == tables.size() ? ERROR_SUCCESS : ERROR_WRITE_FAULT;
+	uint64_t cabinetSize = tables.size();
+	_bytesWritten = cabinetSize;
+	for (size_t i = 0; i < _folders.size(); i++)
+		_folders[i].dataOffset = (uint32_t)cabinetSize;
+
+	std::mutex lock;
+	std::condition_variable batchDone;
+	std::vector<std::vector<uint8_t> > outputs(batches.size());
+	std::vector<uint8_t> ready(batches.size(), 0);
+	uint32_t taskError = ERROR_SUCCESS; // the first error of a task. guarded by lock.
+	WorkStealingPool pool(workerCount);
+	std::vector<MsZipDeflater> deflaters(pool.workerCount());
+	size_t ahead = CABWRITER_BATCHES_AHEAD * pool.workerCount();
+	size_t submitted = 0;
+	for (size_t next = 0; next < batches.size() && errorCode == ERROR_SUCCESS; next++)
+	{
+		for (; submitted < batches.size() && submitted < next + ahead; submitted++)
+		{
+			size_t index = submitted;
+			pool.submit([&, index](int worker)
+			{
+				std::vector<uint8_t> out;
+				uint32_t e = _canceled ? ERROR_CANCELLED : compressBatch(batches[index], deflaters[worker], out);
+				if (e == ERROR_SUCCESS)
+					_bytesCompressed += batches[index].length;
+				std::lock_guard<std::mutex> guard(lock);
+				if (e != ERROR_SUCCESS && taskError == ERROR_SUCCESS)
+					taskError = e;
+				outputs[index].swap(out);
+				ready[index] = 1;
+				batchDone.notify_all();
+			});
+		}
+		std::vector<uint8_t> out;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			while (!ready[next])
+				batchDone.wait(guard);
+			errorCode = taskError;
+			out.swap(outputs[next]);
+		}
+		if (errorCode == ERROR_SUCCESS && _canceled)
+			errorCode = ERROR_CANCELLED;
+		if (errorCode != ERROR_SUCCESS)
+			break;
+		const Batch &batch = batches[next];
+		if (batch.offset == 0)
+			_folders[batch.folder].dataOffset = (uint32_t)cabinetSize;
+		cabinetSize += out.size();
+		if (cabinetSize > 0xFFFFFFFF)
+			errorCode = ERROR_NOT_SUPPORTED; // offsets in a cabinet are 32 bits wide.
+		else if (fwrite(out.data(), 1, out.size(), fp) != out.size())
+			errorCode = ERROR_WRITE_FAULT;
+		_bytesWritten = cabinetSize;
+	}
+	// the tasks refer to the locals. wait for the ones in flight before leaving.
+	pool.wait();
+
+	if (errorCode == ERROR_SUCCESS)
+	{
+		buildTables(tables, (uint32_t)cabinetSize);
+		if (fseek(fp, 0, SEEK_SET) != 0 || fwrite(tables.data(), 1, tables.size(), fp) != tables.size())
+			errorCode = ERROR_WRITE_FAULT;
+	}
+	if (fclose(fp) != 0 && errorCode == ERROR_SUCCESS)
+		errorCode = ERROR_WRITE_FAULT;
+	if (errorCode != ERROR_SUCCESS)
+	{
+#ifdef _WIN32
+		DeleteFileW(cabPath);
+#else
+		remove(cabPath);
+#endif
+	}
+	return errorCode;
+}
+
+/* planFolders - assigns the files to folders in order. A new folder is started when the next file would make a folder larger than it can be. */
+void CabinetWriter::planFolders()
+{
+	_folders.clear();
+	_fileOffsets.resize(_files.size());
+	Folder folder = { 0, 0, 0, 0, 0 };
+	for (size_t i = 0; i < _files.size(); i++)
+	{
+		if (folder.fileCount && folder.size + _files[i].size > CABWRITER_MAX_FOLDER_SIZE)
+		{
+			_folders.push_back(folder);
+			Folder nextFolder = { i, 0, 0, 0, 0 };
+			folder = nextFolder;
+		}
+		_fileOffsets[i] = folder.size;
+		folder.size += _files[i].size;
+		folder.fileCount++;
+	}
+	_folders.push_back(folder);
+	for (size_t i = 0; i < _folders.size(); i++)
+		_folders[i].blockCount = (uint32_t)((_folders[i].size + MSZIP_BLOCK_SIZE - 1) / MSZIP_BLOCK_SIZE);
+}
+
+/* readFolder - reads a range of the uncompressed data of a folder, i.e., of the files of the folder laid back to back. Each file is opened for the read. A range of 1 MB rarely spans more than a few files. */
+uint32_t CabinetWriter::readFolder(const Folder &folder, uint64_t offset, uint8_t *buf, uint32_t len) const
+{
+	std::vector<uint64_t>::const_iterator first = _fileOffsets.begin() + folder.firstFile;
+	size_t i = std::upper_bound(first, first + folder.fileCount, offset) - _fileOffsets.begin() - 1;
+	for (; len; i++)
+	{
+		const CabinetWriterEntry &entry = _files[i];
+		uint64_t at = offset - _fileOffsets[i];
+		if (at >= entry.size)
+			continue; // an empty file.
+		uint32_t n = (uint32_t)std::min<uint64_t>(len, entry.size - at);
+		RangeFile file;
+		uint32_t errorCode = file.open(entry.path.c_str());
+		if (errorCode == ERROR_SUCCESS)
+			errorCode = file.read(at, buf, n);
+		if (errorCode != ERROR_SUCCESS)
+			return errorCode;
+		buf += n;
+		offset += n;
+		len -= n;
+	}
+	return ERROR_SUCCESS;
+}
+
+/* compressBatch - reads a batch of data blocks and the 32 KB of data before them, and compresses the blocks into CFDATA records.
+
+Parameters:
+batch - [in] the range of a folder to compress.
+deflater - [in] the compressor of the worker.
+out - [out] receives the CFDATA records of the blocks, each a header, with the checksum, followed by the compressed data.
+*/
+uint32_t CabinetWriter::compressBatch(const Batch &batch, MsZipDeflater &deflater, std::vector<uint8_t> &out) const
+{
+	uint32_t history = batch.offset < MSZIP_WINDOW_SIZE ? (uint32_t)batch.offset : MSZIP_WINDOW_SIZE;
+	std::vector<uint8_t> in(history + batch.length);
+	uint32_t errorCode = readFolder(_folders[batch.folder], batch.offset - history, in.data(), (uint32_t)in.size());
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	out.reserve(batch.length / 2);
+	for (uint32_t pos = history; pos < in.size(); pos += MSZIP_BLOCK_SIZE)
+	{
+		uint32_t n = std::min<uint32_t>((uint32_t)in.size() - pos, MSZIP_BLOCK_SIZE);
+		size_t at = out.size();
+		out.resize(at + CAB_DATA_SIZE);
+		deflater.deflateBlock(&in[pos], n, pos < MSZIP_WINDOW_SIZE ? pos : MSZIP_WINDOW_SIZE, out);
+		uint32_t packed = (uint32_t)(out.size() - at - CAB_DATA_SIZE);
+		uint8_t *header = &out[at];
+		_set16(header + 4, (uint16_t)packed);
+		_set16(header + 6, (uint16_t)n);
+		// the checksum covers the data, and then the two size fields of the header.
+		_set32(header, checksum(header + 4, 4, checksum(header + CAB_DATA_SIZE, packed, 0)));
+	}
+	return ERROR_SUCCESS;
+}
+
+/* buildTables - makes the cabinet header, the folder table and the file table.
+
+Parameters:
+tables - [out] receives the tables.
+cabinetSize - [in] total size of the cabinet. 0 for a placeholder of the same size.
+*/
+void CabinetWriter::buildTables(std::vector<uint8_t> &tables, uint32_t cabinetSize) const
+{
+	tables.clear();
+	_append32(tables, CAB_SIGNATURE);
+	_append32(tables, 0);
+	_append32(tables, cabinetSize);
+	_append32(tables, 0);
+	_append32(tables, (uint32_t)(CAB_HEADER_SIZE + _folders.size() * CAB_FOLDER_SIZE)); // coffFiles
+	_append32(tables, 0);
+	tables.push_back(3); // versionMinor
+	tables.push_back(1); // versionMajor
+	_append16(tables, (uint16_t)_folders.size());
+	_append16(tables, (uint16_t)_files.size());
+	_append16(tables, 0); // flags
+	_append16(tables, 0); // setID
+	_append16(tables, 0); // iCabinet
+	for (size_t i = 0; i < _folders.size(); i++)
+	{
+		_append32(tables, _folders[i].dataOffset);
+		_append16(tables, (uint16_t)_folders[i].blockCount);
+		_append16(tables, CAB_COMPRESS_MSZIP);
+	}
+	std::string name;
+	for (size_t i = 0, folder = 0; i < _files.size(); i++)
+	{
+		if (folder + 1 < _folders.size() && i == _folders[folder + 1].firstFile)
+			folder++;
+		const CabinetWriterEntry &entry = _files[i];
+		uint16_t attribs = entry.attribs;
+		name.clear();
+		appendUtf8(name, entry.name.c_str(), entry.name.size());
+		if (name.size() != entry.name.size())
+			attribs |= CAB_ATTRIB_NAME_IS_UTF;
+		_append32(tables, (uint32_t)entry.size);
+		_append32(tables, (uint32_t)_fileOffsets[i]);
+		_append16(tables, (uint16_t)folder);
+		_append16(tables, entry.date);
+		_append16(tables, entry.time);
+		_append16(tables, attribs);
+		tables.insert(tables.end(), name.begin(), name.end());
+		tables.push_back(0);
+	}
+}
+
+/* getFileInfo - reads the size, the modification time in local time, and the attributes of a file. */
+uint32_t CabinetWriter::getFileInfo(LPCPATHSTR path, CabinetWriterEntry &entry)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA fa;
+	if (!GetFileAttributesExW(path, GetFileExInfoStandard, &fa))
+		return GetLastError();
+	if (fa.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		return ERROR_FILE_NOT_FOUND;
+	entry.size = ((uint64_t)fa.nFileSizeHigh << 32) | fa.nFileSizeLow;
+	FILETIME ft;
+	WORD date = 0, time = 0;
+	if (FileTimeToLocalFileTime(&fa.ftLastWriteTime, &ft))
+		FileTimeToDosDateTime(&ft, &date, &time);
+	entry.date = date;
+	entry.time = time;
+	entry.attribs = (uint16_t)(fa.dwFileAttributes & (FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_ARCHIVE));
+#else//#ifdef _WIN32
+	struct stat st;
+	if (stat(path, &st) != 0)
+		return errno == EACCES ? ERROR_ACCESS_DENIED : ERROR_FILE_NOT_FOUND;
+	if (!S_ISREG(st.st_mode))
+		return ERROR_FILE_NOT_FOUND;
+	entry.size = (uint64_t)st.st_size;
+	struct tm tm;
+	time_t t = st.st_mtime;
+	localtime_r(&t, &tm);
+	// an MS-DOS date counts years from 1980 in 7 bits.
+	int year = tm.tm_year < 80 ? 80 : tm.tm_year > 207 ? 207 : tm.tm_year;
+	entry.date = (uint16_t)(((year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+	entry.time = (uint16_t)((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+	entry.attribs = CAB_ATTRIB_ARCHIVE;
+	if (!(st.st_mode & S_IWUSR))
+		entry.attribs |= CAB_ATTRIB_READONLY;
+#endif//#ifdef _WIN32
+	return ERROR_SUCCESS;
+}
+
+/* checksum - computes the checksum of a CFDATA. The data is XORed 32 bits at a time. The 1 to 3 bytes left over make the last word, most significant byte first. */
+uint32_t CabinetWriter::checksum(const uint8_t *data, size_t len, uint32_t seed)
+{
+	uint32_t sum = seed;
+	for (size_t n = len / 4; n; n--, data += 4)
+		sum ^= data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+	uint32_t last = 0;
+	switch (len & 3)
+	{
+	case 3: last |= *data++ << 16; // fall through
+	case 2: last |= *data++ << 8; // fall through
+	case 1: last |= *data;
+	}
+	return sum ^ last;
+}
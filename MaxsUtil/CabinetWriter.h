@@ -0,0 +1,99 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "CabinetFile.h"
+#include "MsZip.h"
+#include <vector>
+#include <atomic>
+
+
+// a folder holds up to 65535 data blocks. a file larger than that cannot be stored.
+#define CABWRITER_MAX_FOLDER_SIZE ((uint64_t)0xFFFF * MSZIP_BLOCK_SIZE)
+#define CABWRITER_MAX_FILES 0xFFFF
+// data blocks compressed by one task. a task reads 1 MB of input and the 32 KB before it.
+#define CABWRITER_BATCH_BLOCKS 32
+// batches compressed ahead of the one being written, per worker. it bounds the memory held by finished batches waiting for their turn.
+#define CABWRITER_BATCHES_AHEAD 2
+
+struct CabinetWriterEntry
+{
+	pathstring path; // the file on disk.
+	std::u16string name; // pathname in the cabinet, e.g., 'bin\app.dll'.
+	uint64_t size;
+	uint16_t date, time, attribs; // MS-DOS date, time and attributes.
+};
+
+/* CabinetWriter compresses files into a cabinet (.cab) with MSZIP. addFile() and addDirectory() make a list of the files. write() stores them back to back in folders of up to 2 GB, and cuts the data of a folder into 32 KB blocks.
+
+An MSZIP block may refer to the 32 KB of data before it. That data is just the input, which is all on disk before compression starts. So, write() hands out batches of blocks to a pool of workers. A worker reads its batch, plus the 32 KB before it, straight from the files, and deflates the blocks with a compressor of its own (MsZipDeflater). The compressed batches are written in order as they complete. Reading and compression run in parallel, and the result is as small as a sequential compressor makes it.
+
+A pathname that is not ASCII is stored in UTF-8 with the CAB_ATTRIB_NAME_IS_UTF attribute, which the system's extractor (expand.exe and Explorer) understands. bytesTotal(), bytesCompressed() and bytesWritten() can be read from another thread while write() runs, e.g., to show progress. cancel() stops a write() in progress.
+*/
+class CabinetWriter
+{
+public:
+	CabinetWriter() : _bytesTotal(0), _bytesCompressed(0), _bytesWritten(0), _canceled(false) {}
+
+	uint32_t addFile(LPCPATHSTR path, LPCUTF16STR name, size_t nameLen);
+	uint32_t addDirectory(LPCPATHSTR dirPath, bool recursive);
+	void clear();
+	uint32_t write(LPCPATHSTR cabPath, int workerCount = 0);
+	void cancel() { _canceled = true; }
+
+	size_t fileCount() const { return _files.size(); }
+	const CabinetWriterEntry &file(size_t index) const { return _files[index]; }
+	uint64_t bytesTotal() const { return _bytesTotal; }
+	uint64_t bytesCompressed() const { return _bytesCompressed; }
+	uint64_t bytesWritten() const { return _bytesWritten; }
+
+protected:
+	struct Folder
+	{
+		size_t firstFile, fileCount;
+		uint64_t size; // uncompressed bytes.
+		uint32_t dataOffset; // file offset of the first CFDATA.
+		uint32_t blockCount;
+	};
+	struct Batch
+	{
+		size_t folder;
+		uint64_t offset; // offset in the uncompressed data of the folder.
+		uint32_t length;
+	};
+
+	std::vector<CabinetWriterEntry> _files;
+	std::vector<uint64_t> _fileOffsets; // offset of each file in the data of its folder. set by write().
+	std::vector<Folder> _folders;
+	uint64_t _bytesTotal;
+	std::atomic<uint64_t> _bytesCompressed; // input bytes of the batches compressed so far.
+	std::atomic<uint64_t> _bytesWritten; // bytes of the cabinet written so far.
+	std::atomic<bool> _canceled;
+
+	void planFolders();
+	uint32_t readFolder(const Folder &folder, uint64_t offset, uint8_t *buf, uint32_t len) const;
+	uint32_t compressBatch(const Batch &batch, MsZipDeflater &deflater, std::vector<uint8_t> &out) const;
+	void buildTables(std::vector<uint8_t> &tables, uint32_t cabinetSize) const;
+	static uint32_t getFileInfo(LPCPATHSTR path, CabinetWriterEntry &entry);
+	static uint32_t checksum(const uint8_t *data, size_t len, uint32_t seed);
+};
@@ -0,0 +1,195 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "stdafx.h"
+#include "CabinetWriterImpl.h"
+#include <future>
+#include <chrono>
+
+
+/* AddFile - [method] adds a file to the list of files to compress.
+
+Parameters:
+Path - [in] pathname of the file.
+Name - [in, optional] pathname of the file in the cabinet, e.g., 'bin\app.dll'. If it is omitted, the file is stored under its own name, without a directory.
+
+Remarks:
+An interface error of ERROR_NOT_SUPPORTED is returned if the file is larger than 2 GB, or if 65535 files have been added already. That is as many as a cabinet can hold.
+*/
+STDMETHODIMP CabinetWriterImpl::AddFile(/* [in] */ BSTR Path, /* [in, optional] */ VARIANT *Name)
+{
+	if (!Path || *Path == 0)
+		return E_INVALIDARG;
+	LPCWSTR name = PathFindFileNameW(Path);
+	VariantAutoRel var;
+	if (Name && Name->vt != VT_ERROR && Name->vt != VT_EMPTY)
+	{
+		HRESULT hr = VariantChangeType(var, Name, 0, VT_BSTR);
+		if (FAILED(hr))
+			return hr;
+		name = var._v.bstrVal ? var._v.bstrVal : L"";
+	}
+	return HRESULT_FROM_WIN32(_cw.addFile(Path, (LPCUTF16STR)name, wcslen(name)));
+}
+
+/* AddDirectory - [method] adds the files of a directory. A file is named by its pathname relative to the directory. Files are added in the order of their names, so that the same tree makes the same cabinet. A directory can be added with a call to AddDirectory, or file by file with AddFile if some of its files are to be left out.
+
+Parameters:
+Path - [in] pathname of the directory.
+Recursive - [in, optional] true (the default) to add the files of the subdirectories, too.
+*/
+STDMETHODIMP CabinetWriterImpl::AddDirectory(/* [in] */ BSTR Path, /* [in, optional] */ VARIANT *Recursive)
+{
+	if (!Path || *Path == 0)
+		return E_INVALIDARG;
+	bool recursive = true;
+	if (Recursive && Recursive->vt != VT_ERROR && Recursive->vt != VT_EMPTY)
+	{
+		VariantAutoRel var;
+		HRESULT hr = VariantChangeType(var, Recursive, 0, VT_BOOL);
+		if (FAILED(hr))
+			return hr;
+		recursive = var._v.boolVal != VARIANT_FALSE;
+	}
+	return HRESULT_FROM_WIN32(_cw.addDirectory(Path, recursive));
+}
+
+/* Compress - [method] compresses the added files into a cabinet. The data blocks are compressed in parallel with MSZIP, on as many threads as there are logical processors unless Threads says otherwise. The file list is kept. Call Clear before adding the files of another cabinet.
+
+Parameters:
+CabinetPath - [in] pathname of the cabinet to create. An existing file is replaced.
+ProgressBox - [in, optional] a MaxsUtilLib.ProgressBox object. Every 100 milliseconds, its ProgressPos is moved in the range of 0 to 1000 in proportion to the bytes compressed, and its Note shows the byte counts. If the user cancels the ProgressBox, the compression stops, the partial cabinet is deleted, and an interface error of ERROR_CANCELLED is returned. Call ShowProgressBar or Start with PROGRESSBOXSTARTOPTION_SHOW_PROGRESSBAR to show the bar.
+FileCount - [retval][out] number of files in the cabinet.
+*/
+STDMETHODIMP CabinetWriterImpl::Compress(/* [in] */ BSTR CabinetPath, /* [in, optional] */ VARIANT *ProgressBox, /* [retval][out] */ long *FileCount)
+{
+	if (!CabinetPath || *CabinetPath == 0)
+		return E_INVALIDARG;
+	*FileCount = 0;
+	IProgressBox *progress = NULL;
+	if (ProgressBox && ProgressBox->vt != VT_ERROR && ProgressBox->vt != VT_EMPTY)
+	{
+		if ((ProgressBox->vt != VT_DISPATCH && ProgressBox->vt != VT_UNKNOWN) || !ProgressBox->punkVal)
+			return E_INVALIDARG;
+		HRESULT hr = ProgressBox->punkVal->QueryInterface(IID_IProgressBox, (LPVOID*)&progress);
+		if (FAILED(hr))
+			return hr;
+		progress->put_LowerBound(0);
+		progress->put_UpperBound(CABWRITERIMPL_PROGRESS_RANGE);
+		progress->put_ProgressPos(0);
+	}
+	// the calling thread stays free to update the ProgressBox while the workers compress.
+	std::future<uint32_t> result = std::async(std::launch::async, [this, CabinetPath]() { return _cw.write(CabinetPath, _threads); });
+	while (result.wait_for(std::chrono::milliseconds(CABWRITERIMPL_PROGRESS_INTERVAL)) != std::future_status::ready)
+	{
+		if (progress)
+			updateProgress(progress);
+	}
+	uint32_t errorCode = result.get();
+	if (progress)
+	{
+		updateProgress(progress);
+		progress->Release();
+	}
+	if (errorCode != ERROR_SUCCESS)
+		return HRESULT_FROM_WIN32(errorCode);
+	*FileCount = (long)_cw.fileCount();
+	return S_OK;
+}
+
+/* Clear - [method] empties the list of added files. */
+STDMETHODIMP CabinetWriterImpl::Clear()
+{
+	_cw.clear();
+	return S_OK;
+}
+
+/* get_Threads - [propget] returns the number of threads Compress runs. 0 means one per logical processor.
+*/
+STDMETHODIMP CabinetWriterImpl::get_Threads(/* [retval][out] */ long *Value)
+{
+	*Value = _threads;
+	return S_OK;
+}
+
+/* put_Threads - [propput] sets the number of threads Compress runs. The cabinet is the same whatever the number of threads.
+
+Parameters:
+NewValue - [in] number of threads, or 0 for one per logical processor.
+*/
+STDMETHODIMP CabinetWriterImpl::put_Threads(/* [in] */ long NewValue)
+{
+	if (NewValue < 0)
+		return E_INVALIDARG;
+	_threads = NewValue;
+	return S_OK;
+}
+
+/* get_FileCount - [propget] returns the number of files added.
+*/
+STDMETHODIMP CabinetWriterImpl::get_FileCount(/* [retval][out] */ long *Value)
+{
+	*Value = (long)_cw.fileCount();
+	return S_OK;
+}
+
+/* get_BytesTotal - [propget] returns the total size of the files added.
+*/
+STDMETHODIMP CabinetWriterImpl::get_BytesTotal(/* [retval][out] */ double *Value)
+{
+	*Value = (double)_cw.bytesTotal();
+	return S_OK;
+}
+
+/* get_BytesCompressed - [propget] returns the bytes of the files compressed by the last Compress. It equals BytesTotal if Compress succeeded.
+*/
+STDMETHODIMP CabinetWriterImpl::get_BytesCompressed(/* [retval][out] */ double *Value)
+{
+	*Value = (double)_cw.bytesCompressed();
+	return S_OK;
+}
+
+/* get_CabinetSize - [propget] returns the size of the cabinet written by the last Compress. Divide it by BytesTotal for the compression ratio.
+*/
+STDMETHODIMP CabinetWriterImpl::get_CabinetSize(/* [retval][out] */ double *Value)
+{
+	*Value = (double)_cw.bytesWritten();
+	return S_OK;
+}
+
+/* updateProgress - moves the progress bar of a ProgressBox, and shows the byte counts in its Note. If the user has canceled the ProgressBox, the compression is told to stop. */
+void CabinetWriterImpl::updateProgress(IProgressBox *progress)
+{
+	uint64_t total = _cw.bytesTotal();
+	uint64_t done = _cw.bytesCompressed();
+	progress->put_ProgressPos(total ? (long)(done * CABWRITERIMPL_PROGRESS_RANGE / total) : CABWRITERIMPL_PROGRESS_RANGE);
+	WCHAR doneText[32], totalText[32], packedText[32];
+	StrFormatByteSizeW((LONGLONG)done, doneText, ARRAYSIZE(doneText));
+	StrFormatByteSizeW((LONGLONG)total, totalText, ARRAYSIZE(totalText));
+	StrFormatByteSizeW((LONGLONG)_cw.bytesWritten(), packedText, ARRAYSIZE(packedText));
+	bstring note;
+	note.format(L"%s of %s compressed to %s", doneText, totalText, packedText);
+	progress->put_Note(note);
+	VARIANT_BOOL canceled = VARIANT_FALSE;
+	if (SUCCEEDED(progress->get_Canceled(&canceled)) && canceled)
+		_cw.cancel();
+}
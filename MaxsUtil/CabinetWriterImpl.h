@@ -0,0 +1,61 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "IDispatchImpl.h"
+#include "MaxsUtil_h.h"
+#include "CabinetWriter.h"
+
+
+// Compress sets the progress range of a ProgressBox to this, and moves the position in proportion to the bytes compressed.
+#define CABWRITERIMPL_PROGRESS_RANGE 1000
+// milliseconds between two updates of a ProgressBox.
+#define CABWRITERIMPL_PROGRESS_INTERVAL 100
+
+// implements the ICabinetWriter interface of the CabinetWriter coclass.
+class CabinetWriterImpl :
+	public IDispatchWithObjectSafetyImpl<ICabinetWriter, &IID_ICabinetWriter, &LIBID_MaxsUtilLib>
+{
+public:
+	CabinetWriterImpl() : _threads(0) {}
+
+	// IUnknown methods
+	DELEGATE_IUNKNOWN_TO_IDISPATCHWITHOBJECTSAFETYIMPL(ICabinetWriter, &IID_ICabinetWriter, &LIBID_MaxsUtilLib)
+
+	// ICabinetWriter methods
+	STDMETHOD(AddFile)(/* [in] */ BSTR Path, /* [in, optional] */ VARIANT *Name);
+	STDMETHOD(AddDirectory)(/* [in] */ BSTR Path, /* [in, optional] */ VARIANT *Recursive);
+	STDMETHOD(Compress)(/* [in] */ BSTR CabinetPath, /* [in, optional] */ VARIANT *ProgressBox, /* [retval][out] */ long *FileCount);
+	STDMETHOD(Clear)();
+	STDMETHOD(get_Threads)(/* [retval][out] */ long *Value);
+	STDMETHOD(put_Threads)(/* [in] */ long NewValue);
+	STDMETHOD(get_FileCount)(/* [retval][out] */ long *Value);
+	STDMETHOD(get_BytesTotal)(/* [retval][out] */ double *Value);
+	STDMETHOD(get_BytesCompressed)(/* [retval][out] */ double *Value);
+	STDMETHOD(get_CabinetSize)(/* [retval][out] */ double *Value);
+
+protected:
+	CabinetWriter _cw; // the list of files and the compressor.
+	long _threads; // compression threads. 0 for one per logical processor.
+
+	void updateProgress(IProgressBox *progress);
+};
@@ -0,0 +1,493 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "ClrMetadata.h"
+#include <string.h>
+#include <stdio.h>
+
+
+/* column types of the metadata tables (ECMA-335, partition II, chapter 22). A value below CLI_COL_FIXED2 is a simple index into the table of that number. */
+#define CLI_COL_FIXED2 0x40
+#define CLI_COL_FIXED4 0x41
+#define CLI_COL_STRING 0x42
+#define CLI_COL_GUID 0x43
+#define CLI_COL_BLOB 0x44
+#define CLI_COL_CODED 0x50 // CLI_COL_CODED + a CLI_CODED_* kind.
+#define CLI_COL_END 0xFF
+
+// kinds of coded indices. a coded index is a table index with the table in its low tag bits.
+enum CLI_CODED_INDEX {
+	CLI_CODED_TYPEDEFORREF,
+	CLI_CODED_HASCONSTANT,
+	CLI_CODED_HASCUSTOMATTRIBUTE,
+	CLI_CODED_HASFIELDMARSHAL,
+	CLI_CODED_HASDECLSECURITY,
+	CLI_CODED_MEMBERREFPARENT,
+	CLI_CODED_HASSEMANTICS,
+	CLI_CODED_METHODDEFORREF,
+	CLI_CODED_MEMBERFORWARDED,
+	CLI_CODED_IMPLEMENTATION,
+	CLI_CODED_CUSTOMATTRIBUTETYPE,
+	CLI_CODED_RESOLUTIONSCOPE,
+	CLI_CODED_TYPEORMETHODDEF,
+	CLI_CODED_COUNT
+};
+
+// the tables each kind of coded index can refer to. only their row counts matter. so, unused tags are left out.
+static const struct { uint8_t tagBits; uint8_t tables[24]; } _codedIndices[CLI_CODED_COUNT] = {
+	{ 2, { 0x02, 0x01, 0x1B, CLI_COL_END } },
+	{ 2, { 0x04, 0x08, 0x17, CLI_COL_END } },
+	{ 5, { 0x06, 0x04, 0x01, 0x02, 0x08, 0x09, 0x0A, 0x00, 0x0E, 0x17, 0x14, 0x11, 0x1A, 0x1B, 0x20, 0x23, 0x26, 0x27, 0x28, 0x2A, 0x2C, 0x2B, CLI_COL_END } },
+	{ 1, { 0x04, 0x08, CLI_COL_END } },
+	{ 2, { 0x02, 0x06, 0x20, CLI_COL_END } },
+	{ 3, { 0x02, 0x01, 0x1A, 0x06, 0x1B, CLI_COL_END } },
+	{ 1, { 0x14, 0x17, CLI_COL_END } },
+	{ 1, { 0x06, 0x0A, CLI_COL_END } },
+	{ 1, { 0x04, 0x06, CLI_COL_END } },
+	{ 2, { 0x26, 0x23, 0x27, CLI_COL_END } },
+	{ 3, { 0x06, 0x0A, CLI_COL_END } },
+	{ 2, { 0x00, 0x1A, 0x23, 0x01, CLI_COL_END } },
+	{ 1, { 0x02, 0x06, CLI_COL_END } },
+};
+
+#define C(kind) (CLI_COL_CODED + CLI_CODED_##kind)
+#define F2 CLI_COL_FIXED2
+#define F4 CLI_COL_FIXED4
+#define S CLI_COL_STRING
+#define G CLI_COL_GUID
+#define B CLI_COL_BLOB
+#define END CLI_COL_END
+
+// the columns of the tables in front of the Assembly table. the row size of each is needed to find the next.
+static const uint8_t _tableColumns[CLI_TABLE_ASSEMBLY + 1][10] = {
+	{ F2, S, G, G, G, END }, // 0x00 Module
+	{ C(RESOLUTIONSCOPE), S, S, END }, // 0x01 TypeRef
+	{ F4, S, S, C(TYPEDEFORREF), 0x04, 0x06, END }, // 0x02 TypeDef
+	{ 0x04, END }, // 0x03 FieldPtr
+	{ F2, S, B, END }, // 0x04 Field
+	{ 0x06, END }, // 0x05 MethodPtr
+	{ F4, F2, F2, S, B, 0x08, END }, // 0x06 MethodDef
+	{ 0x08, END }, // 0x07 ParamPtr
+	{ F2, F2, S, END }, // 0x08 Param
+	{ 0x02, C(TYPEDEFORREF), END }, // 0x09 InterfaceImpl
+	{ C(MEMBERREFPARENT), S, B, END }, // 0x0A MemberRef
+	{ F2, C(HASCONSTANT), B, END }, // 0x0B Constant
+	{ C(HASCUSTOMATTRIBUTE), C(CUSTOMATTRIBUTETYPE), B, END }, // 0x0C CustomAttribute
+	{ C(HASFIELDMARSHAL), B, END }, // 0x0D FieldMarshal
+	{ F2, C(HASDECLSECURITY), B, END }, // 0x0E DeclSecurity
+	{ F2, F4, 0x02, END }, // 0x0F ClassLayout
+	{ F4, 0x04, END }, // 0x10 FieldLayout
+	{ B, END }, // 0x11 StandAloneSig
+	{ 0x02, 0x14, END }, // 0x12 EventMap
+	{ 0x14, END }, // 0x13 EventPtr
+	{ F2, S, C(TYPEDEFORREF), END }, // 0x14 Event
+	{ 0x02, 0x17, END }, // 0x15 PropertyMap
+	{ 0x17, END }, // 0x16 PropertyPtr
+	{ F2, S, B, END }, // 0x17 Property
+	{ F2, 0x06, C(HASSEMANTICS), END }, // 0x18 MethodSemantics
+	{ 0x02, C(METHODDEFORREF), C(METHODDEFORREF), END }, // 0x19 MethodImpl
+	{ S, END }, // 0x1A ModuleRef
+	{ B, END }, // 0x1B TypeSpec
+	{ F2, C(MEMBERFORWARDED), S, 0x1A, END }, // 0x1C ImplMap
+	{ F4, 0x04, END }, // 0x1D FieldRVA
+	{ F4, F4, END }, // 0x1E EncLog
+	{ F4, END }, // 0x1F EncMap
+	{ F4, F2, F2, F2, F2, F4, B, S, S, END }, // 0x20 Assembly
+};
+
+#undef C
+#undef F2
+#undef F4
+#undef S
+#undef G
+#undef B
+#undef END
+
+static uint16_t _get16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t _get32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* clear - detaches the metadata. */
+void ClrMetadata::clear()
+{
+	_tables = _strings = _blob = NULL;
+	_tablesLen = _stringsLen = _blobLen = 0;
+	_heapSizes = 0;
+	memset(_rows, 0, sizeof(_rows));
+	memset(_rowSize, 0, sizeof(_rowSize));
+	memset(_tableOffset, 0, sizeof(_tableOffset));
+}
+
+/* attach - finds the metadata of a .NET image, and lays out its tables.
+
+Parameters:
+pe - [in] an attached image. It must stay attached while the metadata is read.
+
+Return value:
+ERROR_NOT_FOUND if the image has no CLI header, i.e., it is not a .NET image. ERROR_INVALID_DATA if the metadata is malformed.
+*/
+uint32_t ClrMetadata::attach(const PEImage &pe)
+{
+	clear();
+	uint32_t rva, size;
+	if (!pe.getDataDirectory(PE_DIRECTORY_ENTRY_COM_DESCRIPTOR, &rva, &size) || rva == 0 || size < sizeof(PE_CLI_HEADER))
+		return ERROR_NOT_FOUND;
+	const PE_CLI_HEADER *cli = (const PE_CLI_HEADER*)pe.rvaToPtr(rva, sizeof(PE_CLI_HEADER));
+	if (!cli)
+		return ERROR_INVALID_DATA;
+	uint32_t metaLen = cli->MetaData.Size;
+	const uint8_t *meta = pe.rvaToPtr(cli->MetaData.VirtualAddress, metaLen);
+	// the root: signature, versions, reserved, the length of the version string, the version string, flags, and the number of streams.
+	if (!meta || metaLen < 16 || _get32(meta) != CLI_METADATA_SIGNATURE)
+		return ERROR_INVALID_DATA;
+	uint32_t versionLen = _get32(meta + 12);
+	if (versionLen > metaLen - 16 - 4)
+		return ERROR_INVALID_DATA;
+	size_t pos = 16 + versionLen;
+	uint16_t streamCount = _get16(meta + pos + 2);
+	pos += 4;
+	const uint8_t *tableStream = NULL;
+	uint32_t tableStreamLen = 0;
+	for (uint16_t i = 0; i < streamCount; i++)
+	{
+		// a stream header is the offset and size of the stream, and a null-terminated name padded to 4 bytes.
+		if (pos + 8 > metaLen)
+			return ERROR_INVALID_DATA;
+		uint32_t offset = _get32(meta + pos);
+		uint32_t len = _get32(meta + pos + 4);
+		const char *name = (const char*)meta + pos + 8;
+		size_t nameMax = metaLen - pos - 8;
+		size_t nameLen = strnlen(name, nameMax < 32 ? nameMax : 32);
+		if (nameLen == nameMax || nameLen == 32)
+			return ERROR_INVALID_DATA;
+		pos += 8 + ((nameLen + 4) & ~3);
+		if (offset > metaLen || len > metaLen - offset)
+			return ERROR_INVALID_DATA;
+		if (strcmp(name, "#~") == 0 || strcmp(name, "#-") == 0)
+		{
+			tableStream = meta + offset;
+			tableStreamLen = len;
+		}
+		else if (strcmp(name, "#Strings") == 0)
+		{
+			_strings = meta + offset;
+			_stringsLen = len;
+		}
+		else if (strcmp(name, "#Blob") == 0)
+		{
+			_blob = meta + offset;
+			_blobLen = len;
+		}
+	}
+	if (!tableStream || tableStreamLen < sizeof(CLI_TABLES_HEADER))
+		return ERROR_INVALID_DATA;
+	const CLI_TABLES_HEADER *th = (const CLI_TABLES_HEADER*)tableStream;
+	_heapSizes = th->HeapSizes;
+	pos = sizeof(CLI_TABLES_HEADER);
+	// a row count follows the header for each table present, including tables this reader does not know.
+	for (int table = 0; table < 64; table++)
+	{
+		if (!(th->Valid & ((uint64_t)1 << table)))
+			continue;
+		if (pos + 4 > tableStreamLen)
+			return ERROR_INVALID_DATA;
+		if (table < CLI_TABLE_COUNT)
+			_rows[table] = _get32(tableStream + pos);
+		pos += 4;
+	}
+	if (_heapSizes & CLI_HEAP_EXTRA_DATA)
+		pos += 4;
+	if (pos > tableStreamLen)
+		return ERROR_INVALID_DATA;
+	_tables = tableStream + pos;
+	_tablesLen = tableStreamLen - pos;
+	uint32_t errorCode = computeLayout();
+	if (errorCode != ERROR_SUCCESS)
+		clear();
+	return errorCode;
+}
+
+/* columnSize - returns the width in bytes of a column of a table row. The width of an index depends on the size of the heap or the row counts of the tables it refers to. */
+uint8_t ClrMetadata::columnSize(uint8_t column) const
+{
+	switch (column)
+	{
+	case CLI_COL_FIXED2:
+		return 2;
+	case CLI_COL_FIXED4:
+		return 4;
+	case CLI_COL_STRING:
+		return (_heapSizes & CLI_HEAP_STRING_WIDE) ? 4 : 2;
+	case CLI_COL_GUID:
+		return (_heapSizes & CLI_HEAP_GUID_WIDE) ? 4 : 2;
+	case CLI_COL_BLOB:
+		return (_heapSizes & CLI_HEAP_BLOB_WIDE) ? 4 : 2;
+	}
+	if (column < CLI_COL_FIXED2)
+		return _rows[column] < 0x10000 ? 2 : 4;
+	// a coded index is 2 bytes wide if the largest table it refers to can be indexed by the bits left over by the tag.
+	const uint8_t *tables = _codedIndices[column - CLI_COL_CODED].tables;
+	uint32_t limit = (uint32_t)1 << (16 - _codedIndices[column - CLI_COL_CODED].tagBits);
+	for (int i = 0; tables[i] != CLI_COL_END; i++)
+	{
+		if (_rows[tables[i]] >= limit)
+			return 4;
+	}
+	return 2;
+}
+
+/* computeLayout - computes the row size and the offset of each table up to the Assembly table. The tables are stored one after another in the order of their numbers. */
+uint32_t ClrMetadata::computeLayout()
+{
+	size_t offset = 0;
+	for (int table = 0; table <= CLI_TABLE_ASSEMBLY; table++)
+	{
+		uint32_t rowSize = 0;
+		for (const uint8_t *column = _tableColumns[table]; *column != CLI_COL_END; column++)
+			rowSize += columnSize(*column);
+		_rowSize[table] = rowSize;
+		_tableOffset[table] = offset;
+		if (_rows[table] > (_tablesLen - offset) / rowSize)
+			return ERROR_INVALID_DATA;
+		offset += (size_t)_rows[table] * rowSize;
+	}
+	return ERROR_SUCCESS;
+}
+
+/* readString - reads a null-terminated UTF-8 string of the #Strings heap. */
+bool ClrMetadata::readString(uint32_t index, std::string &text) const
+{
+	text.clear();
+	if (index >= _stringsLen)
+		return false;
+	const char *s = (const char*)_strings + index;
+	size_t maxLen = _stringsLen - index;
+	size_t len = strnlen(s, maxLen < CLI_MAX_NAME ? maxLen : CLI_MAX_NAME);
+	if (len == maxLen || len == CLI_MAX_NAME)
+		return false;
+	text.assign(s, len);
+	return true;
+}
+
+/* readBlob - finds an item of the #Blob heap. An item starts with its length compressed into 1, 2 or 4 bytes (ECMA-335, II.24.2.4). */
+bool ClrMetadata::readBlob(uint32_t index, const uint8_t **data, uint32_t *len) const
+{
+	*data = NULL;
+	*len = 0;
+	if (index >= _blobLen)
+		return false;
+	const uint8_t *p = _blob + index;
+	size_t avail = _blobLen - index;
+	uint32_t n, headerLen;
+	if ((p[0] & 0x80) == 0)
+	{
+		n = p[0];
+		headerLen = 1;
+	}
+	else if ((p[0] & 0xC0) == 0x80 && avail >= 2)
+	{
+		n = ((p[0] & 0x3F) << 8) | p[1];
+		headerLen = 2;
+	}
+	else if ((p[0] & 0xE0) == 0xC0 && avail >= 4)
+	{
+		n = ((uint32_t)(p[0] & 0x1F) << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+		headerLen = 4;
+	}
+	else
+		return false;
+	if (n > avail - headerLen)
+		return false;
+	*data = p + headerLen;
+	*len = n;
+	return true;
+}
+
+/* readAssembly - reads the identity of the assembly from the only row of the Assembly table. The token of the public key is computed from the key.
+
+Parameters:
+identity - [out] receives the name, version, culture and public key token.
+
+Return value:
+ERROR_NOT_FOUND if the image has no Assembly row, e.g., it is a module of a multi-module assembly. ERROR_INVALID_DATA if the row refers outside the heaps.
+*/
+uint32_t ClrMetadata::readAssembly(ClrAssemblyIdentity &identity) const
+{
+	identity.name.clear();
+	identity.culture.clear();
+	memset(identity.version, 0, sizeof(identity.version));
+	identity.flags = identity.hashAlgId = 0;
+	identity.hasPublicKeyToken = false;
+	memset(identity.publicKeyToken, 0, sizeof(identity.publicKeyToken));
+	if (!_tables)
+		return ERROR_NOT_FOUND;
+	if (_rows[CLI_TABLE_ASSEMBLY] == 0)
+		return ERROR_NOT_FOUND;
+	const uint8_t *row = _tables + _tableOffset[CLI_TABLE_ASSEMBLY];
+	identity.hashAlgId = _get32(row);
+	for (int i = 0; i < 4; i++)
+		identity.version[i] = _get16(row + 4 + i * 2);
+	identity.flags = _get32(row + 12);
+	row += 16;
+	uint32_t index[3]; // PublicKey, Name and Culture.
+	uint8_t widths[3] = { columnSize(CLI_COL_BLOB), columnSize(CLI_COL_STRING), columnSize(CLI_COL_STRING) };
+	for (int i = 0; i < 3; i++)
+	{
+		index[i] = widths[i] == 4 ? _get32(row) : _get16(row);
+		row += widths[i];
+	}
+	const uint8_t *publicKey;
+	uint32_t publicKeyLen;
+	if (!readBlob(index[0], &publicKey, &publicKeyLen) || !readString(index[1], identity.name) || !readString(index[2], identity.culture))
+		return ERROR_INVALID_DATA;
+	// the Assembly table holds the full public key. an assembly that is not strong-named has none.
+	if (publicKeyLen)
+	{
+		computePublicKeyToken(publicKey, publicKeyLen, identity.publicKeyToken);
+		identity.hasPublicKeyToken = true;
+	}
+	return ERROR_SUCCESS;
+}
+
+static uint32_t _rotateLeft(uint32_t x, int n)
+{
+	return (x << n) | (x >> (32 - n));
+}
+
+/* _sha1 - computes a SHA-1 digest (FIPS 180-4). It hashes public keys, a few hundred bytes each. So, the portable code is all it needs. */
+static void _sha1(const uint8_t *data, size_t len, uint8_t digest[20])
+{
+	uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+	uint64_t bitLen = (uint64_t)len * 8;
+	// the message is followed by 0x80, zeros, and the length in bits, up to a multiple of 64 bytes.
+	size_t total = (len + 1 + 8 + 63) & ~(size_t)63;
+	for (size_t blockPos = 0; blockPos < total; blockPos += 64)
+	{
+		uint8_t block[64];
+		for (size_t i = 0; i < 64; i++)
+		{
+			size_t k = blockPos + i;
+			if (k < len)
+				block[i] = data[k];
+			else if (k == len)
+				block[i] = 0x80;
+			else if (k >= total - 8)
+				block[i] = (uint8_t)(bitLen >> ((total - 1 - k) * 8));
+			else
+				block[i] = 0;
+		}
+		uint32_t w[80];
+		for (int t = 0; t < 16; t++)
+			w[t] = ((uint32_t)block[t * 4] << 24) | ((uint32_t)block[t * 4 + 1] << 16) | ((uint32_t)block[t * 4 + 2] << 8) | block[t * 4 + 3];
+		for (int t = 16; t < 80; t++)
+			w[t] = _rotateLeft(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+		uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+		for (int t = 0; t < 80; t++)
+		{
+			uint32_t f, k;
+			if (t < 20)
+			{
+				f = (b & c) | (~b & d);
+				k = 0x5A827999;
+			}
+			else if (t < 40)
+			{
+				f = b ^ c ^ d;
+				k = 0x6ED9EBA1;
+			}
+			else if (t < 60)
+			{
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8F1BBCDC;
+			}
+			else
+			{
+				f = b ^ c ^ d;
+				k = 0xCA62C1D6;
+			}
+			uint32_t temp = _rotateLeft(a, 5) + f + e + k + w[t];
+			e = d;
+			d = c;
+			c = _rotateLeft(b, 30);
+			b = a;
+			a = temp;
+		}
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+	}
+	for (int i = 0; i < 5; i++)
+	{
+		digest[i * 4] = (uint8_t)(h[i] >> 24);
+		digest[i * 4 + 1] = (uint8_t)(h[i] >> 16);
+		digest[i * 4 + 2] = (uint8_t)(h[i] >> 8);
+		digest[i * 4 + 3] = (uint8_t)h[i];
+	}
+}
+
+/* computePublicKeyToken - makes the token of a public key: the last 8 bytes of its SHA-1 digest in reverse order.
+
+Parameters:
+publicKey - [in] the public key blob of the Assembly table.
+len - [in] length of the key in bytes.
+token - [out] receives the token.
+*/
+void ClrMetadata::computePublicKeyToken(const uint8_t *publicKey, size_t len, uint8_t token[CLI_PUBLIC_KEY_TOKEN_SIZE])
+{
+	uint8_t digest[20];
+	_sha1(publicKey, len, digest);
+	for (int i = 0; i < CLI_PUBLIC_KEY_TOKEN_SIZE; i++)
+		token[i] = digest[19 - i];
+}
+
+/* formatVersion - formats an assembly version, e.g., 4.0.0.0. */
+void ClrMetadata::formatVersion(const uint16_t version[4], std::u16string &text)
+{
+	text.clear();
+	for (int i = 0; i < 4; i++)
+	{
+		if (i)
+			text.push_back('.');
+		char digits[8];
+		int n = snprintf(digits, sizeof(digits), "%u", (unsigned)version[i]);
+		text.append(digits, digits + n);
+	}
+}
+
+/* formatPublicKeyToken - formats a token as 16 lowercase hex digits, the form of a display name, e.g., b77a5c561934e089. The text is not null-terminated. */
+void ClrMetadata::formatPublicKeyToken(const uint8_t token[CLI_PUBLIC_KEY_TOKEN_SIZE], UTF16CHAR text[CLI_PUBLIC_KEY_TOKEN_SIZE * 2])
+{
+	static const char hex[] = "0123456789abcdef";
+	for (int i = 0; i < CLI_PUBLIC_KEY_TOKEN_SIZE; i++)
+	{
+		text[i * 2] = hex[token[i] >> 4];
+		text[i * 2 + 1] = hex[token[i] & 0xF];
+	}
+}
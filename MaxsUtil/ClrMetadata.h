@@ -0,0 +1,120 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "PEImage.h"
+
+
+#pragma pack(push, 1)
+// the CLI header of a .NET image (IMAGE_COR20_HEADER), found through PE_DIRECTORY_ENTRY_COM_DESCRIPTOR.
+struct PE_CLI_HEADER
+{
+	uint32_t cb;
+	uint16_t MajorRuntimeVersion;
+	uint16_t MinorRuntimeVersion;
+	PE_DATA_DIRECTORY MetaData;
+	uint32_t Flags;
+	uint32_t EntryPointToken;
+	PE_DATA_DIRECTORY Resources;
+	PE_DATA_DIRECTORY StrongNameSignature;
+	PE_DATA_DIRECTORY CodeManagerTable;
+	PE_DATA_DIRECTORY VTableFixups;
+	PE_DATA_DIRECTORY ExportAddressTableJumps;
+	PE_DATA_DIRECTORY ManagedNativeHeader;
+};
+
+// the header of the table stream (#~ or #-). the row counts of the tables present follow it.
+struct CLI_TABLES_HEADER
+{
+	uint32_t Reserved;
+	uint8_t MajorVersion;
+	uint8_t MinorVersion;
+	uint8_t HeapSizes; // CLI_HEAP_* bits.
+	uint8_t Reserved2;
+	uint64_t Valid; // a bit per table present.
+	uint64_t Sorted;
+};
+#pragma pack(pop)
+
+#define CLI_METADATA_SIGNATURE 0x424A5342 // 'BSJB'
+// bits of HeapSizes. an index into the heap is 4 bytes wide rather than 2.
+#define CLI_HEAP_STRING_WIDE 0x01
+#define CLI_HEAP_GUID_WIDE 0x02
+#define CLI_HEAP_BLOB_WIDE 0x04
+// an unoptimized (#-) table stream has 4 bytes of extra data after the row counts.
+#define CLI_HEAP_EXTRA_DATA 0x40
+// tables up to GenericParamConstraint (0x2C) are defined by ECMA-335.
+#define CLI_TABLE_COUNT 0x2D
+#define CLI_TABLE_ASSEMBLY 0x20
+#define CLI_PUBLIC_KEY_TOKEN_SIZE 8
+// the longest assembly name or culture read from the string heap.
+#define CLI_MAX_NAME 1024
+
+/* ClrAssemblyIdentity is the identity of a .NET assembly, the parts of its display name, e.g., System.Xml, Version=4.0.0.0, Culture=neutral, PublicKeyToken=b77a5c561934e089.
+*/
+struct ClrAssemblyIdentity
+{
+	std::string name; // UTF-8.
+	uint16_t version[4]; // major, minor, build and revision.
+	std::string culture; // UTF-8. empty for a culture-neutral assembly.
+	uint32_t flags;
+	uint32_t hashAlgId;
+	bool hasPublicKeyToken; // false if the assembly is not strong-named.
+	uint8_t publicKeyToken[CLI_PUBLIC_KEY_TOKEN_SIZE]; // the last 8 bytes of the SHA-1 of the public key, in reverse order.
+};
+
+/* ClrMetadata reads the metadata of a .NET image in place, with no runtime loaded. attach() follows the CLI header to the metadata root, finds the table stream and the string and blob heaps, and computes the row size of every table from the row counts. A row of any table can then be read at a computed offset. Every offset is checked against the size of its stream, so that malformed metadata cannot make a caller read outside the image.
+*/
+class ClrMetadata
+{
+public:
+	ClrMetadata() { clear(); }
+
+	uint32_t attach(const PEImage &pe);
+	void clear();
+
+	bool isValid() const { return _tables != NULL; }
+	uint32_t rowCount(int table) const { return table >= 0 && table < CLI_TABLE_COUNT ? _rows[table] : 0; }
+	uint32_t readAssembly(ClrAssemblyIdentity &identity) const;
+
+	static void computePublicKeyToken(const uint8_t *publicKey, size_t len, uint8_t token[CLI_PUBLIC_KEY_TOKEN_SIZE]);
+	static void formatVersion(const uint16_t version[4], std::u16string &text);
+	static void formatPublicKeyToken(const uint8_t token[CLI_PUBLIC_KEY_TOKEN_SIZE], UTF16CHAR text[CLI_PUBLIC_KEY_TOKEN_SIZE * 2]);
+
+protected:
+	const uint8_t *_tables; // the first row of the first table.
+	size_t _tablesLen;
+	const uint8_t *_strings; // #Strings heap.
+	size_t _stringsLen;
+	const uint8_t *_blob; // #Blob heap.
+	size_t _blobLen;
+	uint8_t _heapSizes;
+	uint32_t _rows[CLI_TABLE_COUNT];
+	uint32_t _rowSize[CLI_TABLE_COUNT];
+	size_t _tableOffset[CLI_TABLE_COUNT]; // offset of each table from _tables.
+
+	uint32_t computeLayout();
+	uint8_t columnSize(uint8_t column) const;
+	bool readString(uint32_t index, std::string &text) const;
+	bool readBlob(uint32_t index, const uint8_t **data, uint32_t *len) const;
+};
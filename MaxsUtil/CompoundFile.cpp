@@ -0,0 +1,356 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "CompoundFile.h"
+#include <string.h>
+
+
+static uint32_t _get32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t _get16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+/* _compareNames - orders directory entry names the way the red-black trees of a compound file are sorted. A shorter name comes first. Names of the same length are compared character by character in upper case.
+*/
+static int _compareNames(LPCUTF16STR s1, size_t len1, LPCUTF16STR s2, size_t len2)
+{
+	if (len1 != len2)
+		return len1 < len2 ? -1 : 1;
+	for (size_t i = 0; i < len1; i++)
+	{
+		UTF16CHAR c1 = s1[i] >= 'a' && s1[i] <= 'z' ? (UTF16CHAR)(s1[i] - 'a' + 'A') : s1[i];
+		UTF16CHAR c2 = s2[i] >= 'a' && s2[i] <= 'z' ? (UTF16CHAR)(s2[i] - 'a' + 'A') : s2[i];
+		if (c1 != c2)
+			return c1 < c2 ? -1 : 1;
+	}
+	return 0;
+}
+
+/* hasSignature - returns true if data starts with the signature of a compound file. */
+bool CompoundFile::hasSignature(const uint8_t *data, size_t len)
+{
+	return len >= 8 && _get32(data) == CFB_SIGNATURE_LO && _get32(data + 4) == CFB_SIGNATURE_HI;
+}
+
+/* open - opens a compound file and reads its header and root directory entry.
+
+Return value:
+ERROR_BAD_FORMAT - the file is not a compound file, or its header is not valid.
+*/
+uint32_t CompoundFile::open(LPCPATHSTR path)
+{
+	close();
+	uint32_t errorCode = _file.open(path);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	uint8_t h[CFB_HEADER_SIZE];
+	errorCode = _file.read(0, h, sizeof(h));
+	if (errorCode == ERROR_HANDLE_EOF || (errorCode == ERROR_SUCCESS && !hasSignature(h, sizeof(h))))
+		errorCode = ERROR_BAD_FORMAT;
+	if (errorCode != ERROR_SUCCESS)
+	{
+		close();
+		return errorCode;
+	}
+	// version 3 files have 512-byte sectors, and version 4 files 4096-byte sectors. the mini sector is always 64 bytes.
+	uint16_t majorVersion = _get16(h + 0x1A);
+	_sectorShift = _get16(h + 0x1E);
+	_miniSectorShift = _get16(h + 0x20);
+	if (_get16(h + 0x1C) != 0xFFFE || !((majorVersion == 3 && _sectorShift == 9) || (majorVersion == 4 && _sectorShift == 12)) || _miniSectorShift != 6)
+	{
+		close();
+		return ERROR_BAD_FORMAT;
+	}
+	uint32_t fatCount = _get32(h + 0x2C);
+	_dirStart = _get32(h + 0x30);
+	_miniCutoff = _get32(h + 0x38);
+	_miniFatStart = _get32(h + 0x3C);
+	_miniFatCount = _get32(h + 0x40);
+	_nextDifat = _get32(h + 0x44);
+	_difatLeft = _get32(h + 0x48);
+	_maxSectors = (uint32_t)((_file.size() >> _sectorShift) + 1);
+	for (uint32_t i = 0; i < CFB_HEADER_DIFAT_COUNT && i < fatCount; i++)
+		_difat.push_back(_get32(h + 0x4C + i * 4));
+
+	errorCode = loadChain(_dirStart, 0, _dirChain);
+	if (errorCode == ERROR_SUCCESS)
+		errorCode = readEntry(0, _root);
+	if (errorCode == ERROR_SUCCESS && _root.type != CFB_TYPE_ROOT)
+		errorCode = ERROR_BAD_FORMAT;
+	if (errorCode != ERROR_SUCCESS)
+		close();
+	return errorCode;
+}
+
+/* close - closes the file and drops the cached tables. */
+void CompoundFile::close()
+{
+	_file.close();
+	_difat.clear();
+	_fat.clear();
+	_dirChain.clear();
+	_miniFat.clear();
+	_miniStreamChain.clear();
+	_miniLoaded = false;
+	_nextDifat = CFB_ENDOFCHAIN;
+	_difatLeft = 0;
+}
+
+/* nextSector - looks up the sector that follows a sector in its chain. The FAT sector holding the entry is read on first use. Its location is found in the header, or in the DIFAT sectors, which are read as far as needed.
+*/
+uint32_t CompoundFile::nextSector(uint32_t sector, uint32_t *next)
+{
+	uint32_t perSector = (1U << _sectorShift) / 4;
+	uint32_t fatIndex = sector / perSector;
+	std::map<uint32_t, std::vector<uint32_t> >::iterator it = _fat.find(fatIndex);
+	if (it == _fat.end())
+	{
+		// a DIFAT sector lists the locations of (perSector - 1) more FAT sectors, followed by the location of the next DIFAT sector.
+		while (fatIndex >= _difat.size() && _difatLeft && _nextDifat <= CFB_MAXREGSECT)
+		{
+			std::vector<uint8_t> buf(1U << _sectorShift);
+			uint32_t errorCode = _file.read((uint64_t)(_nextDifat + 1) << _sectorShift, buf.data(), (uint32_t)buf.size());
+			if (errorCode != ERROR_SUCCESS)
+				return errorCode;
+			for (uint32_t i = 0; i < perSector - 1; i++)
+				_difat.push_back(_get32(&buf[i * 4]));
+			_nextDifat = _get32(&buf[(perSector - 1) * 4]);
+			_difatLeft--;
+		}
+		if (fatIndex >= _difat.size() || _difat[fatIndex] > CFB_MAXREGSECT)
+			return ERROR_BAD_FORMAT;
+		std::vector<uint8_t> buf(1U << _sectorShift);
+		uint32_t errorCode = _file.read((uint64_t)(_difat[fatIndex] + 1) << _sectorShift, buf.data(), (uint32_t)buf.size());
+		if (errorCode != ERROR_SUCCESS)
+			return errorCode == ERROR_HANDLE_EOF ? ERROR_BAD_FORMAT : errorCode;
+		std::vector<uint32_t> &entries = _fat[fatIndex];
+		entries.resize(perSector);
+		for (uint32_t i = 0; i < perSector; i++)
+			entries[i] = _get32(&buf[i * 4]);
+		it = _fat.find(fatIndex);
+	}
+	*next = it->second[sector % perSector];
+	return ERROR_SUCCESS;
+}
+
+/* loadChain - follows a chain of sectors through the FAT.
+
+Parameters:
+start - [in] first sector of the chain.
+size - [in] byte length of the stream, or 0 to follow the chain to its end.
+chain - [out] receives the sectors.
+*/
+uint32_t CompoundFile::loadChain(uint32_t start, uint64_t size, std::vector<uint32_t> &chain)
+{
+	chain.clear();
+	uint64_t count = size ? ((size + (1U << _sectorShift) - 1) >> _sectorShift) : _maxSectors;
+	if (count > _maxSectors)
+		return ERROR_BAD_FORMAT;
+	uint32_t sector = start;
+	while (sector <= CFB_MAXREGSECT && chain.size() < count)
+	{
+		chain.push_back(sector);
+		uint32_t errorCode = nextSector(sector, &sector);
+		if (errorCode != ERROR_SUCCESS)
+			return errorCode;
+	}
+	if (size && chain.size() < count)
+		return ERROR_BAD_FORMAT;
+	if (!size && sector != CFB_ENDOFCHAIN)
+		return ERROR_BAD_FORMAT; // a loop.
+	return ERROR_SUCCESS;
+}
+
+/* loadMini - reads the mini FAT, and the chain of the mini stream, when a small stream is first opened. */
+uint32_t CompoundFile::loadMini()
+{
+	if (_miniLoaded)
+		return ERROR_SUCCESS;
+	std::vector<uint32_t> chain;
+	uint32_t errorCode = loadChain(_miniFatStart, (uint64_t)_miniFatCount << _sectorShift, chain);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	std::vector<uint8_t> buf((size_t)_miniFatCount << _sectorShift);
+	if (!buf.empty())
+	{
+		errorCode = readChain(chain, false, 0, buf.data(), (uint32_t)buf.size());
+		if (errorCode != ERROR_SUCCESS)
+			return errorCode;
+	}
+	_miniFat.resize(buf.size() / 4);
+	for (size_t i = 0; i < _miniFat.size(); i++)
+		_miniFat[i] = _get32(&buf[i * 4]);
+	errorCode = loadChain(_root.startSector, _root.size, _miniStreamChain);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	_miniLoaded = true;
+	return ERROR_SUCCESS;
+}
+
+/* readEntry - reads a directory entry by its id. */
+uint32_t CompoundFile::readEntry(uint32_t id, CompoundFileEntry &entry)
+{
+	uint8_t e[CFB_DIRENTRY_SIZE];
+	uint32_t errorCode = readChain(_dirChain, false, (uint64_t)id * CFB_DIRENTRY_SIZE, e, sizeof(e));
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	uint16_t nameBytes = _get16(e + 64);
+	if (nameBytes > 64 || (nameBytes & 1))
+		return ERROR_BAD_FORMAT;
+	entry.id = id;
+	entry.name.clear();
+	for (uint16_t i = 0; i + 2 < nameBytes; i += 2)
+		entry.name.push_back((UTF16CHAR)_get16(e + i));
+	entry.type = e[66];
+	entry.left = _get32(e + 68);
+	entry.right = _get32(e + 72);
+	entry.child = _get32(e + 76);
+	entry.startSector = _get32(e + 116);
+	entry.size = _get32(e + 120);
+	// version 3 files may leave garbage in the high part of the size.
+	if (_sectorShift != 9)
+		entry.size |= (uint64_t)_get32(e + 124) << 32;
+	return ERROR_SUCCESS;
+}
+
+/* findEntry - looks up a child of a storage by name. Only the entries on the path through the storage's red-black tree are read.
+
+Parameters:
+storage - [in] the storage to search, e.g., root().
+name - [in] name of the child. It need not be null-terminated.
+nameLen - [in] number of characters in name.
+entry - [out] receives the entry of the child.
+
+Return value:
+ERROR_FILE_NOT_FOUND - the storage has no child of the name.
+*/
+uint32_t CompoundFile::findEntry(const CompoundFileEntry &storage, LPCUTF16STR name, size_t nameLen, CompoundFileEntry &entry)
+{
+	uint32_t id = storage.child;
+	// the tree cannot be deeper than the directory has entries. a longer walk means a loop.
+	size_t maxSteps = (_dirChain.size() << _sectorShift) / CFB_DIRENTRY_SIZE;
+	for (size_t steps = 0; id != CFB_NOSTREAM && steps < maxSteps; steps++)
+	{
+		uint32_t errorCode = readEntry(id, entry);
+		if (errorCode != ERROR_SUCCESS)
+			return errorCode;
+		int c = _compareNames(name, nameLen, entry.name.c_str(), entry.name.size());
+		if (c == 0)
+			return ERROR_SUCCESS;
+		id = c < 0 ? entry.left : entry.right;
+	}
+	return id == CFB_NOSTREAM ? ERROR_FILE_NOT_FOUND : ERROR_BAD_FORMAT;
+}
+
+/* openStream - collects the sector chain of a stream for readStream. */
+uint32_t CompoundFile::openStream(const CompoundFileEntry &entry, CompoundFileStream &stream)
+{
+	if (entry.type != CFB_TYPE_STREAM)
+		return ERROR_BAD_FORMAT;
+	stream.size = entry.size;
+	stream.mini = entry.size < _miniCutoff;
+	stream.chain.clear();
+	if (entry.size == 0)
+		return ERROR_SUCCESS;
+	if (!stream.mini)
+		return loadChain(entry.startSector, entry.size, stream.chain);
+	uint32_t errorCode = loadMini();
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	uint64_t count = (entry.size + (1U << _miniSectorShift) - 1) >> _miniSectorShift;
+	uint32_t sector = entry.startSector;
+	while (stream.chain.size() < count)
+	{
+		if (sector >= _miniFat.size())
+			return ERROR_BAD_FORMAT;
+		stream.chain.push_back(sector);
+		sector = _miniFat[sector];
+	}
+	return ERROR_SUCCESS;
+}
+
+/* readStream - reads a range of an opened stream.
+
+Parameters:
+stream - [in] the stream opened by openStream.
+offset - [in] offset in the stream to read from.
+buf - [out] receives the data.
+len - [in] number of bytes to read. The range must lie within the stream.
+*/
+uint32_t CompoundFile::readStream(const CompoundFileStream &stream, uint64_t offset, void *buf, uint32_t len)
+{
+	if (offset + len > stream.size)
+		return ERROR_HANDLE_EOF;
+	return readChain(stream.chain, stream.mini, offset, buf, len);
+}
+
+/* unitOffset - returns the file offset of a sector, or of a mini sector, which lives in a sector of the mini stream. */
+uint64_t CompoundFile::unitOffset(uint32_t unit, bool mini) const
+{
+	if (!mini)
+		return (uint64_t)(unit + 1) << _sectorShift;
+	uint64_t pos = (uint64_t)unit << _miniSectorShift;
+	size_t index = (size_t)(pos >> _sectorShift);
+	if (index >= _miniStreamChain.size())
+		return (uint64_t)-1;
+	return ((uint64_t)(_miniStreamChain[index] + 1) << _sectorShift) + (pos & ((1U << _sectorShift) - 1));
+}
+
+/* readChain - reads a range of the data held by a chain of sectors or mini sectors. Sectors that follow each other in the file are read in one call.
+*/
+uint32_t CompoundFile::readChain(const std::vector<uint32_t> &chain, bool mini, uint64_t offset, void *buf, uint32_t len)
+{
+	uint32_t shift = mini ? _miniSectorShift : _sectorShift;
+	uint32_t unitSize = 1U << shift;
+	uint8_t *p = (uint8_t*)buf;
+	while (len)
+	{
+		size_t index = (size_t)(offset >> shift);
+		if (index >= chain.size())
+			return ERROR_BAD_FORMAT;
+		uint32_t within = (uint32_t)(offset & (unitSize - 1));
+		uint64_t fileOffset = unitOffset(chain[index], mini);
+		if (fileOffset == (uint64_t)-1)
+			return ERROR_BAD_FORMAT;
+		uint32_t run = unitSize - within;
+		// extend the read over the units that follow in the file.
+		while (run < len && index + 1 < chain.size() && unitOffset(chain[index + 1], mini) == fileOffset + within + run)
+		{
+			run += unitSize;
+			index++;
+		}
+		if (run > len)
+			run = len;
+		uint32_t errorCode = _file.read(fileOffset + within, p, run);
+		if (errorCode != ERROR_SUCCESS)
+			return errorCode == ERROR_HANDLE_EOF ? ERROR_BAD_FORMAT : errorCode;
+		p += run;
+		offset += run;
+		len -= run;
+	}
+	return ERROR_SUCCESS;
+}
@@ -0,0 +1,104 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "PEProbe.h"
+#include <vector>
+#include <map>
+
+
+// signature of a compound file, the first 8 bytes of its header.
+#define CFB_SIGNATURE_LO 0xE011CFD0
+#define CFB_SIGNATURE_HI 0xE11AB1A1
+#define CFB_HEADER_SIZE 512
+#define CFB_DIRENTRY_SIZE 128
+// special sector numbers.
+#define CFB_MAXREGSECT 0xFFFFFFFA
+#define CFB_ENDOFCHAIN 0xFFFFFFFE
+#define CFB_NOSTREAM 0xFFFFFFFF
+// types of a directory entry.
+#define CFB_TYPE_STORAGE 1
+#define CFB_TYPE_STREAM 2
+#define CFB_TYPE_ROOT 5
+// number of FAT sector locations held by the header.
+#define CFB_HEADER_DIFAT_COUNT 109
+
+/* CompoundFileEntry is a directory entry of a compound file. */
+struct CompoundFileEntry
+{
+	uint32_t id; // index in the directory. the root storage is 0.
+	std::u16string name;
+	uint8_t type; // CFB_TYPE_*
+	uint32_t left, right, child; // ids of the siblings in the red-black tree, and of the root of the children of a storage.
+	uint32_t startSector;
+	uint64_t size;
+};
+
+/* CompoundFileStream is an opened stream. It holds the chain of sectors of the stream, so that any range of it can be read without walking the allocation table again. A stream smaller than the cutoff size lives in the mini stream, and its chain is one of mini sectors.
+*/
+struct CompoundFileStream
+{
+	uint64_t size;
+	bool mini;
+	std::vector<uint32_t> chain;
+};
+
+/* CompoundFile reads an OLE compound file (the Compound File Binary format of an .msi or an Office 97 document) with positioned reads. Nothing is read in advance besides the header. A directory entry is found by walking the red-black tree of its storage, which reads only the directory sectors on the way. A sector of the allocation table is read when a chain first passes through it, and is kept. A range of a stream is read in as few reads as the sectors are contiguous in the file. So, a lookup of a few small streams in a large package reads a few KB.
+*/
+class CompoundFile
+{
+public:
+	CompoundFile() : _sectorShift(9), _miniSectorShift(6), _miniCutoff(4096), _dirStart(0), _miniFatStart(0), _miniFatCount(0), _nextDifat(CFB_ENDOFCHAIN), _difatLeft(0), _maxSectors(0), _miniLoaded(false) {}
+
+	uint32_t open(LPCPATHSTR path);
+	void close();
+	uint32_t findEntry(const CompoundFileEntry &storage, LPCUTF16STR name, size_t nameLen, CompoundFileEntry &entry);
+	uint32_t openStream(const CompoundFileEntry &entry, CompoundFileStream &stream);
+	uint32_t readStream(const CompoundFileStream &stream, uint64_t offset, void *buf, uint32_t len);
+	const CompoundFileEntry &root() const { return _root; }
+	uint64_t bytesRead() const { return _file.bytesRead(); }
+
+	static bool hasSignature(const uint8_t *data, size_t len);
+
+protected:
+	RangeFile _file;
+	uint32_t _sectorShift, _miniSectorShift, _miniCutoff;
+	uint32_t _dirStart, _miniFatStart, _miniFatCount;
+	std::vector<uint32_t> _difat; // locations of the FAT sectors found so far.
+	uint32_t _nextDifat; // next DIFAT sector to read when _difat runs short.
+	uint32_t _difatLeft; // DIFAT sectors not read yet.
+	uint32_t _maxSectors; // sectors the file can hold. a chain longer than that has a loop.
+	std::map<uint32_t, std::vector<uint32_t> > _fat; // FAT sector index to its entries.
+	std::vector<uint32_t> _dirChain; // sectors of the directory.
+	bool _miniLoaded;
+	std::vector<uint32_t> _miniFat; // the whole mini FAT. read when a mini stream is first opened.
+	std::vector<uint32_t> _miniStreamChain; // sectors of the mini stream (the stream of the root entry).
+	CompoundFileEntry _root;
+
+	uint32_t nextSector(uint32_t sector, uint32_t *next);
+	uint32_t loadChain(uint32_t start, uint64_t size, std::vector<uint32_t> &chain);
+	uint32_t loadMini();
+	uint32_t readEntry(uint32_t id, CompoundFileEntry &entry);
+	uint32_t readChain(const std::vector<uint32_t> &chain, bool mini, uint64_t offset, void *buf, uint32_t len);
+	uint64_t unitOffset(uint32_t unit, bool mini) const;
+};
@@ -0,0 +1,479 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "DependencyGraph.h"
+#include "MappedFile.h"
+#include "DirectoryWalker.h"
+#include "WorkStealingPool.h"
+#include <string.h>
+
+
+// lowercases the ASCII letters of a pathname. DLL names are matched without regard to case, as the loader matches them.
+static pathstring _toLower(const pathstring &s)
+{
+	pathstring t(s);
+	for (size_t i = 0; i < t.length(); i++)
+	{
+		if (t[i] >= 'A' && t[i] <= 'Z')
+			t[i] = (PATHCHAR)(t[i] + ('a' - 'A'));
+	}
+	return t;
+}
+
+static char _lowerAscii(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+}
+
+// reads a null-terminated name at an RVA. returns false if the name is not backed by file data or is not terminated within DEPENDENCY_MAX_NAME bytes.
+static bool _readName(const PEImage &pe, const uint8_t *base, size_t size, uint32_t rva, std::string &name)
+{
+	size_t offset;
+	if (!pe.rvaToOffset(rva, 1, &offset) || offset >= size)
+		return false;
+	const char *p = (const char*)base + offset;
+	size_t maxLen = size - offset < DEPENDENCY_MAX_NAME ? size - offset : DEPENDENCY_MAX_NAME;
+	size_t len = strnlen(p, maxLen);
+	if (len == 0 || len == maxLen)
+		return false;
+	name.assign(p, len);
+	return true;
+}
+
+// adds a name to the edge list, or adds the kind to an edge of the same name.
+static void _addEdge(std::vector<DependencyEdge> &edges, const std::string &name, uint32_t kind)
+{
+	for (size_t i = 0; i < edges.size(); i++)
+	{
+		const std::string &s = edges[i].name;
+		if (s.length() != name.length())
+			continue;
+		size_t j = 0;
+		while (j < s.length() && _lowerAscii(s[j]) == _lowerAscii(name[j]))
+			j++;
+		if (j == s.length())
+		{
+			edges[i].kinds |= kind;
+			return;
+		}
+	}
+	DependencyEdge edge;
+	edge.name = name;
+	edge.kinds = kind;
+	edge.target = -1;
+	edges.push_back(edge);
+}
+
+// adds a name of the bound import directory.
+static void _addBoundName(const uint8_t *dir, uint32_t dirSize, uint32_t offset, std::vector<DependencyEdge> &edges)
+{
+	if (offset >= dirSize)
+		return;
+	const char *p = (const char*)dir + offset;
+	size_t len = strnlen(p, dirSize - offset);
+	if (len > 0 && len < dirSize - offset)
+		_addEdge(edges, std::string(p, len), DEPENDENCY_BOUNDIMPORT);
+}
+
+/* readImports - reads the names of the DLLs an image references from its import, delay-import and bound import directories. A name found in more than one directory makes one edge with the DEPENDENCY_* flags of all of them. The targets of the edges are not resolved.
+
+Parameters:
+pe - [in] the image.
+edges - [out] receives an edge per DLL name, in the order the names are first found.
+
+Return value:
+ERROR_SUCCESS, or ERROR_BAD_EXE_FORMAT if a directory points outside the file.
+*/
+uint32_t DependencyGraph::readImports(const PEImage &pe, std::vector<DependencyEdge> &edges)
+{
+	const uint8_t *base = pe.base();
+	size_t size = pe.size();
+	uint32_t dirRva, dirSize;
+	std::string name;
+	// the descriptor lists end with a zeroed entry. the directory size is not trusted, as some linkers and packers get it wrong.
+	if (pe.getDataDirectory(PE_DIRECTORY_ENTRY_IMPORT, &dirRva, &dirSize))
+	{
+		for (uint32_t rva = dirRva;; rva += sizeof(PE_IMPORT_DESCRIPTOR))
+		{
+			const PE_IMPORT_DESCRIPTOR *desc = (const PE_IMPORT_DESCRIPTOR*)pe.rvaToPtr(rva, sizeof(PE_IMPORT_DESCRIPTOR));
+			if (!desc)
+				return ERROR_BAD_EXE_FORMAT;
+			if (desc->Name == 0 && desc->FirstThunk == 0)
+				break;
+			if (_readName(pe, base, size, desc->Name, name))
+				_addEdge(edges, name, DEPENDENCY_IMPORT);
+		}
+	}
+	if (pe.getDataDirectory(PE_DIRECTORY_ENTRY_DELAY_IMPORT, &dirRva, &dirSize))
+	{
+		for (uint32_t rva = dirRva;; rva += sizeof(PE_DELAYLOAD_DESCRIPTOR))
+		{
+			const PE_DELAYLOAD_DESCRIPTOR *desc = (const PE_DELAYLOAD_DESCRIPTOR*)pe.rvaToPtr(rva, sizeof(PE_DELAYLOAD_DESCRIPTOR));
+			if (!desc)
+				return ERROR_BAD_EXE_FORMAT;
+			if (desc->DllNameRVA == 0)
+				break;
+			uint32_t nameRva = desc->DllNameRVA;
+			// an image of VC 6.0 has virtual addresses here. such images are all 32-bit.
+			if (!(desc->Attributes & PE_DELAYLOAD_RVA_BASED) && !pe.is64())
+				nameRva -= pe.optionalHeader()->ImageBase_or_ImageBaseHigh;
+			if (_readName(pe, base, size, nameRva, name))
+				_addEdge(edges, name, DEPENDENCY_DELAYLOAD);
+		}
+	}
+	// the bound import directory sits in the headers. the name offsets are relative to the start of the directory.
+	if (pe.getDataDirectory(PE_DIRECTORY_ENTRY_BOUND_IMPORT, &dirRva, &dirSize))
+	{
+		const uint8_t *dir = pe.rvaToPtr(dirRva, dirSize);
+		if (!dir)
+			return ERROR_BAD_EXE_FORMAT;
+		uint32_t pos = 0;
+		while (pos + sizeof(PE_BOUND_IMPORT_DESCRIPTOR) <= dirSize)
+		{
+			const PE_BOUND_IMPORT_DESCRIPTOR *desc = (const PE_BOUND_IMPORT_DESCRIPTOR*)(dir + pos);
+			if (desc->TimeDateStamp == 0 && desc->OffsetModuleName == 0)
+				break;
+			pos += sizeof(PE_BOUND_IMPORT_DESCRIPTOR);
+			_addBoundName(dir, dirSize, desc->OffsetModuleName, edges);
+			// a forwarder ref names a DLL the bound DLL forwards some of the imported functions to.
+			for (uint16_t i = 0; i < desc->NumberOfModuleForwarderRefs && pos + sizeof(PE_BOUND_FORWARDER_REF) <= dirSize; i++)
+			{
+				_addBoundName(dir, dirSize, ((const PE_BOUND_FORWARDER_REF*)(dir + pos))->OffsetModuleName, edges);
+				pos += sizeof(PE_BOUND_FORWARDER_REF);
+			}
+		}
+	}
+	return ERROR_SUCCESS;
+}
+
+/* isApiSetName - checks if a DLL name is an API set (e.g., api-ms-win-core-file-l1-1-0.dll). The loader maps an API set to a system DLL with a table in the process, and there is no file of that name to find. */
+bool DependencyGraph::isApiSetName(const std::string &name)
+{
+	const char *prefixes[] = { "api-ms-", "ext-ms-" };
+	for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++)
+	{
+		size_t len = strlen(prefixes[i]);
+		if (name.length() < len)
+			continue;
+		size_t j = 0;
+		while (j < len && _lowerAscii(name[j]) == prefixes[i][j])
+			j++;
+		if (j == len)
+			return true;
+	}
+	return false;
+}
+
+/* setSearchPath - sets the directories a DLL name is looked up in after the directory of the importing file. The graph is cleared, as the names may resolve to other files now.
+
+Parameters:
+dirs - [in] pathnames of the directories, in the order they are searched.
+*/
+void DependencyGraph::setSearchPath(const std::vector<pathstring> &dirs)
+{
+	clear();
+	_searchPath = dirs;
+}
+
+/* clear - forgets all nodes and directory listings. It must not be called while another thread is using the graph. */
+void DependencyGraph::clear()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	_nodes.clear();
+	_nodeIds.clear();
+	_listings.clear();
+	_parseCount = 0;
+}
+
+/* nodeCount - returns the number of files in the graph. A file is added when it is a root of a closure, or when a DLL name is found to be the file. */
+size_t DependencyGraph::nodeCount()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _nodes.size();
+}
+
+/* addFile - returns the node of a file, and adds one if the file is not in the graph. The file is not read until the node is used.
+
+Parameters:
+path - [in] pathname of the file.
+*/
+int DependencyGraph::addFile(LPCPATHSTR path)
+{
+#ifdef _WIN32
+	pathstring key = _toLower(path);
+#else
+	pathstring key = path;
+#endif
+	std::lock_guard<std::mutex> guard(_lock);
+	std::unordered_map<pathstring, int>::const_iterator it = _nodeIds.find(key);
+	if (it != _nodeIds.end())
+		return it->second;
+	int id = (int)_nodes.size();
+	_nodes.push_back(std::unique_ptr<NodeState>(new NodeState));
+	_nodes.back()->node.path = path;
+	_nodes.back()->node.errorCode = ERROR_FILE_NOT_FOUND;
+	_nodes.back()->node.machine = 0;
+	_nodeIds[key] = id;
+	return id;
+}
+
+/* node - returns a node with the names of its DLLs resolved. The reference stays valid until clear() is called.
+
+Parameters:
+id - [in] a node returned by addFile, or the target of an edge.
+*/
+const DependencyNode &DependencyGraph::node(int id)
+{
+	return link(id)->node;
+}
+
+// returns the state of a node. the pointer stays valid when more nodes are added.
+DependencyGraph::NodeState *DependencyGraph::getState(int id)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _nodes[id].get();
+}
+
+// parses the file of a node once.
+DependencyGraph::NodeState *DependencyGraph::load(int id)
+{
+	NodeState *state = getState(id);
+	std::call_once(state->loaded, [this, state]() { parse(state->node); });
+	return state;
+}
+
+// resolves the names of a node once.
+DependencyGraph::NodeState *DependencyGraph::link(int id)
+{
+	NodeState *state = load(id);
+	std::call_once(state->linked, [this, state]()
+	{
+		DependencyNode &node = state->node;
+		if (node.errorCode != ERROR_SUCCESS)
+			return;
+		pathstring dirPath;
+		size_t pos = node.path.find_last_of(PATHSEPARATOR);
+		if (pos != pathstring::npos)
+			dirPath = node.path.substr(0, pos);
+		for (size_t i = 0; i < node.edges.size(); i++)
+		{
+			if (!isApiSetName(node.edges[i].name))
+				node.edges[i].target = resolve(dirPath, node.edges[i].name, node.machine);
+		}
+	});
+	return state;
+}
+
+// maps a file and reads its machine type and the names of its DLLs.
+void DependencyGraph::parse(DependencyNode &node)
+{
+	_parseCount++;
+	MappedFile file;
+	node.errorCode = file.open(node.path.c_str());
+	if (node.errorCode != ERROR_SUCCESS)
+		return;
+	PEImage pe;
+	node.errorCode = pe.attach(file.data(), file.size());
+	if (node.errorCode != ERROR_SUCCESS)
+		return;
+	node.machine = pe.fileHeader()->Machine;
+	node.errorCode = readImports(pe, node.edges);
+}
+
+/* resolve - finds the file a DLL name refers to. The directory of the importing file is searched first, then the search path. A file that is not a PE image of the given machine type is passed over, and the search goes on, as the loader would do.
+
+Return value:
+the node of the file, or -1 if no directory has a usable file of the name.
+*/
+int DependencyGraph::resolve(const pathstring &dirPath, const std::string &name, uint16_t machine)
+{
+	pathstring key;
+	for (size_t i = 0; i < name.length(); i++)
+		key += (PATHCHAR)(uint8_t)_lowerAscii(name[i]);
+	for (size_t i = 0; i <= _searchPath.size(); i++)
+	{
+		const pathstring &dir = i == 0 ? dirPath : _searchPath[i - 1];
+		if (dir.empty())
+			continue;
+		std::shared_ptr<DirectoryListing> listing = getListing(dir);
+		DirectoryListing::const_iterator it = listing->find(key);
+		if (it == listing->end())
+			continue;
+		int id = addFile(it->second.c_str());
+		const DependencyNode &node = load(id)->node;
+		if (node.errorCode == ERROR_SUCCESS && node.machine == machine)
+			return id;
+	}
+	return -1;
+}
+
+/* getListing - returns the files of a directory keyed by their lowercase names. A directory is listed once. Looking a name up in the listing is faster than asking the file system for the file, and it finds the file on a case-sensitive file system, too, where a staging folder may have KERNEL32.DLL for kernel32.dll. A directory that cannot be read has an empty listing. */
+std::shared_ptr<DependencyGraph::DirectoryListing> DependencyGraph::getListing(const pathstring &dirPath)
+{
+	pathstring dirKey = dirPath;
+	if (dirKey.length() > 1 && dirKey.back() == PATHSEPARATOR)
+		dirKey.pop_back();
+#ifdef _WIN32
+	dirKey = _toLower(dirKey);
+#endif
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+		std::unordered_map<pathstring, std::shared_ptr<DirectoryListing> >::const_iterator it = _listings.find(dirKey);
+		if (it != _listings.end())
+			return it->second;
+	}
+	// two threads may list the same directory at the same time. the first listing stored wins.
+	std::shared_ptr<DirectoryListing> listing(new DirectoryListing);
+	std::vector<pathstring> files, subdirs;
+	DirectoryWalker::listDirectory(dirPath, files, subdirs);
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		size_t pos = files[i].find_last_of(PATHSEPARATOR);
+		listing->insert(std::make_pair(_toLower(files[i].substr(pos + 1)), files[i]));
+	}
+	std::lock_guard<std::mutex> guard(_lock);
+	return _listings.insert(std::make_pair(dirKey, listing)).first->second;
+}
+
+/* closure - finds the files a set of images needs to run: the images, the DLLs they reference, the DLLs those reference, and so on. The files are read on a WorkStealingPool. A file already in the graph is not read again.
+
+Parameters:
+roots - [in] pathnames of the images.
+entries - [out] receives an entry per file, and an entry per DLL name that did not resolve. The roots come first, and the other entries follow in the order of their depth.
+
+Return value:
+ERROR_SUCCESS. A file that cannot be read has an entry with the error code.
+*/
+uint32_t DependencyGraph::closure(const std::vector<pathstring> &roots, std::vector<DependencyClosureEntry> &entries)
+{
+	entries.clear();
+	std::vector<int> rootIds;
+	for (size_t i = 0; i < roots.size(); i++)
+		rootIds.push_back(addFile(roots[i].c_str()));
+
+	// read and link the reachable files in parallel. a node is queued once by any closure.
+	{
+		WorkStealingPool pool(_workerCount);
+		std::function<void(int)> visit = [&](int id)
+		{
+			const DependencyNode &node = link(id)->node;
+			for (size_t i = 0; i < node.edges.size(); i++)
+			{
+				int target = node.edges[i].target;
+				if (target >= 0 && !getState(target)->visited.exchange(true))
+					pool.submit([&visit, target](int) { visit(target); });
+			}
+		};
+		for (size_t i = 0; i < rootIds.size(); i++)
+		{
+			int id = rootIds[i];
+			if (!getState(id)->visited.exchange(true))
+				pool.submit([&visit, id](int) { visit(id); });
+		}
+		pool.wait();
+	}
+
+	// walk the graph breadth first for the depths. a second walk following the static references alone finds the files that are not delay-loaded.
+	std::unordered_map<int, size_t> nodeEntries;
+	std::unordered_map<std::string, size_t> nameEntries; // lowercase names that did not resolve.
+	for (int pass = 0; pass < 2; pass++)
+	{
+		std::vector<int> queue;
+		for (size_t i = 0; i < rootIds.size(); i++)
+		{
+			int id = rootIds[i];
+			if (pass == 0 && nodeEntries.find(id) == nodeEntries.end())
+			{
+				DependencyClosureEntry entry;
+				entry.node = id;
+				entry.errorCode = node(id).errorCode;
+				entry.depth = 0;
+				entry.delayLoadOnly = true;
+				nodeEntries[id] = entries.size();
+				entries.push_back(entry);
+				queue.push_back(id);
+			}
+			else if (pass == 1 && entries[nodeEntries[id]].delayLoadOnly)
+			{
+				entries[nodeEntries[id]].delayLoadOnly = false;
+				queue.push_back(id);
+			}
+		}
+		for (size_t head = 0; head < queue.size(); head++)
+		{
+			const DependencyNode &from = node(queue[head]);
+			uint32_t depth = entries[nodeEntries[queue[head]]].depth + 1;
+			for (size_t i = 0; i < from.edges.size(); i++)
+			{
+				const DependencyEdge &edge = from.edges[i];
+				if (pass == 1 && !(edge.kinds & ~DEPENDENCY_DELAYLOAD))
+					continue;
+				if (edge.target < 0)
+				{
+					if (isApiSetName(edge.name))
+						continue;
+					std::string key;
+					for (size_t j = 0; j < edge.name.length(); j++)
+						key += _lowerAscii(edge.name[j]);
+					std::unordered_map<std::string, size_t>::const_iterator it = nameEntries.find(key);
+					if (pass == 1)
+					{
+						entries[it->second].delayLoadOnly = false;
+						continue;
+					}
+					if (it != nameEntries.end())
+						continue;
+					DependencyClosureEntry entry;
+					entry.node = -1;
+					entry.name = edge.name;
+					entry.errorCode = ERROR_MOD_NOT_FOUND;
+					entry.depth = depth;
+					entry.delayLoadOnly = true;
+					nameEntries[key] = entries.size();
+					entries.push_back(entry);
+					continue;
+				}
+				std::unordered_map<int, size_t>::const_iterator it = nodeEntries.find(edge.target);
+				if (pass == 1)
+				{
+					if (entries[it->second].delayLoadOnly)
+					{
+						entries[it->second].delayLoadOnly = false;
+						queue.push_back(edge.target);
+					}
+					continue;
+				}
+				if (it != nodeEntries.end())
+					continue;
+				DependencyClosureEntry entry;
+				entry.node = edge.target;
+				entry.errorCode = node(edge.target).errorCode;
+				entry.depth = depth;
+				entry.delayLoadOnly = true;
+				nodeEntries[edge.target] = entries.size();
+				entries.push_back(entry);
+				queue.push_back(edge.target);
+			}
+		}
+	}
+	return ERROR_SUCCESS;
+}
@@ -0,0 +1,161 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "PEImage.h"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+
+#pragma pack(push, 1)
+struct PE_IMPORT_DESCRIPTOR
+{
+	uint32_t OriginalFirstThunk; // RVA of the import name table.
+	uint32_t TimeDateStamp;
+	uint32_t ForwarderChain;
+	uint32_t Name; // RVA of the DLL name.
+	uint32_t FirstThunk; // RVA of the import address table.
+};
+
+struct PE_DELAYLOAD_DESCRIPTOR
+{
+	uint32_t Attributes; // bit 0 is set if the other fields are RVAs. a VC 6.0 image has VAs instead.
+	uint32_t DllNameRVA;
+	uint32_t ModuleHandleRVA;
+	uint32_t ImportAddressTableRVA;
+	uint32_t ImportNameTableRVA;
+	uint32_t BoundImportAddressTableRVA;
+	uint32_t UnloadInformationTableRVA;
+	uint32_t TimeDateStamp;
+};
+
+// an entry of the bound import directory. NumberOfModuleForwarderRefs PE_BOUND_FORWARDER_REF entries follow it.
+struct PE_BOUND_IMPORT_DESCRIPTOR
+{
+	uint32_t TimeDateStamp;
+	uint16_t OffsetModuleName; // offset of the DLL name from the start of the bound import directory.
+	uint16_t NumberOfModuleForwarderRefs;
+};
+
+struct PE_BOUND_FORWARDER_REF
+{
+	uint32_t TimeDateStamp;
+	uint16_t OffsetModuleName;
+	uint16_t Reserved;
+};
+#pragma pack(pop)
+
+#define PE_DELAYLOAD_RVA_BASED 0x1
+
+// how a DLL is referenced. an edge of the graph may carry more than one.
+#define DEPENDENCY_IMPORT 0x1 // the import directory. the DLL is loaded with the image.
+#define DEPENDENCY_DELAYLOAD 0x2 // the delay-import directory. the DLL is loaded on the first call into it.
+#define DEPENDENCY_BOUNDIMPORT 0x4 // the bound import directory. the image was bound to the DLL, or to a DLL it forwards to.
+
+// the longest DLL name read from an import table.
+#define DEPENDENCY_MAX_NAME 256
+
+/* DependencyEdge is a DLL an image references. */
+struct DependencyEdge
+{
+	std::string name; // the name as the import table has it (e.g., KERNEL32.dll).
+	uint32_t kinds; // DEPENDENCY_* flags.
+	int target; // node of the file the name resolved to. -1 if it did not resolve.
+};
+
+/* DependencyNode is a file of the graph and the DLLs it references. */
+struct DependencyNode
+{
+	pathstring path;
+	uint32_t errorCode; // ERROR_SUCCESS, or the reason the file could not be read as a PE image. the other members are not valid then.
+	uint16_t machine; // Machine of the file header.
+	std::vector<DependencyEdge> edges;
+};
+
+/* DependencyClosureEntry is a member of the closure of a set of images. */
+struct DependencyClosureEntry
+{
+	int node; // -1 for a DLL that did not resolve. name has its name then.
+	std::string name;
+	uint32_t errorCode; // ERROR_MOD_NOT_FOUND for a DLL that did not resolve. otherwise, errorCode of the node.
+	uint32_t depth; // 0 for a root. otherwise, the fewest references that lead to the file from a root.
+	bool delayLoadOnly; // every chain of references from the roots to the file passes through a delay-load import.
+};
+
+/* DependencyGraph finds the DLLs an image needs to run, and the DLLs they need in turn. The import, delay-import and bound import directories are read from the mapped file with PEImage. A DLL name is resolved the way the loader resolves it for an application in a staging folder: the directory of the importing file first, then the directories of the search path in order. A candidate file of a different machine type is passed over. The API set names (api-ms-win-*, ext-ms-*) are resolved by the loader to system DLLs at run time, and are not followed.
+
+Each file is a node of the graph, and is parsed once however many images reference it. The nodes and the directory listings used for name lookups are kept until clear() is called, so that computing the closures of thousands of images costs one parse per unique file and one listing per directory. closure() reads the files it reaches on a WorkStealingPool, and any number of threads may call closure() and node() concurrently.
+*/
+class DependencyGraph
+{
+public:
+	DependencyGraph() : _workerCount(0), _parseCount(0) {}
+
+	void setSearchPath(const std::vector<pathstring> &dirs);
+	void setWorkerCount(int workerCount) { _workerCount = workerCount; }
+	void clear();
+
+	int addFile(LPCPATHSTR path);
+	const DependencyNode &node(int id);
+	uint32_t closure(const std::vector<pathstring> &roots, std::vector<DependencyClosureEntry> &entries);
+
+	size_t nodeCount();
+	uint64_t parseCount() const { return _parseCount; }
+
+	static uint32_t readImports(const PEImage &pe, std::vector<DependencyEdge> &edges);
+	static bool isApiSetName(const std::string &name);
+
+protected:
+	// a node is filled in two stages. loading parses the file. linking resolves the names of its edges, which loads the candidate files but does not link them. so, a cycle of references cannot make a stage wait on itself.
+	struct NodeState
+	{
+		DependencyNode node;
+		std::once_flag loaded, linked;
+		std::atomic<bool> visited; // the node was queued by a prefetch of closure().
+		NodeState() : visited(false) {}
+	};
+	// the files of a directory, keyed by their lowercase names.
+	typedef std::unordered_map<pathstring, pathstring> DirectoryListing;
+
+	int _workerCount; // 0 selects one per logical processor.
+	std::vector<pathstring> _searchPath;
+	std::mutex _lock; // guards _nodes, _nodeIds and _listings.
+	std::vector<std::unique_ptr<NodeState> > _nodes;
+	std::unordered_map<pathstring, int> _nodeIds; // node of a pathname (lowercase on Windows).
+	std::unordered_map<pathstring, std::shared_ptr<DirectoryListing> > _listings;
+	std::atomic<uint64_t> _parseCount; // files parsed.
+
+	NodeState *getState(int id);
+	NodeState *load(int id);
+	NodeState *link(int id);
+	void parse(DependencyNode &node);
+	int resolve(const pathstring &dirPath, const std::string &name, uint16_t machine);
+	std::shared_ptr<DirectoryListing> getListing(const pathstring &dirPath);
+
+private:
+	DependencyGraph(const DependencyGraph&);
+	DependencyGraph& operator=(const DependencyGraph&);
+};
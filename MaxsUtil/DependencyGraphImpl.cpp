@@ -0,0 +1,306 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "stdafx.h"
+#include "DependencyGraphImpl.h"
+
+
+DependencyGraphImpl::DependencyGraphImpl() : _threads(0)
+{
+	// the loader looks in the system directory and the Windows directory after the application directory. a 32-bit process on 64-bit Windows is redirected to SysWOW64 when it reads the system directory.
+	WCHAR dir[MAX_PATH];
+	std::vector<pathstring> dirs;
+	UINT len = GetSystemDirectoryW(dir, ARRAYSIZE(dir));
+	if (len && len < ARRAYSIZE(dir))
+		dirs.push_back(pathstring(dir, len));
+	len = GetWindowsDirectoryW(dir, ARRAYSIZE(dir));
+	if (len && len < ARRAYSIZE(dir))
+		dirs.push_back(pathstring(dir, len));
+	for (size_t i = 0; i < dirs.size(); i++)
+	{
+		if (i)
+			_searchPath += L';';
+		_searchPath += dirs[i];
+	}
+	_graph.setSearchPath(dirs);
+}
+
+/* get_SearchPath - [propget] returns the directories a DLL name is looked up in after the directory of the importing file, separated by semicolons. It is the system directory and the Windows directory by default.
+*/
+STDMETHODIMP DependencyGraphImpl::get_SearchPath(/* [retval][out] */ BSTR *Value)
+{
+	*Value = SysAllocStringLen(_searchPath.c_str(), (UINT)_searchPath.length());
+	return *Value ? S_OK : E_OUTOFMEMORY;
+}
+
+/* put_SearchPath - [propput] sets the directories a DLL name is looked up in after the directory of the importing file. The files read so far are forgotten, as their DLL names may resolve to other files now.
+
+Parameters:
+NewValue - [in] pathnames of the directories separated by semicolons, in the order they are searched (e.g., the staging folder of a redistributable runtime, then the system directory). An empty string confines the search to the directory of the importing file.
+*/
+STDMETHODIMP DependencyGraphImpl::put_SearchPath(/* [in] */ BSTR NewValue)
+{
+	std::wstring value(NewValue ? NewValue : L"");
+	std::vector<pathstring> dirs;
+	size_t pos = 0;
+	while (pos <= value.length())
+	{
+		size_t end = value.find(L';', pos);
+		if (end == std::wstring::npos)
+			end = value.length();
+		size_t first = value.find_first_not_of(L" \t", pos);
+		if (first != std::wstring::npos && first < end)
+		{
+			size_t last = value.find_last_not_of(L" \t", end - 1);
+			dirs.push_back(value.substr(first, last - first + 1));
+		}
+		pos = end + 1;
+	}
+	_graph.setSearchPath(dirs);
+	_searchPath = value;
+	return S_OK;
+}
+
+/* Imports - [method] lists the DLLs an executable or a DLL references in its import, delay-import and bound import directories, and the files the names resolve to.
+
+Parameters:
+Path - [in] pathname of the file.
+Result - [retval][out] receives a 2-D array of VARIANTs with a row per DLL name. Column 0 is the name as the file has it (e.g., KERNEL32.dll). Column 1 is the pathname of the file the name resolved to, or VT_EMPTY if no directory has a file of the name and the machine type, or if it is an API set (e.g., api-ms-win-crt-runtime-l1-1-0.dll), which the loader maps to a system DLL. Column 2 is a combination of DEPENDENCYKIND_IMPORT, DEPENDENCYKIND_DELAYLOAD and DEPENDENCYKIND_BOUNDIMPORT telling the directories the name is in.
+*/
+STDMETHODIMP DependencyGraphImpl::Imports(/* [in] */ BSTR Path, /* [retval][out] */ VARIANT *Result)
+{
+	if (!Path || *Path == 0)
+		return E_INVALIDARG;
+	VariantInit(Result);
+	const DependencyNode &node = _graph.node(_graph.addFile(Path));
+	if (node.errorCode != ERROR_SUCCESS)
+		return HRESULT_FROM_WIN32(node.errorCode);
+	size_t rowCount = node.edges.size();
+	SAFEARRAY *psa;
+	VARIANT *cells;
+	HRESULT hr = createArray(rowCount, 3, &psa, &cells);
+	if (hr != S_OK)
+		return hr;
+	for (size_t i = 0; i < rowCount; i++)
+	{
+		const DependencyEdge &edge = node.edges[i];
+		VARIANT *cell = cells + i;
+		std::u16string name;
+		appendUtf16(name, edge.name.c_str(), edge.name.length());
+		hr = setString(cell, (LPCWSTR)name.c_str(), name.length());
+		if (hr != S_OK)
+			break;
+		cell += rowCount;
+		if (edge.target >= 0)
+		{
+			const pathstring &path = _graph.node(edge.target).path;
+			hr = setString(cell, path.c_str(), path.length());
+			if (hr != S_OK)
+				break;
+		}
+		cell += rowCount;
+		cell->vt = VT_I4;
+		cell->lVal = (long)edge.kinds;
+	}
+	SafeArrayUnaccessData(psa);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	Result->vt = VT_ARRAY | VT_VARIANT;
+	Result->parray = psa;
+	return S_OK;
+}
+
+/* Closure - [method] finds every file one or more executables need to run: the executables, the DLLs they reference, the DLLs those reference, and so on. The files are read on a pool of worker threads. A file is read once however many files reference it, and the files read by earlier calls are not read again. So, calling Closure for each of thousands of executables costs one read of each file in all.
+
+Parameters:
+Paths - [in] pathname of an executable, or an array of pathnames (e.g., a VBScript array or a C# string[]). The result covers all of them.
+Result - [retval][out] receives a 2-D array of VARIANTs with a row per file. Column 0 is the pathname of the file, or the DLL name if no file was found for it. Column 1 is a status code, 0 if the file was read, 0x8007007E (ERROR_MOD_NOT_FOUND) for a DLL name that did not resolve, or an HRESULT explaining why the file could not be read. Column 2 is the depth, 0 for the files of Paths, 1 for the DLLs they reference, and so on. Column 3 is VARIANT_TRUE if the file is needed only through delay-load imports, i.e., the executables can start without it. The rows of Paths come first, and the others follow in the order of their depth.
+*/
+STDMETHODIMP DependencyGraphImpl::Closure(/* [in] */ VARIANT Paths, /* [retval][out] */ VARIANT *Result)
+{
+	VariantInit(Result);
+	std::vector<pathstring> roots;
+	HRESULT hr = parsePaths(&Paths, roots);
+	if (hr != S_OK)
+		return hr;
+	_graph.setWorkerCount(_threads);
+	std::vector<DependencyClosureEntry> entries;
+	uint32_t errorCode = _graph.closure(roots, entries);
+	if (errorCode != ERROR_SUCCESS)
+		return HRESULT_FROM_WIN32(errorCode);
+	size_t rowCount = entries.size();
+	SAFEARRAY *psa;
+	VARIANT *cells;
+	hr = createArray(rowCount, 4, &psa, &cells);
+	if (hr != S_OK)
+		return hr;
+	for (size_t i = 0; i < rowCount; i++)
+	{
+		const DependencyClosureEntry &entry = entries[i];
+		VARIANT *cell = cells + i;
+		if (entry.node >= 0)
+		{
+			const pathstring &path = _graph.node(entry.node).path;
+			hr = setString(cell, path.c_str(), path.length());
+		}
+		else
+		{
+			std::u16string name;
+			appendUtf16(name, entry.name.c_str(), entry.name.length());
+			hr = setString(cell, (LPCWSTR)name.c_str(), name.length());
+		}
+		if (hr != S_OK)
+			break;
+		cell += rowCount;
+		cell->vt = VT_I4;
+		cell->lVal = HRESULT_FROM_WIN32(entry.errorCode);
+		cell += rowCount;
+		cell->vt = VT_I4;
+		cell->lVal = (long)entry.depth;
+		cell += rowCount;
+		cell->vt = VT_BOOL;
+		cell->boolVal = entry.delayLoadOnly ? VARIANT_TRUE : VARIANT_FALSE;
+	}
+	SafeArrayUnaccessData(psa);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	Result->vt = VT_ARRAY | VT_VARIANT;
+	Result->parray = psa;
+	return S_OK;
+}
+
+/* get_Threads - [propget] returns the number of threads Closure reads files on. 0 means one per logical processor.
+*/
+STDMETHODIMP DependencyGraphImpl::get_Threads(/* [retval][out] */ long *Value)
+{
+	*Value = _threads;
+	return S_OK;
+}
+
+/* put_Threads - [propput] sets the number of threads Closure reads files on.
+
+Parameters:
+NewValue - [in] number of threads, or 0 for one per logical processor.
+*/
+STDMETHODIMP DependencyGraphImpl::put_Threads(/* [in] */ long NewValue)
+{
+	if (NewValue < 0)
+		return E_INVALIDARG;
+	_threads = NewValue;
+	return S_OK;
+}
+
+/* get_FilesParsed - [propget] returns the number of files read since the object was created or last cleared. It does not grow when Imports or Closure is called again for files already read.
+*/
+STDMETHODIMP DependencyGraphImpl::get_FilesParsed(/* [retval][out] */ long *Value)
+{
+	*Value = (long)_graph.parseCount();
+	return S_OK;
+}
+
+/* Clear - [method] forgets the files read so far. Call it when the files may have been replaced since.
+*/
+STDMETHODIMP DependencyGraphImpl::Clear()
+{
+	_graph.clear();
+	return S_OK;
+}
+
+/* parsePaths - converts the Paths argument of Closure to a list of pathnames. It accepts a BSTR, or an array of BSTRs or of VARIANTs convertible to BSTR. */
+HRESULT DependencyGraphImpl::parsePaths(VARIANT *Paths, std::vector<pathstring> &paths)
+{
+	VariantAutoRel var;
+	HRESULT hr = VariantCopyInd(var, Paths);
+	if (hr != S_OK)
+		return hr;
+	if (var._v.vt == VT_BSTR)
+	{
+		if (!var._v.bstrVal || *var._v.bstrVal == 0)
+			return E_INVALIDARG;
+		paths.push_back(var._v.bstrVal);
+		return S_OK;
+	}
+	if (!(var._v.vt & VT_ARRAY) || ((var._v.vt & ~VT_ARRAY) != VT_BSTR && (var._v.vt & ~VT_ARRAY) != VT_VARIANT))
+		return DISP_E_TYPEMISMATCH;
+	SAFEARRAY *psa = var._v.parray;
+	if (!psa || SafeArrayGetDim(psa) != 1)
+		return E_INVALIDARG;
+	LONG lbound, ubound;
+	SafeArrayGetLBound(psa, 1, &lbound);
+	SafeArrayGetUBound(psa, 1, &ubound);
+	for (LONG i = lbound; i <= ubound; i++)
+	{
+		VariantAutoRel item;
+		if ((var._v.vt & ~VT_ARRAY) == VT_BSTR)
+		{
+			BSTR bs = NULL;
+			hr = SafeArrayGetElement(psa, &i, &bs);
+			item._v.vt = VT_BSTR;
+			item._v.bstrVal = bs;
+		}
+		else
+		{
+			VariantAutoRel elem;
+			hr = SafeArrayGetElement(psa, &i, (VARIANT*)elem);
+			if (hr == S_OK)
+				hr = VariantChangeType(item, elem, 0, VT_BSTR);
+		}
+		if (hr != S_OK)
+			return hr;
+		if (item._v.bstrVal && *item._v.bstrVal)
+			paths.push_back(item._v.bstrVal);
+	}
+	return paths.empty() ? E_INVALIDARG : S_OK;
+}
+
+/* createArray - creates a 2-D array of VARIANTs for the result of Imports or Closure, and locks it for access. The elements are stored in column-major order. element (i,j) is at cells[j*rowCount+i]. The caller calls SafeArrayUnaccessData when done. */
+HRESULT DependencyGraphImpl::createArray(size_t rowCount, size_t colCount, SAFEARRAY **ppsa, VARIANT **cells)
+{
+	SAFEARRAYBOUND sab[2] = { { (ULONG)rowCount, 0 }, { (ULONG)colCount, 0 } };
+	SAFEARRAY *psa = SafeArrayCreate(VT_VARIANT, 2, sab);
+	if (!psa)
+		return E_OUTOFMEMORY;
+	HRESULT hr = SafeArrayAccessData(psa, (void**)cells);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	*ppsa = psa;
+	return S_OK;
+}
+
+// stores a string in a cell of a result array.
+HRESULT DependencyGraphImpl::setString(VARIANT *cell, LPCWSTR s, size_t len)
+{
+	cell->bstrVal = SysAllocStringLen(s, (UINT)len);
+	if (!cell->bstrVal)
+		return E_OUTOFMEMORY;
+	cell->vt = VT_BSTR;
+	return S_OK;
+}
@@ -0,0 +1,57 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "IDispatchImpl.h"
+#include "MaxsUtil_h.h"
+#include "DependencyGraph.h"
+
+
+// implements the IDependencyGraph interface of the DependencyGraph coclass.
+class DependencyGraphImpl :
+	public IDispatchWithObjectSafetyImpl<IDependencyGraph, &IID_IDependencyGraph, &LIBID_MaxsUtilLib>
+{
+public:
+	DependencyGraphImpl();
+
+	// IUnknown methods
+	DELEGATE_IUNKNOWN_TO_IDISPATCHWITHOBJECTSAFETYIMPL(IDependencyGraph, &IID_IDependencyGraph, &LIBID_MaxsUtilLib)
+
+	// IDependencyGraph methods
+	STDMETHOD(get_SearchPath)(/* [retval][out] */ BSTR *Value);
+	STDMETHOD(put_SearchPath)(/* [in] */ BSTR NewValue);
+	STDMETHOD(Imports)(/* [in] */ BSTR Path, /* [retval][out] */ VARIANT *Result);
+	STDMETHOD(Closure)(/* [in] */ VARIANT Paths, /* [retval][out] */ VARIANT *Result);
+	STDMETHOD(get_Threads)(/* [retval][out] */ long *Value);
+	STDMETHOD(put_Threads)(/* [in] */ long NewValue);
+	STDMETHOD(get_FilesParsed)(/* [retval][out] */ long *Value);
+	STDMETHOD(Clear)();
+
+protected:
+	std::wstring _searchPath; // semicolon-separated directories.
+	long _threads; // threads reading files. 0 for one per logical processor.
+	DependencyGraph _graph; // kept between calls, so that a file is parsed once for all of them.
+
+	static HRESULT parsePaths(VARIANT *Paths, std::vector<pathstring> &paths);
+	static HRESULT createArray(size_t rowCount, size_t colCount, SAFEARRAY **ppsa, VARIANT **cells);
+	static HRESULT setString(VARIANT *cell, LPCWSTR s, size_t len);
+};
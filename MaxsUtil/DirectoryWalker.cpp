@@ -0,0 +1,225 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "DirectoryWalker.h"
+#include <algorithm>
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#endif
+
+
+#ifndef _WIN32
+// an entry getdents64 returns. glibc does not declare it. the entries are 8-byte aligned, and d_reclen bytes apart.
+struct LINUX_DIRENT64
+{
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1]; // null-terminated.
+};
+
+// the buffer of entries of each thread. a walk lists directories on every worker, and reuses the buffer from directory to directory.
+static thread_local std::vector<uint64_t> s_entryBuffer;
+
+/* _directoryError - maps an errno value from opening or reading a directory to a Win32 error code. A path that names a file rather than a directory is ERROR_DIRECTORY, as FindFirstFile reports it. */
+static uint32_t _directoryError(int e)
+{
+	if (e == ENOENT)
+		return ERROR_PATH_NOT_FOUND;
+	if (e == ENOTDIR)
+		return ERROR_DIRECTORY;
+	return errnoToWin32(e);
+}
+#endif//#ifndef _WIN32
+
+
+/* listDirectory - reads the entries of a directory and sorts them into files and subdirectories. Symbolic links to directories and other reparse points are not followed, so that the walk cannot loop. On Linux, the entries are read with getdents64 into a buffer of DIRWALK_READ_SIZE bytes, which holds a few thousand entries, and an entry of a file system that does not report its type is stat'ed relative to the open directory.
+
+Parameters:
+dirPath - [in] pathname of the directory.
+files - [out] receives the pathnames of the regular files in the directory.
+subdirs - [out] receives the pathnames of the subdirectories.
+
+Return value:
+ERROR_PATH_NOT_FOUND if the directory does not exist. ERROR_DIRECTORY if the pathname names a file. Otherwise, an error of opening the directory or of reading its first entries.
+*/
+uint32_t DirectoryWalker::listDirectory(const pathstring &dirPath, std::vector<pathstring> &files, std::vector<pathstring> &subdirs)
+{
+	pathstring prefix = dirPath;
+	if (!prefix.empty() && prefix.back() != PATHSEPARATOR)
+		prefix += PATHSEPARATOR;
+#ifdef _WIN32
+	WIN32_FIND_DATAW fd;
+	// FindExInfoBasic skips the short names, and FIND_FIRST_EX_LARGE_FETCH asks for bigger directory reads. both help on a network share.
+	HANDLE hfind = FindFirstFileExW((prefix + L"*").c_str(), FindExInfoBasic, &fd, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if (hfind == INVALID_HANDLE_VALUE)
+		return GetLastError();
+	do
+	{
+		if (fd.cFileName[0] == '.' && (fd.cFileName[1] == 0 || (fd.cFileName[1] == '.' && fd.cFileName[2] == 0)))
+			continue;
+		if (fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+			continue;
+		if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			subdirs.push_back(prefix + fd.cFileName);
+		else
+			files.push_back(prefix + fd.cFileName);
+	} while (FindNextFileW(hfind, &fd));
+	FindClose(hfind);
+#else//#ifdef _WIN32
+	int fd = open(dirPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return _directoryError(errno);
+	std::vector<uint64_t> &buf = s_entryBuffer;
+	if (buf.empty())
+		buf.resize(DIRWALK_READ_SIZE / sizeof(uint64_t));
+	const char *p = (const char*)buf.data();
+	long n;
+	bool listed = false;
+	// a read error past the first batch ends the listing with the entries read so far, as readdir would. an error on the first batch fails the listing.
+	while ((n = syscall(SYS_getdents64, fd, buf.data(), DIRWALK_READ_SIZE)) > 0)
+	{
+		listed = true;
+		for (long pos = 0; pos < n; )
+		{
+			const LINUX_DIRENT64 *de = (const LINUX_DIRENT64*)(p + pos);
+			pos += de->d_reclen;
+			if (de->d_name[0] == '.' && (de->d_name[1] == 0 || (de->d_name[1] == '.' && de->d_name[2] == 0)))
+				continue;
+			unsigned char type = de->d_type;
+			if (type == DT_UNKNOWN)
+			{
+				// some file systems do not report the type in the directory entry. ask for it.
+				struct stat st;
+				if (fstatat(fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+					continue;
+				type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+			}
+			if (type == DT_DIR)
+				subdirs.push_back(prefix + de->d_name);
+			else if (type == DT_REG)
+				files.push_back(prefix + de->d_name);
+		}
+	}
+	uint32_t errorCode = n < 0 && !listed ? _directoryError(errno) : ERROR_SUCCESS;
+	close(fd);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+#endif//#ifdef _WIN32
+	return ERROR_SUCCESS;
+}
+
+/* walk - lists the root directory, and runs the directory tasks of a walk on a pool. The handler is called on the workers of the pool, and must be safe to run on several of them at once. The walk returns after all files have been passed to the handler.
+
+Parameters:
+rootPath - [in] pathname of the directory to walk.
+recursive - [in] true to descend into subdirectories.
+pool - [in] the pool to run the tasks on. The walk waits for all tasks of the pool.
+handler - [in] the function that receives the files.
+
+Return value:
+ERROR_SUCCESS if the root directory could be read. Subdirectories that cannot be read are skipped.
+*/
+uint32_t DirectoryWalker::walk(LPCPATHSTR rootPath, bool recursive, WorkStealingPool &pool, const FileHandler &handler)
+{
+	FileList files(new std::vector<pathstring>);
+	std::vector<pathstring> subdirs;
+	uint32_t errorCode = listDirectory(rootPath, *files, subdirs);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	_pool = &pool;
+	_handler = &handler;
+	_recursive = recursive;
+	_queued = 0;
+	// the root is fanned out on a worker, so that a task run in place of a queued one has a worker index to pass to the handler.
+	pool.submit([this, files, subdirs](int worker) { fanOut(files, subdirs, worker); });
+	pool.wait();
+	_pool = NULL;
+	_handler = NULL;
+	return ERROR_SUCCESS;
+}
+
+/* walkDirectory - lists a directory found by the walk, and fans out its entries. */
+void DirectoryWalker::walkDirectory(const pathstring &dirPath, int workerIndex)
+{
+	FileList files(new std::vector<pathstring>);
+	std::vector<pathstring> subdirs;
+	if (listDirectory(dirPath, *files, subdirs) == ERROR_SUCCESS)
+		fanOut(files, subdirs, workerIndex);
+}
+
+/* fanOut - spawns a task per subdirectory and a task per batch of files. The batches share the list of files of the directory rather than copying it. A subdirectory or a batch that finds the queues full is run in place.
+
+Parameters:
+files - [in] the files of a directory.
+subdirs - [in] the subdirectories of the directory.
+workerIndex - [in] the worker running the directory task.
+*/
+void DirectoryWalker::fanOut(const FileList &files, const std::vector<pathstring> &subdirs, int workerIndex)
+{
+	if (_recursive)
+	{
+		for (size_t i = 0; i < subdirs.size(); i++)
+		{
+			if (!reserveTask())
+			{
+				walkDirectory(subdirs[i], workerIndex);
+				continue;
+			}
+			pathstring dirPath = subdirs[i];
+			_pool->submit([this, dirPath](int worker)
+			{
+				_queued--;
+				walkDirectory(dirPath, worker);
+			});
+		}
+	}
+	for (size_t i = 0; i < files->size(); i += _batchSize)
+	{
+		size_t first = i, count = std::min(files->size() - i, _batchSize);
+		if (!reserveTask())
+		{
+			(*_handler)(files->data() + first, count, workerIndex);
+			continue;
+		}
+		_pool->submit([this, files, first, count](int worker)
+		{
+			_queued--;
+			(*_handler)(files->data() + first, count, worker);
+		});
+	}
+}
+
+/* reserveTask - counts a task about to be queued. Returns false if the walk already has _maxQueued tasks in the queues. */
+bool DirectoryWalker::reserveTask()
+{
+	if (_queued++ < _maxQueued)
+		return true;
+	_queued--;
+	return false;
+}
@@ -0,0 +1,72 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "WorkStealingPool.h"
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+
+
+// files found in a directory are passed to the handler in batches of this size, unless setBatchSize sets another.
+#define DIRWALK_DEFAULT_BATCH_SIZE 64
+// the most tasks a walk keeps in the queues of the pool, unless setMaxQueued sets another.
+#define DIRWALK_DEFAULT_MAX_QUEUED 1024
+// bytes of directory entries read with a system call on Linux. glibc's readdir reads 32KB at a time.
+#define DIRWALK_READ_SIZE 0x20000
+
+/* DirectoryWalker walks a directory tree on a WorkStealingPool. A directory task lists the entries of its directory, spawns a task per subdirectory, and passes the files to a handler in batches. So, the listing of one subtree and the processing of files found in another proceed in parallel, and an idle worker steals a whole subtree rather than a single entry. The walk keeps no more than a set number of tasks queued. A directory or a batch found past that number is run by the worker that found it, so that the memory a walk holds stays bounded on a wide tree. On Linux, listDirectory reads the entries in large batches with getdents64, and sorts them by the type in the entry, so that most entries cost no stat call. On Windows, FindFirstFileEx does the same with FIND_FIRST_EX_LARGE_FETCH. The scanner, the hasher and the cabinet writer share the walker.
+*/
+class DirectoryWalker
+{
+public:
+	// receives a batch of pathnames of regular files. workerIndex is the worker running the batch.
+	typedef std::function<void(const pathstring *files, size_t count, int workerIndex)> FileHandler;
+
+	DirectoryWalker() : _batchSize(DIRWALK_DEFAULT_BATCH_SIZE), _maxQueued(DIRWALK_DEFAULT_MAX_QUEUED), _queued(0), _pool(NULL), _handler(NULL), _recursive(false) {}
+
+	void setBatchSize(size_t batchSize) { _batchSize = batchSize ? batchSize : 1; }
+	void setMaxQueued(size_t maxQueued) { _maxQueued = maxQueued; }
+	uint32_t walk(LPCPATHSTR rootPath, bool recursive, WorkStealingPool &pool, const FileHandler &handler);
+
+	static uint32_t listDirectory(const pathstring &dirPath, std::vector<pathstring> &files, std::vector<pathstring> &subdirs);
+
+protected:
+	typedef std::shared_ptr<std::vector<pathstring> > FileList;
+
+	size_t _batchSize;
+	size_t _maxQueued;
+	std::atomic<size_t> _queued; // tasks of the walk submitted to the pool and not yet started.
+	WorkStealingPool *_pool; // set while a walk runs.
+	const FileHandler *_handler; // set while a walk runs.
+	bool _recursive;
+
+	void walkDirectory(const pathstring &dirPath, int workerIndex);
+	void fanOut(const FileList &files, const std::vector<pathstring> &subdirs, int workerIndex);
+	bool reserveTask();
+
+private:
+	DirectoryWalker(const DirectoryWalker&);
+	DirectoryWalker& operator=(const DirectoryWalker&);
+};
@@ -0,0 +1,198 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "FileClassifier.h"
+#include "PEImage.h"
+#include "PEProbe.h"
+#include "CompoundFile.h"
+#include <string.h>
+#include <algorithm>
+
+
+/* the extensions of the name stage, in lowercase and in sorted order for a binary search. an executable extension is accepted without a look at the head. a data extension is rejected without opening the file. the data formats listed have signatures of their own, so that a file of one cannot be an executable or a compound file, unless it is misnamed.
+*/
+static const char *const executableExtensions[] = {
+	"acm", "ax", "cpl", "dll", "drv", "efi", "exe", "msi", "mui", "node", "ocx", "pyd", "scr", "sys", "winmd",
+};
+static const char *const dataExtensions[] = {
+	"7z", "bmp", "bz2", "c", "cab", "cc", "cpp", "cs", "css", "csv", "gif", "gz", "h", "hpp", "htm", "html", "ico", "idb", "ilk", "ini", "iobj", "ipdb", "jar", "jpeg", "jpg", "js", "json", "lastbuildstate", "lib", "log", "manifest", "map", "md", "nupkg", "obj", "pch", "pdb", "pdf", "png", "rc", "res", "resx", "svg", "tar", "tgz", "tlog", "ts", "txt", "vsix", "xml", "xz", "yaml", "yml", "zip",
+};
+
+/* _findExtension - binary-searches a sorted list of extensions. */
+template <size_t N>
+static bool _findExtension(const char *const (&list)[N], const char *ext)
+{
+	return std::binary_search(list, list + N, ext, [](const char *a, const char *b) { return strcmp(a, b) < 0; });
+}
+
+/* classifyName - the name stage. Looks up the extension of a file.
+
+Parameters:
+path - [in] pathname of the file. Only the part after the last dot of the file name is read.
+
+Return value:
+FNC_EXECUTABLE or FNC_DATA if the extension is on one of the lists. FNC_UNKNOWN if it is on neither, or the file name has no extension.
+*/
+FILE_NAME_CLASS FileClassifier::classifyName(LPCPATHSTR path)
+{
+	size_t len = 0;
+	while (path[len])
+		len++;
+	size_t dot = len;
+	while (dot > 0 && path[dot - 1] != '.' && path[dot - 1] != PATHSEPARATOR && path[dot - 1] != '/')
+		dot--;
+	if (dot == 0 || path[dot - 1] != '.' || len - dot == 0 || len - dot > FILE_MAX_EXTENSION)
+		return FNC_UNKNOWN;
+	// lowercase the extension. a character outside ASCII matches no extension of the lists.
+	char ext[FILE_MAX_EXTENSION + 1];
+	size_t n = 0;
+	for (size_t i = dot; i < len; i++)
+	{
+		PATHCHAR c = path[i];
+		if (c >= 'A' && c <= 'Z')
+			c = (PATHCHAR)(c + ('a' - 'A'));
+		else if ((uint32_t)c >= 0x80)
+			return FNC_UNKNOWN;
+		ext[n++] = (char)c;
+	}
+	ext[n] = 0;
+	if (_findExtension(executableExtensions, ext))
+		return FNC_EXECUTABLE;
+	if (_findExtension(dataExtensions, ext))
+		return FNC_DATA;
+	return FNC_UNKNOWN;
+}
+
+/* classifyHead - the magic stage. Tells the kind of a file from its first bytes.
+
+Parameters:
+head - [in] the first bytes of the file.
+len - [in] number of bytes in head. It is FILE_HEAD_SIZE, or the file size if the file is smaller.
+fileSize - [in] size of the file in bytes.
+
+Return value:
+FK_EXECUTABLE if the head is a DOS header, and the PE header it points to fits in the file. A smaller file, or a header pointing past the end, is one PEImage::attach would reject. It is FK_OTHER.
+*/
+FILE_KIND FileClassifier::classifyHead(const uint8_t *head, size_t len, uint64_t fileSize)
+{
+	if (len >= PE_DOS_LFANEW_OFFSET + sizeof(uint32_t) && head[0] == 'M' && head[1] == 'Z')
+	{
+		uint32_t ntOffset;
+		memcpy(&ntOffset, head + PE_DOS_LFANEW_OFFSET, sizeof(ntOffset));
+		if ((uint64_t)ntOffset + sizeof(uint32_t) + sizeof(PE_FILE_HEADER) <= fileSize)
+			return FK_EXECUTABLE;
+		return FK_OTHER;
+	}
+	if (CompoundFile::hasSignature(head, len))
+		return FK_PACKAGE;
+	if (len >= 4 && memcmp(head, "MSCF", 4) == 0)
+		return FK_CABINET;
+	if (len >= 4 && head[0] == 'P' && head[1] == 'K' && ((head[2] == 3 && head[3] == 4) || (head[2] == 5 && head[3] == 6)))
+		return FK_ZIP;
+	return FK_OTHER;
+}
+
+/* accept - runs a file through the name stage and, if the name does not decide, through the magic stage.
+
+Parameters:
+path - [in] pathname of the file.
+
+Return value:
+true if the file should be parsed. The caller reports the outcome of the parse with countParse. false if the file is neither an executable nor a package, and need not be opened again.
+*/
+bool FileClassifier::accept(LPCPATHSTR path)
+{
+	_files++;
+	FILE_NAME_CLASS nameClass = classifyName(path);
+	if (nameClass == FNC_DATA)
+	{
+		_rejectedByName++;
+		return false;
+	}
+	if (nameClass == FNC_EXECUTABLE)
+	{
+		_acceptedByName++;
+		return true;
+	}
+	if (!_sniffing)
+		return true;
+
+	RangeFile file;
+	uint32_t errorCode = file.open(path);
+	if (errorCode == ERROR_HANDLE_EOF)
+	{
+		// an empty file. a full parse would reject it, too.
+		_sniffed++;
+		_kinds[FK_OTHER]++;
+		_rejectedByMagic++;
+		return false;
+	}
+	if (errorCode != ERROR_SUCCESS)
+		return true; // let the full parse report the error.
+	uint8_t head[FILE_HEAD_SIZE];
+	uint32_t len = (uint32_t)std::min<uint64_t>(file.size(), sizeof(head));
+	if (file.read(0, head, len) != ERROR_SUCCESS)
+		return true;
+	FILE_KIND kind = classifyHead(head, len, file.size());
+	_sniffed++;
+	_kinds[kind]++;
+	if (kind == FK_EXECUTABLE || kind == FK_PACKAGE)
+		return true;
+	_rejectedByMagic++;
+	_bytesSkipped += file.size();
+	return false;
+}
+
+/* countParse - counts the outcome of the full parse of a file accept has accepted.
+
+Parameters:
+executable - [in] false if the parse found that the file is not an executable or a package after all (ERROR_BAD_EXE_FORMAT).
+*/
+void FileClassifier::countParse(bool executable)
+{
+	_parsed++;
+	if (!executable)
+		_parseRejected++;
+}
+
+/* getStats - returns the counters. */
+void FileClassifier::getStats(FileClassifyStats &stats) const
+{
+	stats.files = _files;
+	stats.rejectedByName = _rejectedByName;
+	stats.acceptedByName = _acceptedByName;
+	stats.sniffed = _sniffed;
+	for (int i = 0; i < FK_COUNT; i++)
+		stats.kinds[i] = _kinds[i];
+	stats.rejectedByMagic = _rejectedByMagic;
+	stats.bytesSkipped = _bytesSkipped;
+	stats.parsed = _parsed;
+	stats.parseRejected = _parseRejected;
+}
+
+/* reset - zeroes the counters. */
+void FileClassifier::reset()
+{
+	_files = _rejectedByName = _acceptedByName = _sniffed = _rejectedByMagic = _bytesSkipped = _parsed = _parseRejected = 0;
+	for (int i = 0; i < FK_COUNT; i++)
+		_kinds[i] = 0;
+}
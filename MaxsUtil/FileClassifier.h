@@ -0,0 +1,95 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include <atomic>
+
+
+// the bytes of the head of a file the magic stage reads. the DOS header of an executable is 64 bytes, and ends with the offset of the PE header.
+#define FILE_HEAD_SIZE 64
+// the longest extension the name stage looks up. a longer one is not on either list.
+#define FILE_MAX_EXTENSION 15
+
+/* what the extension of a file tells about it. */
+enum FILE_NAME_CLASS {
+	FNC_UNKNOWN = 0, // the head has to be read.
+	FNC_EXECUTABLE, // an extension of executables and installer packages, e.g., .dll or .msi. the file is parsed without reading its head first.
+	FNC_DATA, // an extension of a format that is never an executable, e.g., .pdb, .txt or .png. the file is not opened.
+};
+
+/* what the head of a file tells about it. */
+enum FILE_KIND {
+	FK_OTHER = 0, // none of the formats below.
+	FK_EXECUTABLE, // an 'MZ' DOS header whose PE header offset lies within the file.
+	FK_PACKAGE, // a compound file, e.g., an installer package (.msi).
+	FK_CABINET, // 'MSCF'.
+	FK_ZIP, // 'PK' followed by a local file header or an end of central directory, e.g., a .zip, .nupkg or .vsix.
+	FK_COUNT
+};
+
+/* FileClassifyStats are counters of the stages of FileClassifier since it was reset. Every file goes through the name stage. A file the name stage cannot decide goes through the magic stage, if it is enabled. A file either stage accepts goes through the full parse.
+*/
+struct FileClassifyStats
+{
+	uint64_t files; // files classified.
+	uint64_t rejectedByName; // files with a data extension. they were not opened.
+	uint64_t acceptedByName; // files with an executable extension.
+	uint64_t sniffed; // files whose head was read.
+	uint64_t kinds[FK_COUNT]; // sniffed files by the kind of their head.
+	uint64_t rejectedByMagic; // sniffed files that are neither executables nor packages. they were not mapped.
+	uint64_t bytesSkipped; // the total size of the files the magic stage rejected. a full parse would have mapped them.
+	uint64_t parsed; // files passed to the full parse.
+	uint64_t parseRejected; // parsed files that turned out not to be executables, e.g., a DOS program with no PE header.
+};
+
+/* FileClassifier decides which files of a tree are worth parsing for a version resource, with as little I/O as it can. A tree of build output is mostly symbol files, text, images and archives. Without the classifier, a scanner maps every one of them to find that out. The classifier runs a file through stages of increasing cost, and stops at the first stage that can decide.
+1) the name stage looks the extension up in two lists: the extensions of executables and installer packages, which are accepted, and the extensions of data formats that cannot be either, which are rejected. It costs no I/O.
+2) the magic stage reads the first FILE_HEAD_SIZE bytes of the file with one positioned read, and accepts an executable or a compound file. It also tells a cabinet and a zip archive apart from other data, so that the counters show what a tree holds.
+3) the full parse is done by the caller (e.g., VersionResource::load), which reports the outcome with countParse.
+A file the magic stage cannot open is accepted, so that the full parse reports the error. The counters are atomic. Threads can classify files with the same classifier at the same time.
+*/
+class FileClassifier
+{
+public:
+	FileClassifier() : _sniffing(true) { reset(); }
+
+	void setSniffing(bool sniffing) { _sniffing = sniffing; }
+	bool sniffing() const { return _sniffing; }
+
+	bool accept(LPCPATHSTR path);
+	void countParse(bool executable);
+	void getStats(FileClassifyStats &stats) const;
+	void reset();
+
+	static FILE_NAME_CLASS classifyName(LPCPATHSTR path);
+	static FILE_KIND classifyHead(const uint8_t *head, size_t len, uint64_t fileSize);
+
+protected:
+	bool _sniffing; // false to skip the magic stage, e.g., when an index or positioned reads make a full parse as cheap.
+	std::atomic<uint64_t> _files, _rejectedByName, _acceptedByName, _sniffed, _rejectedByMagic, _bytesSkipped, _parsed, _parseRejected;
+	std::atomic<uint64_t> _kinds[FK_COUNT];
+
+private:
+	FileClassifier(const FileClassifier&);
+	FileClassifier& operator=(const FileClassifier&);
+};
@@ -0,0 +1,584 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "FileHasher.h"
+#include "DirectoryWalker.h"
+#include "WorkStealingPool.h"
+#include <algorithm>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define FILEHASH_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define FILEHASH_SHANI
+#define FILEHASH_PCLMUL
+#else//#ifdef _MSC_VER
+#include <cpuid.h>
+// gcc and clang compile the SHA and PCLMULQDQ intrinsics only in functions marked for the instruction sets. the functions are called after a run-time check of the processor.
+#define FILEHASH_SHANI __attribute__((target("sha,sse4.1")))
+#define FILEHASH_PCLMUL __attribute__((target("pclmul,sse4.1")))
+#endif//#ifdef _MSC_VER
+#endif//#if defined(_M_X64) ...
+
+
+static const uint32_t _sha256K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t _rotateRight(uint32_t x, int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+/* _sha256Portable - the compression function of FIPS 180-4 in plain C++. */
+static void _sha256Portable(uint32_t state[8], const uint8_t *data, size_t blockCount)
+{
+	for (; blockCount; blockCount--, data += SHA256_BLOCK_SIZE)
+	{
+		uint32_t w[64];
+		for (int t = 0; t < 16; t++)
+			w[t] = ((uint32_t)data[4 * t] << 24) | (data[4 * t + 1] << 16) | (data[4 * t + 2] << 8) | data[4 * t + 3];
+		for (int t = 16; t < 64; t++)
+		{
+			uint32_t s0 = _rotateRight(w[t - 15], 7) ^ _rotateRight(w[t - 15], 18) ^ (w[t - 15] >> 3);
+			uint32_t s1 = _rotateRight(w[t - 2], 17) ^ _rotateRight(w[t - 2], 19) ^ (w[t - 2] >> 10);
+			w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+		}
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+		for (int t = 0; t < 64; t++)
+		{
+			uint32_t t1 = h + (_rotateRight(e, 6) ^ _rotateRight(e, 11) ^ _rotateRight(e, 25)) + ((e & f) ^ (~e & g)) + _sha256K[t] + w[t];
+			uint32_t t2 = (_rotateRight(a, 2) ^ _rotateRight(a, 13) ^ _rotateRight(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+/* CRC-32 slicing tables. _crcTable[0] is the classic byte table. _crcTable[k][b] is the CRC of byte b followed by k zero bytes. */
+static uint32_t _crcTable[8][256];
+static bool _initCrcTable()
+{
+	for (uint32_t i = 0; i < 256; i++)
+	{
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++)
+			c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		_crcTable[0][i] = c;
+	}
+	for (uint32_t i = 0; i < 256; i++)
+	{
+		for (int k = 1; k < 8; k++)
+			_crcTable[k][i] = (_crcTable[k - 1][i] >> 8) ^ _crcTable[0][_crcTable[k - 1][i] & 0xFF];
+	}
+	return true;
+}
+static const bool _crcTableReady = _initCrcTable();
+
+/* _crc32Portable - updates an inverted CRC (the register, not the final value) 8 bytes at a time. */
+static uint32_t _crc32Portable(uint32_t c, const uint8_t *p, size_t len)
+{
+	for (; len >= 8; len -= 8, p += 8)
+	{
+		uint32_t one = (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24)) ^ c;
+		uint32_t two = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t)p[7] << 24);
+		c = _crcTable[7][one & 0xFF] ^ _crcTable[6][(one >> 8) & 0xFF] ^ _crcTable[5][(one >> 16) & 0xFF] ^ _crcTable[4][one >> 24] ^
+			_crcTable[3][two & 0xFF] ^ _crcTable[2][(two >> 8) & 0xFF] ^ _crcTable[1][(two >> 16) & 0xFF] ^ _crcTable[0][two >> 24];
+	}
+	for (; len; len--)
+		c = _crcTable[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+	return c;
+}
+
+#ifdef FILEHASH_X86
+/* _cpuidBits - returns EBX and ECX of a cpuid leaf, or zeros if the processor does not have the leaf. */
+static void _cpuidBits(unsigned leaf, uint32_t *ebx, uint32_t *ecx)
+{
+	*ebx = *ecx = 0;
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if ((unsigned)info[0] < leaf)
+		return;
+	__cpuidex(info, leaf, 0);
+	*ebx = (uint32_t)info[1];
+	*ecx = (uint32_t)info[2];
+#else//#ifdef _MSC_VER
+	unsigned a, b, c, d;
+	if (__get_cpuid_max(0, NULL) < leaf)
+		return;
+	__cpuid_count(leaf, 0, a, b, c, d);
+	*ebx = b;
+	*ecx = c;
+#endif//#ifdef _MSC_VER
+}
+
+// cpuid leaf 1 ECX has PCLMULQDQ in bit 1 and SSE4.1 in bit 19. leaf 7 EBX has the SHA extensions in bit 29.
+static bool _hasShaNi()
+{
+	uint32_t ebx, ecx, ebx7, ecx7;
+	_cpuidBits(1, &ebx, &ecx);
+	_cpuidBits(7, &ebx7, &ecx7);
+	return (ecx & (1u << 19)) && (ebx7 & (1u << 29));
+}
+static bool _hasPclmul()
+{
+	uint32_t ebx, ecx;
+	_cpuidBits(1, &ebx, &ecx);
+	return (ecx & (1u << 1)) && (ecx & (1u << 19));
+}
+static bool _useShaNi()
+{
+	static const bool hasShaNi = _hasShaNi();
+	return hasShaNi;
+}
+static bool _usePclmul()
+{
+	static const bool hasPclmul = _hasPclmul();
+	return hasPclmul;
+}
+
+/* _sha256ShaNi - the compression function on the SHA extensions. The state is kept as the ABEF and CDGH halves the SHA256RNDS2 instruction works on. A step does 4 rounds. The message schedule of the next 4 words is made with SHA256MSG1 and SHA256MSG2 from the last 16 words. */
+FILEHASH_SHANI static void _sha256ShaNi(uint32_t state[8], const uint8_t *data, size_t blockCount)
+{
+	const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i tmp = _mm_loadu_si128((const __m128i*)&state[0]);
+	__m128i state1 = _mm_loadu_si128((const __m128i*)&state[4]);
+	tmp = _mm_shuffle_epi32(tmp, 0xB1); // CDAB
+	state1 = _mm_shuffle_epi32(state1, 0x1B); // EFGH
+	__m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0); // CDGH
+	for (; blockCount; blockCount--, data += SHA256_BLOCK_SIZE)
+	{
+		__m128i abefSave = state0, cdghSave = state1;
+		__m128i w[4];
+		for (int i = 0; i < 16; i++)
+		{
+			__m128i msg;
+			if (i < 4)
+			{
+				msg = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * i)), byteSwap);
+			}
+			else
+			{
+				msg = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+				msg = _mm_add_epi32(msg, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+				msg = _mm_sha256msg2_epu32(msg, w[(i + 3) & 3]);
+			}
+			w[i & 3] = msg;
+			msg = _mm_add_epi32(msg, _mm_loadu_si128((const __m128i*)&_sha256K[4 * i]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0E);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+		}
+		state0 = _mm_add_epi32(state0, abefSave);
+		state1 = _mm_add_epi32(state1, cdghSave);
+	}
+	tmp = _mm_shuffle_epi32(state0, 0x1B); // FEBA
+	state1 = _mm_shuffle_epi32(state1, 0xB1); // DCHG
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0); // DCBA
+	state1 = _mm_alignr_epi8(state1, tmp, 8); // HGFE
+	_mm_storeu_si128((__m128i*)&state[0], state0);
+	_mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+/* _crc32Pclmul - updates an inverted CRC with carry-less multiplication. Four 128-bit lanes are folded 64 bytes ahead at a time, then folded into one lane, which is reduced to 32 bits with a Barrett reduction. The constants are powers of x modulo the bit-reflected polynomial (Gopal et al., Intel, 'Fast CRC Computation for Generic Polynomials Using PCLMULQDQ'). len must be a multiple of 16 and at least 64. */
+FILEHASH_PCLMUL static uint32_t _crc32Pclmul(uint32_t c, const uint8_t *p, size_t len)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+	const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+	__m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)p), _mm_cvtsi32_si128((int)c));
+	__m128i x2 = _mm_loadu_si128((const __m128i*)(p + 16));
+	__m128i x3 = _mm_loadu_si128((const __m128i*)(p + 32));
+	__m128i x4 = _mm_loadu_si128((const __m128i*)(p + 48));
+	p += 64;
+	len -= 64;
+	for (; len >= 64; len -= 64, p += 64)
+	{
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x00), _mm_clmulepi64_si128(x1, k1k2, 0x11)), _mm_loadu_si128((const __m128i*)p));
+		x2 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x00), _mm_clmulepi64_si128(x2, k1k2, 0x11)), _mm_loadu_si128((const __m128i*)(p + 16)));
+		x3 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x00), _mm_clmulepi64_si128(x3, k1k2, 0x11)), _mm_loadu_si128((const __m128i*)(p + 32)));
+		x4 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x4, k1k2, 0x00), _mm_clmulepi64_si128(x4, k1k2, 0x11)), _mm_loadu_si128((const __m128i*)(p + 48)));
+	}
+	// fold the four lanes into one, then fold in the 16-byte blocks that are left.
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x2);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x3);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x4);
+	for (; len >= 16; len -= 16, p += 16)
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), _mm_loadu_si128((const __m128i*)p));
+	// 128 bits to 64 bits.
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5k0, 0x00), x2);
+	// Barrett reduction to 32 bits.
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x10);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, low32), poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+#endif//#ifdef FILEHASH_X86
+
+uint32_t crc32Update(uint32_t crc, const void *data, size_t len)
+{
+	const uint8_t *p = (const uint8_t*)data;
+	uint32_t c = ~crc;
+#ifdef FILEHASH_X86
+	if (len >= 64 && _usePclmul())
+	{
+		size_t n = len & ~(size_t)15;
+		c = _crc32Pclmul(c, p, n);
+		p += n;
+		len -= n;
+	}
+#endif//#ifdef FILEHASH_X86
+	return ~_crc32Portable(c, p, len);
+}
+
+/* init - starts a new digest. */
+void Sha256::init()
+{
+	static const uint32_t initialState[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	memcpy(_state, initialState, sizeof(_state));
+	_length = 0;
+	_blockLen = 0;
+}
+
+/* update - adds data to the digest. Whole blocks are hashed straight from the input. A partial block is kept until more data comes in. */
+void Sha256::update(const void *data, size_t len)
+{
+	const uint8_t *p = (const uint8_t*)data;
+	_length += len;
+	if (_blockLen)
+	{
+		size_t n = std::min<size_t>(len, SHA256_BLOCK_SIZE - _blockLen);
+		memcpy(_block + _blockLen, p, n);
+		_blockLen += (uint32_t)n;
+		p += n;
+		len -= n;
+		if (_blockLen < SHA256_BLOCK_SIZE)
+			return;
+		compress(_state, _block, 1);
+		_blockLen = 0;
+	}
+	if (len >= SHA256_BLOCK_SIZE)
+	{
+		compress(_state, p, len / SHA256_BLOCK_SIZE);
+		p += len & ~(size_t)(SHA256_BLOCK_SIZE - 1);
+		len &= SHA256_BLOCK_SIZE - 1;
+	}
+	memcpy(_block, p, len);
+	_blockLen = (uint32_t)len;
+}
+
+/* final - pads the message, and returns the digest. Call init() to start another. */
+void Sha256::final(uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	uint64_t bits = _length * 8;
+	uint8_t pad[SHA256_BLOCK_SIZE * 2] = { 0x80 };
+	size_t padLen = (_blockLen < SHA256_BLOCK_SIZE - 8 ? SHA256_BLOCK_SIZE : SHA256_BLOCK_SIZE * 2) - _blockLen;
+	for (int i = 0; i < 8; i++)
+		pad[padLen - 1 - i] = (uint8_t)(bits >> (8 * i));
+	update(pad, padLen);
+	for (int i = 0; i < 8; i++)
+	{
+		digest[4 * i] = (uint8_t)(_state[i] >> 24);
+		digest[4 * i + 1] = (uint8_t)(_state[i] >> 16);
+		digest[4 * i + 2] = (uint8_t)(_state[i] >> 8);
+		digest[4 * i + 3] = (uint8_t)_state[i];
+	}
+}
+
+void Sha256::compress(uint32_t state[8], const uint8_t *data, size_t blockCount)
+{
+#ifdef FILEHASH_X86
+	if (_useShaNi())
+	{
+		_sha256ShaNi(state, data, blockCount);
+		return;
+	}
+#endif//#ifdef FILEHASH_X86
+	_sha256Portable(state, data, blockCount);
+}
+
+/* hashFile - computes the SHA-256 and CRC-32 of a file.
+
+Parameters:
+path - [in] pathname of the file.
+digest - [out] receives the digests and the size of the file, and the pathname.
+
+Return value:
+ERROR_FILE_NOT_FOUND if the file does not exist or is not a regular file. Otherwise, a read error.
+*/
+uint32_t FileHasher::hashFile(LPCPATHSTR path, FileDigest &digest)
+{
+	digest.path = path;
+	digest.size = 0;
+	memset(digest.sha256, 0, sizeof(digest.sha256));
+	digest.crc32 = 0;
+	digest.errorCode = readAndHash(path, digest);
+	return digest.errorCode;
+}
+
+/* hashData - computes the SHA-256 and CRC-32 of a file that is already in memory, e.g., the view of a MappedFile another parser has read the file through. Both digests are fed one chunk at a time, so that a page is faulted in once and hashed twice while it is still in the processor's cache.
+
+Parameters:
+path - [in] pathname of the file. It is only recorded in the digest.
+data - [in] contents of the file.
+len - [in] byte length of data.
+digest - [out] receives the digests and the size of the file, and the pathname.
+*/
+uint32_t FileHasher::hashData(LPCPATHSTR path, const uint8_t *data, size_t len, FileDigest &digest)
+{
+	digest.path = path;
+	Sha256 sha;
+	uint32_t crc = 0;
+	for (size_t pos = 0; pos < len; pos += FILEHASH_CHUNK_SIZE)
+	{
+		size_t cb = len - pos < FILEHASH_CHUNK_SIZE ? len - pos : FILEHASH_CHUNK_SIZE;
+		sha.update(data + pos, cb);
+		crc = crc32Update(crc, data + pos, cb);
+		_bytesHashed += cb;
+	}
+	digest.size = len;
+	sha.final(digest.sha256);
+	digest.crc32 = crc;
+	digest.errorCode = ERROR_SUCCESS;
+	return ERROR_SUCCESS;
+}
+
+/* hashDirectory - walks a directory tree with a DirectoryWalker and hashes every file in it. Subdirectories and batches of files are run as tasks of a WorkStealingPool. The digests are sorted by pathname. A file that cannot be read has a digest with an error code.
+
+Parameters:
+rootPath - [in] pathname of the directory.
+recursive - [in] true to descend into subdirectories.
+digests - [out] receives a digest per file.
+
+Return value:
+ERROR_SUCCESS if the root directory could be read. Subdirectories that cannot be read are skipped.
+*/
+uint32_t FileHasher::hashDirectory(LPCPATHSTR rootPath, bool recursive, std::vector<FileDigest> &digests)
+{
+	_bytesHashed = 0;
+	WorkStealingPool pool(_workerCount);
+	_results.clear();
+	_results.resize(pool.workerCount());
+	DirectoryWalker walker;
+	walker.setBatchSize(FILEHASH_FILE_BATCH_SIZE);
+	uint32_t errorCode = walker.walk(rootPath, recursive, pool, [this](const pathstring *files, size_t count, int worker)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			_results[worker].push_back(FileDigest());
+			hashFile(files[i].c_str(), _results[worker].back());
+		}
+	});
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	collectResults(digests);
+	return ERROR_SUCCESS;
+}
+
+/* hashFiles - hashes a list of files on a WorkStealingPool. The digests are sorted by pathname.
+
+Parameters:
+paths - [in] pathnames of the files.
+digests - [out] receives a digest per file.
+*/
+void FileHasher::hashFiles(const std::vector<pathstring> &paths, std::vector<FileDigest> &digests)
+{
+	_bytesHashed = 0;
+	WorkStealingPool pool(_workerCount);
+	_results.clear();
+	_results.resize(pool.workerCount());
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		pool.submit([this, &paths, i](int worker)
+		{
+			_results[worker].push_back(FileDigest());
+			hashFile(paths[i].c_str(), _results[worker].back());
+		});
+	}
+	pool.wait();
+	collectResults(digests);
+}
+
+/* formatSha256 - formats a SHA-256 digest as 64 lowercase hex digits. The text is not null-terminated. */
+void FileHasher::formatSha256(const uint8_t sha256[SHA256_DIGEST_SIZE], UTF16CHAR text[SHA256_DIGEST_SIZE * 2])
+{
+	static const char hexDigits[] = "0123456789abcdef";
+	for (int i = 0; i < SHA256_DIGEST_SIZE; i++)
+	{
+		text[2 * i] = hexDigits[sha256[i] >> 4];
+		text[2 * i + 1] = hexDigits[sha256[i] & 0xF];
+	}
+}
+
+/* readAndHash - reads a file in chunks, and feeds each chunk to both digests. The read of the next chunk is started before the current one is hashed. */
+uint32_t FileHasher::readAndHash(LPCPATHSTR path, FileDigest &digest)
+{
+	Sha256 sha;
+	uint32_t crc = 0;
+	uint64_t total = 0;
+	uint32_t errorCode = ERROR_SUCCESS;
+#ifdef _WIN32
+	HANDLE hfile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hfile == INVALID_HANDLE_VALUE)
+	{
+		errorCode = GetLastError();
+		return errorCode == ERROR_PATH_NOT_FOUND ? ERROR_FILE_NOT_FOUND : errorCode;
+	}
+	// two buffers. one is hashed while the other is being filled.
+	std::vector<uint8_t> buf(2 * FILEHASH_CHUNK_SIZE);
+	OVERLAPPED ov = { 0 };
+	ov.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	if (!ov.hEvent)
+	{
+		errorCode = GetLastError();
+		CloseHandle(hfile);
+		return errorCode;
+	}
+	int current = 0;
+	bool pending = ReadFile(hfile, buf.data(), FILEHASH_CHUNK_SIZE, NULL, &ov) || GetLastError() == ERROR_IO_PENDING;
+	if (!pending && GetLastError() != ERROR_HANDLE_EOF)
+		errorCode = GetLastError();
+	while (pending)
+	{
+		DWORD cb = 0;
+		if (!GetOverlappedResult(hfile, &ov, &cb, TRUE))
+		{
+			if (GetLastError() != ERROR_HANDLE_EOF)
+				errorCode = GetLastError();
+			break;
+		}
+		if (cb == 0)
+			break;
+		const uint8_t *chunk = buf.data() + current * FILEHASH_CHUNK_SIZE;
+		total += cb;
+		current ^= 1;
+		ov.Offset = (DWORD)total;
+		ov.OffsetHigh = (DWORD)(total >> 32);
+		pending = ReadFile(hfile, buf.data() + current * FILEHASH_CHUNK_SIZE, FILEHASH_CHUNK_SIZE, NULL, &ov) || GetLastError() == ERROR_IO_PENDING;
+		if (!pending && GetLastError() != ERROR_HANDLE_EOF)
+			errorCode = GetLastError();
+		sha.update(chunk, cb);
+		crc = crc32Update(crc, chunk, cb);
+		_bytesHashed += cb;
+	}
+	if (pending)
+	{
+		// an error ended the loop with a read in flight. the buffer must outlive it.
+		CancelIo(hfile);
+		DWORD cb;
+		GetOverlappedResult(hfile, &ov, &cb, TRUE);
+	}
+	CloseHandle(ov.hEvent);
+	CloseHandle(hfile);
+#else//#ifdef _WIN32
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return errnoToWin32(errno);
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+	{
+		close(fd);
+		return ERROR_FILE_NOT_FOUND;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	std::vector<uint8_t> buf(FILEHASH_CHUNK_SIZE);
+	for (;;)
+	{
+		ssize_t cb = read(fd, buf.data(), buf.size());
+		if (cb < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			errorCode = errnoToWin32(errno);
+			break;
+		}
+		if (cb == 0)
+			break;
+		total += cb;
+		// have the kernel read the next chunk while this one is hashed.
+		posix_fadvise(fd, (off_t)total, FILEHASH_CHUNK_SIZE, POSIX_FADV_WILLNEED);
+		sha.update(buf.data(), cb);
+		crc = crc32Update(crc, buf.data(), cb);
+		_bytesHashed += cb;
+	}
+	close(fd);
+#endif//#ifdef _WIN32
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	digest.size = total;
+	sha.final(digest.sha256);
+	digest.crc32 = crc;
+	return ERROR_SUCCESS;
+}
+
+/* collectResults - moves the digests of all workers to a single list sorted by pathname. */
+void FileHasher::collectResults(std::vector<FileDigest> &digests)
+{
+	size_t total = 0;
+	for (size_t i = 0; i < _results.size(); i++)
+		total += _results[i].size();
+	digests.clear();
+	digests.reserve(total);
+	for (size_t i = 0; i < _results.size(); i++)
+	{
+		for (size_t j = 0; j < _results[i].size(); j++)
+			digests.push_back(std::move(_results[i][j]));
+	}
+	_results.clear();
+	std::sort(digests.begin(), digests.end(), [](const FileDigest &a, const FileDigest &b) { return a.path < b.path; });
+}
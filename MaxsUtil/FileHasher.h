@@ -0,0 +1,93 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include <vector>
+#include <atomic>
+
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+// a file is read in chunks of this size. the next chunk is read while the current one is hashed.
+#define FILEHASH_CHUNK_SIZE 0x100000
+// files hashed by one task of a directory walk.
+#define FILEHASH_FILE_BATCH_SIZE 16
+
+/* Sha256 computes a SHA-256 digest (FIPS 180-4). On an x86 or x64 processor with the SHA extensions, the compression function runs on the SHA-NI instructions, which process a 64-byte block several times faster than the portable code. The choice is made once at run time.
+*/
+class Sha256
+{
+public:
+	Sha256() { init(); }
+
+	void init();
+	void update(const void *data, size_t len);
+	void final(uint8_t digest[SHA256_DIGEST_SIZE]);
+
+protected:
+	uint32_t _state[8];
+	uint64_t _length; // bytes hashed so far.
+	uint8_t _block[SHA256_BLOCK_SIZE]; // a partial block waiting for more data.
+	uint32_t _blockLen;
+
+	static void compress(uint32_t state[8], const uint8_t *data, size_t blockCount);
+};
+
+/* crc32Update - adds data to a CRC-32 (the ISO-HDLC polynomial of zip, gzip and PNG). Start with 0. On an x86 or x64 processor with PCLMULQDQ, 64 bytes are folded per step with carry-less multiplication. Otherwise, 8 bytes are looked up per step in slicing tables. */
+uint32_t crc32Update(uint32_t crc, const void *data, size_t len);
+
+/* FileDigest is the result of hashing a file. */
+struct FileDigest
+{
+	pathstring path;
+	uint32_t errorCode; // ERROR_SUCCESS, or the reason the file could not be read. the other members are not valid then.
+	uint64_t size;
+	uint8_t sha256[SHA256_DIGEST_SIZE];
+	uint32_t crc32;
+};
+
+/* FileHasher computes the SHA-256 and CRC-32 of files in a single read of each file. A file is read in 1 MB chunks, and the read of the next chunk overlaps the hashing of the current one. On Windows, the next chunk is read with an overlapped ReadFile into a second buffer. On Linux, the kernel is asked to read it ahead with posix_fadvise. hashDirectory spreads the files of a tree over a WorkStealingPool, which keeps the disks and the processors busy at the same time. bytesHashed() can be read from another thread while a hash runs.
+*/
+class FileHasher
+{
+public:
+	FileHasher() : _workerCount(0), _bytesHashed(0) {}
+
+	void setWorkerCount(int workerCount) { _workerCount = workerCount; }
+	uint32_t hashFile(LPCPATHSTR path, FileDigest &digest);
+	uint32_t hashData(LPCPATHSTR path, const uint8_t *data, size_t len, FileDigest &digest);
+	uint32_t hashDirectory(LPCPATHSTR rootPath, bool recursive, std::vector<FileDigest> &digests);
+	void hashFiles(const std::vector<pathstring> &paths, std::vector<FileDigest> &digests);
+
+	uint64_t bytesHashed() const { return _bytesHashed; }
+
+	static void formatSha256(const uint8_t sha256[SHA256_DIGEST_SIZE], UTF16CHAR text[SHA256_DIGEST_SIZE * 2]);
+
+protected:
+	int _workerCount; // 0 selects one per logical processor.
+	std::atomic<uint64_t> _bytesHashed; // bytes read and hashed by all workers.
+	std::vector<std::vector<FileDigest> > _results; // one digest list per worker.
+
+	uint32_t readAndHash(LPCPATHSTR path, FileDigest &digest);
+	void collectResults(std::vector<FileDigest> &digests);
+};
@@ -0,0 +1,190 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "stdafx.h"
+#include "FileHasherImpl.h"
+
+
+/* HashFile - [method] computes the SHA-256 and CRC-32 of a file. The file is read once, and both digests are computed on the same pass.
+
+Parameters:
+Path - [in] pathname of the file.
+Sha256 - [retval][out] receives the SHA-256 of the file as 64 lowercase hex digits, the form sha256sum and Get-FileHash print (the latter in uppercase). Read Crc32 and Size for the CRC-32 and the size of the file.
+*/
+STDMETHODIMP FileHasherImpl::HashFile(/* [in] */ BSTR Path, /* [retval][out] */ BSTR *Sha256)
+{
+	if (!Path || *Path == 0)
+		return E_INVALIDARG;
+	*Sha256 = NULL;
+	FileHasher hasher;
+	uint32_t errorCode = hasher.hashFile(Path, _digest);
+	_bytesHashed = hasher.bytesHashed();
+	if (errorCode != ERROR_SUCCESS)
+		return HRESULT_FROM_WIN32(errorCode);
+	UTF16CHAR text[SHA256_DIGEST_SIZE * 2];
+	FileHasher::formatSha256(_digest.sha256, text);
+	*Sha256 = SysAllocStringLen((LPCWSTR)text, SHA256_DIGEST_SIZE * 2);
+	return *Sha256 ? S_OK : E_OUTOFMEMORY;
+}
+
+/* HashDirectory - [method] computes the SHA-256 and CRC-32 of every file in a directory tree. Files are spread over a pool of worker threads. Each file is read once, in chunks, and the next chunk is read while the current one is hashed. So, the disks and the processors are kept busy together.
+
+Parameters:
+RootPath - [in] a pathname of the directory.
+Recursive - [in, optional] VARIANT_TRUE (default) to hash the files in subdirectories as well.
+Result - [retval][out] receives a 2-D array of VARIANTs. There is a row for each file. Column 0 is the pathname of the file. Column 1 is a status code, 0 if the file was hashed, or an HRESULT explaining why it could not be (e.g., 0x80070020 for a file locked by another process). Column 2 is the size of the file. Column 3 is the SHA-256 as 64 lowercase hex digits. Column 4 is the CRC-32. Columns 2 to 4 are VT_EMPTY if the status is not 0. The rows are sorted by pathname.
+
+Remarks:
+To have the version attributes and the digests of executables in one pass, call VersionInfo.ScanDirectory with SHA256 and CRC32 among the attribute names instead.
+*/
+STDMETHODIMP FileHasherImpl::HashDirectory(/* [in] */ BSTR RootPath, /* [in, optional] */ VARIANT *Recursive, /* [retval][out] */ VARIANT *Result)
+{
+	if (!RootPath || *RootPath == 0)
+		return E_INVALIDARG;
+	VariantInit(Result);
+	bool recursive = true;
+	if (Recursive && Recursive->vt != VT_ERROR && Recursive->vt != VT_EMPTY)
+	{
+		VariantAutoRel var;
+		HRESULT hr = VariantChangeType(var, Recursive, 0, VT_BOOL);
+		if (FAILED(hr))
+			return hr;
+		recursive = var._v.boolVal != VARIANT_FALSE;
+	}
+	FileHasher hasher;
+	hasher.setWorkerCount(_threads);
+	std::vector<FileDigest> digests;
+	uint32_t errorCode = hasher.hashDirectory(RootPath, recursive, digests);
+	_bytesHashed = hasher.bytesHashed();
+	if (errorCode != ERROR_SUCCESS)
+		return HRESULT_FROM_WIN32(errorCode);
+	return digestsToArray(digests, Result);
+}
+
+/* get_Crc32 - [propget] returns the CRC-32 of the file of the last HashFile. It is the checksum zip and gzip store, as a signed 32-bit number.
+*/
+STDMETHODIMP FileHasherImpl::get_Crc32(/* [retval][out] */ long *Value)
+{
+	if (_digest.errorCode != ERROR_SUCCESS)
+		return E_UNEXPECTED;
+	*Value = (long)_digest.crc32;
+	return S_OK;
+}
+
+/* get_Size - [propget] returns the size of the file of the last HashFile.
+*/
+STDMETHODIMP FileHasherImpl::get_Size(/* [retval][out] */ double *Value)
+{
+	if (_digest.errorCode != ERROR_SUCCESS)
+		return E_UNEXPECTED;
+	*Value = (double)_digest.size;
+	return S_OK;
+}
+
+/* get_Threads - [propget] returns the number of threads HashDirectory runs. 0 means one per logical processor.
+*/
+STDMETHODIMP FileHasherImpl::get_Threads(/* [retval][out] */ long *Value)
+{
+	*Value = _threads;
+	return S_OK;
+}
+
+/* put_Threads - [propput] sets the number of threads HashDirectory runs. A tree on a slow network share may hash faster with more threads than processors.
+
+Parameters:
+NewValue - [in] number of threads, or 0 for one per logical processor.
+*/
+STDMETHODIMP FileHasherImpl::put_Threads(/* [in] */ long NewValue)
+{
+	if (NewValue < 0)
+		return E_INVALIDARG;
+	_threads = NewValue;
+	return S_OK;
+}
+
+/* get_BytesHashed - [propget] returns the bytes read and hashed by the last HashFile or HashDirectory.
+*/
+STDMETHODIMP FileHasherImpl::get_BytesHashed(/* [retval][out] */ double *Value)
+{
+	*Value = (double)_bytesHashed;
+	return S_OK;
+}
+
+/* digestsToArray - converts the digests of HashDirectory to a 2-D array of VARIANTs in the layout described there. */
+HRESULT FileHasherImpl::digestsToArray(const std::vector<FileDigest> &digests, VARIANT *Result)
+{
+	SAFEARRAYBOUND sab[2] = { { (ULONG)digests.size(), 0 }, { 5, 0 } };
+	SAFEARRAY *psa = SafeArrayCreate(VT_VARIANT, 2, sab);
+	if (!psa)
+		return E_OUTOFMEMORY;
+	VARIANT *cells;
+	HRESULT hr = SafeArrayAccessData(psa, (void**)&cells);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	// the elements are stored in column-major order. element (i,j) is at cells[j*rows+i].
+	size_t rowCount = digests.size();
+	for (size_t i = 0; i < rowCount; i++)
+	{
+		const FileDigest &digest = digests[i];
+		VARIANT *cell = cells + i;
+		cell->bstrVal = SysAllocStringLen(digest.path.c_str(), (UINT)digest.path.length());
+		if (!cell->bstrVal)
+		{
+			hr = E_OUTOFMEMORY;
+			break;
+		}
+		cell->vt = VT_BSTR;
+		cell += rowCount;
+		cell->vt = VT_I4;
+		cell->lVal = HRESULT_FROM_WIN32(digest.errorCode);
+		if (digest.errorCode != ERROR_SUCCESS)
+			continue;
+		cell += rowCount;
+		cell->vt = VT_R8;
+		cell->dblVal = (double)digest.size;
+		cell += rowCount;
+		UTF16CHAR text[SHA256_DIGEST_SIZE * 2];
+		FileHasher::formatSha256(digest.sha256, text);
+		cell->bstrVal = SysAllocStringLen((LPCWSTR)text, SHA256_DIGEST_SIZE * 2);
+		if (!cell->bstrVal)
+		{
+			hr = E_OUTOFMEMORY;
+			break;
+		}
+		cell->vt = VT_BSTR;
+		cell += rowCount;
+		cell->vt = VT_I4;
+		cell->lVal = (long)digest.crc32;
+	}
+	SafeArrayUnaccessData(psa);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	Result->vt = VT_ARRAY | VT_VARIANT;
+	Result->parray = psa;
+	return S_OK;
+}
@@ -0,0 +1,59 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "IDispatchImpl.h"
+#include "MaxsUtil_h.h"
+#include "FileHasher.h"
+
+
+// implements the IFileHasher interface of the FileHasher coclass.
+class FileHasherImpl :
+	public IDispatchWithObjectSafetyImpl<IFileHasher, &IID_IFileHasher, &LIBID_MaxsUtilLib>
+{
+public:
+	FileHasherImpl() : _threads(0), _bytesHashed(0)
+	{
+		_digest.errorCode = ERROR_FILE_NOT_FOUND;
+		_digest.size = 0;
+		_digest.crc32 = 0;
+	}
+
+	// IUnknown methods
+	DELEGATE_IUNKNOWN_TO_IDISPATCHWITHOBJECTSAFETYIMPL(IFileHasher, &IID_IFileHasher, &LIBID_MaxsUtilLib)
+
+	// IFileHasher methods
+	STDMETHOD(HashFile)(/* [in] */ BSTR Path, /* [retval][out] */ BSTR *Sha256);
+	STDMETHOD(HashDirectory)(/* [in] */ BSTR RootPath, /* [in, optional] */ VARIANT *Recursive, /* [retval][out] */ VARIANT *Result);
+	STDMETHOD(get_Crc32)(/* [retval][out] */ long *Value);
+	STDMETHOD(get_Size)(/* [retval][out] */ double *Value);
+	STDMETHOD(get_Threads)(/* [retval][out] */ long *Value);
+	STDMETHOD(put_Threads)(/* [in] */ long NewValue);
+	STDMETHOD(get_BytesHashed)(/* [retval][out] */ double *Value);
+
+protected:
+	FileDigest _digest; // result of the last HashFile.
+	long _threads; // hashing threads. 0 for one per logical processor.
+	uint64_t _bytesHashed; // bytes hashed by the last call.
+
+	static HRESULT digestsToArray(const std::vector<FileDigest> &digests, VARIANT *Result);
+};
@@ -0,0 +1,204 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "MappedFile.h"
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+/* open - maps a file for read access. An existing mapping is closed first. An empty file cannot be mapped, and the method returns ERROR_HANDLE_EOF for it.
+
+Parameters:
+path - [in] pathname of the file to map.
+*/
+uint32_t MappedFile::open(LPCPATHSTR path)
+{
+	close();
+#ifdef _WIN32
+	// FILE_SHARE_DELETE lets a build step replace or delete the file while we hold a view of it.
+	_hfile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (_hfile == INVALID_HANDLE_VALUE)
+		return GetLastError();
+	LARGE_INTEGER cb;
+	if (!GetFileSizeEx(_hfile, &cb))
+	{
+		uint32_t errorCode = GetLastError();
+		close();
+		return errorCode;
+	}
+	if (cb.QuadPart == 0 || (ULONGLONG)cb.QuadPart > (SIZE_T)-1)
+	{
+		close();
+		return ERROR_HANDLE_EOF;
+	}
+	_hmap = CreateFileMappingW(_hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (_hmap)
+		_data = (uint8_t*)MapViewOfFile(_hmap, FILE_MAP_READ, 0, 0, 0);
+	if (!_data)
+	{
+		uint32_t errorCode = GetLastError();
+		close();
+		return errorCode;
+	}
+	_size = (size_t)cb.QuadPart;
+#else//#ifdef _WIN32
+	_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (_fd == -1)
+		return errnoToWin32(errno);
+	struct stat st;
+	if (fstat(_fd, &st) != 0)
+	{
+		uint32_t errorCode = errnoToWin32(errno);
+		close();
+		return errorCode;
+	}
+	if (!S_ISREG(st.st_mode) || st.st_size == 0)
+	{
+		close();
+		return ERROR_HANDLE_EOF;
+	}
+	void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, _fd, 0);
+	if (p == MAP_FAILED)
+	{
+		uint32_t errorCode = errnoToWin32(errno);
+		close();
+		return errorCode;
+	}
+	// the parsers jump from header to header. tell the kernel not to bother reading ahead.
+	madvise(p, (size_t)st.st_size, MADV_RANDOM);
+	_data = (uint8_t*)p;
+	_size = (size_t)st.st_size;
+#endif//#ifdef _WIN32
+	return ERROR_SUCCESS;
+}
+
+/* openForWrite - maps a file for read and write access. Changes made through writableData() go to the file. The file is not shared with writers while it is mapped.
+
+Parameters:
+path - [in] pathname of the file to map.
+size - [in, optional] if larger than the file, the file is extended to this size, and the view covers all of it. The added bytes are zeros.
+*/
+uint32_t MappedFile::openForWrite(LPCPATHSTR path, size_t size)
+{
+	close();
+#ifdef _WIN32
+	_hfile = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (_hfile == INVALID_HANDLE_VALUE)
+		return GetLastError();
+	LARGE_INTEGER cb;
+	if (!GetFileSizeEx(_hfile, &cb))
+	{
+		uint32_t errorCode = GetLastError();
+		close();
+		return errorCode;
+	}
+	if ((ULONGLONG)cb.QuadPart < size)
+		cb.QuadPart = size;
+	if (cb.QuadPart == 0 || (ULONGLONG)cb.QuadPart > (SIZE_T)-1)
+	{
+		close();
+		return ERROR_HANDLE_EOF;
+	}
+	// a mapping object larger than the file extends the file.
+	_hmap = CreateFileMappingW(_hfile, NULL, PAGE_READWRITE, cb.HighPart, cb.LowPart, NULL);
+	if (_hmap)
+		_data = (uint8_t*)MapViewOfFile(_hmap, FILE_MAP_WRITE, 0, 0, 0);
+	if (!_data)
+	{
+		uint32_t errorCode = GetLastError();
+		close();
+		return errorCode;
+	}
+	_size = (size_t)cb.QuadPart;
+#else//#ifdef _WIN32
+	_fd = ::open(path, O_RDWR | O_CLOEXEC);
+	if (_fd == -1)
+		return errnoToWin32(errno);
+	struct stat st;
+	if (fstat(_fd, &st) != 0)
+	{
+		uint32_t errorCode = errnoToWin32(errno);
+		close();
+		return errorCode;
+	}
+	if (!S_ISREG(st.st_mode))
+	{
+		close();
+		return ERROR_HANDLE_EOF;
+	}
+	size_t fileSize = (size_t)st.st_size;
+	if (fileSize < size)
+	{
+		if (ftruncate(_fd, (off_t)size) != 0)
+		{
+			uint32_t errorCode = errno == ENOSPC ? ERROR_WRITE_FAULT : errnoToWin32(errno);
+			close();
+			return errorCode;
+		}
+		fileSize = size;
+	}
+	if (fileSize == 0)
+	{
+		close();
+		return ERROR_HANDLE_EOF;
+	}
+	void *p = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if (p == MAP_FAILED)
+	{
+		uint32_t errorCode = errnoToWin32(errno);
+		close();
+		return errorCode;
+	}
+	_data = (uint8_t*)p;
+	_size = fileSize;
+#endif//#ifdef _WIN32
+	_writable = true;
+	return ERROR_SUCCESS;
+}
+
+/* close - unmaps the view and closes the file. It is safe to call the method on a closed instance. */
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (_data)
+		UnmapViewOfFile(_data);
+	if (_hmap)
+		CloseHandle(_hmap);
+	if (_hfile != INVALID_HANDLE_VALUE)
+		CloseHandle(_hfile);
+	_hmap = NULL;
+	_hfile = INVALID_HANDLE_VALUE;
+#else//#ifdef _WIN32
+	if (_data)
+		munmap(_data, _size);
+	if (_fd != -1)
+		::close(_fd);
+	_fd = -1;
+#endif//#ifdef _WIN32
+	_data = NULL;
+	_size = 0;
+	_writable = false;
+}
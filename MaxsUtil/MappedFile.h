@@ -0,0 +1,64 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+
+
+/* MappedFile maps a file into memory for read access. Windows uses a file mapping object, and Linux uses mmap. Nothing is read until a page of the view is touched. So, a parser following a chain of offsets (e.g., from the PE headers to a resource) pays only for the pages it actually visits rather than for the whole file. A file opened with openForWrite is mapped for read and write access instead, and the pages modified through writableData() are written back to the file.
+*/
+class MappedFile
+{
+public:
+	MappedFile() : _data(NULL), _size(0), _writable(false),
+#ifdef _WIN32
+		_hfile(INVALID_HANDLE_VALUE), _hmap(NULL)
+#else
+		_fd(-1)
+#endif
+	{}
+	~MappedFile() { close(); }
+
+	uint32_t open(LPCPATHSTR path);
+	uint32_t openForWrite(LPCPATHSTR path, size_t size = 0);
+	void close();
+
+	bool isOpen() const { return _data != NULL; }
+	const uint8_t *data() const { return _data; }
+	uint8_t *writableData() const { return _writable ? _data : NULL; }
+	size_t size() const { return _size; }
+
+protected:
+	uint8_t *_data; // start of the mapped view.
+	size_t _size; // byte length of the view (same as the file size).
+	bool _writable; // true if the view was mapped by openForWrite.
+#ifdef _WIN32
+	HANDLE _hfile, _hmap;
+#else
+	int _fd;
+#endif
+
+private:
+	// a mapping cannot be shared by two owners.
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+};
@@ -0,0 +1,764 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "MsZip.h"
+#include <string.h>
+#include <algorithm>
+
+
+// base lengths and extra bits of the length symbols 257 to 285.
+static const uint16_t _lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t _lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+// base distances and extra bits of the distance symbols 0 to 29.
+static const uint16_t _distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t _distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+// order in which the code lengths of the code length alphabet are stored.
+static const uint8_t _codeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+MsZipInflater::MsZipInflater() : _buf(MSZIP_WINDOW_SIZE + MSZIP_BLOCK_SIZE), _historyLen(0), _outLen(0), _src(NULL), _srcEnd(NULL), _bitBuf(0), _bitCount(0), _overrun(0)
+{
+	// the fixed codes of RFC 1951 3.2.6.
+	uint8_t lengths[288];
+	memset(lengths, 8, 144);
+	memset(lengths + 144, 9, 112);
+	memset(lengths + 256, 7, 24);
+	memset(lengths + 280, 8, 8);
+	buildHuffman(_fixedLit, lengths, 288);
+	memset(lengths, 5, 30);
+	buildHuffman(_fixedDist, lengths, 30);
+}
+
+// tops up the bit buffer to at least 56 bits. past the end of the input, zeros are fed, and _overrun counts them.
+void MsZipInflater::fill()
+{
+	while (_bitCount <= 56)
+	{
+		if (_src < _srcEnd)
+			_bitBuf |= (uint64_t)*_src++ << _bitCount;
+		else
+			_overrun++;
+		_bitCount += 8;
+	}
+}
+
+uint32_t MsZipInflater::bits(uint32_t n)
+{
+	if (_bitCount < n)
+		fill();
+	uint32_t v = (uint32_t)(_bitBuf & ((1ULL << n) - 1));
+	_bitBuf >>= n;
+	_bitCount -= n;
+	return v;
+}
+
+/* buildHuffman - makes the decoding tables of a canonical Huffman code from its code lengths. An over-subscribed set of lengths is rejected. An incomplete set is accepted. Input that hits one of its unused codes fails to decode.
+*/
+bool MsZipInflater::buildHuffman(Huffman &h, const uint8_t *lengths, uint32_t n)
+{
+	memset(h.count, 0, sizeof(h.count));
+	for (uint32_t i = 0; i < n; i++)
+		h.count[lengths[i]]++;
+	int left = 1;
+	for (int len = 1; len < 16; len++)
+	{
+		left = (left << 1) - h.count[len];
+		if (left < 0)
+			return false;
+	}
+	uint16_t offs[16];
+	offs[1] = 0;
+	for (int len = 1; len < 15; len++)
+		offs[len + 1] = offs[len] + h.count[len];
+	for (uint32_t i = 0; i < n; i++)
+	{
+		if (lengths[i])
+			h.symbol[offs[lengths[i]]++] = (uint16_t)i;
+	}
+	// codes are sent most significant bit first. so, the table is indexed by the bit-reversed code.
+	memset(h.fast, 0, sizeof(h.fast));
+	uint32_t code = 0, index = 0;
+	for (uint32_t len = 1; len <= MSZIP_FAST_BITS; len++)
+	{
+		for (uint32_t k = 0; k < h.count[len]; k++, code++, index++)
+		{
+			uint32_t rev = 0;
+			for (uint32_t b = 0; b < len; b++)
+				rev |= ((code >> b) & 1) << (len - 1 - b);
+			for (uint32_t j = rev; j < (1U << MSZIP_FAST_BITS); j += 1U << len)
+				h.fast[j] = (uint16_t)(h.symbol[index] << 4 | len);
+		}
+		code <<= 1;
+	}
+	return true;
+}
+
+/* decodeSymbol - decodes a symbol. A code of up to MSZIP_FAST_BITS bits takes a table lookup. A longer one is decoded a bit at a time. Returns -1 for an unused code.
+*/
+int MsZipInflater::decodeSymbol(const Huffman &h)
+{
+	if (_bitCount < 15)
+		fill();
+	uint16_t e = h.fast[_bitBuf & ((1U << MSZIP_FAST_BITS) - 1)];
+	if (e)
+	{
+		_bitBuf >>= e & 15;
+		_bitCount -= e & 15;
+		return e >> 4;
+	}
+	int code = 0, first = 0, index = 0;
+	for (int len = 1; len < 16; len++)
+	{
+		code |= (int)(_bitBuf & 1);
+		_bitBuf >>= 1;
+		_bitCount--;
+		int count = h.count[len];
+		if (code - count < first)
+			return h.symbol[index + (code - first)];
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+// copies a stored block.
+bool MsZipInflater::inflateStored(uint8_t *out, uint32_t &pos, uint32_t outLen)
+{
+	// drop the rest of the current byte, and put the whole bytes left in the bit buffer back to the input.
+	bits(_bitCount & 7);
+	uint32_t putBack = _bitCount / 8;
+	if (putBack < _overrun)
+		return false;
+	_src -= putBack - _overrun;
+	_overrun = 0;
+	_bitBuf = 0;
+	_bitCount = 0;
+	if (_srcEnd - _src < 4)
+		return false;
+	uint32_t len = _src[0] | (_src[1] << 8);
+	uint32_t nlen = _src[2] | (_src[3] << 8);
+	_src += 4;
+	if (len != (~nlen & 0xFFFF) || len > (uint32_t)(_srcEnd - _src) || len > outLen - pos)
+		return false;
+	memcpy(out + pos, _src, len);
+	_src += len;
+	pos += len;
+	return true;
+}
+
+// decodes the literals and matches of a compressed block up to the end-of-block symbol.
+bool MsZipInflater::inflateCodes(const Huffman &lit, const Huffman &dist, uint8_t *out, uint32_t &pos, uint32_t outLen)
+{
+	for (;;)
+	{
+		int sym = decodeSymbol(lit);
+		if (sym < 0 || _overrun > _bitCount / 8)
+			return false;
+		if (sym < 256)
+		{
+			if (pos == outLen)
+				return false;
+			out[pos++] = (uint8_t)sym;
+			continue;
+		}
+		if (sym == 256)
+			return true;
+		sym -= 257;
+		if (sym >= 29)
+			return false;
+		uint32_t len = _lengthBase[sym] + bits(_lengthExtra[sym]);
+		int d = decodeSymbol(dist);
+		if (d < 0 || d >= 30)
+			return false;
+		uint32_t distance = _distBase[d] + bits(_distExtra[d]);
+		if (distance > pos + _historyLen || len > outLen - pos)
+			return false;
+		// out is preceded by the history in _buf. a match may overlap its own output. so, it is copied byte by byte.
+		const uint8_t *from = out + pos - distance;
+		uint8_t *to = out + pos;
+		for (uint32_t i = 0; i < len; i++)
+			to[i] = from[i];
+		pos += len;
+	}
+}
+
+// reads the code length code, and the literal/length and distance codes of a dynamic block.
+bool MsZipInflater::readDynamicTables()
+{
+	uint32_t nlen = bits(5) + 257, ndist = bits(5) + 1, ncode = bits(4) + 4;
+	if (nlen > 286 || ndist > 30)
+		return false;
+	uint8_t lengths[320];
+	memset(lengths, 0, 19);
+	for (uint32_t i = 0; i < ncode; i++)
+		lengths[_codeLengthOrder[i]] = (uint8_t)bits(3);
+	Huffman &lencode = _lit; // borrowed to decode the code lengths.
+	if (!buildHuffman(lencode, lengths, 19))
+		return false;
+	uint32_t i = 0;
+	while (i < nlen + ndist)
+	{
+		int sym = decodeSymbol(lencode);
+		if (sym < 0 || _overrun > _bitCount / 8)
+			return false;
+		if (sym < 16)
+		{
+			lengths[i++] = (uint8_t)sym;
+			continue;
+		}
+		uint8_t len = 0;
+		uint32_t repeat;
+		if (sym == 16)
+		{
+			if (i == 0)
+				return false;
+			len = lengths[i - 1];
+			repeat = 3 + bits(2);
+		}
+		else if (sym == 17)
+			repeat = 3 + bits(3);
+		else
+			repeat = 11 + bits(7);
+		if (i + repeat > nlen + ndist)
+			return false;
+		while (repeat--)
+			lengths[i++] = len;
+	}
+	if (lengths[256] == 0)
+		return false; // no end-of-block code.
+	return buildHuffman(_lit, lengths, nlen) && buildHuffman(_dist, lengths + nlen, ndist);
+}
+
+/* inflateBlock - decompresses the next data block of a folder.
+
+Parameters:
+src - [in] compressed data of the block, starting with the 'CK' signature.
+srcLen - [in] byte length of the compressed data.
+outLen - [in] uncompressed size of the block the cabinet specifies.
+out - [out] receives a pointer to the uncompressed data. It is valid until the next call.
+
+Return value:
+ERROR_INVALID_DATA - the data is corrupt, or it does not decompress to outLen bytes.
+*/
+uint32_t MsZipInflater::inflateBlock(const uint8_t *src, size_t srcLen, uint32_t outLen, const uint8_t **out)
+{
+	if (srcLen < 2 || (src[0] | (src[1] << 8)) != MSZIP_SIGNATURE || outLen > MSZIP_BLOCK_SIZE)
+		return ERROR_INVALID_DATA;
+	if (_outLen)
+	{
+		// the output of the previous block becomes history. keep the last MSZIP_WINDOW_SIZE bytes of it.
+		uint32_t keep = _historyLen + _outLen < MSZIP_WINDOW_SIZE ? _historyLen + _outLen : MSZIP_WINDOW_SIZE;
+		memmove(_buf.data() + MSZIP_WINDOW_SIZE - keep, _buf.data() + MSZIP_WINDOW_SIZE + _outLen - keep, keep);
+		_historyLen = keep;
+		_outLen = 0;
+	}
+	_src = src + 2;
+	_srcEnd = src + srcLen;
+	_bitBuf = 0;
+	_bitCount = 0;
+	_overrun = 0;
+	uint8_t *dest = _buf.data() + MSZIP_WINDOW_SIZE;
+	uint32_t pos = 0;
+	bool ok = true, last = false;
+	while (ok && !last)
+	{
+		last = bits(1) != 0;
+		switch (bits(2))
+		{
+		case 0:
+			ok = inflateStored(dest, pos, outLen);
+			break;
+		case 1:
+			ok = inflateCodes(_fixedLit, _fixedDist, dest, pos, outLen);
+			break;
+		case 2:
+			ok = readDynamicTables() && inflateCodes(_lit, _dist, dest, pos, outLen);
+			break;
+		default:
+			ok = false;
+		}
+		// the zero bytes fed past the end must not have been used.
+		if (_overrun > _bitCount / 8)
+			ok = false;
+	}
+	if (!ok || pos != outLen)
+	{
+		reset();
+		return ERROR_INVALID_DATA;
+	}
+	*out = dest;
+	_outLen = pos;
+	return ERROR_SUCCESS;
+}
+
+// length symbol (0 to 28 for 257 to 285) by match length minus 3.
+static uint8_t _lengthCode[256];
+// distance symbol by distance minus 1 for distances up to 256, and by (distance - 1) >> 7 beyond.
+static uint8_t _distCode[512];
+static bool _initCodeTables()
+{
+	for (uint32_t code = 0; code < 29; code++)
+	{
+		uint32_t n = code == 28 ? 1 : 1U << _lengthExtra[code];
+		for (uint32_t i = 0; i < n; i++)
+			_lengthCode[_lengthBase[code] - 3 + i] = (uint8_t)code;
+	}
+	_lengthCode[255] = 28; // a length of 258 has a symbol of its own.
+	for (uint32_t code = 0; code < 30; code++)
+	{
+		for (uint32_t d = _distBase[code] - 1; d < (uint32_t)_distBase[code] - 1 + (1U << _distExtra[code]); d++)
+		{
+			if (d < 256)
+				_distCode[d] = (uint8_t)code;
+			else
+				_distCode[256 + (d >> 7)] = (uint8_t)code;
+		}
+	}
+	return true;
+}
+static const bool _codeTablesReady = _initCodeTables();
+
+static inline uint32_t _distSymbol(uint32_t distance)
+{
+	return distance <= 256 ? _distCode[distance - 1] : _distCode[256 + ((distance - 1) >> 7)];
+}
+
+// reverses the low n bits of a code. DEFLATE sends Huffman codes from the most significant bit.
+static inline uint16_t _reverseBits(uint32_t code, uint32_t n)
+{
+	uint32_t r = 0;
+	for (uint32_t i = 0; i < n; i++, code >>= 1)
+		r = (r << 1) | (code & 1);
+	return (uint16_t)r;
+}
+
+static inline uint32_t _hash3(const uint8_t *p)
+{
+	return ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) & ((1U << MSZIP_HASH_BITS) - 1);
+}
+
+MsZipDeflater::MsZipDeflater() : _head(1U << MSZIP_HASH_BITS), _prev(MSZIP_WINDOW_SIZE + MSZIP_BLOCK_SIZE), _out(NULL), _bitBuf(0), _bitCount(0)
+{
+	(void)_codeTablesReady;
+}
+
+void MsZipDeflater::putBits(uint32_t value, uint32_t n)
+{
+	_bitBuf |= (uint64_t)value << _bitCount;
+	_bitCount += n;
+	while (_bitCount >= 8)
+	{
+		_out->push_back((uint8_t)_bitBuf);
+		_bitBuf >>= 8;
+		_bitCount -= 8;
+	}
+}
+
+// pads the output to a byte boundary.
+void MsZipDeflater::flushBits()
+{
+	if (_bitCount)
+		_out->push_back((uint8_t)_bitBuf);
+	_bitBuf = 0;
+	_bitCount = 0;
+}
+
+/* buildLengths - computes the code lengths of a length-limited Huffman code for a set of symbol frequencies. A Huffman tree is built first. If it is deeper than maxBits, the deepest codes are moved up and the shortest ones down until the lengths fit and still make a complete code. The shortest lengths go to the most frequent symbols.
+*/
+void MsZipDeflater::buildLengths(const uint32_t *freq, uint32_t n, uint32_t maxBits, uint8_t *lengths)
+{
+	memset(lengths, 0, n);
+	// leaves, sorted by frequency.
+	uint32_t order[288], count = 0;
+	for (uint32_t i = 0; i < n; i++)
+	{
+		if (freq[i])
+			order[count++] = i;
+	}
+	if (count == 0)
+		return;
+	if (count == 1)
+	{
+		lengths[order[0]] = 1;
+		return;
+	}
+	std::sort(order, order + count, [freq](uint32_t a, uint32_t b) { return freq[a] < freq[b] || (freq[a] == freq[b] && a < b); });
+	// two-queue Huffman construction. the leaves are in order. so are the internal nodes, as they are made.
+	uint64_t weight[2 * 288];
+	uint32_t parent[2 * 288];
+	for (uint32_t i = 0; i < count; i++)
+		weight[i] = freq[order[i]];
+	uint32_t leaf = 0, node = count, next = count;
+	for (uint32_t k = 0; k < count - 1; k++)
+	{
+		uint32_t pick[2];
+		for (int j = 0; j < 2; j++)
+		{
+			if (leaf < count && (node >= next || weight[leaf] <= weight[node]))
+				pick[j] = leaf++;
+			else
+				pick[j] = node++;
+		}
+		weight[next] = weight[pick[0]] + weight[pick[1]];
+		parent[pick[0]] = parent[pick[1]] = next;
+		next++;
+	}
+	// depths. the root is the last node made.
+	uint32_t depth[2 * 288];
+	depth[next - 1] = 0;
+	uint32_t bitLengthCount[64] = { 0 };
+	for (uint32_t i = next - 1; i-- > 0;)
+	{
+		depth[i] = depth[parent[i]] + 1;
+		if (i < count)
+			bitLengthCount[depth[i] < 63 ? depth[i] : 63]++;
+	}
+	// fold the codes longer than maxBits into maxBits, then restore the Kraft sum by splitting shorter codes.
+	for (uint32_t len = maxBits + 1; len < 64; len++)
+	{
+		bitLengthCount[maxBits] += bitLengthCount[len];
+		bitLengthCount[len] = 0;
+	}
+	uint64_t total = 0;
+	for (uint32_t len = maxBits; len > 0; len--)
+		total += (uint64_t)bitLengthCount[len] << (maxBits - len);
+	while (total > (1ULL << maxBits))
+	{
+		bitLengthCount[maxBits]--;
+		for (uint32_t len = maxBits - 1; len > 0; len--)
+		{
+			if (bitLengthCount[len])
+			{
+				bitLengthCount[len]--;
+				bitLengthCount[len + 1] += 2;
+				break;
+			}
+		}
+		total--;
+	}
+	// the most frequent symbols get the shortest codes.
+	uint32_t k = count;
+	for (uint32_t len = 1; len <= maxBits; len++)
+	{
+		for (uint32_t i = 0; i < bitLengthCount[len]; i++)
+			lengths[order[--k]] = (uint8_t)len;
+	}
+}
+
+/* buildCodes - assigns the canonical codes of RFC 1951 3.2.2 to a set of code lengths. The codes are returned bit-reversed, ready to be written least significant bit first.
+*/
+void MsZipDeflater::buildCodes(const uint8_t *lengths, uint32_t n, uint16_t *codes)
+{
+	uint32_t bitLengthCount[16] = { 0 }, nextCode[16];
+	for (uint32_t i = 0; i < n; i++)
+		bitLengthCount[lengths[i]]++;
+	bitLengthCount[0] = 0;
+	uint32_t code = 0;
+	for (uint32_t len = 1; len < 16; len++)
+	{
+		code = (code + bitLengthCount[len - 1]) << 1;
+		nextCode[len] = code;
+	}
+	for (uint32_t i = 0; i < n; i++)
+		codes[i] = lengths[i] ? _reverseBits(nextCode[lengths[i]]++, lengths[i]) : 0;
+}
+
+/* findMatches - turns a range of the input into literals and matches in _tokens, and counts the symbols. The strings of the history before start are in the hash chains already.
+*/
+void MsZipDeflater::findMatches(const uint8_t *base, uint32_t start, uint32_t end)
+{
+	memset(_litFreq, 0, sizeof(_litFreq));
+	memset(_distFreq, 0, sizeof(_distFreq));
+	_tokens.clear();
+	uint32_t pos = start;
+	uint32_t prevLen = 0, prevDist = 0; // a match found at pos - 1 that waits to see if pos has a longer one.
+	while (pos < end)
+	{
+		uint32_t bestLen = 0, bestDist = 0;
+		if (pos + 3 <= end)
+		{
+			uint32_t h = _hash3(base + pos);
+			uint32_t limit = end - pos < 258 ? end - pos : 258;
+			uint32_t candidate = _head[h];
+			for (int chain = MSZIP_MAX_CHAIN; candidate && chain > 0; chain--)
+			{
+				uint32_t c = candidate - 1;
+				if (pos - c > MSZIP_WINDOW_SIZE)
+					break;
+				if (base[c + bestLen] == base[pos + bestLen] && base[c] == base[pos])
+				{
+					uint32_t len = 0;
+					while (len < limit && base[c + len] == base[pos + len])
+						len++;
+					if (len > bestLen)
+					{
+						bestLen = len;
+						bestDist = pos - c;
+						if (len == limit)
+							break;
+					}
+				}
+				candidate = _prev[c];
+			}
+			_prev[pos] = _head[h];
+			_head[h] = pos + 1;
+			if (bestLen < 3)
+				bestLen = 0;
+		}
+		if (prevLen)
+		{
+			if (bestLen > prevLen)
+			{
+				// the match here is longer. the byte before goes out as a literal.
+				_tokens.push_back(base[pos - 1]);
+				_litFreq[base[pos - 1]]++;
+				prevLen = bestLen;
+				prevDist = bestDist;
+				pos++;
+				continue;
+			}
+			// take the match of the byte before. it covers this byte and prevLen - 2 more.
+			_tokens.push_back(prevDist << 8 | (prevLen - 3));
+			_litFreq[257 + _lengthCode[prevLen - 3]]++;
+			_distFreq[_distSymbol(prevDist)]++;
+			uint32_t matchEnd = pos - 1 + prevLen;
+			for (pos++; pos < matchEnd; pos++)
+			{
+				if (pos + 3 <= end)
+				{
+					uint32_t h = _hash3(base + pos);
+					_prev[pos] = _head[h];
+					_head[h] = pos + 1;
+				}
+			}
+			prevLen = 0;
+			continue;
+		}
+		if (bestLen >= MSZIP_LAZY_LENGTH)
+		{
+			_tokens.push_back(bestDist << 8 | (bestLen - 3));
+			_litFreq[257 + _lengthCode[bestLen - 3]]++;
+			_distFreq[_distSymbol(bestDist)]++;
+			uint32_t matchEnd = pos + bestLen;
+			for (pos++; pos < matchEnd; pos++)
+			{
+				if (pos + 3 <= end)
+				{
+					uint32_t h = _hash3(base + pos);
+					_prev[pos] = _head[h];
+					_head[h] = pos + 1;
+				}
+			}
+			continue;
+		}
+		if (bestLen)
+		{
+			prevLen = bestLen;
+			prevDist = bestDist;
+			pos++;
+			continue;
+		}
+		_tokens.push_back(base[pos]);
+		_litFreq[base[pos]]++;
+		pos++;
+	}
+	// a waiting match is at least 3 bytes long. so, the loop cannot end with one.
+	_litFreq[256] = 1;
+}
+
+// writes the tokens with a pair of codes, and the end-of-block code.
+void MsZipDeflater::writeCodes(const uint16_t *litCodes, const uint8_t *litLengths, const uint16_t *distCodes, const uint8_t *distLengths)
+{
+	for (size_t i = 0; i < _tokens.size(); i++)
+	{
+		uint32_t t = _tokens[i];
+		if (t < 256)
+		{
+			putBits(litCodes[t], litLengths[t]);
+			continue;
+		}
+		uint32_t len = t & 0xFF, dist = t >> 8;
+		uint32_t lc = _lengthCode[len];
+		putBits(litCodes[257 + lc], litLengths[257 + lc]);
+		putBits(len + 3 - _lengthBase[lc], _lengthExtra[lc]);
+		uint32_t dc = _distSymbol(dist);
+		putBits(distCodes[dc], distLengths[dc]);
+		putBits(dist - _distBase[dc], _distExtra[dc]);
+	}
+	putBits(litCodes[256], litLengths[256]);
+}
+
+/* deflateBlock - compresses a data block, and appends it to a buffer with the 'CK' signature in front.
+
+Parameters:
+src - [in] data of the block.
+srcLen - [in] byte length of the data. MSZIP_BLOCK_SIZE at most.
+historyLen - [in] number of bytes before src that the block can refer to. It is 0 for the first block of a folder and MSZIP_WINDOW_SIZE for the others.
+out - [in, out] receives the compressed block. It is appended to what the buffer holds.
+*/
+void MsZipDeflater::deflateBlock(const uint8_t *src, uint32_t srcLen, uint32_t historyLen, std::vector<uint8_t> &out)
+{
+	const uint8_t *base = src - historyLen;
+	uint32_t end = historyLen + srcLen;
+	std::fill(_head.begin(), _head.end(), 0);
+	for (uint32_t pos = 0; pos < historyLen && pos + 3 <= end; pos++)
+	{
+		uint32_t h = _hash3(base + pos);
+		_prev[pos] = _head[h];
+		_head[h] = pos + 1;
+	}
+	findMatches(base, historyLen, end);
+
+	// a decoder wants two distance codes at least.
+	uint32_t used = 0;
+	for (int i = 0; i < 30; i++)
+		used += _distFreq[i] != 0;
+	for (int i = 0; used < 2; i++)
+	{
+		if (!_distFreq[i])
+		{
+			_distFreq[i] = 1;
+			used++;
+		}
+	}
+	uint8_t litLengths[288], distLengths[30];
+	buildLengths(_litFreq, 286, 15, litLengths);
+	buildLengths(_distFreq, 30, 15, distLengths);
+	litLengths[286] = litLengths[287] = 0;
+	uint32_t litCount = 286, distCount = 30;
+	while (litCount > 257 && !litLengths[litCount - 1])
+		litCount--;
+	while (distCount > 1 && !distLengths[distCount - 1])
+		distCount--;
+
+	// run-length code the two sets of lengths with the symbols 16 (repeat the last length), 17 and 18 (repeat a zero).
+	uint8_t all[286 + 30];
+	memcpy(all, litLengths, litCount);
+	memcpy(all + litCount, distLengths, distCount);
+	uint32_t allCount = litCount + distCount;
+	uint16_t runs[286 + 30]; // a symbol in the low 5 bits and its extra bits above.
+	uint32_t runCount = 0, clFreq[19] = { 0 };
+	for (uint32_t i = 0; i < allCount;)
+	{
+		uint32_t len = all[i], run = 1;
+		while (i + run < allCount && all[i + run] == len)
+			run++;
+		if (len == 0 && run >= 3)
+		{
+			uint32_t n = run > 138 ? 138 : run;
+			runs[runCount++] = (uint16_t)(n >= 11 ? 18 | (n - 11) << 5 : 17 | (n - 3) << 5);
+			clFreq[n >= 11 ? 18 : 17]++;
+			i += n;
+			continue;
+		}
+		runs[runCount++] = (uint16_t)len;
+		clFreq[len]++;
+		i++;
+		for (run--; run >= 3;)
+		{
+			uint32_t n = run > 6 ? 6 : run;
+			runs[runCount++] = (uint16_t)(16 | (n - 3) << 5);
+			clFreq[16]++;
+			i += n;
+			run -= n;
+		}
+	}
+	uint8_t clLengths[19];
+	uint16_t clCodes[19];
+	buildLengths(clFreq, 19, 7, clLengths);
+	buildCodes(clLengths, 19, clCodes);
+	uint32_t clCount = 19;
+	while (clCount > 4 && !clLengths[_codeLengthOrder[clCount - 1]])
+		clCount--;
+
+	// the size of each kind of block in bits.
+	uint64_t dynamicBits = 3 + 5 + 5 + 4 + clCount * 3, fixedBits = 3;
+	for (uint32_t i = 0; i < runCount; i++)
+	{
+		uint32_t sym = runs[i] & 31;
+		dynamicBits += clLengths[sym] + (sym == 16 ? 2 : sym == 17 ? 3 : sym == 18 ? 7 : 0);
+	}
+	for (uint32_t i = 0; i < 286; i++)
+	{
+		uint32_t extra = i >= 257 ? _lengthExtra[i - 257] : 0;
+		uint32_t fixedLen = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+		dynamicBits += (uint64_t)_litFreq[i] * (litLengths[i] + extra);
+		fixedBits += (uint64_t)_litFreq[i] * (fixedLen + extra);
+	}
+	for (uint32_t i = 0; i < 30; i++)
+	{
+		dynamicBits += (uint64_t)_distFreq[i] * (distLengths[i] + _distExtra[i]);
+		fixedBits += (uint64_t)_distFreq[i] * (5 + _distExtra[i]);
+	}
+	uint64_t storedBits = 3 + 5 + 32 + (uint64_t)srcLen * 8;
+
+	_out = &out;
+	_bitBuf = 0;
+	_bitCount = 0;
+	out.push_back((uint8_t)MSZIP_SIGNATURE);
+	out.push_back((uint8_t)(MSZIP_SIGNATURE >> 8));
+	if (storedBits <= dynamicBits && storedBits <= fixedBits)
+	{
+		putBits(1, 3); // the last block, stored.
+		flushBits();
+		out.push_back((uint8_t)srcLen);
+		out.push_back((uint8_t)(srcLen >> 8));
+		out.push_back((uint8_t)~srcLen);
+		out.push_back((uint8_t)(~srcLen >> 8));
+		out.insert(out.end(), src, src + srcLen);
+		return;
+	}
+	uint16_t litCodes[288], distCodes[30];
+	if (fixedBits <= dynamicBits)
+	{
+		uint8_t fixedLit[288], fixedDist[30];
+		memset(fixedLit, 8, 144);
+		memset(fixedLit + 144, 9, 112);
+		memset(fixedLit + 256, 7, 24);
+		memset(fixedLit + 280, 8, 8);
+		memset(fixedDist, 5, 30);
+		buildCodes(fixedLit, 288, litCodes);
+		buildCodes(fixedDist, 30, distCodes);
+		putBits(1 | 1 << 1, 3); // the last block, fixed codes.
+		writeCodes(litCodes, fixedLit, distCodes, fixedDist);
+		flushBits();
+		return;
+	}
+	buildCodes(litLengths, 286, litCodes);
+	buildCodes(distLengths, 30, distCodes);
+	putBits(1 | 2 << 1, 3); // the last block, dynamic codes.
+	putBits(litCount - 257, 5);
+	putBits(distCount - 1, 5);
+	putBits(clCount - 4, 4);
+	for (uint32_t i = 0; i < clCount; i++)
+		putBits(clLengths[_codeLengthOrder[i]], 3);
+	for (uint32_t i = 0; i < runCount; i++)
+	{
+		uint32_t sym = runs[i] & 31;
+		putBits(clCodes[sym], clLengths[sym]);
+		if (sym >= 16)
+			putBits(runs[i] >> 5, sym == 16 ? 2 : sym == 17 ? 3 : 7);
+	}
+	writeCodes(litCodes, litLengths, distCodes, distLengths);
+	flushBits();
+}
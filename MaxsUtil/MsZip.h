@@ -0,0 +1,107 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include <vector>
+
+
+// an MSZIP data block starts with these two bytes ('CK').
+#define MSZIP_SIGNATURE 0x4B43
+// uncompressed bytes in a data block, at most.
+#define MSZIP_BLOCK_SIZE 0x8000
+// how far back a match can reach. a match can reach into the blocks before the current one.
+#define MSZIP_WINDOW_SIZE 0x8000
+// bits of a Huffman code resolved with one table lookup. a longer code is decoded bit by bit.
+#define MSZIP_FAST_BITS 10
+
+/* MsZipInflater decompresses the MSZIP data blocks of a cabinet folder. A block is a 'CK' signature followed by DEFLATE data (RFC 1951) that decompresses to at most 32 KB. The blocks of a folder make one stream. A match in a block can copy from the blocks before it. So, the blocks must be inflated in order from the start of the folder, and the inflater keeps the last 32 KB of output from one block to the next. Call reset() at the start of a folder.
+*/
+class MsZipInflater
+{
+public:
+	MsZipInflater();
+
+	void reset() { _historyLen = _outLen = 0; }
+	uint32_t inflateBlock(const uint8_t *src, size_t srcLen, uint32_t outLen, const uint8_t **out);
+
+protected:
+	struct Huffman
+	{
+		uint16_t fast[1 << MSZIP_FAST_BITS]; // symbol << 4 | code length, by the next MSZIP_FAST_BITS bits of input. 0 for a longer code.
+		uint16_t count[16]; // number of codes of each length.
+		uint16_t symbol[288]; // symbols in code order.
+	};
+
+	std::vector<uint8_t> _buf; // the history (MSZIP_WINDOW_SIZE bytes) followed by the output of the current block.
+	uint32_t _historyLen; // bytes of history before _buf[MSZIP_WINDOW_SIZE].
+	uint32_t _outLen; // bytes of output of the last block at _buf[MSZIP_WINDOW_SIZE]. they are added to the history when the next block is inflated.
+	const uint8_t *_src, *_srcEnd;
+	uint64_t _bitBuf;
+	uint32_t _bitCount;
+	uint32_t _overrun; // zero bytes fed to _bitBuf past the end of the input.
+	Huffman _lit, _dist;
+	Huffman _fixedLit, _fixedDist;
+
+	void fill();
+	uint32_t bits(uint32_t n);
+	bool buildHuffman(Huffman &h, const uint8_t *lengths, uint32_t n);
+	int decodeSymbol(const Huffman &h);
+	bool inflateCodes(const Huffman &lit, const Huffman &dist, uint8_t *out, uint32_t &pos, uint32_t outLen);
+	bool inflateStored(uint8_t *out, uint32_t &pos, uint32_t outLen);
+	bool readDynamicTables();
+};
+
+// candidates a match search looks at, at most. more finds longer matches and takes longer.
+#define MSZIP_MAX_CHAIN 64
+// a match this long is taken without looking for a longer one at the next byte.
+#define MSZIP_LAZY_LENGTH 32
+#define MSZIP_HASH_BITS 15
+
+/* MsZipDeflater compresses data blocks for an MSZIP folder. A block may refer to the 32 KB of data before it. The data is all known before compression starts, so the history of a block is just the input that precedes it, not the output of a compressor that has run through it. So, the blocks of a folder can be compressed independently and in parallel, and still compress as well as a sequential compressor does.
+
+A block is compressed by LZ77 matching on hash chains with one step of lazy evaluation, followed by Huffman coding. It is written as a single DEFLATE block with the dynamic codes, the fixed codes or no compression, whichever is the smallest.
+*/
+class MsZipDeflater
+{
+public:
+	MsZipDeflater();
+
+	void deflateBlock(const uint8_t *src, uint32_t srcLen, uint32_t historyLen, std::vector<uint8_t> &out);
+
+protected:
+	std::vector<uint32_t> _head; // 1 + position of the latest string of each hash. 0 for none.
+	std::vector<uint32_t> _prev; // 1 + position of the previous string of the same hash, by position.
+	std::vector<uint32_t> _tokens; // a literal byte, or a match as distance << 8 | (length - 3).
+	uint32_t _litFreq[288], _distFreq[30];
+	std::vector<uint8_t> *_out;
+	uint64_t _bitBuf;
+	uint32_t _bitCount;
+
+	void findMatches(const uint8_t *base, uint32_t start, uint32_t end);
+	void putBits(uint32_t value, uint32_t n);
+	void flushBits();
+	void writeCodes(const uint16_t *litCodes, const uint8_t *litLengths, const uint16_t *distCodes, const uint8_t *distLengths);
+
+	static void buildLengths(const uint32_t *freq, uint32_t n, uint32_t maxBits, uint8_t *lengths);
+	static void buildCodes(const uint8_t *lengths, uint32_t n, uint16_t *codes);
+};
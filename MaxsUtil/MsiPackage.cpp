@@ -0,0 +1,338 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "MsiPackage.h"
+#include "VersionWriter.h"
+#include <string.h>
+#include <stdio.h>
+
+
+// Windows-1252 characters 0x80 to 0x9F. the rest of the codepage is the same as Latin-1.
+static const UTF16CHAR _cp1252High[32] = {
+	0x20AC, 0xFFFD, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021, 0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0xFFFD, 0x017D, 0xFFFD,
+	0xFFFD, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014, 0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0xFFFD, 0x017E, 0x0178,
+};
+
+/* _decodeString - converts a string of the pool to UTF-16. Windows converts from any codepage. Elsewhere, UTF-8 (65001) is decoded, and any other codepage is read as Windows-1252, which is what most packages are authored in.
+*/
+static void _decodeString(uint32_t codepage, const char *s, size_t len, std::u16string &out)
+{
+	out.clear();
+	if (!len)
+		return;
+#ifdef _WIN32
+	int n = MultiByteToWideChar(codepage, 0, s, (int)len, NULL, 0);
+	if (n > 0)
+	{
+		out.resize(n);
+		MultiByteToWideChar(codepage, 0, s, (int)len, (LPWSTR)&out[0], n);
+		return;
+	}
+#endif
+	if (codepage == 65001)
+	{
+		appendUtf16(out, s, len);
+		return;
+	}
+	for (size_t i = 0; i < len; i++)
+	{
+		uint8_t c = (uint8_t)s[i];
+		out.push_back(c >= 0x80 && c < 0xA0 ? _cp1252High[c - 0x80] : (UTF16CHAR)c);
+	}
+}
+
+// the 64 characters a stream name can pack two to a character.
+static int _mimeIndex(UTF16CHAR c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A' + 10;
+	if (c >= 'a' && c <= 'z')
+		return c - 'a' + 36;
+	if (c == '.')
+		return 62;
+	if (c == '_')
+		return 63;
+	return -1;
+}
+
+/* encodeStreamName - converts a table or stream name to the name of its stream in the package. Two characters out of [0-9A-Za-z._] are packed into one character from 0x3800 up. One such character with no partner becomes a character from 0x4800 up. Other characters are kept. A table name starts with MSI_TABLE_NAME_PREFIX.
+*/
+void MsiPackage::encodeStreamName(LPCUTF16STR name, size_t nameLen, bool table, std::u16string &out)
+{
+	out.clear();
+	if (table)
+		out.push_back(MSI_TABLE_NAME_PREFIX);
+	for (size_t i = 0; i < nameLen; i++)
+	{
+		int c1 = _mimeIndex(name[i]);
+		if (c1 < 0)
+		{
+			out.push_back(name[i]);
+			continue;
+		}
+		int c2 = i + 1 < nameLen ? _mimeIndex(name[i + 1]) : -1;
+		if (c2 < 0)
+			out.push_back((UTF16CHAR)(0x4800 + c1));
+		else
+		{
+			out.push_back((UTF16CHAR)(0x3800 + c1 + (c2 << 6)));
+			i++;
+		}
+	}
+}
+
+uint32_t MsiPackage::openStream(const char *name, bool table, CompoundFileStream &stream)
+{
+	std::u16string plain, encoded;
+	while (*name)
+		plain.push_back((UTF16CHAR)*name++);
+	encodeStreamName(plain.c_str(), plain.size(), table, encoded);
+	CompoundFileEntry entry;
+	uint32_t errorCode = _cf.findEntry(_cf.root(), encoded.c_str(), encoded.size(), entry);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	return _cf.openStream(entry, stream);
+}
+
+/* open - opens a package, and reads the lengths of its strings and the rows of its Property table.
+
+Return value:
+ERROR_BAD_FORMAT - the file is not a compound file, or its string pool or Property table is malformed.
+ERROR_FILE_NOT_FOUND - the compound file has no string pool or no Property table. It is not an installer database.
+*/
+uint32_t MsiPackage::open(LPCPATHSTR path)
+{
+	close();
+	uint32_t errorCode = _cf.open(path);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	CompoundFileStream pool, property;
+	errorCode = openStream("_StringPool", true, pool);
+	if (errorCode == ERROR_SUCCESS)
+		errorCode = openStream("_StringData", true, _stringData);
+	if (errorCode == ERROR_SUCCESS)
+		errorCode = openStream("Property", true, property);
+	if (errorCode != ERROR_SUCCESS)
+	{
+		close();
+		return errorCode;
+	}
+	// 4 bytes per entry. the first entry holds the codepage. the others hold the length and the reference count of string 1, 2 and so on.
+	if (pool.size < 4 || pool.size % 4 || pool.size > 0x10000000 || property.size > 0x10000000)
+	{
+		close();
+		return ERROR_BAD_FORMAT;
+	}
+	std::vector<uint8_t> buf((size_t)pool.size);
+	errorCode = _cf.readStream(pool, 0, buf.data(), (uint32_t)buf.size());
+	if (errorCode != ERROR_SUCCESS)
+	{
+		close();
+		return errorCode;
+	}
+	uint32_t header = buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+	_codepage = header & ~MSI_STRINGPOOL_LONGREFS;
+	_refSize = (header & MSI_STRINGPOOL_LONGREFS) ? 3 : 2;
+	size_t count = buf.size() / 4;
+	_stringOffset.assign(1, 0);
+	_stringLength.assign(1, 0);
+	uint64_t offset = 0;
+	for (size_t i = 1; i < count; i++)
+	{
+		const uint8_t *e = &buf[i * 4];
+		uint32_t len = e[0] | (e[1] << 8);
+		uint32_t refs = e[2] | (e[3] << 8);
+		// a string longer than 64K takes two entries. the first is zero with a nonzero count. the second holds the low and high words of the length.
+		if (len == 0 && refs != 0 && i + 1 < count)
+		{
+			e += 4;
+			len = (e[0] | (e[1] << 8)) | ((uint32_t)(e[2] | (e[3] << 8)) << 16);
+			i++;
+		}
+		_stringOffset.push_back(offset);
+		_stringLength.push_back(len);
+		offset += len;
+	}
+	if (offset > _stringData.size)
+	{
+		close();
+		return ERROR_BAD_FORMAT;
+	}
+
+	// the Property table has two string columns. its stream holds the first column of all rows, then the second.
+	size_t rowSize = _refSize * 2;
+	if (property.size % rowSize)
+	{
+		close();
+		return ERROR_BAD_FORMAT;
+	}
+	size_t rowCount = (size_t)(property.size / rowSize);
+	buf.resize((size_t)property.size);
+	if (!buf.empty())
+		errorCode = _cf.readStream(property, 0, buf.data(), (uint32_t)buf.size());
+	if (errorCode != ERROR_SUCCESS)
+	{
+		close();
+		return errorCode;
+	}
+	_keys.resize(rowCount);
+	_values.resize(rowCount);
+	for (size_t i = 0; i < rowCount; i++)
+	{
+		const uint8_t *k = &buf[i * _refSize], *v = &buf[(rowCount + i) * _refSize];
+		_keys[i] = k[0] | (k[1] << 8) | (_refSize == 3 ? k[2] << 16 : 0);
+		_values[i] = v[0] | (v[1] << 8) | (_refSize == 3 ? v[2] << 16 : 0);
+	}
+	return ERROR_SUCCESS;
+}
+
+/* close - closes the package. */
+void MsiPackage::close()
+{
+	_cf.close();
+	_stringData.chain.clear();
+	_stringData.size = 0;
+	_stringOffset.clear();
+	_stringLength.clear();
+	_keys.clear();
+	_values.clear();
+}
+
+/* readString - reads a string of the pool by its id. Id 0 is the null string, which is empty. */
+uint32_t MsiPackage::readString(uint32_t id, std::u16string &text)
+{
+	text.clear();
+	if (id >= _stringLength.size())
+		return ERROR_BAD_FORMAT;
+	if (_stringLength[id] == 0)
+		return ERROR_SUCCESS;
+	std::vector<char> buf(_stringLength[id]);
+	uint32_t errorCode = _cf.readStream(_stringData, _stringOffset[id], buf.data(), (uint32_t)buf.size());
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	_decodeString(_codepage, buf.data(), buf.size(), text);
+	return ERROR_SUCCESS;
+}
+
+/* getProperty - looks up a property of the package.
+
+Parameters:
+name - [in] name of the property, e.g., ProductVersion. Property names are ASCII, and case-sensitive.
+nameLen - [in] number of characters in name.
+value - [out] receives the value.
+
+Return value:
+ERROR_RESOURCE_DATA_NOT_FOUND - the package does not define the property.
+*/
+uint32_t MsiPackage::getProperty(LPCUTF16STR name, size_t nameLen, std::u16string &value)
+{
+	std::u16string key;
+	for (size_t i = 0; i < _keys.size(); i++)
+	{
+		// a name of a different length cannot match. its bytes are not read.
+		if (_keys[i] >= _stringLength.size() || _stringLength[_keys[i]] != nameLen)
+			continue;
+		uint32_t errorCode = readString(_keys[i], key);
+		if (errorCode != ERROR_SUCCESS)
+			return errorCode;
+		if (key.size() == nameLen && memcmp(key.data(), name, nameLen * sizeof(UTF16CHAR)) == 0)
+			return readString(_values[i], value);
+	}
+	return ERROR_RESOURCE_DATA_NOT_FOUND;
+}
+
+static void _addString(VersionNode &table, const char16_t *key, const std::u16string &value)
+{
+	VersionNode node;
+	node.key = key;
+	node.type = VERSION_BLOCK_TYPE_TEXT;
+	const uint8_t *p = (const uint8_t*)value.c_str();
+	node.value.assign(p, p + (value.size() + 1) * sizeof(UTF16CHAR));
+	table.children.push_back(node);
+}
+
+/* buildVersionBlock - makes a VS_VERSIONINFO block of the product properties. ProductVersion, parsed as a version number, becomes both the file and the product version of the fixed-length part. The string table has ProductName, ProductVersion, Manufacturer (also as CompanyName), ProductCode and UpgradeCode, as far as the package defines them. Its translation is ProductLanguage with the Unicode codepage 1200.
+
+Parameters:
+block - [out] receives the block.
+*/
+uint32_t MsiPackage::buildVersionBlock(std::vector<uint8_t> &block)
+{
+	static const char16_t *const names[] = { u"ProductName", u"ProductVersion", u"Manufacturer", u"ProductCode", u"UpgradeCode" };
+	VersionNode table;
+	std::u16string value, version, language;
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+	{
+		uint32_t errorCode = getProperty(names[i], utf16len(names[i]), value);
+		if (errorCode == ERROR_RESOURCE_DATA_NOT_FOUND)
+			continue;
+		if (errorCode != ERROR_SUCCESS)
+			return errorCode;
+		_addString(table, names[i], value);
+		if (i == 1)
+			version = value;
+		else if (i == 2)
+			_addString(table, u"CompanyName", value);
+	}
+	uint32_t langId = 0;
+	if (getProperty(u"ProductLanguage", 15, language) == ERROR_SUCCESS)
+	{
+		for (size_t i = 0; i < language.size() && language[i] >= '0' && language[i] <= '9' && langId <= 0xFFFF; i++)
+			langId = langId * 10 + (language[i] - '0');
+		if (langId > 0xFFFF)
+			langId = 0;
+	}
+	char hex[9];
+	snprintf(hex, sizeof(hex), "%04x04b0", langId);
+	for (int i = 0; i < 8; i++)
+		table.key.push_back((UTF16CHAR)hex[i]);
+	table.type = VERSION_BLOCK_TYPE_TEXT;
+
+	uint64_t key = 0;
+	parseVersionKey(version.c_str(), version.size(), &key);
+	VERSION_FIXEDFILEINFO ffi;
+	memset(&ffi, 0, sizeof(ffi));
+	ffi.dwSignature = VERSION_FIXEDFILEINFO_SIGNATURE;
+	ffi.dwStrucVersion = 0x10000;
+	ffi.dwFileVersionMS = ffi.dwProductVersionMS = (uint32_t)(key >> 32);
+	ffi.dwFileVersionLS = ffi.dwProductVersionLS = (uint32_t)key;
+	ffi.dwFileFlagsMask = 0x3F;
+
+	VersionNode root, stringFileInfo, varFileInfo, translation;
+	root.key = u"VS_VERSION_INFO";
+	root.value.assign((const uint8_t*)&ffi, (const uint8_t*)(&ffi + 1));
+	stringFileInfo.key = u"StringFileInfo";
+	stringFileInfo.type = VERSION_BLOCK_TYPE_TEXT;
+	stringFileInfo.children.push_back(table);
+	varFileInfo.key = u"VarFileInfo";
+	varFileInfo.type = VERSION_BLOCK_TYPE_TEXT;
+	translation.key = u"Translation";
+	uint8_t langCp[4] = { (uint8_t)langId, (uint8_t)(langId >> 8), 0xB0, 0x04 };
+	translation.value.assign(langCp, langCp + 4);
+	varFileInfo.children.push_back(translation);
+	root.children.push_back(stringFileInfo);
+	root.children.push_back(varFileInfo);
+	block.clear();
+	return VersionWriter::serialize(root, block) ? ERROR_SUCCESS : ERROR_INVALID_DATA;
+}
@@ -0,0 +1,62 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "CompoundFile.h"
+#include <vector>
+
+
+// a string pool flagged with this bit in the high word of its codepage uses 3-byte string references in the tables instead of 2-byte ones.
+#define MSI_STRINGPOOL_LONGREFS 0x80000000
+// first character of the stream name of a table.
+#define MSI_TABLE_NAME_PREFIX 0x4840
+
+/* MsiPackage reads properties of a Windows Installer package (.msi) without the Windows Installer API. A package is a compound file (see CompoundFile). Its tables are streams with encoded names. Strings are kept apart in a string pool: the _StringPool stream lists the length of each string, and the _StringData stream holds their bytes back to back. The Property table is stored column by column: the string references of the Property column of all rows, then those of the Value column.
+
+open() reads the string pool lengths and the Property table. getProperty() then reads only the bytes of the strings it compares and returns. So, a package of any size costs a few reads. buildVersionBlock() presents the product properties as a VS_VERSIONINFO block, so that a VersionResource can answer queries on a package as it does on an executable.
+*/
+class MsiPackage
+{
+public:
+	MsiPackage() : _codepage(0), _refSize(2) {}
+
+	uint32_t open(LPCPATHSTR path);
+	void close();
+	uint32_t getProperty(LPCUTF16STR name, size_t nameLen, std::u16string &value);
+	uint32_t buildVersionBlock(std::vector<uint8_t> &block);
+	uint64_t bytesRead() const { return _cf.bytesRead(); }
+
+	static void encodeStreamName(LPCUTF16STR name, size_t nameLen, bool table, std::u16string &out);
+
+protected:
+	CompoundFile _cf;
+	CompoundFileStream _stringData;
+	std::vector<uint64_t> _stringOffset; // offset of each string in _StringData by string id.
+	std::vector<uint32_t> _stringLength; // byte length of each string by string id. id 0 is the null string.
+	uint32_t _codepage; // codepage of the strings.
+	uint32_t _refSize; // byte width of a string reference in a table.
+	std::vector<uint32_t> _keys, _values; // string ids of the Property and Value columns of the Property table.
+
+	uint32_t openStream(const char *name, bool table, CompoundFileStream &stream);
+	uint32_t readString(uint32_t id, std::u16string &text);
+};
@@ -0,0 +1,201 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "PEDigest.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <vector>
+
+
+/* DER encodings the signature scan looks for. An Authenticode signature is a PKCS#7 SignedData whose content is an SpcIndirectDataContent. The content ends with a DigestInfo of the image hash: a SEQUENCE of the algorithm and an OCTET STRING of the hash. */
+// OBJECT IDENTIFIER 1.3.6.1.4.1.311.2.1.4 (SPC_INDIRECT_DATA_OBJID).
+static const uint8_t _spcIndirectDataOid[] = { 0x06, 0x0A, 0x2B, 0x06, 0x01, 0x04, 0x01, 0x82, 0x37, 0x02, 0x01, 0x04 };
+// OBJECT IDENTIFIER 2.16.840.1.101.3.4.2.1 (id-sha256).
+static const uint8_t _sha256Oid[] = { 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01 };
+// OCTET STRING of 32 bytes.
+static const uint8_t _sha256OctetString[] = { 0x04, 0x20 };
+
+static const uint8_t *_find(const uint8_t *p, const uint8_t *end, const uint8_t *pattern, size_t patternLen)
+{
+	const uint8_t *found = std::search(p, end, pattern, pattern + patternLen);
+	return found == end ? NULL : found;
+}
+
+/* clear - forgets the values of the last image. */
+void PEDigest::clear()
+{
+	_loaded = false;
+	_storedChecksum = _computedChecksum = 0;
+	memset(_imageHash, 0, sizeof(_imageHash));
+	_signed = _hasSignedHash = false;
+	memset(_signedHash, 0, sizeof(_signedHash));
+}
+
+/* load - maps a file, and computes its checksum and image hash.
+
+Parameters:
+path - [in] pathname of the file.
+
+Return value:
+ERROR_BAD_EXE_FORMAT if the file is not a PE image. Otherwise, an error of opening the file.
+*/
+uint32_t PEDigest::load(LPCPATHSTR path)
+{
+	clear();
+	MappedFile file;
+	uint32_t errorCode = file.open(path);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	PEImage pe;
+	errorCode = pe.attach(file.data(), file.size());
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	return compute(pe);
+}
+
+/* compute - computes the checksum and the image hash of an image, and looks for the hash recorded in its signature.
+
+Parameters:
+pe - [in] the image. The whole file must be in memory.
+*/
+uint32_t PEDigest::compute(const PEImage &pe)
+{
+	clear();
+	if (pe.size() < pe.fileSize())
+		return ERROR_INVALID_PARAMETER;
+	const uint8_t *base = pe.base();
+	size_t checksumOffset = (const uint8_t*)&pe.optionalHeader()->CheckSum - base;
+	_storedChecksum = pe.optionalHeader()->CheckSum;
+	_computedChecksum = PEImage::computeChecksum(base, pe.size(), checksumOffset);
+	uint32_t errorCode = computeImageHash(pe, _imageHash);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	// the certificate table is a list of 8-byte aligned WIN_CERTIFICATE entries. its address is a file offset, not an RVA.
+	uint32_t certOffset, certSize;
+	if (pe.getDataDirectory(PE_DIRECTORY_ENTRY_SECURITY, &certOffset, &certSize) && certSize && (uint64_t)certOffset + certSize <= pe.size())
+	{
+		_signed = true;
+		const uint8_t *cert = base + certOffset, *certEnd = cert + certSize;
+		while (!_hasSignedHash && cert + PE_CERT_HEADER_SIZE <= certEnd)
+		{
+			uint32_t length;
+			uint16_t type;
+			memcpy(&length, cert, sizeof(length));
+			memcpy(&type, cert + 6, sizeof(type));
+			if (length < PE_CERT_HEADER_SIZE || length > (size_t)(certEnd - cert))
+				break;
+			if (type == PE_CERT_TYPE_PKCS_SIGNED_DATA)
+				_hasSignedHash = findSignedHash(cert + PE_CERT_HEADER_SIZE, length - PE_CERT_HEADER_SIZE, _signedHash);
+			cert += (length + 7) & ~7u;
+		}
+	}
+	_loaded = true;
+	return ERROR_SUCCESS;
+}
+
+/* computeImageHash - computes the Authenticode SHA-256 of an image. The headers are hashed without the CheckSum field and the certificate table entry. The sections follow in the order of their file offsets. Data after the last section is hashed, too, except for the certificate table at the end of the file.
+
+Parameters:
+pe - [in] the image. The whole file must be in memory.
+digest - [out] receives the hash.
+
+Return value:
+ERROR_BAD_EXE_FORMAT if the headers or a section extend past the end of the file.
+*/
+uint32_t PEDigest::computeImageHash(const PEImage &pe, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	const uint8_t *base = pe.base();
+	size_t fileSize = pe.size();
+	size_t checksumOffset = (const uint8_t*)&pe.optionalHeader()->CheckSum - base;
+	size_t headerSize = pe.optionalHeader()->SizeOfHeaders;
+	if (headerSize > fileSize || headerSize < checksumOffset + 4)
+		return ERROR_BAD_EXE_FORMAT;
+	Sha256 sha;
+	sha.update(base, checksumOffset);
+	const PE_DATA_DIRECTORY *certEntry = pe.dataDirectory(PE_DIRECTORY_ENTRY_SECURITY);
+	uint32_t certSize = 0;
+	if (certEntry)
+	{
+		size_t certEntryOffset = (const uint8_t*)certEntry - base;
+		if (certEntryOffset + sizeof(PE_DATA_DIRECTORY) > headerSize)
+			return ERROR_BAD_EXE_FORMAT;
+		sha.update(base + checksumOffset + 4, certEntryOffset - (checksumOffset + 4));
+		sha.update(base + certEntryOffset + sizeof(PE_DATA_DIRECTORY), headerSize - (certEntryOffset + sizeof(PE_DATA_DIRECTORY)));
+		certSize = certEntry->Size;
+	}
+	else
+		sha.update(base + checksumOffset + 4, headerSize - (checksumOffset + 4));
+	// the sections in file order. a section with no raw data (e.g., .bss) has nothing to hash.
+	std::vector<const PE_SECTION_HEADER*> sections;
+	for (int i = 0; i < pe.sectionCount(); i++)
+	{
+		if (pe.section(i)->SizeOfRawData)
+			sections.push_back(pe.section(i));
+	}
+	std::sort(sections.begin(), sections.end(), [](const PE_SECTION_HEADER *a, const PE_SECTION_HEADER *b) { return a->PointerToRawData < b->PointerToRawData; });
+	uint64_t hashed = headerSize;
+	for (size_t i = 0; i < sections.size(); i++)
+	{
+		const PE_SECTION_HEADER *sh = sections[i];
+		if ((uint64_t)sh->PointerToRawData + sh->SizeOfRawData > fileSize)
+			return ERROR_BAD_EXE_FORMAT;
+		sha.update(base + sh->PointerToRawData, sh->SizeOfRawData);
+		hashed += sh->SizeOfRawData;
+	}
+	// overlay data, e.g., the payload of a self-extractor. the certificate table, if any, is at the end of the file, and is left out.
+	if (fileSize > hashed + certSize)
+		sha.update(base + hashed, (size_t)(fileSize - certSize - hashed));
+	sha.final(digest);
+	return ERROR_SUCCESS;
+}
+
+/* findSignedHash - finds the image hash in an Authenticode signature. The DER of the PKCS#7 SignedData is scanned for the SpcIndirectDataContent, and then for a DigestInfo of SHA-256 in it. A signature of SHA-1 alone has no SHA-256 hash to compare with. A dual-signed image carries a SHA-256 signature nested in the SHA-1 one, and its hash is found.
+
+Parameters:
+signedData - [in] the certificate data of a WIN_CERTIFICATE of PE_CERT_TYPE_PKCS_SIGNED_DATA.
+len - [in] byte length of signedData.
+digest - [out] receives the hash.
+
+Return value:
+true if a SHA-256 image hash was found.
+*/
+bool PEDigest::findSignedHash(const uint8_t *signedData, size_t len, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	const uint8_t *end = signedData + len;
+	const uint8_t *p = _find(signedData, end, _spcIndirectDataOid, sizeof(_spcIndirectDataOid));
+	while (p)
+	{
+		p = _find(p, end, _sha256Oid, sizeof(_sha256Oid));
+		if (!p)
+			break;
+		p += sizeof(_sha256Oid);
+		// the algorithm's parameters are an optional NULL. a DigestAlgorithmIdentifier elsewhere in the SignedData is not followed by the hash.
+		if (end - p >= 2 && p[0] == 0x05 && p[1] == 0x00)
+			p += 2;
+		if ((size_t)(end - p) >= sizeof(_sha256OctetString) + SHA256_DIGEST_SIZE && memcmp(p, _sha256OctetString, sizeof(_sha256OctetString)) == 0)
+		{
+			memcpy(digest, p + sizeof(_sha256OctetString), SHA256_DIGEST_SIZE);
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,67 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "PEImage.h"
+#include "FileHasher.h"
+#include <string.h>
+
+
+// wCertificateType of a WIN_CERTIFICATE holding a PKCS#7 SignedData, i.e., an Authenticode signature.
+#define PE_CERT_TYPE_PKCS_SIGNED_DATA 0x0002
+// size of the dwLength, wRevision and wCertificateType fields in front of a certificate.
+#define PE_CERT_HEADER_SIZE 8
+
+/* PEDigest computes the integrity values of a PE image without the Windows trust APIs: the image checksum of the optional header, and the Authenticode image hash, which is the SHA-256 of the image minus the CheckSum field, the certificate table entry of the data directory, and the certificate table itself. So, a hash recorded before a file is signed still matches after it is. If the image is signed, the hash recorded in its signature is found as well, and can be compared with the computed one. The signature itself and the certificate chain are not verified. The file is mapped, and the checksum and the hash each take one pass over it. Both passes run on vector instructions where the processor has them (see PEImage::computeChecksum and Sha256).
+*/
+class PEDigest
+{
+public:
+	PEDigest() { clear(); }
+
+	uint32_t load(LPCPATHSTR path);
+	uint32_t compute(const PEImage &pe);
+	void clear();
+
+	bool isLoaded() const { return _loaded; }
+	uint32_t storedChecksum() const { return _storedChecksum; }
+	uint32_t computedChecksum() const { return _computedChecksum; }
+	bool checksumMatches() const { return _storedChecksum == _computedChecksum; }
+	const uint8_t *imageHash() const { return _imageHash; }
+	bool isSigned() const { return _signed; }
+	bool hasSignedHash() const { return _hasSignedHash; }
+	const uint8_t *signedHash() const { return _signedHash; }
+	bool signedHashMatches() const { return _hasSignedHash && memcmp(_signedHash, _imageHash, SHA256_DIGEST_SIZE) == 0; }
+
+	static uint32_t computeImageHash(const PEImage &pe, uint8_t digest[SHA256_DIGEST_SIZE]);
+	static bool findSignedHash(const uint8_t *signedData, size_t len, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+protected:
+	bool _loaded;
+	uint32_t _storedChecksum; // the CheckSum field of the optional header. 0 if the linker did not set it.
+	uint32_t _computedChecksum;
+	uint8_t _imageHash[SHA256_DIGEST_SIZE]; // the Authenticode SHA-256 of the image.
+	bool _signed; // the image has a certificate table.
+	bool _hasSignedHash; // a SHA-256 Authenticode signature was found in the certificate table.
+	uint8_t _signedHash[SHA256_DIGEST_SIZE]; // the image hash recorded in the signature.
+};
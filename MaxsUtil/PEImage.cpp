@@ -0,0 +1,489 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "PEImage.h"
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PEIMAGE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PEIMAGE_AVX2
+#else//#ifdef _MSC_VER
+// gcc and clang compile AVX2 intrinsics only in functions marked for the instruction set. the functions are called after a run-time check of the processor.
+#define PEIMAGE_AVX2 __attribute__((target("avx2")))
+#endif//#ifdef _MSC_VER
+#endif//#if defined(_M_X64) ...
+
+#ifdef PEIMAGE_X86
+/* _hasAvx2 - checks that the processor supports AVX2 and that the system saves the YMM registers. */
+static bool _hasAvx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	// OSXSAVE and AVX must be set, and XCR0 must enable the XMM and YMM states.
+	if ((info[2] & 0x18000000) != 0x18000000 || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & 0x20) != 0;
+#else//#ifdef _MSC_VER
+	return __builtin_cpu_supports("avx2") != 0;
+#endif//#ifdef _MSC_VER
+}
+
+static bool _useAvx2()
+{
+	static const bool hasAvx2 = _hasAvx2();
+	return hasAvx2;
+}
+
+/* _sumAvx2 - adds up the 32-bit words of 32-byte blocks of data. Each 64-bit lane takes the low and the high word of its quadword into two accumulators. A lane would need 2^32 blocks to overflow. Returns the number of bytes summed, a multiple of 32.
+*/
+PEIMAGE_AVX2 static size_t _sumAvx2(const uint8_t *data, size_t size, uint64_t *sum)
+{
+	const __m256i low32 = _mm256_set1_epi64x(0xFFFFFFFF);
+	__m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+		lo = _mm256_add_epi64(lo, _mm256_and_si256(v, low32));
+		hi = _mm256_add_epi64(hi, _mm256_srli_epi64(v, 32));
+	}
+	uint64_t lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(lo, hi));
+	*sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	return i;
+}
+#endif//#ifdef PEIMAGE_X86
+
+
+/* clear - detaches the instance from the image. */
+void PEImage::clear()
+{
+	_base = NULL;
+	_size = 0;
+	_fileSize = 0;
+	_fh = NULL;
+	_opt = NULL;
+	_dirs = NULL;
+	_dirCount = 0;
+	_sections = NULL;
+}
+
+/* attach - validates the headers of a PE image and prepares the instance for RVA translation and directory lookups. The image is not copied. The caller must keep the buffer alive while the instance is in use. ERROR_BAD_EXE_FORMAT is returned if the data is not a PE image (e.g., a text file, a 16-bit NE executable, or a truncated file).
+
+Parameters:
+data - [in] start of the image, e.g., MappedFile::data().
+size - [in] byte length of the image.
+fileSize - [in, optional] byte length of the file if data holds only the start of it, e.g., the headers. RVAs are then checked against the file rather than the buffer. Pass 0 if data holds the whole file.
+*/
+uint32_t PEImage::attach(const uint8_t *data, size_t size, uint64_t fileSize)
+{
+	clear();
+	if (!data || size < PE_DOS_LFANEW_OFFSET + sizeof(uint32_t))
+		return ERROR_BAD_EXE_FORMAT;
+	uint16_t dosMagic;
+	uint32_t ntOffset;
+	memcpy(&dosMagic, data, sizeof(dosMagic));
+	memcpy(&ntOffset, data + PE_DOS_LFANEW_OFFSET, sizeof(ntOffset));
+	if (dosMagic != PE_DOS_SIGNATURE)
+		return ERROR_BAD_EXE_FORMAT;
+	// the NT signature is followed by the file header and the optional header.
+	if ((uint64_t)ntOffset + sizeof(uint32_t) + sizeof(PE_FILE_HEADER) > size)
+		return ERROR_BAD_EXE_FORMAT;
+	uint32_t ntSig;
+	memcpy(&ntSig, data + ntOffset, sizeof(ntSig));
+	if (ntSig != PE_NT_SIGNATURE)
+		return ERROR_BAD_EXE_FORMAT;
+	const PE_FILE_HEADER *fh = (const PE_FILE_HEADER*)(data + ntOffset + sizeof(uint32_t));
+	size_t optOffset = ntOffset + sizeof(uint32_t) + sizeof(PE_FILE_HEADER);
+	if (fh->SizeOfOptionalHeader < sizeof(PE_OPTIONAL_HEADER_COMMON) || optOffset + fh->SizeOfOptionalHeader > size)
+		return ERROR_BAD_EXE_FORMAT;
+	const PE_OPTIONAL_HEADER_COMMON *opt = (const PE_OPTIONAL_HEADER_COMMON*)(data + optOffset);
+	uint32_t dirOffset;
+	if (opt->Magic == PE_OPTIONAL_HDR32_MAGIC)
+		dirOffset = PE_OPTIONAL_HDR32_DIRECTORY_OFFSET;
+	else if (opt->Magic == PE_OPTIONAL_HDR64_MAGIC)
+		dirOffset = PE_OPTIONAL_HDR64_DIRECTORY_OFFSET;
+	else
+		return ERROR_BAD_EXE_FORMAT;
+	// NumberOfRvaAndSizes immediately precedes the data directory.
+	uint32_t dirCount = 0;
+	if (fh->SizeOfOptionalHeader >= dirOffset)
+	{
+		memcpy(&dirCount, data + optOffset + dirOffset - sizeof(uint32_t), sizeof(dirCount));
+		// trust the directory count only as far as the optional header actually extends.
+		uint32_t maxCount = (fh->SizeOfOptionalHeader - dirOffset) / sizeof(PE_DATA_DIRECTORY);
+		if (dirCount > maxCount)
+			dirCount = maxCount;
+	}
+	size_t secOffset = optOffset + fh->SizeOfOptionalHeader;
+	if (secOffset + (size_t)fh->NumberOfSections * sizeof(PE_SECTION_HEADER) > size)
+		return ERROR_BAD_EXE_FORMAT;
+
+	_base = data;
+	_size = size;
+	_fileSize = fileSize > size ? fileSize : size;
+	_fh = fh;
+	_opt = opt;
+	_dirs = (const PE_DATA_DIRECTORY*)(data + optOffset + dirOffset);
+	_dirCount = dirCount;
+	_sections = (const PE_SECTION_HEADER*)(data + secOffset);
+	return ERROR_SUCCESS;
+}
+
+/* getDataDirectory - retrieves the RVA and byte size of a data directory (e.g., PE_DIRECTORY_ENTRY_RESOURCE). Returns false if the image does not define the directory.
+
+Parameters:
+index - [in] one of the PE_DIRECTORY_ENTRY values.
+rva - [out] receives the RVA of the directory.
+size - [out] receives the size of the directory.
+*/
+bool PEImage::getDataDirectory(int index, uint32_t *rva, uint32_t *size) const
+{
+	if (index < 0 || (uint32_t)index >= _dirCount)
+		return false;
+	*rva = _dirs[index].VirtualAddress;
+	*size = _dirs[index].Size;
+	return *rva != 0 && *size != 0;
+}
+
+/* rvaToOffset - converts a relative virtual address to a file offset by finding the section that contains it. The entire range of len bytes must lie within the raw data of the section and within the file. Addresses below SizeOfHeaders map to the headers which are not part of any section.
+
+Parameters:
+rva - [in] relative virtual address to convert.
+len - [in] number of bytes the caller intends to access at the address.
+offset - [out] receives the file offset.
+*/
+bool PEImage::rvaToOffset(uint32_t rva, uint32_t len, size_t *offset) const
+{
+	if (!_fh)
+		return false;
+	uint64_t end = (uint64_t)rva + len;
+	if (end <= _opt->SizeOfHeaders && end <= _fileSize)
+	{
+		*offset = rva;
+		return true;
+	}
+	for (int i = 0; i < _fh->NumberOfSections; i++)
+	{
+		const PE_SECTION_HEADER *sh = _sections + i;
+		if (rva < sh->VirtualAddress)
+			continue;
+		uint32_t delta = rva - sh->VirtualAddress;
+		uint32_t span = sh->VirtualSize > sh->SizeOfRawData ? sh->VirtualSize : sh->SizeOfRawData;
+		if (delta >= span)
+			continue;
+		// data past SizeOfRawData is zero-fill that exists only in memory. it can't be read from the file.
+		if ((uint64_t)delta + len > sh->SizeOfRawData)
+			return false;
+		uint64_t pos = (uint64_t)sh->PointerToRawData + delta;
+		if (pos + len > _fileSize)
+			return false;
+		*offset = (size_t)pos;
+		return true;
+	}
+	return false;
+}
+
+/* rvaToPtr - same as rvaToOffset except that it returns a pointer into the image. Returns NULL if the range is not backed by file data or is not in the buffer. */
+const uint8_t *PEImage::rvaToPtr(uint32_t rva, uint32_t len) const
+{
+	size_t offset;
+	if (!rvaToOffset(rva, len, &offset) || (uint64_t)offset + len > _size)
+		return NULL;
+	return _base + offset;
+}
+
+/* getResourceSection - locates the resource directory tree, the data of the resource directory entry of the data directory. Offsets in the tree are relative to its start.
+
+Parameters:
+rsrc - [out] receives a pointer to the root directory.
+rsrcLen - [out] receives the byte length of the tree. The linker pads the size in the data directory. So, it is clipped to what the buffer actually contains.
+
+Return value:
+false if the image has no resource section, or the root directory is outside the buffer.
+*/
+bool PEImage::getResourceSection(const uint8_t **rsrc, uint32_t *rsrcLen) const
+{
+	uint32_t rva, len;
+	if (!getDataDirectory(PE_DIRECTORY_ENTRY_RESOURCE, &rva, &len))
+		return false;
+	size_t offset;
+	if (!rvaToOffset(rva, sizeof(PE_RESOURCE_DIRECTORY), &offset) || offset + sizeof(PE_RESOURCE_DIRECTORY) > _size)
+		return false;
+	if (offset + len > _size)
+		len = (uint32_t)(_size - offset);
+	*rsrc = _base + offset;
+	*rsrcLen = len;
+	return true;
+}
+
+/* findResourceEntry - searches a resource directory for an entry with an integer id. Named entries come first in a directory and are skipped.
+
+Parameters:
+rsrc - [in] start of the resource section data.
+rsrcLen - [in] byte length of the resource data. Offsets in the directory tree are checked against it.
+dirOffset - [in] offset of the directory relative to rsrc.
+id - [in] integer id to look for.
+fallbackToFirst - [in] if true and no entry matches the id, return the first entry of the directory. The name and language levels use this to emulate how the system picks a resource when the exact one is not present.
+*/
+const PE_RESOURCE_DIRECTORY_ENTRY *PEImage::findResourceEntry(const uint8_t *rsrc, uint32_t rsrcLen, uint32_t dirOffset, uint32_t id, bool fallbackToFirst) const
+{
+	if ((uint64_t)dirOffset + sizeof(PE_RESOURCE_DIRECTORY) > rsrcLen)
+		return NULL;
+	const PE_RESOURCE_DIRECTORY *dir = (const PE_RESOURCE_DIRECTORY*)(rsrc + dirOffset);
+	uint32_t count = (uint32_t)dir->NumberOfNamedEntries + dir->NumberOfIdEntries;
+	const PE_RESOURCE_DIRECTORY_ENTRY *entries = (const PE_RESOURCE_DIRECTORY_ENTRY*)(dir + 1);
+	if ((uint64_t)dirOffset + sizeof(PE_RESOURCE_DIRECTORY) + (uint64_t)count * sizeof(PE_RESOURCE_DIRECTORY_ENTRY) > rsrcLen)
+		return NULL;
+	for (uint32_t i = dir->NumberOfNamedEntries; i < count; i++)
+	{
+		if (entries[i].Name == id)
+			return entries + i;
+	}
+	if (fallbackToFirst && count > 0)
+		return entries;
+	return NULL;
+}
+
+/* findResource - locates a resource by following the three-level resource directory tree (type, name and language) of the .rsrc section. The located data is returned as a pointer into the image. Nothing is copied.
+
+Parameters:
+typeId - [in] integer resource type, e.g., PE_RT_VERSION.
+nameId - [in] integer resource name. If the image does not have a resource of the name, the first one of the type is used.
+langId - [in] preferred language. If the resource is not available in the language, the first language entry is used. Pass 0 (LANG_NEUTRAL) to accept any language.
+data - [out] receives a pointer to the resource data.
+dataLen - [out] receives the byte length of the resource data.
+
+Return value:
+ERROR_RESOURCE_DATA_NOT_FOUND - the image has no resource section, or the section is malformed.
+ERROR_RESOURCE_TYPE_NOT_FOUND - the image has no resource of the type.
+*/
+uint32_t PEImage::findResource(uint32_t typeId, uint32_t nameId, uint16_t langId, const uint8_t **data, uint32_t *dataLen) const
+{
+	const PE_RESOURCE_DATA_ENTRY *de;
+	uint32_t errorCode = findResourceDataEntry(typeId, nameId, langId, &de);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	const uint8_t *p = rvaToPtr(de->OffsetToData, de->Size);
+	if (!p)
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	*data = p;
+	*dataLen = de->Size;
+	return ERROR_SUCCESS;
+}
+
+/* findResourceDataEntry - same as findResource except that it returns the data entry of the resource rather than the data. A writer (see VersionWriter) uses it to move or resize the data. The parameters and the return value are the same as those of findResource.
+*/
+uint32_t PEImage::findResourceDataEntry(uint32_t typeId, uint32_t nameId, uint16_t langId, const PE_RESOURCE_DATA_ENTRY **dataEntry) const
+{
+	const uint8_t *rsrc;
+	uint32_t rsrcLen;
+	if (!getResourceSection(&rsrc, &rsrcLen))
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+
+	const PE_RESOURCE_DIRECTORY_ENTRY *e = findResourceEntry(rsrc, rsrcLen, 0, typeId, false);
+	if (!e || !(e->OffsetToData & PE_RESOURCE_HIGH_BIT))
+		return ERROR_RESOURCE_TYPE_NOT_FOUND;
+	e = findResourceEntry(rsrc, rsrcLen, e->OffsetToData & ~PE_RESOURCE_HIGH_BIT, nameId, true);
+	if (!e || !(e->OffsetToData & PE_RESOURCE_HIGH_BIT))
+		return ERROR_RESOURCE_NAME_NOT_FOUND;
+	e = findResourceEntry(rsrc, rsrcLen, e->OffsetToData & ~PE_RESOURCE_HIGH_BIT, langId, true);
+	if (!e || (e->OffsetToData & PE_RESOURCE_HIGH_BIT))
+		return ERROR_RESOURCE_LANG_NOT_FOUND;
+	// a leaf entry points to a data entry which in turn points to the resource data by RVA.
+	if ((uint64_t)e->OffsetToData + sizeof(PE_RESOURCE_DATA_ENTRY) > rsrcLen)
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	*dataEntry = (const PE_RESOURCE_DATA_ENTRY*)(rsrc + e->OffsetToData);
+	return ERROR_SUCCESS;
+}
+
+/* findCodeView - reads the CodeView record of the debug directory. The record is found by its file offset, or by its RVA if the offset is outside the buffer.
+
+Parameters:
+codeView - [out] receives the PDB pathname, the signature and the age.
+
+Return value:
+ERROR_NOT_FOUND - the image has no debug directory, or no RSDS or NB10 record in it.
+ERROR_INVALID_DATA - the debug directory is not backed by file data.
+*/
+uint32_t PEImage::findCodeView(PECodeView &codeView) const
+{
+	uint32_t dirRva, dirSize;
+	if (!getDataDirectory(PE_DIRECTORY_ENTRY_DEBUG, &dirRva, &dirSize))
+		return ERROR_NOT_FOUND;
+	const uint8_t *dir = rvaToPtr(dirRva, dirSize);
+	if (!dir)
+		return ERROR_INVALID_DATA;
+	for (uint32_t i = 0; i + sizeof(PE_DEBUG_DIRECTORY) <= dirSize; i += sizeof(PE_DEBUG_DIRECTORY))
+	{
+		PE_DEBUG_DIRECTORY dd;
+		memcpy(&dd, dir + i, sizeof(dd));
+		if (dd.Type != PE_DEBUG_TYPE_CODEVIEW)
+			continue;
+		const uint8_t *data = NULL;
+		if (dd.PointerToRawData && (uint64_t)dd.PointerToRawData + dd.SizeOfData <= _size)
+			data = _base + dd.PointerToRawData;
+		else if (dd.AddressOfRawData)
+			data = rvaToPtr(dd.AddressOfRawData, dd.SizeOfData);
+		if (!data || dd.SizeOfData < sizeof(uint32_t))
+			continue;
+		uint32_t format, pathOffset;
+		memcpy(&format, data, sizeof(format));
+		memset(codeView.guid, 0, sizeof(codeView.guid));
+		codeView.signature = 0;
+		if (format == PE_CODEVIEW_RSDS && dd.SizeOfData > 24)
+		{
+			// 'RSDS', a GUID, an age, and the pathname.
+			memcpy(codeView.guid, data + 4, PE_CODEVIEW_GUID_SIZE);
+			memcpy(&codeView.age, data + 20, sizeof(codeView.age));
+			pathOffset = 24;
+		}
+		else if (format == PE_CODEVIEW_NB10 && dd.SizeOfData > 16)
+		{
+			// 'NB10', an offset (always 0), a signature, an age, and the pathname.
+			memcpy(&codeView.signature, data + 8, sizeof(codeView.signature));
+			memcpy(&codeView.age, data + 12, sizeof(codeView.age));
+			pathOffset = 16;
+		}
+		else
+			continue;
+		codeView.format = format;
+		codeView.portablePdb = format == PE_CODEVIEW_RSDS && dd.MinorVersion == PE_CODEVIEW_PORTABLE_PDB;
+		uint32_t maxLen = dd.SizeOfData - pathOffset;
+		if (maxLen > PE_CODEVIEW_MAX_PATH)
+			maxLen = PE_CODEVIEW_MAX_PATH;
+		const char *path = (const char*)data + pathOffset;
+		codeView.pdbPath.assign(path, strnlen(path, maxLen));
+		return ERROR_SUCCESS;
+	}
+	return ERROR_NOT_FOUND;
+}
+
+/* formatGuid - formats a GUID in the registry form, e.g., {6B29FC40-CA47-1067-B31D-00DD010662DA}. The text is not null-terminated.
+
+Parameters:
+guid - [in] 16 bytes in the layout of a GUID structure. the first three fields are little-endian.
+text - [out] receives 38 characters.
+*/
+void PEImage::formatGuid(const uint8_t guid[PE_CODEVIEW_GUID_SIZE], UTF16CHAR text[38])
+{
+	static const char hex[] = "0123456789ABCDEF";
+	// the order the bytes are printed in. the first three fields are printed most significant byte first.
+	static const uint8_t order[PE_CODEVIEW_GUID_SIZE] = { 3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15 };
+	UTF16CHAR *p = text;
+	*p++ = '{';
+	for (int i = 0; i < PE_CODEVIEW_GUID_SIZE; i++)
+	{
+		if (i == 4 || i == 6 || i == 8 || i == 10)
+			*p++ = '-';
+		uint8_t b = guid[order[i]];
+		*p++ = hex[b >> 4];
+		*p++ = hex[b & 0xF];
+	}
+	*p = '}';
+}
+
+/* formatSymbolKey - makes the key a symbol server files a PDB under: the signature in hex digits followed by the age in hex digits. The signature is the GUID without the punctuation for an RSDS record, and the 8-digit time stamp for an NB10 record. A portable PDB has FFFFFFFF in place of the age. For example, a PDB with signature {6B29FC40-CA47-1067-B31D-00DD010662DA} and age 2 is stored as <pdb name>\6B29FC40CA471067B31D00DD010662DA2\<pdb name>.
+
+Parameters:
+codeView - [in] a CodeView record.
+key - [out] receives the key.
+*/
+void PEImage::formatSymbolKey(const PECodeView &codeView, std::u16string &key)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	key.clear();
+	if (codeView.format == PE_CODEVIEW_RSDS)
+	{
+		UTF16CHAR text[38];
+		formatGuid(codeView.guid, text);
+		for (int i = 1; i < 37; i++)
+		{
+			if (text[i] != '-')
+				key.push_back(text[i]);
+		}
+	}
+	else
+	{
+		for (int shift = 28; shift >= 0; shift -= 4)
+			key.push_back(hex[(codeView.signature >> shift) & 0xF]);
+	}
+	if (codeView.portablePdb)
+	{
+		key.append(u"FFFFFFFF");
+		return;
+	}
+	// the age has no leading zeros.
+	int shift = 28;
+	while (shift > 0 && !((codeView.age >> shift) & 0xF))
+		shift -= 4;
+	for (; shift >= 0; shift -= 4)
+		key.push_back(hex[(codeView.age >> shift) & 0xF]);
+}
+
+/* computeChecksum - computes the image checksum the way ImageHlp CheckSumMappedFile does. The file is summed as 16-bit words with the carries folded back in, the CheckSum field itself is left out, and the file length is added to the result. On a processor with AVX2, the sum runs 32 bytes per step.
+
+Parameters:
+data - [in] the whole file.
+size - [in] byte length of the file.
+checksumOffset - [in] file offset of the CheckSum field of the optional header.
+*/
+uint32_t PEImage::computeChecksum(const uint8_t *data, size_t size, size_t checksumOffset)
+{
+	uint64_t sum = 0;
+	size_t i = 0;
+	// add 32 bits at a time into a 64-bit accumulator. folding it down at the end gives the same one's complement sum of the 16-bit words. AVX2 adds 8 words per step.
+#ifdef PEIMAGE_X86
+	if (_useAvx2())
+		i = _sumAvx2(data, size, &sum);
+#endif//#ifdef PEIMAGE_X86
+	for (; i + 4 <= size; i += 4)
+	{
+		uint32_t v;
+		memcpy(&v, data + i, sizeof(v));
+		sum += v;
+	}
+	if (i + 2 <= size)
+	{
+		sum += (uint32_t)data[i] | ((uint32_t)data[i + 1] << 8);
+		i += 2;
+	}
+	if (i < size)
+		sum += data[i];
+	// take the CheckSum field back out. it was added as two 16-bit words, and adding their complements cancels them.
+	if (checksumOffset + 4 <= size)
+	{
+		sum += 0xFFFF - ((uint32_t)data[checksumOffset] | ((uint32_t)data[checksumOffset + 1] << 8));
+		sum += 0xFFFF - ((uint32_t)data[checksumOffset + 2] | ((uint32_t)data[checksumOffset + 3] << 8));
+	}
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	return (uint32_t)sum + (uint32_t)size;
+}
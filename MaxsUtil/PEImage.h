@@ -0,0 +1,223 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+
+
+/* on-disk structures of a Portable Executable (PE) image. They mirror the IMAGE_* structures of winnt.h, and are defined here under PE_* names so that the parser builds on systems without the Windows headers. All fields are little-endian. The structures are byte-packed because a pointer into a mapped image is not guaranteed to be aligned.
+*/
+#pragma pack(push, 1)
+struct PE_FILE_HEADER
+{
+	uint16_t Machine;
+	uint16_t NumberOfSections;
+	uint32_t TimeDateStamp;
+	uint32_t PointerToSymbolTable;
+	uint32_t NumberOfSymbols;
+	uint16_t SizeOfOptionalHeader;
+	uint16_t Characteristics;
+};
+
+struct PE_DATA_DIRECTORY
+{
+	uint32_t VirtualAddress;
+	uint32_t Size;
+};
+
+// fields common to PE32 and PE32+ optional headers. the layouts diverge after SizeOfCode + ... + BaseOfCode, but the fields from SectionAlignment to CheckSum sit at the same offsets in both.
+struct PE_OPTIONAL_HEADER_COMMON
+{
+	uint16_t Magic;
+	uint8_t MajorLinkerVersion;
+	uint8_t MinorLinkerVersion;
+	uint32_t SizeOfCode;
+	uint32_t SizeOfInitializedData;
+	uint32_t SizeOfUninitializedData;
+	uint32_t AddressOfEntryPoint;
+	uint32_t BaseOfCode;
+	uint32_t BaseOfData_or_ImageBaseLow; // BaseOfData in PE32; low half of ImageBase in PE32+.
+	uint32_t ImageBase_or_ImageBaseHigh; // ImageBase in PE32; high half of ImageBase in PE32+.
+	uint32_t SectionAlignment;
+	uint32_t FileAlignment;
+	uint16_t MajorOperatingSystemVersion;
+	uint16_t MinorOperatingSystemVersion;
+	uint16_t MajorImageVersion;
+	uint16_t MinorImageVersion;
+	uint16_t MajorSubsystemVersion;
+	uint16_t MinorSubsystemVersion;
+	uint32_t Win32VersionValue;
+	uint32_t SizeOfImage;
+	uint32_t SizeOfHeaders;
+	uint32_t CheckSum;
+	uint16_t Subsystem;
+	uint16_t DllCharacteristics;
+};
+
+struct PE_SECTION_HEADER
+{
+	uint8_t Name[8];
+	uint32_t VirtualSize;
+	uint32_t VirtualAddress;
+	uint32_t SizeOfRawData;
+	uint32_t PointerToRawData;
+	uint32_t PointerToRelocations;
+	uint32_t PointerToLinenumbers;
+	uint16_t NumberOfRelocations;
+	uint16_t NumberOfLinenumbers;
+	uint32_t Characteristics;
+};
+
+struct PE_RESOURCE_DIRECTORY
+{
+	uint32_t Characteristics;
+	uint32_t TimeDateStamp;
+	uint16_t MajorVersion;
+	uint16_t MinorVersion;
+	uint16_t NumberOfNamedEntries;
+	uint16_t NumberOfIdEntries;
+};
+
+struct PE_RESOURCE_DIRECTORY_ENTRY
+{
+	uint32_t Name; // an integer id, or if the high bit is set, an offset to a counted UTF-16 name.
+	uint32_t OffsetToData; // if the high bit is set, an offset to a subdirectory. otherwise, an offset to a PE_RESOURCE_DATA_ENTRY.
+};
+
+struct PE_RESOURCE_DATA_ENTRY
+{
+	uint32_t OffsetToData; // an RVA, not an offset into the resource section.
+	uint32_t Size;
+	uint32_t CodePage;
+	uint32_t Reserved;
+};
+
+struct PE_DEBUG_DIRECTORY
+{
+	uint32_t Characteristics;
+	uint32_t TimeDateStamp;
+	uint16_t MajorVersion;
+	uint16_t MinorVersion;
+	uint32_t Type;
+	uint32_t SizeOfData;
+	uint32_t AddressOfRawData; // an RVA. 0 if the data is not mapped.
+	uint32_t PointerToRawData; // a file offset.
+};
+#pragma pack(pop)
+
+#define PE_DOS_SIGNATURE 0x5A4D // MZ
+#define PE_NT_SIGNATURE 0x00004550 // PE00
+#define PE_OPTIONAL_HDR32_MAGIC 0x10b
+#define PE_OPTIONAL_HDR64_MAGIC 0x20b
+#define PE_DOS_LFANEW_OFFSET 0x3C
+#define PE_OPTIONAL_HDR32_DIRECTORY_OFFSET 96
+#define PE_OPTIONAL_HDR64_DIRECTORY_OFFSET 112
+
+// indexes into the data directory of the optional header.
+enum PE_DIRECTORY_ENTRY {
+	PE_DIRECTORY_ENTRY_EXPORT = 0,
+	PE_DIRECTORY_ENTRY_IMPORT = 1,
+	PE_DIRECTORY_ENTRY_RESOURCE = 2,
+	PE_DIRECTORY_ENTRY_EXCEPTION = 3,
+	PE_DIRECTORY_ENTRY_SECURITY = 4,
+	PE_DIRECTORY_ENTRY_BASERELOC = 5,
+	PE_DIRECTORY_ENTRY_DEBUG = 6,
+	PE_DIRECTORY_ENTRY_BOUND_IMPORT = 11,
+	PE_DIRECTORY_ENTRY_IAT = 12,
+	PE_DIRECTORY_ENTRY_DELAY_IMPORT = 13,
+	PE_DIRECTORY_ENTRY_COM_DESCRIPTOR = 14,
+};
+
+#define PE_RESOURCE_HIGH_BIT 0x80000000
+#define PE_SCN_MEM_DISCARDABLE 0x02000000
+#define PE_RT_ICON 3
+#define PE_RT_STRING 6
+#define PE_RT_GROUP_ICON 14
+#define PE_RT_VERSION 16
+#define PE_RT_MANIFEST 24
+#define PE_VS_VERSION_INFO 1
+#define PE_DEBUG_TYPE_CODEVIEW 2
+#define PE_CODEVIEW_RSDS 0x53445352 // 'RSDS'. the CodeView record of a PDB 7.0 file.
+#define PE_CODEVIEW_NB10 0x3031424E // 'NB10'. the CodeView record of a PDB 2.0 file (VC 6.0 and older).
+#define PE_CODEVIEW_GUID_SIZE 16
+#define PE_CODEVIEW_PORTABLE_PDB 0x504D // MinorVersion of the debug directory entry of a portable PDB ('PM').
+// the longest PDB pathname read from a CodeView record.
+#define PE_CODEVIEW_MAX_PATH 1024
+
+/* PECodeView is the CodeView record of the debug directory. It names the PDB file of the image, and identifies the build of the PDB that matches the image by a signature and an age. A symbol server files the PDB under its name and a key made of the two (see PEImage::formatSymbolKey).
+*/
+struct PECodeView
+{
+	uint32_t format; // PE_CODEVIEW_RSDS or PE_CODEVIEW_NB10.
+	uint8_t guid[PE_CODEVIEW_GUID_SIZE]; // the signature of an RSDS record, in the layout of a GUID structure. zeros for NB10.
+	uint32_t signature; // the signature of an NB10 record, a time stamp. 0 for RSDS.
+	uint32_t age; // incremented each time the PDB is updated.
+	bool portablePdb; // the PDB is a portable PDB of a .NET assembly. it has no age.
+	std::string pdbPath; // the pathname the linker wrote the PDB to. UTF-8 in an RSDS record, and in the ANSI code page of the build machine in an NB10 record.
+};
+
+
+/* PEImage interprets the headers of a PE image held in memory (typically a view of a MappedFile). It does not copy anything. It validates the DOS and NT headers and the section table when attach() is called. The other methods translate RVAs to pointers into the image with bounds checking, so that a truncated or malformed file cannot make a caller read outside the buffer. A caller reading the file piece by piece (see PEProbe) can attach the headers alone and use rvaToOffset to find the file offsets of the rest.
+*/
+class PEImage
+{
+public:
+	PEImage() { clear(); }
+
+	uint32_t attach(const uint8_t *data, size_t size, uint64_t fileSize = 0);
+	void clear();
+
+	bool isValid() const { return _fh != NULL; }
+	bool is64() const { return _opt && _opt->Magic == PE_OPTIONAL_HDR64_MAGIC; }
+	const uint8_t *base() const { return _base; }
+	size_t size() const { return _size; }
+	uint64_t fileSize() const { return _fileSize; }
+	const PE_FILE_HEADER *fileHeader() const { return _fh; }
+	const PE_OPTIONAL_HEADER_COMMON *optionalHeader() const { return _opt; }
+	int sectionCount() const { return _fh ? _fh->NumberOfSections : 0; }
+	const PE_SECTION_HEADER *section(int index) const { return _sections + index; }
+
+	bool getDataDirectory(int index, uint32_t *rva, uint32_t *size) const;
+	const PE_DATA_DIRECTORY *dataDirectory(int index) const { return index >= 0 && (uint32_t)index < _dirCount ? _dirs + index : NULL; }
+	bool rvaToOffset(uint32_t rva, uint32_t len, size_t *offset) const;
+	const uint8_t *rvaToPtr(uint32_t rva, uint32_t len) const;
+	bool getResourceSection(const uint8_t **rsrc, uint32_t *rsrcLen) const;
+	uint32_t findResource(uint32_t typeId, uint32_t nameId, uint16_t langId, const uint8_t **data, uint32_t *dataLen) const;
+	uint32_t findResourceDataEntry(uint32_t typeId, uint32_t nameId, uint16_t langId, const PE_RESOURCE_DATA_ENTRY **dataEntry) const;
+	uint32_t findCodeView(PECodeView &codeView) const;
+
+	static uint32_t computeChecksum(const uint8_t *data, size_t size, size_t checksumOffset);
+	static void formatGuid(const uint8_t guid[PE_CODEVIEW_GUID_SIZE], UTF16CHAR text[38]);
+	static void formatSymbolKey(const PECodeView &codeView, std::u16string &key);
+
+protected:
+	const uint8_t *_base;
+	size_t _size;
+	uint64_t _fileSize; // size of the whole file. larger than _size if only the headers are in memory.
+	const PE_FILE_HEADER *_fh;
+	const PE_OPTIONAL_HEADER_COMMON *_opt;
+	const PE_DATA_DIRECTORY *_dirs;
+	uint32_t _dirCount;
+	const PE_SECTION_HEADER *_sections;
+
+	const PE_RESOURCE_DIRECTORY_ENTRY *findResourceEntry(const uint8_t *rsrc, uint32_t rsrcLen, uint32_t dirOffset, uint32_t id, bool fallbackToFirst) const;
+};
@@ -0,0 +1,294 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "PEProbe.h"
+#include <string.h>
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+// the first read of a file. it's the usual SizeOfHeaders. so, it covers the headers and the section table of most images.
+#define PEPROBE_HEADER_READ 1024
+// headers larger than this are not believed.
+#define PEPROBE_MAX_HEADERS 0x10000
+// a resource directory is read with room for this many entries. more are read only if the directory has more.
+#define PEPROBE_DIRECTORY_ENTRIES 16
+// a larger resource is not believed to be a version resource.
+#define PEPROBE_MAX_RESOURCE 0x100000
+
+
+/* open - opens a file for positioned reads. An empty file or one that is not a regular file returns ERROR_HANDLE_EOF as MappedFile::open does.
+
+Parameters:
+path - [in] pathname of the file.
+*/
+uint32_t RangeFile::open(LPCPATHSTR path)
+{
+	close();
+#ifdef _WIN32
+	_hfile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (_hfile == INVALID_HANDLE_VALUE)
+		return GetLastError();
+	LARGE_INTEGER cb;
+	if (!GetFileSizeEx(_hfile, &cb))
+	{
+		uint32_t errorCode = GetLastError();
+		close();
+		return errorCode;
+	}
+	_size = (uint64_t)cb.QuadPart;
+#else//#ifdef _WIN32
+	_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (_fd == -1)
+		return errnoToWin32(errno);
+	struct stat st;
+	if (fstat(_fd, &st) != 0)
+	{
+		uint32_t errorCode = errnoToWin32(errno);
+		close();
+		return errorCode;
+	}
+	if (!S_ISREG(st.st_mode))
+	{
+		close();
+		return ERROR_HANDLE_EOF;
+	}
+	_size = (uint64_t)st.st_size;
+#endif//#ifdef _WIN32
+	if (_size == 0)
+	{
+		close();
+		return ERROR_HANDLE_EOF;
+	}
+	return ERROR_SUCCESS;
+}
+
+/* close - closes the file. The byte counter is reset. */
+void RangeFile::close()
+{
+#ifdef _WIN32
+	if (_hfile != INVALID_HANDLE_VALUE)
+		CloseHandle(_hfile);
+	_hfile = INVALID_HANDLE_VALUE;
+#else
+	if (_fd != -1)
+		::close(_fd);
+	_fd = -1;
+#endif
+	_size = 0;
+	_bytesRead = 0;
+}
+
+/* read - reads a range of the file. The range must lie within the file. ERROR_HANDLE_EOF is returned if it does not.
+
+Parameters:
+offset - [in] file offset to read from.
+buf - [out] receives the data.
+len - [in] number of bytes to read.
+*/
+uint32_t RangeFile::read(uint64_t offset, void *buf, uint32_t len)
+{
+	if (offset + len > _size)
+		return ERROR_HANDLE_EOF;
+	uint8_t *p = (uint8_t*)buf;
+	while (len)
+	{
+#ifdef _WIN32
+		OVERLAPPED ov = { 0 };
+		ov.Offset = (DWORD)offset;
+		ov.OffsetHigh = (DWORD)(offset >> 32);
+		DWORD cb = 0;
+		if (!ReadFile(_hfile, p, len, &cb, &ov))
+			return GetLastError();
+#else
+		ssize_t cb = pread(_fd, p, len, (off_t)offset);
+		if (cb < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return errnoToWin32(errno);
+		}
+#endif
+		if (cb == 0)
+			return ERROR_HANDLE_EOF; // the file has shrunk.
+		_bytesRead += cb;
+		p += cb;
+		offset += cb;
+		len -= (uint32_t)cb;
+	}
+	return ERROR_SUCCESS;
+}
+
+/* readHeaders - reads the headers and the section table into _headers and attaches _pe to them. Most images need one read. An image with a far NT header or a long section table needs one or two more. */
+uint32_t PEProbe::readHeaders()
+{
+	uint32_t len = _source->size() < PEPROBE_HEADER_READ ? (uint32_t)_source->size() : PEPROBE_HEADER_READ;
+	_headers.resize(len);
+	uint32_t errorCode = _source->read(0, _headers.data(), len);
+	while (errorCode == ERROR_SUCCESS)
+	{
+		if (_pe.attach(_headers.data(), len, _source->size()) == ERROR_SUCCESS)
+			return ERROR_SUCCESS;
+		// see how much the headers really take.
+		if (len < PE_DOS_LFANEW_OFFSET + sizeof(uint32_t))
+			return ERROR_BAD_EXE_FORMAT;
+		uint16_t dosMagic;
+		uint32_t ntOffset;
+		memcpy(&dosMagic, _headers.data(), sizeof(dosMagic));
+		memcpy(&ntOffset, _headers.data() + PE_DOS_LFANEW_OFFSET, sizeof(ntOffset));
+		if (dosMagic != PE_DOS_SIGNATURE)
+			return ERROR_BAD_EXE_FORMAT;
+		uint64_t need = (uint64_t)ntOffset + sizeof(uint32_t) + sizeof(PE_FILE_HEADER);
+		if (need <= len)
+		{
+			// the file header is in. it tells the size of the optional header and the number of sections.
+			const PE_FILE_HEADER *fh = (const PE_FILE_HEADER*)(_headers.data() + ntOffset + sizeof(uint32_t));
+			need += fh->SizeOfOptionalHeader + (uint64_t)fh->NumberOfSections * sizeof(PE_SECTION_HEADER);
+		}
+		else
+			need += PEPROBE_HEADER_READ; // not known yet. make room for a typical optional header and section table.
+		if (need > PEPROBE_MAX_HEADERS || need > _source->size())
+			need = _source->size() < PEPROBE_MAX_HEADERS ? _source->size() : PEPROBE_MAX_HEADERS;
+		if (need <= len)
+			return ERROR_BAD_EXE_FORMAT; // everything is in. it's just not a valid image.
+		_headers.resize((size_t)need);
+		errorCode = _source->read(len, _headers.data() + len, (uint32_t)need - len);
+		len = (uint32_t)need;
+	}
+	return errorCode;
+}
+
+/* readResourceEntry - reads a resource directory and searches it for an entry with an integer id. It is the positioned-read version of PEImage::findResourceEntry.
+
+Parameters:
+rsrcOffset - [in] file offset of the resource section data.
+rsrcLen - [in] byte length of the resource data.
+dirOffset - [in] offset of the directory relative to the resource data.
+id - [in] integer id to look for.
+fallbackToFirst - [in] if true and no entry matches the id, return the first entry of the directory.
+entry - [out] receives the entry.
+*/
+bool PEProbe::readResourceEntry(uint64_t rsrcOffset, uint32_t rsrcLen, uint32_t dirOffset, uint32_t id, bool fallbackToFirst, PE_RESOURCE_DIRECTORY_ENTRY *entry)
+{
+	if ((uint64_t)dirOffset + sizeof(PE_RESOURCE_DIRECTORY) > rsrcLen)
+		return false;
+	uint8_t buf[sizeof(PE_RESOURCE_DIRECTORY) + PEPROBE_DIRECTORY_ENTRIES * sizeof(PE_RESOURCE_DIRECTORY_ENTRY)];
+	uint32_t len = rsrcLen - dirOffset < sizeof(buf) ? rsrcLen - dirOffset : (uint32_t)sizeof(buf);
+	if (_source->read(rsrcOffset + dirOffset, buf, len) != ERROR_SUCCESS)
+		return false;
+	const PE_RESOURCE_DIRECTORY *dir = (const PE_RESOURCE_DIRECTORY*)buf;
+	uint32_t count = (uint32_t)dir->NumberOfNamedEntries + dir->NumberOfIdEntries;
+	uint64_t need = sizeof(PE_RESOURCE_DIRECTORY) + (uint64_t)count * sizeof(PE_RESOURCE_DIRECTORY_ENTRY);
+	if ((uint64_t)dirOffset + need > rsrcLen)
+		return false;
+	const PE_RESOURCE_DIRECTORY_ENTRY *entries = (const PE_RESOURCE_DIRECTORY_ENTRY*)(dir + 1);
+	std::vector<uint8_t> more;
+	if (need > len)
+	{
+		// a big directory. read the rest of the entries.
+		more.resize((size_t)need);
+		memcpy(more.data(), buf, len);
+		if (_source->read(rsrcOffset + dirOffset + len, more.data() + len, (uint32_t)need - len) != ERROR_SUCCESS)
+			return false;
+		entries = (const PE_RESOURCE_DIRECTORY_ENTRY*)(more.data() + sizeof(PE_RESOURCE_DIRECTORY));
+	}
+	for (uint32_t i = dir->NumberOfNamedEntries; i < count; i++)
+	{
+		if (entries[i].Name == id)
+		{
+			*entry = entries[i];
+			return true;
+		}
+	}
+	if (fallbackToFirst && count > 0)
+	{
+		*entry = entries[0];
+		return true;
+	}
+	return false;
+}
+
+/* findResource - locates a resource by walking the resource directory tree with positioned reads, and reads the resource data. It follows the same rules as PEImage::findResource. Call bytesRead() afterwards to see how much of the file was read.
+
+Parameters:
+path - [in] pathname of a PE file.
+typeId - [in] integer resource type, e.g., PE_RT_VERSION.
+nameId - [in] integer resource name. If the image does not have a resource of the name, the first one of the type is used.
+langId - [in] preferred language. Pass 0 to accept any language.
+data - [out] receives a copy of the resource data.
+
+Return value:
+ERROR_BAD_EXE_FORMAT - the file is not a PE image.
+ERROR_HANDLE_EOF - the file is empty or is not a regular file.
+ERROR_RESOURCE_* - see PEImage::findResource.
+*/
+uint32_t PEProbe::findResource(LPCPATHSTR path, uint32_t typeId, uint32_t nameId, uint16_t langId, std::vector<uint8_t> &data)
+{
+	_pe.clear();
+	uint32_t errorCode = _file.open(path);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	return findResource(_file, typeId, nameId, langId, data);
+}
+
+/* findResource - the same as findResource(path, ...) for an image read through a RangeSource other than a file (e.g., a file in a cabinet). bytesRead() does not count the reads. Ask the source instead.
+*/
+uint32_t PEProbe::findResource(RangeSource &source, uint32_t typeId, uint32_t nameId, uint16_t langId, std::vector<uint8_t> &data)
+{
+	_pe.clear();
+	_source = &source;
+	if (source.size() == 0)
+		return ERROR_HANDLE_EOF;
+	uint32_t errorCode = readHeaders();
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	uint32_t rsrcRva, rsrcLen;
+	if (!_pe.getDataDirectory(PE_DIRECTORY_ENTRY_RESOURCE, &rsrcRva, &rsrcLen))
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	size_t rsrcOffset;
+	if (!_pe.rvaToOffset(rsrcRva, sizeof(PE_RESOURCE_DIRECTORY), &rsrcOffset))
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	if (rsrcOffset + (uint64_t)rsrcLen > _source->size())
+		rsrcLen = (uint32_t)(_source->size() - rsrcOffset);
+
+	PE_RESOURCE_DIRECTORY_ENTRY e;
+	if (!readResourceEntry(rsrcOffset, rsrcLen, 0, typeId, false, &e) || !(e.OffsetToData & PE_RESOURCE_HIGH_BIT))
+		return ERROR_RESOURCE_TYPE_NOT_FOUND;
+	if (!readResourceEntry(rsrcOffset, rsrcLen, e.OffsetToData & ~PE_RESOURCE_HIGH_BIT, nameId, true, &e) || !(e.OffsetToData & PE_RESOURCE_HIGH_BIT))
+		return ERROR_RESOURCE_NAME_NOT_FOUND;
+	if (!readResourceEntry(rsrcOffset, rsrcLen, e.OffsetToData & ~PE_RESOURCE_HIGH_BIT, langId, true, &e) || (e.OffsetToData & PE_RESOURCE_HIGH_BIT))
+		return ERROR_RESOURCE_LANG_NOT_FOUND;
+	PE_RESOURCE_DATA_ENTRY de;
+	if ((uint64_t)e.OffsetToData + sizeof(de) > rsrcLen ||
+		_source->read(rsrcOffset + e.OffsetToData, &de, sizeof(de)) != ERROR_SUCCESS)
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	size_t offset;
+	if (de.Size > PEPROBE_MAX_RESOURCE || !_pe.rvaToOffset(de.OffsetToData, de.Size, &offset))
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	data.resize(de.Size);
+	if (_source->read(offset, data.data(), de.Size) != ERROR_SUCCESS)
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	return ERROR_SUCCESS;
+}
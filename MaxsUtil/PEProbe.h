@@ -0,0 +1,93 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "PEImage.h"
+#include <vector>
+
+
+/* RangeSource is a byte range that can be read at any offset. PEProbe reads an image through it. RangeFile is one for a file. CabinetFile is one for a file inside a cabinet.
+*/
+class RangeSource
+{
+public:
+	virtual ~RangeSource() {}
+	virtual uint32_t read(uint64_t offset, void *buf, uint32_t len) = 0;
+	virtual uint64_t size() const = 0;
+};
+
+/* RangeFile reads a file with positioned reads (ReadFile with an offset on Windows and pread on Linux). Unlike MappedFile, it reads exactly the ranges asked for, and it counts the bytes. On a network share, where every page fault of a mapped view turns into a round trip, a few small reads are much cheaper than mapping the file.
+*/
+class RangeFile : public RangeSource
+{
+public:
+	RangeFile() : _size(0), _bytesRead(0),
+#ifdef _WIN32
+		_hfile(INVALID_HANDLE_VALUE)
+#else
+		_fd(-1)
+#endif
+	{}
+	~RangeFile() { close(); }
+
+	uint32_t open(LPCPATHSTR path);
+	void close();
+	virtual uint32_t read(uint64_t offset, void *buf, uint32_t len);
+
+	virtual uint64_t size() const { return _size; }
+	uint64_t bytesRead() const { return _bytesRead; }
+
+protected:
+	uint64_t _size;
+	uint64_t _bytesRead; // total of the bytes read since the file was opened.
+#ifdef _WIN32
+	HANDLE _hfile;
+#else
+	int _fd;
+#endif
+
+private:
+	RangeFile(const RangeFile&);
+	RangeFile& operator=(const RangeFile&);
+};
+
+/* PEProbe locates a resource in a PE file without reading the whole file or mapping it. It reads the headers and the section table, one resource directory per level of the type-name-language tree, the data entry, and finally the resource data itself. For a version resource, that is a few KB no matter how large the image is.
+*/
+class PEProbe
+{
+public:
+	PEProbe() : _source(NULL) {}
+
+	uint32_t findResource(LPCPATHSTR path, uint32_t typeId, uint32_t nameId, uint16_t langId, std::vector<uint8_t> &data);
+	uint32_t findResource(RangeSource &source, uint32_t typeId, uint32_t nameId, uint16_t langId, std::vector<uint8_t> &data);
+	uint64_t bytesRead() const { return _file.bytesRead(); }
+
+protected:
+	RangeFile _file;
+	RangeSource *_source; // _file, or the source passed to findResource.
+	std::vector<uint8_t> _headers; // the DOS and NT headers and the section table.
+	PEImage _pe; // attached to _headers.
+
+	uint32_t readHeaders();
+	bool readResourceEntry(uint64_t rsrcOffset, uint32_t rsrcLen, uint32_t dirOffset, uint32_t id, bool fallbackToFirst, PE_RESOURCE_DIRECTORY_ENTRY *entry);
+};
@@ -0,0 +1,257 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "ResourceTable.h"
+#include <string.h>
+
+
+/* _readDirectory - checks that a resource directory and its entries lie within the tree.
+
+Parameters:
+rsrc - [in] start of the tree.
+rsrcLen - [in] byte length of the tree.
+offset - [in] offset of the directory.
+entries - [out] receives the entries of the directory.
+count - [out] receives the number of entries.
+*/
+static bool _readDirectory(const uint8_t *rsrc, uint32_t rsrcLen, uint32_t offset, const PE_RESOURCE_DIRECTORY_ENTRY **entries, uint32_t *count)
+{
+	if ((uint64_t)offset + sizeof(PE_RESOURCE_DIRECTORY) > rsrcLen)
+		return false;
+	const PE_RESOURCE_DIRECTORY *dir = (const PE_RESOURCE_DIRECTORY*)(rsrc + offset);
+	uint32_t n = (uint32_t)dir->NumberOfNamedEntries + dir->NumberOfIdEntries;
+	if ((uint64_t)offset + sizeof(PE_RESOURCE_DIRECTORY) + (uint64_t)n * sizeof(PE_RESOURCE_DIRECTORY_ENTRY) > rsrcLen)
+		return false;
+	*entries = (const PE_RESOURCE_DIRECTORY_ENTRY*)(dir + 1);
+	*count = n;
+	return true;
+}
+
+/* _readId - makes a ResourceId of the Name field of a directory entry. A name is a 16-bit length followed by UTF-16 characters. */
+static bool _readId(const uint8_t *rsrc, uint32_t rsrcLen, const PE_RESOURCE_DIRECTORY_ENTRY &e, ResourceId &rid)
+{
+	if (!(e.Name & PE_RESOURCE_HIGH_BIT))
+	{
+		rid = ResourceId::fromId(e.Name);
+		return true;
+	}
+	uint32_t offset = e.Name & ~PE_RESOURCE_HIGH_BIT;
+	// the resource compiler aligns a name on a 2-byte boundary. an odd offset would make a misaligned UTF-16 pointer.
+	if ((offset & 1) || (uint64_t)offset + 2 > rsrcLen)
+		return false;
+	uint16_t len = (uint16_t)(rsrc[offset] | (rsrc[offset + 1] << 8));
+	if ((uint64_t)offset + 2 + (uint64_t)len * 2 > rsrcLen)
+		return false;
+	rid = ResourceId::fromName((LPCUTF16STR)(rsrc + offset + 2), len);
+	return true;
+}
+
+/* load - walks the resource directory tree of an image, and makes an entry for each resource. A subtree that lies outside the section is skipped.
+
+Parameters:
+pe - [in] an attached image. It must stay attached while the table is used.
+
+Return value:
+ERROR_RESOURCE_DATA_NOT_FOUND if the image has no resource section. ERROR_INVALID_DATA if the tree has more than RESOURCE_MAX_ENTRIES leaves.
+*/
+uint32_t ResourceTable::load(const PEImage &pe)
+{
+	_entries.clear();
+	const uint8_t *rsrc;
+	uint32_t rsrcLen;
+	if (!pe.getResourceSection(&rsrc, &rsrcLen))
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	const PE_RESOURCE_DIRECTORY_ENTRY *types, *names, *langs;
+	uint32_t typeCount, nameCount, langCount;
+	if (!_readDirectory(rsrc, rsrcLen, 0, &types, &typeCount))
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	ResourceEntry re;
+	for (uint32_t i = 0; i < typeCount; i++)
+	{
+		if (!(types[i].OffsetToData & PE_RESOURCE_HIGH_BIT) || !_readId(rsrc, rsrcLen, types[i], re.type))
+			continue;
+		if (!_readDirectory(rsrc, rsrcLen, types[i].OffsetToData & ~PE_RESOURCE_HIGH_BIT, &names, &nameCount))
+			continue;
+		for (uint32_t j = 0; j < nameCount; j++)
+		{
+			if (!(names[j].OffsetToData & PE_RESOURCE_HIGH_BIT) || !_readId(rsrc, rsrcLen, names[j], re.name))
+				continue;
+			if (!_readDirectory(rsrc, rsrcLen, names[j].OffsetToData & ~PE_RESOURCE_HIGH_BIT, &langs, &langCount))
+				continue;
+			for (uint32_t k = 0; k < langCount; k++)
+			{
+				// a leaf points to a data entry, which points to the data by RVA.
+				uint32_t offset = langs[k].OffsetToData;
+				if ((offset & PE_RESOURCE_HIGH_BIT) || (uint64_t)offset + sizeof(PE_RESOURCE_DATA_ENTRY) > rsrcLen)
+					continue;
+				if (_entries.size() == RESOURCE_MAX_ENTRIES)
+				{
+					_entries.clear();
+					return ERROR_INVALID_DATA;
+				}
+				const PE_RESOURCE_DATA_ENTRY *de = (const PE_RESOURCE_DATA_ENTRY*)(rsrc + offset);
+				re.langId = (uint16_t)langs[k].Name;
+				re.codePage = de->CodePage;
+				re.size = de->Size;
+				re.data = pe.rvaToPtr(de->OffsetToData, de->Size);
+				_entries.push_back(re);
+			}
+		}
+	}
+	return ERROR_SUCCESS;
+}
+
+/* find - looks up a resource by type and name. If it is not available in the language, the first language of it is returned, the way the system picks a resource.
+
+Parameters:
+type - [in] type of the resource, e.g., ResourceId::fromId(PE_RT_MANIFEST).
+name - [in] name of the resource.
+langId - [in] preferred language. Pass 0 (LANG_NEUTRAL) to accept any language.
+
+Return value:
+the entry of the resource, or NULL if the image has no resource of the type and name.
+*/
+const ResourceEntry *ResourceTable::find(const ResourceId &type, const ResourceId &name, uint16_t langId) const
+{
+	const ResourceEntry *first = NULL;
+	for (size_t i = 0; i < _entries.size(); i++)
+	{
+		const ResourceEntry &re = _entries[i];
+		if (!re.type.matches(type) || !re.name.matches(name))
+		{
+			// the languages of a resource are next to each other.
+			if (first)
+				break;
+			continue;
+		}
+		if (re.langId == langId)
+			return &re;
+		if (!first)
+			first = &re;
+	}
+	return first;
+}
+
+/* findFirst - returns the first resource of a type, e.g., the manifest of an image, whose name varies (1 for an exe, 2 for a dll). NULL if the image has none. */
+const ResourceEntry *ResourceTable::findFirst(const ResourceId &type) const
+{
+	for (size_t i = 0; i < _entries.size(); i++)
+	{
+		if (_entries[i].type.matches(type))
+			return &_entries[i];
+	}
+	return NULL;
+}
+
+/* findString - looks up a string of a string table, the string LoadString loads. The string is returned as a view into the image. It is not null-terminated.
+
+Parameters:
+stringId - [in] id of the string.
+langId - [in] preferred language. See find.
+text - [out] receives a pointer to the string.
+len - [out] receives the length of the string in characters.
+
+Return value:
+ERROR_RESOURCE_NAME_NOT_FOUND if the image has no string of the id, or the string is empty.
+*/
+uint32_t ResourceTable::findString(uint32_t stringId, uint16_t langId, LPCUTF16STR *text, uint16_t *len) const
+{
+	const ResourceEntry *re = find(ResourceId::fromId(PE_RT_STRING), ResourceId::fromId(stringId / RESOURCE_STRINGS_PER_BLOCK + 1), langId);
+	if (!re)
+		return ERROR_RESOURCE_NAME_NOT_FOUND;
+	if (!re->data)
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	if ((uintptr_t)re->data & 1)
+		return ERROR_INVALID_DATA;
+	// the block is 16 counted strings. skip to the one of the id.
+	uint32_t pos = 0;
+	for (uint32_t i = 0; i <= stringId % RESOURCE_STRINGS_PER_BLOCK; i++)
+	{
+		if ((uint64_t)pos + 2 > re->size)
+			return ERROR_RESOURCE_NAME_NOT_FOUND;
+		uint16_t n = (uint16_t)(re->data[pos] | (re->data[pos + 1] << 8));
+		if ((uint64_t)pos + 2 + (uint64_t)n * 2 > re->size)
+			return ERROR_RESOURCE_NAME_NOT_FOUND;
+		*text = (LPCUTF16STR)(re->data + pos + 2);
+		*len = n;
+		pos += 2 + n * 2;
+	}
+	return *len ? ERROR_SUCCESS : ERROR_RESOURCE_NAME_NOT_FOUND;
+}
+
+/* buildIcon - assembles an .ico file of an icon group. A group (RT_GROUP_ICON) lists images of the icon in several sizes and color depths. Each image is a separate RT_ICON resource. The file is the group header with the resource ids of the images replaced by file offsets, followed by the images. An image the file does not have is left out.
+
+Parameters:
+group - [in] an RT_GROUP_ICON entry of the table.
+ico - [out] receives the file.
+
+Return value:
+ERROR_INVALID_DATA if the group is malformed. ERROR_RESOURCE_NAME_NOT_FOUND if no image of the group is found.
+*/
+uint32_t ResourceTable::buildIcon(const ResourceEntry &group, std::vector<uint8_t> &ico) const
+{
+	ico.clear();
+	if (!group.data || group.size < sizeof(PE_ICON_DIR))
+		return ERROR_INVALID_DATA;
+	PE_ICON_DIR dir;
+	memcpy(&dir, group.data, sizeof(dir));
+	if ((uint64_t)sizeof(PE_ICON_DIR) + (uint64_t)dir.Count * sizeof(PE_GROUP_ICON_ENTRY) > group.size)
+		return ERROR_INVALID_DATA;
+	std::vector<const ResourceEntry*> images;
+	std::vector<PE_GROUP_ICON_ENTRY> groupEntries;
+	size_t fileSize = sizeof(PE_ICON_DIR);
+	for (uint16_t i = 0; i < dir.Count; i++)
+	{
+		PE_GROUP_ICON_ENTRY ge;
+		memcpy(&ge, group.data + sizeof(PE_ICON_DIR) + i * sizeof(PE_GROUP_ICON_ENTRY), sizeof(ge));
+		const ResourceEntry *image = find(ResourceId::fromId(PE_RT_ICON), ResourceId::fromId(ge.Id), group.langId);
+		if (!image || !image->data)
+			continue;
+		images.push_back(image);
+		groupEntries.push_back(ge);
+		fileSize += sizeof(PE_ICON_FILE_ENTRY) + image->size;
+	}
+	if (images.empty())
+		return ERROR_RESOURCE_NAME_NOT_FOUND;
+	ico.resize(fileSize);
+	dir.Count = (uint16_t)images.size();
+	memcpy(ico.data(), &dir, sizeof(dir));
+	size_t imageOffset = sizeof(PE_ICON_DIR) + images.size() * sizeof(PE_ICON_FILE_ENTRY);
+	for (size_t i = 0; i < images.size(); i++)
+	{
+		const PE_GROUP_ICON_ENTRY &ge = groupEntries[i];
+		PE_ICON_FILE_ENTRY fe;
+		fe.Width = ge.Width;
+		fe.Height = ge.Height;
+		fe.ColorCount = ge.ColorCount;
+		fe.Reserved = ge.Reserved;
+		fe.Planes = ge.Planes;
+		fe.BitCount = ge.BitCount;
+		// the size of the group entry may disagree with the resource. the resource is what is copied.
+		fe.BytesInRes = images[i]->size;
+		fe.ImageOffset = (uint32_t)imageOffset;
+		memcpy(ico.data() + sizeof(PE_ICON_DIR) + i * sizeof(PE_ICON_FILE_ENTRY), &fe, sizeof(fe));
+		memcpy(ico.data() + imageOffset, images[i]->data, images[i]->size);
+		imageOffset += images[i]->size;
+	}
+	return ERROR_SUCCESS;
+}
@@ -0,0 +1,126 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "PEImage.h"
+#include <vector>
+
+
+#pragma pack(push, 1)
+// the header of an RT_GROUP_ICON resource, and of an .ico file.
+struct PE_ICON_DIR
+{
+	uint16_t Reserved;
+	uint16_t Type; // 1 for icons.
+	uint16_t Count;
+};
+
+// an image of an RT_GROUP_ICON resource. the image is the RT_ICON resource of the id.
+struct PE_GROUP_ICON_ENTRY
+{
+	uint8_t Width;
+	uint8_t Height;
+	uint8_t ColorCount;
+	uint8_t Reserved;
+	uint16_t Planes;
+	uint16_t BitCount;
+	uint32_t BytesInRes;
+	uint16_t Id;
+};
+
+// an image of an .ico file. the same as PE_GROUP_ICON_ENTRY except for the last field.
+struct PE_ICON_FILE_ENTRY
+{
+	uint8_t Width;
+	uint8_t Height;
+	uint8_t ColorCount;
+	uint8_t Reserved;
+	uint16_t Planes;
+	uint16_t BitCount;
+	uint32_t BytesInRes;
+	uint32_t ImageOffset; // offset of the image from the start of the file.
+};
+#pragma pack(pop)
+
+// an RT_STRING resource is a block of 16 strings. block n holds the strings of ids (n-1)*16 to (n-1)*16+15.
+#define RESOURCE_STRINGS_PER_BLOCK 16
+// the most leaves a resource directory tree can have. a tree with more is taken to be malformed.
+#define RESOURCE_MAX_ENTRIES 0x10000
+
+/* ResourceId is the type or the name of a resource: an integer id, or a counted UTF-16 string in the resource section. */
+struct ResourceId
+{
+	uint32_t id; // the integer id. 0 if the resource is named.
+	LPCUTF16STR name; // points into the image. NULL if the id is an integer.
+	uint16_t nameLen;
+
+	bool isNamed() const { return name != NULL; }
+	bool matches(const ResourceId &other) const
+	{
+		if (isNamed() != other.isNamed())
+			return false;
+		// the system compares names without case.
+		return isNamed() ? utf16icmp(name, nameLen, other.name, other.nameLen) == 0 : id == other.id;
+	}
+
+	static ResourceId fromId(uint32_t id)
+	{
+		ResourceId rid = { id, NULL, 0 };
+		return rid;
+	}
+	static ResourceId fromName(LPCUTF16STR name, size_t len)
+	{
+		ResourceId rid = { 0, name, (uint16_t)len };
+		return rid;
+	}
+};
+
+/* ResourceEntry is a resource of an image: its type, name and language, and a view of its data in the image. */
+struct ResourceEntry
+{
+	ResourceId type;
+	ResourceId name;
+	uint16_t langId;
+	uint32_t codePage;
+	const uint8_t *data; // points into the image. NULL if the data is outside the buffer.
+	uint32_t size;
+};
+
+/* ResourceTable lists all resources of a PE image with one walk of the resource directory tree. The walk makes an entry for each leaf of the tree (a type, a name and a language). An entry refers to its names and data in the image. Nothing is copied. So, the image must stay attached while the table is used. Lookups after the walk run on the list, and do not read the tree again. The table also decodes the resources a packaging check asks for most: a string of a string table (see findString), the manifest (see findFirst and PE_RT_MANIFEST), and an icon, which it assembles into an .ico file (see buildIcon).
+*/
+class ResourceTable
+{
+public:
+	uint32_t load(const PEImage &pe);
+	void clear() { _entries.clear(); }
+
+	size_t count() const { return _entries.size(); }
+	const ResourceEntry &entry(size_t index) const { return _entries[index]; }
+	const ResourceEntry *find(const ResourceId &type, const ResourceId &name, uint16_t langId) const;
+	const ResourceEntry *findFirst(const ResourceId &type) const;
+	uint32_t findString(uint32_t stringId, uint16_t langId, LPCUTF16STR *text, uint16_t *len) const;
+	uint32_t buildIcon(const ResourceEntry &group, std::vector<uint8_t> &ico) const;
+
+protected:
+	std::vector<ResourceEntry> _entries; // in the order of the tree: by type, then name, then language.
+};
@@ -0,0 +1,201 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "VersionCache.h"
+
+
+/* instance - returns the cache shared by all VersionResource users of the process. It is created on first use with the default budget. */
+VersionCache &VersionCache::instance()
+{
+	static VersionCache cache;
+	return cache;
+}
+
+/* load - loads the version resource of a file through the cache. If the cache has a current entry for the file, the resource is assigned the shared block, and the file is not opened. Otherwise, the resource is read from the index or the file, and a successful result is entered in the cache.
+
+Parameters:
+path - [in] pathname of the file.
+vr - [out] receives the version resource.
+index - [in, optional] a version index to read a missed file through. NULL to read the file directly.
+
+Return value:
+same as VersionResource::load.
+*/
+uint32_t VersionCache::load(LPCPATHSTR path, VersionResource &vr, VersionIndex *index)
+{
+	VersionFileStamp stamp;
+	if (budget() == 0 || VersionIndex::getFileStamp(path, stamp) != ERROR_SUCCESS || stamp.fileId == 0)
+		return index ? index->load(path, vr) : vr.load(path); // not cached. let the loader report an error, if any.
+	if (lookup(stamp, vr))
+		return ERROR_SUCCESS;
+	uint32_t errorCode = index ? index->load(path, stamp, vr) : vr.load(path);
+	if (errorCode == ERROR_SUCCESS)
+		store(stamp, vr);
+	return errorCode;
+}
+
+/* lookup - finds the entry of a file and assigns it to a version resource if the file has not changed since the entry was made. A stale entry is dropped.
+
+Parameters:
+stamp - [in] current stamp of the file. See VersionIndex::getFileStamp.
+vr - [out] receives the shared block on a hit. It is not changed on a miss.
+
+Return value:
+true on a hit. false if there is no current entry.
+*/
+bool VersionCache::lookup(const VersionFileStamp &stamp, VersionResource &vr)
+{
+	SharedVersionBlockPtr block;
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+		EntryMap::iterator it = _map.find(identityOf(stamp));
+		if (it != _map.end() && it->second->stamp != stamp)
+		{
+			erase(it->second);
+			it = _map.end();
+		}
+		if (it == _map.end())
+		{
+			_misses++;
+			return false;
+		}
+		// move the entry to the front of the recency list.
+		_lru.splice(_lru.begin(), _lru, it->second);
+		_hits++;
+		block = it->second->block;
+	}
+	vr.assignShared(block);
+	return true;
+}
+
+/* store - enters a loaded version resource in the cache. The resource is switched over to the shared copy (see VersionResource::share). Entries are evicted as needed to stay within the budget. A block larger than the whole budget is not kept.
+
+Parameters:
+stamp - [in] stamp of the file the resource was loaded from.
+vr - [in, out] a loaded version resource.
+*/
+void VersionCache::store(const VersionFileStamp &stamp, VersionResource &vr)
+{
+	if (budget() == 0 || stamp.fileId == 0)
+		return;
+	// copying and decoding is done outside the lock.
+	SharedVersionBlockPtr block = vr.share();
+	if (!block)
+		return;
+	size_t bytes = footprint(*block);
+	std::lock_guard<std::mutex> guard(_lock);
+	if (bytes > _budget)
+		return;
+	FileIdentity id = identityOf(stamp);
+	EntryMap::iterator it = _map.find(id);
+	if (it != _map.end())
+		erase(it->second); // another thread has stored the same file, or the file has changed.
+	Entry entry = { id, stamp, block, bytes };
+	_lru.push_front(entry);
+	_map[id] = _lru.begin();
+	_residentBytes += bytes;
+	trim();
+}
+
+/* invalidate - drops the entry of a file. Call it after writing to the file (see VersionWriter::commit). A write may leave the size unchanged and may update the modification time late. So, the stamp alone does not reveal the change. */
+void VersionCache::invalidate(LPCPATHSTR path)
+{
+	VersionFileStamp stamp;
+	if (VersionIndex::getFileStamp(path, stamp) != ERROR_SUCCESS)
+		return;
+	std::lock_guard<std::mutex> guard(_lock);
+	EntryMap::iterator it = _map.find(identityOf(stamp));
+	if (it != _map.end())
+		erase(it->second);
+}
+
+/* clear - drops all entries. The counters are not reset. */
+void VersionCache::clear()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	_map.clear();
+	_lru.clear();
+	_residentBytes = 0;
+}
+
+/* setBudget - changes the byte budget. Lowering it evicts entries right away. 0 disables the cache and drops all entries. */
+void VersionCache::setBudget(uint64_t budget)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	_budget = budget;
+	trim();
+}
+
+uint64_t VersionCache::budget() const
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _budget;
+}
+
+/* getStats - returns the counters, the number of entries and their estimated size. */
+void VersionCache::getStats(VersionCacheStats &stats) const
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	stats.hits = _hits;
+	stats.misses = _misses;
+	stats.evictions = _evictions;
+	stats.residentBytes = _residentBytes;
+	stats.budget = _budget;
+	stats.entries = (uint32_t)_map.size();
+}
+
+/* resetStats - zeroes the hit, miss and eviction counters. */
+void VersionCache::resetStats()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	_hits = _misses = _evictions = 0;
+}
+
+/* erase - removes an entry. The caller holds _lock. */
+void VersionCache::erase(EntryList::iterator it)
+{
+	_residentBytes -= it->bytes;
+	_map.erase(it->id);
+	_lru.erase(it);
+}
+
+/* trim - evicts the least recently used entries until the resident size is within the budget. The caller holds _lock. */
+void VersionCache::trim()
+{
+	while (_residentBytes > _budget && !_lru.empty())
+	{
+		EntryList::iterator last = _lru.end();
+		erase(--last);
+		_evictions++;
+	}
+}
+
+/* footprint - estimates the memory an entry takes. */
+size_t VersionCache::footprint(const SharedVersionBlock &block)
+{
+	const VersionAttribTable &t = block.table;
+	return sizeof(SharedVersionBlock) + VERSIONCACHE_ENTRY_OVERHEAD +
+		block.data.capacity() +
+		(t.tableLangCp.capacity() + t.tableFirst.capacity() + t.keyOffset.capacity() + t.valueOffset.capacity()) * sizeof(uint32_t) +
+		(t.keyLen.capacity() + t.valueLen.capacity()) * sizeof(uint16_t) +
+		t.attribId.capacity();
+}
@@ -0,0 +1,115 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "VersionResource.h"
+#include "VersionIndex.h"
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+
+// default byte budget of the process-wide cache. a typical version block and its table take 2 to 6 KB. so, a few thousand files fit.
+#define VERSIONCACHE_DEFAULT_BUDGET (16 * 1024 * 1024)
+// estimated bytes of bookkeeping per entry (list and hash nodes, and the shared_ptr control block). counted against the budget.
+#define VERSIONCACHE_ENTRY_OVERHEAD 128
+
+/* VersionCacheStats are counters of cache use since the process started or the stats were last reset. A lookup that finds an entry of a file that has changed since is counted as a miss. residentBytes is the estimated memory the entries take, and never exceeds budget after a store completes.
+*/
+struct VersionCacheStats
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t residentBytes;
+	uint64_t budget;
+	uint32_t entries;
+
+	double hitRate() const { return hits + misses ? (double)hits / (double)(hits + misses) : 0.0; }
+};
+
+/* VersionCache is a process-wide, memory-bounded cache of parsed version blocks. An entry is a SharedVersionBlock, i.e., a copy of a file's VS_VERSIONINFO block and its decoded attribute table. VersionResources loaded through the cache share the entry instead of each mapping the file and decoding the tree. So, any number of VersionInfo objects pointed at the same DLL hold one copy of its version data.
+
+Entries are keyed by file identity, the device and file id of VersionFileStamp, not by pathname. Two pathnames of one file (e.g., a short name and a long name, or two hard links) find the same entry. An entry is used only if the file's size and modification time still match. Otherwise, the file is read again and the entry is replaced. A file system that reports no file id (0) is not cached.
+
+When the estimated size of the entries exceeds the byte budget, the least recently used entries are evicted. An evicted block stays alive as long as a VersionResource still refers to it, but it no longer counts against the budget. A budget of 0 disables the cache. Only successful loads are cached. A file without a version resource is read again every time.
+
+All methods are thread-safe.
+*/
+class VersionCache
+{
+public:
+	VersionCache(uint64_t budget = VERSIONCACHE_DEFAULT_BUDGET) : _budget(budget), _residentBytes(0), _hits(0), _misses(0), _evictions(0) {}
+
+	static VersionCache &instance();
+
+	uint32_t load(LPCPATHSTR path, VersionResource &vr, VersionIndex *index = NULL);
+	bool lookup(const VersionFileStamp &stamp, VersionResource &vr);
+	void store(const VersionFileStamp &stamp, VersionResource &vr);
+	void invalidate(LPCPATHSTR path);
+	void clear();
+
+	void setBudget(uint64_t budget);
+	uint64_t budget() const;
+	void getStats(VersionCacheStats &stats) const;
+	void resetStats();
+
+protected:
+	struct FileIdentity
+	{
+		uint64_t fileId;
+		uint64_t device;
+
+		bool operator==(const FileIdentity &other) const { return fileId == other.fileId && device == other.device; }
+	};
+	struct FileIdentityHash
+	{
+		size_t operator()(const FileIdentity &id) const { return (size_t)(id.fileId ^ (id.device * 0x9E3779B97F4A7C15ull)); }
+	};
+	struct Entry
+	{
+		FileIdentity id;
+		VersionFileStamp stamp;
+		SharedVersionBlockPtr block;
+		size_t bytes; // estimated footprint. see footprint().
+	};
+	typedef std::list<Entry> EntryList; // most recently used first.
+	typedef std::unordered_map<FileIdentity, EntryList::iterator, FileIdentityHash> EntryMap;
+
+	EntryList _lru;
+	EntryMap _map;
+	mutable std::mutex _lock; // protects all members below and above.
+	uint64_t _budget;
+	uint64_t _residentBytes;
+	uint64_t _hits, _misses, _evictions;
+
+	void erase(EntryList::iterator it);
+	void trim();
+
+	static FileIdentity identityOf(const VersionFileStamp &stamp) { FileIdentity id = { stamp.fileId, stamp.device }; return id; }
+	static size_t footprint(const SharedVersionBlock &block);
+
+private:
+	VersionCache(const VersionCache&);
+	VersionCache& operator=(const VersionCache&);
+};
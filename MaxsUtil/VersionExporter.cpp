@@ -0,0 +1,706 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "VersionExporter.h"
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+
+// days from 1601-01-01, the FILETIME epoch, to 1970-01-01.
+#define FILETIME_DAYS_TO_1970 134774
+#define FILETIME_TICKS_PER_SECOND 10000000ULL
+
+static void _appendVarint(std::string &out, uint64_t v)
+{
+	while (v >= 0x80)
+	{
+		out.push_back((char)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((char)v);
+}
+
+static size_t _varintLen(uint64_t v)
+{
+	size_t n = 1;
+	while (v >= 0x80)
+	{
+		v >>= 7;
+		n++;
+	}
+	return n;
+}
+
+static void _appendUint32(std::string &out, uint32_t v)
+{
+	char b[4] = { (char)v, (char)(v >> 8), (char)(v >> 16), (char)(v >> 24) };
+	out.append(b, 4);
+}
+
+static void _appendDecimal(std::string &out, uint64_t v)
+{
+	char b[24];
+	size_t i = sizeof(b);
+	do
+	{
+		b[--i] = (char)('0' + v % 10);
+		v /= 10;
+	} while (v);
+	out.append(b + i, sizeof(b) - i);
+}
+
+// pathnames are UTF-8 already on Linux.
+static void _appendPath(std::string &out, const pathstring &path)
+{
+#ifdef _WIN32
+	appendUtf8(out, (LPCUTF16STR)path.c_str(), path.size());
+#else
+	out.append(path);
+#endif
+}
+
+// writes a FILETIME value as an ISO 8601 UTC time.
+static void _appendFileTime(std::string &out, uint64_t fileTime)
+{
+	uint64_t secs = fileTime / FILETIME_TICKS_PER_SECOND;
+	int64_t days = (int64_t)(secs / 86400) - FILETIME_DAYS_TO_1970;
+	uint32_t daySecs = (uint32_t)(secs % 86400);
+	// civil date of a day count from 1970-01-01, counted in 400-year eras starting on March 1st.
+	days += 719468;
+	int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+	uint32_t doe = (uint32_t)(days - era * 146097);
+	uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	uint32_t mp = (5 * doy + 2) / 153;
+	uint32_t day = doy - (153 * mp + 2) / 5 + 1;
+	uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+	int64_t year = (int64_t)yoe + era * 400 + (month <= 2 ? 1 : 0);
+	char b[32];
+	int n = snprintf(b, sizeof(b), "%04d-%02u-%02uT%02u:%02u:%02uZ", (int)year, month, day, daySecs / 3600, daySecs / 60 % 60, daySecs % 60);
+	out.append(b, n);
+}
+
+// writes the value of an attribute as text. an empty value writes nothing.
+static void _appendValueText(std::string &out, const VersionAttribData &value)
+{
+	switch (value.type)
+	{
+	case VAT_TEXT:
+		appendUtf8(out, value.text.c_str(), value.text.size());
+		break;
+	case VAT_NUMBER:
+		_appendDecimal(out, value.number);
+		break;
+	case VAT_FILETIME:
+		_appendFileTime(out, value.fileTime);
+		break;
+	default:
+		break;
+	}
+}
+
+// writes a CSV field. a field with a comma, a quote or a line break is quoted, and its quotes are doubled.
+static void _appendCsvField(std::string &out, const std::string &field)
+{
+	if (field.find_first_of(",\"\r\n") == std::string::npos)
+	{
+		out.append(field);
+		return;
+	}
+	out.push_back('"');
+	for (size_t i = 0; i < field.size(); i++)
+	{
+		if (field[i] == '"')
+			out.push_back('"');
+		out.push_back(field[i]);
+	}
+	out.push_back('"');
+}
+
+// writes a JSON string literal of UTF-8 text.
+static void _appendJsonString(std::string &out, const char *s, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	out.push_back('"');
+	for (size_t i = 0; i < len; i++)
+	{
+		unsigned char c = (unsigned char)s[i];
+		if (c == '"' || c == '\\')
+		{
+			out.push_back('\\');
+			out.push_back((char)c);
+		}
+		else if (c < 0x20)
+		{
+			switch (c)
+			{
+			case '\n': out.append("\\n", 2); break;
+			case '\r': out.append("\\r", 2); break;
+			case '\t': out.append("\\t", 2); break;
+			default:
+				out.append("\\u00", 4);
+				out.push_back(hex[c >> 4]);
+				out.push_back(hex[c & 15]);
+			}
+		}
+		else
+			out.push_back((char)c);
+	}
+	out.push_back('"');
+}
+
+
+VersionExporter::VersionExporter(VERSIONEXPORT_FORMAT format) :
+	_format(format), _errorCode(ERROR_SUCCESS), _rowsWritten(0), _bytesWritten(0),
+#ifdef _WIN32
+	_hfile(INVALID_HANDLE_VALUE),
+#else
+	_fd(-1),
+#endif
+	_ownsFile(false)
+{
+}
+
+/* open - creates the output file. An existing file is replaced.
+
+Parameters:
+path - [in] pathname of the file. NULL or "-" selects the standard output.
+*/
+uint32_t VersionExporter::open(LPCPATHSTR path)
+{
+	close();
+	_errorCode = ERROR_SUCCESS;
+	if (!path || (path[0] == '-' && path[1] == 0))
+	{
+#ifdef _WIN32
+		_hfile = GetStdHandle(STD_OUTPUT_HANDLE);
+		if (_hfile == NULL || _hfile == INVALID_HANDLE_VALUE)
+		{
+			_hfile = INVALID_HANDLE_VALUE;
+			return ERROR_INVALID_PARAMETER;
+		}
+#else
+		_fd = STDOUT_FILENO;
+#endif
+		_ownsFile = false;
+		return ERROR_SUCCESS;
+	}
+#ifdef _WIN32
+	_hfile = CreateFileW(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (_hfile == INVALID_HANDLE_VALUE)
+		return GetLastError();
+#else
+	_fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (_fd == -1)
+		return errnoToWin32(errno);
+#endif
+	_ownsFile = true;
+	return ERROR_SUCCESS;
+}
+
+/* close - closes the output file. The standard output is left open. */
+void VersionExporter::close()
+{
+#ifdef _WIN32
+	if (_hfile != INVALID_HANDLE_VALUE && _ownsFile)
+		CloseHandle(_hfile);
+	_hfile = INVALID_HANDLE_VALUE;
+#else
+	if (_fd != -1 && _ownsFile)
+		::close(_fd);
+	_fd = -1;
+#endif
+	_ownsFile = false;
+}
+
+/* write - writes bytes to the output. Workers call it concurrently. The first failure is kept, and later writes are dropped. */
+uint32_t VersionExporter::write(const void *data, size_t len)
+{
+	std::lock_guard<std::mutex> lock(_writeLock);
+	if (_errorCode != ERROR_SUCCESS)
+		return _errorCode;
+	const uint8_t *p = (const uint8_t*)data;
+	size_t remaining = len;
+	while (remaining)
+	{
+#ifdef _WIN32
+		DWORD cb = 0;
+		if (!WriteFile(_hfile, p, remaining > 0x40000000 ? 0x40000000 : (DWORD)remaining, &cb, NULL))
+		{
+			_errorCode = GetLastError();
+			return _errorCode;
+		}
+#else
+		ssize_t cb = ::write(_fd, p, remaining);
+		if (cb < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			_errorCode = errno == ENOSPC ? ERROR_WRITE_FAULT : errnoToWin32(errno);
+			return _errorCode;
+		}
+#endif
+		if (cb == 0)
+		{
+			_errorCode = ERROR_WRITE_FAULT;
+			return _errorCode;
+		}
+		p += cb;
+		remaining -= cb;
+	}
+	_bytesWritten += len;
+	return ERROR_SUCCESS;
+}
+
+/* flush - writes out the formatted rows of a worker. The buffer keeps its capacity. */
+void VersionExporter::flush(Worker &w)
+{
+	if (w.buf.empty())
+		return;
+	write(w.buf.data(), w.buf.size());
+	w.buf.clear();
+}
+
+/* begin - prepares the worker buffers and writes the header of the format. The output must have been opened.
+
+Parameters:
+names - [in] names of the attributes that follow the Path and Error columns.
+workerCount - [in] number of workers that will call writeRow.
+*/
+uint32_t VersionExporter::begin(const std::vector<std::u16string> &names, int workerCount)
+{
+#ifdef _WIN32
+	if (_hfile == INVALID_HANDLE_VALUE)
+#else
+	if (_fd == -1)
+#endif
+		return ERROR_INVALID_PARAMETER;
+	_names = names;
+	_rowsWritten = 0;
+	_workers.clear();
+	_workers.resize(workerCount > 0 ? workerCount : 1);
+	for (size_t i = 0; i < _workers.size(); i++)
+	{
+		_workers[i].buf.reserve(VERSIONEXPORT_FLUSH_SIZE + VERSIONEXPORT_FLUSH_SIZE / 4);
+		_workers[i].columns.resize(_names.size() + 1);
+	}
+	std::string header, name;
+	if (_format == VEF_CSV)
+	{
+		header = "Path,Error";
+		for (size_t i = 0; i < _names.size(); i++)
+		{
+			name.clear();
+			appendUtf8(name, _names[i].c_str(), _names[i].size());
+			header.push_back(',');
+			_appendCsvField(header, name);
+		}
+		header.append("\r\n", 2);
+	}
+	else if (_format == VEF_JSONL)
+	{
+		_jsonKeys.resize(_names.size());
+		for (size_t i = 0; i < _names.size(); i++)
+		{
+			name.clear();
+			appendUtf8(name, _names[i].c_str(), _names[i].size());
+			_jsonKeys[i] = ",";
+			_appendJsonString(_jsonKeys[i], name.data(), name.size());
+			_jsonKeys[i].push_back(':');
+		}
+	}
+	else
+	{
+		static const char *const fixedNames[] = { "Path", "Error" };
+		_appendUint32(header, VERSIONEXPORT_COLUMNAR_SIGNATURE);
+		uint16_t columnCount = (uint16_t)(_names.size() + 2);
+		char b[4] = { (char)VERSIONEXPORT_COLUMNAR_VERSION, (char)(VERSIONEXPORT_COLUMNAR_VERSION >> 8), (char)columnCount, (char)(columnCount >> 8) };
+		header.append(b, 4);
+		for (size_t i = 0; i < 2; i++)
+		{
+			_appendVarint(header, strlen(fixedNames[i]));
+			header.append(fixedNames[i]);
+		}
+		for (size_t i = 0; i < _names.size(); i++)
+		{
+			name.clear();
+			appendUtf8(name, _names[i].c_str(), _names[i].size());
+			_appendVarint(header, name.size());
+			header.append(name);
+		}
+	}
+	if (header.empty())
+		return ERROR_SUCCESS;
+	return write(header.data(), header.size());
+}
+
+/* writeRow - formats a row into the buffer of a worker, and writes the buffer out once it is full. */
+void VersionExporter::writeRow(int worker, const VersionScanRow &row)
+{
+	if (_errorCode != ERROR_SUCCESS)
+		return;
+	Worker &w = _workers[worker];
+	if (_format == VEF_CSV)
+		formatCsv(w, row);
+	else if (_format == VEF_JSONL)
+		formatJson(w, row);
+	else
+		addToGroup(w, row);
+	w.rows++;
+	if (w.buf.size() >= VERSIONEXPORT_FLUSH_SIZE)
+		flush(w);
+}
+
+/* end - writes out what the workers have left in their buffers, and the end of the format.
+
+Return value:
+ERROR_SUCCESS if all rows were written. Otherwise, the first write error.
+*/
+uint32_t VersionExporter::end()
+{
+	_rowsWritten = 0;
+	for (size_t i = 0; i < _workers.size(); i++)
+	{
+		if (_format == VEF_COLUMNAR && _workers[i].groupRows)
+			encodeGroup(_workers[i]);
+		flush(_workers[i]);
+		_rowsWritten += _workers[i].rows;
+	}
+	_workers.clear();
+	if (_format == VEF_COLUMNAR)
+	{
+		std::string trailer;
+		_appendUint32(trailer, VERSIONEXPORT_COLUMNAR_END);
+		_appendUint32(trailer, (uint32_t)_rowsWritten);
+		_appendUint32(trailer, (uint32_t)(_rowsWritten >> 32));
+		write(trailer.data(), trailer.size());
+	}
+	return _errorCode;
+}
+
+/* formatCsv - appends a CSV line of a row to a worker's buffer. */
+void VersionExporter::formatCsv(Worker &w, const VersionScanRow &row)
+{
+	w.key.clear();
+	_appendPath(w.key, row.path);
+	_appendCsvField(w.buf, w.key);
+	w.buf.push_back(',');
+	_appendDecimal(w.buf, row.errorCode);
+	for (size_t i = 0; i < _names.size(); i++)
+	{
+		w.buf.push_back(',');
+		if (i < row.values.size() && row.values[i].type != VAT_EMPTY)
+		{
+			w.key.clear();
+			_appendValueText(w.key, row.values[i]);
+			_appendCsvField(w.buf, w.key);
+		}
+	}
+	w.buf.append("\r\n", 2);
+}
+
+/* formatJson - appends a JSON object of a row and a line feed to a worker's buffer. */
+void VersionExporter::formatJson(Worker &w, const VersionScanRow &row)
+{
+	w.key.clear();
+	_appendPath(w.key, row.path);
+	w.buf.append("{\"Path\":", 8);
+	_appendJsonString(w.buf, w.key.data(), w.key.size());
+	w.buf.append(",\"Error\":", 9);
+	_appendDecimal(w.buf, row.errorCode);
+	for (size_t i = 0; i < _names.size(); i++)
+	{
+		w.buf.append(_jsonKeys[i]);
+		const VersionAttribData *value = i < row.values.size() ? &row.values[i] : NULL;
+		if (!value || value->type == VAT_EMPTY)
+			w.buf.append("null", 4);
+		else if (value->type == VAT_NUMBER)
+			_appendDecimal(w.buf, value->number);
+		else
+		{
+			w.key.clear();
+			_appendValueText(w.key, *value);
+			_appendJsonString(w.buf, w.key.data(), w.key.size());
+		}
+	}
+	w.buf.append("}\n", 2);
+}
+
+/* addToGroup - adds a row to the columnar row group a worker is building. A full group is encoded into the worker's buffer. */
+void VersionExporter::addToGroup(Worker &w, const VersionScanRow &row)
+{
+	w.key.clear();
+	_appendPath(w.key, row.path);
+	size_t shared = 0, n = w.key.size() < w.lastPath.size() ? w.key.size() : w.lastPath.size();
+	while (shared < n && w.key[shared] == w.lastPath[shared])
+		shared++;
+	_appendVarint(w.paths, shared);
+	_appendVarint(w.paths, w.key.size() - shared);
+	w.paths.append(w.key, shared, std::string::npos);
+	w.lastPath.swap(w.key);
+
+	for (size_t i = 0; i < w.columns.size(); i++)
+	{
+		w.key.clear();
+		if (i == 0)
+		{
+			w.key.push_back((char)VAT_NUMBER);
+			_appendVarint(w.key, row.errorCode);
+		}
+		else
+		{
+			const VersionAttribData *value = i - 1 < row.values.size() ? &row.values[i - 1] : NULL;
+			VERSION_ATTRIB_TYPE type = value ? value->type : VAT_EMPTY;
+			w.key.push_back((char)type);
+			if (type == VAT_NUMBER)
+				_appendVarint(w.key, value->number);
+			else if (type == VAT_FILETIME)
+				_appendVarint(w.key, value->fileTime);
+			else if (type == VAT_TEXT)
+			{
+				size_t pos = w.key.size();
+				appendUtf8(w.key, value->text.c_str(), value->text.size());
+				std::string len;
+				_appendVarint(len, w.key.size() - pos);
+				w.key.insert(pos, len);
+			}
+		}
+		Column &c = w.columns[i];
+		std::unordered_map<std::string, uint32_t>::iterator it = c.ids.find(w.key);
+		uint32_t id;
+		if (it == c.ids.end())
+		{
+			id = (uint32_t)c.ids.size();
+			c.ids.insert(std::make_pair(w.key, id));
+			c.dict.append(w.key);
+		}
+		else
+			id = it->second;
+		_appendVarint(c.indices, id);
+	}
+	if (++w.groupRows == VERSIONEXPORT_GROUP_ROWS)
+		encodeGroup(w);
+}
+
+/* encodeGroup - appends the row group a worker has built to its buffer, and starts a new group. */
+void VersionExporter::encodeGroup(Worker &w)
+{
+	size_t len = w.paths.size();
+	for (size_t i = 0; i < w.columns.size(); i++)
+		len += _varintLen(w.columns[i].ids.size()) + w.columns[i].dict.size() + w.columns[i].indices.size();
+	_appendUint32(w.buf, w.groupRows);
+	_appendUint32(w.buf, (uint32_t)len);
+	w.buf.append(w.paths);
+	for (size_t i = 0; i < w.columns.size(); i++)
+	{
+		Column &c = w.columns[i];
+		_appendVarint(w.buf, c.ids.size());
+		w.buf.append(c.dict);
+		w.buf.append(c.indices);
+		c.ids.clear();
+		c.dict.clear();
+		c.indices.clear();
+	}
+	w.groupRows = 0;
+	w.lastPath.clear();
+	w.paths.clear();
+}
+
+
+static bool _readVarint(const uint8_t *&p, const uint8_t *end, uint64_t &v)
+{
+	v = 0;
+	for (int shift = 0; p < end && shift < 64; shift += 7)
+	{
+		uint8_t b = *p++;
+		v |= (uint64_t)(b & 0x7F) << shift;
+		if (!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static bool _readText(const uint8_t *&p, const uint8_t *end, const char *&s, size_t &len)
+{
+	uint64_t n;
+	if (!_readVarint(p, end, n) || n > (uint64_t)(end - p))
+		return false;
+	s = (const char*)p;
+	len = (size_t)n;
+	p += len;
+	return true;
+}
+
+static uint32_t _readUint32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* open - maps a columnar export file and reads its header.
+
+Return value:
+ERROR_INVALID_DATA if the file is not in the columnar format. ERROR_NOT_SUPPORTED if it was written in a newer version of the format.
+*/
+uint32_t VersionColumnarReader::open(LPCPATHSTR path)
+{
+	_names.clear();
+	_totalRows = 0;
+	uint32_t errorCode = _mf.open(path);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	const uint8_t *p = _mf.data(), *end = p + _mf.size();
+	if (_mf.size() < 8 || _readUint32(p) != VERSIONEXPORT_COLUMNAR_SIGNATURE)
+		return ERROR_INVALID_DATA;
+	if ((p[4] | (p[5] << 8)) != VERSIONEXPORT_COLUMNAR_VERSION)
+		return ERROR_NOT_SUPPORTED;
+	size_t columnCount = p[6] | (p[7] << 8);
+	if (columnCount < 2)
+		return ERROR_INVALID_DATA;
+	p += 8;
+	for (size_t i = 0; i < columnCount; i++)
+	{
+		const char *s;
+		size_t len;
+		if (!_readText(p, end, s, len))
+			return ERROR_INVALID_DATA;
+		if (i < 2)
+			continue;
+		_names.push_back(std::u16string());
+		appendUtf16(_names.back(), s, len);
+	}
+	_pos = p - _mf.data();
+	return ERROR_SUCCESS;
+}
+
+/* readGroup - decodes the next row group.
+
+Parameters:
+rows - [out] receives the rows of the group. A row that could not be read (a non-zero errorCode) has no values.
+
+Return value:
+ERROR_HANDLE_EOF after the last group. totalRows() is valid then.
+*/
+uint32_t VersionColumnarReader::readGroup(std::vector<VersionScanRow> &rows)
+{
+	rows.clear();
+	if (!_mf.isOpen())
+		return ERROR_INVALID_PARAMETER;
+	const uint8_t *p = _mf.data() + _pos, *end = _mf.data() + _mf.size();
+	if (end - p < 8)
+		return ERROR_INVALID_DATA;
+	uint32_t rowCount = _readUint32(p);
+	if (rowCount == VERSIONEXPORT_COLUMNAR_END)
+	{
+		if (end - p < 12)
+			return ERROR_INVALID_DATA;
+		_totalRows = _readUint32(p + 4) | ((uint64_t)_readUint32(p + 8) << 32);
+		return ERROR_HANDLE_EOF;
+	}
+	uint32_t len = _readUint32(p + 4);
+	p += 8;
+	if (len > (size_t)(end - p) || rowCount > len)
+		return ERROR_INVALID_DATA;
+	end = p + len;
+
+	rows.resize(rowCount);
+	std::string path, prev;
+	for (uint32_t i = 0; i < rowCount; i++)
+	{
+		uint64_t shared;
+		const char *s;
+		size_t n;
+		if (!_readVarint(p, end, shared) || shared > prev.size() || !_readText(p, end, s, n))
+			return ERROR_INVALID_DATA;
+		path.assign(prev, 0, (size_t)shared);
+		path.append(s, n);
+#ifdef _WIN32
+		std::u16string u;
+		appendUtf16(u, path.data(), path.size());
+		rows[i].path.assign((const wchar_t*)u.c_str(), u.size());
+#else
+		rows[i].path = path;
+#endif
+		rows[i].errorCode = ERROR_SUCCESS;
+		rows[i].bytesRead = 0;
+		prev.swap(path);
+	}
+
+	std::vector<VersionAttribData> dict;
+	for (size_t col = 0; col < _names.size() + 1; col++)
+	{
+		uint64_t dictSize;
+		if (!_readVarint(p, end, dictSize) || dictSize > (uint64_t)(end - p))
+			return ERROR_INVALID_DATA;
+		dict.resize((size_t)dictSize);
+		for (size_t k = 0; k < dict.size(); k++)
+		{
+			if (p == end)
+				return ERROR_INVALID_DATA;
+			VersionAttribData &value = dict[k];
+			value.clear();
+			value.type = (VERSION_ATTRIB_TYPE)*p++;
+			uint64_t v = 0;
+			const char *s;
+			size_t n;
+			if (value.type == VAT_NUMBER || value.type == VAT_FILETIME)
+			{
+				if (!_readVarint(p, end, v))
+					return ERROR_INVALID_DATA;
+				if (value.type == VAT_NUMBER)
+					value.number = (uint32_t)v;
+				else
+					value.fileTime = v;
+			}
+			else if (value.type == VAT_TEXT)
+			{
+				if (!_readText(p, end, s, n))
+					return ERROR_INVALID_DATA;
+				appendUtf16(value.text, s, n);
+			}
+			else if (value.type != VAT_EMPTY)
+				return ERROR_INVALID_DATA;
+		}
+		for (uint32_t i = 0; i < rowCount; i++)
+		{
+			uint64_t id;
+			if (!_readVarint(p, end, id) || id >= dict.size())
+				return ERROR_INVALID_DATA;
+			VersionScanRow &row = rows[i];
+			if (col == 0)
+			{
+				row.errorCode = dict[(size_t)id].number;
+				if (row.errorCode == ERROR_SUCCESS)
+					row.values.resize(_names.size());
+			}
+			else if (row.errorCode == ERROR_SUCCESS)
+				row.values[col - 1] = dict[(size_t)id];
+		}
+	}
+	if (p != end)
+		return ERROR_INVALID_DATA;
+	_pos = end - _mf.data();
+	return ERROR_SUCCESS;
+}
@@ -0,0 +1,142 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "VersionScanner.h"
+#include "MappedFile.h"
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+
+// a worker writes its buffer out to the file when the buffer reaches this size. the lock on the file is taken once per buffer, not once per row.
+#define VERSIONEXPORT_FLUSH_SIZE (256 * 1024)
+// rows of a row group of the columnar format. a worker encodes a group once it has this many rows.
+#define VERSIONEXPORT_GROUP_ROWS 4096
+
+// signature of a columnar export file ('MXVC') and the marker of its end ('MXVE').
+#define VERSIONEXPORT_COLUMNAR_SIGNATURE 0x4356584D
+#define VERSIONEXPORT_COLUMNAR_END 0x4556584D
+#define VERSIONEXPORT_COLUMNAR_VERSION 1
+
+enum VERSIONEXPORT_FORMAT
+{
+	VEF_CSV, // RFC 4180 comma-separated values with a header line.
+	VEF_JSONL, // JSON Lines. an object per line.
+	VEF_COLUMNAR, // dictionary-encoded binary columns in row groups. see VersionExporter.
+};
+
+/* VersionExporter is a VersionScanSink that writes the rows of a scan to a file or to the standard output as they are produced. Each worker formats its rows into a buffer of its own, without locking. A full buffer is written out in one call under a lock. So, memory use is fixed by the number of workers, not by the number of files, and the export is bound by the disk rather than by allocation or contention. Rows are written in the order workers finish them, not sorted.
+
+Every format has the columns Path and Error (the Win32 error code of reading the file, 0 if it was read), followed by the requested attributes. Text is written in UTF-8. A number is written in decimal. A file time is written as an ISO 8601 UTC time (e.g., 2022-03-01T12:34:56Z) in CSV and JSON Lines. An attribute the file does not have is an empty field in CSV and null in JSON Lines.
+
+The columnar format is little-endian. A varint is an unsigned LEB128 integer.
+header: uint32 VERSIONEXPORT_COLUMNAR_SIGNATURE, uint16 VERSIONEXPORT_COLUMNAR_VERSION, uint16 column count, then a varint length and the UTF-8 bytes of each column name.
+row group: uint32 row count, uint32 byte length of the columns that follow, then a chunk per column.
+ Path chunk: a pathname per row, front-coded against the previous row of the group: varint length of the shared prefix, varint length of the rest, the rest (UTF-8).
+ other chunks: varint dictionary size, the dictionary entries, then a varint dictionary index per row. An entry is a VERSION_ATTRIB_TYPE byte followed by nothing (VAT_EMPTY), a varint (VAT_NUMBER, VAT_FILETIME; Error is stored as VAT_NUMBER), or a varint length and UTF-8 bytes (VAT_TEXT).
+end: uint32 VERSIONEXPORT_COLUMNAR_END, uint64 total row count.
+A dictionary covers one group. So, a worker can encode its groups independently. A version string or a company name repeats across thousands of files, and the dictionary stores it once per group. VersionColumnarReader reads the format back.
+*/
+class VersionExporter : public VersionScanSink
+{
+public:
+	VersionExporter(VERSIONEXPORT_FORMAT format);
+	~VersionExporter() { close(); }
+
+	uint32_t open(LPCPATHSTR path);
+	void close();
+	uint64_t rowsWritten() const { return _rowsWritten; }
+	uint64_t bytesWritten() const { return _bytesWritten; }
+
+	// VersionScanSink
+	virtual uint32_t begin(const std::vector<std::u16string> &names, int workerCount);
+	virtual void writeRow(int worker, const VersionScanRow &row);
+	virtual uint32_t end();
+
+protected:
+	// a dictionary-encoded column of a row group.
+	struct Column
+	{
+		std::unordered_map<std::string, uint32_t> ids; // encoded entry to its index.
+		std::string dict; // encoded entries in index order.
+		std::string indices; // varint index per row.
+	};
+	// per-worker state. only the owning worker touches it until end().
+	struct Worker
+	{
+		std::string buf; // formatted output not yet written.
+		uint32_t groupRows; // rows in the columnar group being built.
+		std::string lastPath; // previous pathname of the group, for front coding.
+		std::string paths; // the Path chunk of the group.
+		std::vector<Column> columns; // Error and the attributes.
+		std::string key; // scratch for encoding a value.
+		uint64_t rows; // rows written by the worker.
+		Worker() : groupRows(0), rows(0) {}
+	};
+
+	VERSIONEXPORT_FORMAT _format;
+	std::vector<std::u16string> _names;
+	std::vector<std::string> _jsonKeys; // ',"name":' of each attribute in UTF-8.
+	std::vector<Worker> _workers;
+	std::mutex _writeLock; // serializes writes to the output.
+	std::atomic<uint32_t> _errorCode; // the first write error.
+	uint64_t _rowsWritten; // set by end().
+	std::atomic<uint64_t> _bytesWritten;
+#ifdef _WIN32
+	HANDLE _hfile;
+#else
+	int _fd;
+#endif
+	bool _ownsFile; // false when writing to the standard output.
+
+	uint32_t write(const void *data, size_t len);
+	void flush(Worker &w);
+	void formatCsv(Worker &w, const VersionScanRow &row);
+	void formatJson(Worker &w, const VersionScanRow &row);
+	void addToGroup(Worker &w, const VersionScanRow &row);
+	void encodeGroup(Worker &w);
+
+private:
+	VersionExporter(const VersionExporter&);
+	VersionExporter& operator=(const VersionExporter&);
+};
+
+/* VersionColumnarReader reads a file written by VersionExporter in the columnar format, a row group at a time. The file is mapped. So, only the rows of the group being decoded take memory.
+*/
+class VersionColumnarReader
+{
+public:
+	VersionColumnarReader() : _pos(0), _totalRows(0) {}
+
+	uint32_t open(LPCPATHSTR path);
+	const std::vector<std::u16string> &attributes() const { return _names; }
+	uint32_t readGroup(std::vector<VersionScanRow> &rows);
+	uint64_t totalRows() const { return _totalRows; }
+
+protected:
+	MappedFile _mf;
+	size_t _pos; // offset of the next row group.
+	std::vector<std::u16string> _names; // column names after Path and Error.
+	uint64_t _totalRows; // set once the end marker has been read.
+};
@@ -0,0 +1,598 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "VersionFilter.h"
+#include <string.h>
+
+
+// instructions of the filter program.
+#define FILTEROP_NUMBER 1 // push _numbers[arg] as a number.
+#define FILTEROP_VERSION 2 // push _numbers[arg] as a version key.
+#define FILTEROP_TEXT 3 // push _strings[arg].
+#define FILTEROP_ATTRIB 4 // push the attribute named _strings[arg], or null.
+#define FILTEROP_FILEVERSION 5 // push the file version key of the fixed-length block, or null.
+#define FILTEROP_PRODUCTVERSION 6 // push the product version key, or null.
+#define FILTEROP_NOT 7
+#define FILTEROP_BITOR 8
+#define FILTEROP_BITAND 9
+#define FILTEROP_EQ 10
+#define FILTEROP_NE 11
+#define FILTEROP_LT 12
+#define FILTEROP_LE 13
+#define FILTEROP_GT 14
+#define FILTEROP_GE 15
+#define FILTEROP_MATCH 16
+#define FILTEROP_NOMATCH 17
+#define FILTEROP_ANDJUMP 18 // if the top is false, replace it with false and jump to arg. else, pop it.
+#define FILTEROP_ORJUMP 19 // if the top is true, replace it with true and jump to arg. else, pop it.
+#define FILTEROP_BOOL 20 // replace the top with its truth value.
+
+// precedence levels of the binary operators, from the lowest.
+#define FILTERLEVEL_OR 0
+#define FILTERLEVEL_AND 1
+#define FILTERLEVEL_COMPARE 2
+#define FILTERLEVEL_BITOR 3
+#define FILTERLEVEL_BITAND 4
+#define FILTERLEVEL_UNARY 5
+
+// types of a value on the evaluation stack.
+#define FILTERVAL_NULL 0
+#define FILTERVAL_NUMBER 1
+#define FILTERVAL_VERSION 2
+#define FILTERVAL_TEXT 3
+
+struct FilterValue
+{
+	int type;
+	uint64_t number; // FILTERVAL_NUMBER or FILTERVAL_VERSION.
+	LPCUTF16STR text; // FILTERVAL_TEXT. not null-terminated.
+	uint32_t textLen;
+};
+
+struct FilterConstant
+{
+	const char *name;
+	uint32_t value;
+};
+
+// the winver.h constants a filter can name.
+static const FilterConstant _filterConstants[] = {
+	{ "VS_FF_DEBUG", 0x01 },
+	{ "VS_FF_PRERELEASE", 0x02 },
+	{ "VS_FF_PATCHED", 0x04 },
+	{ "VS_FF_PRIVATEBUILD", 0x08 },
+	{ "VS_FF_INFOINFERRED", 0x10 },
+	{ "VS_FF_SPECIALBUILD", 0x20 },
+	{ "VFT_APP", 1 },
+	{ "VFT_DLL", 2 },
+	{ "VFT_DRV", 3 },
+	{ "VFT_FONT", 4 },
+	{ "VFT_VXD", 5 },
+	{ "VFT_STATIC_LIB", 7 },
+};
+
+static bool _isIdentChar(UTF16CHAR c, bool first)
+{
+	return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_' || (!first && c >= '0' && c <= '9');
+}
+
+static bool _equalsAscii(LPCUTF16STR s, size_t len, const char *ascii)
+{
+	size_t i = 0;
+	for (; i < len && ascii[i]; i++)
+	{
+		if (s[i] != (UTF16CHAR)ascii[i])
+			return false;
+	}
+	return i == len && ascii[i] == 0;
+}
+
+static bool _isTrue(const FilterValue &v)
+{
+	if (v.type == FILTERVAL_TEXT)
+		return v.textLen != 0;
+	return v.type != FILTERVAL_NULL && v.number != 0;
+}
+
+static void _setBool(FilterValue &v, bool b)
+{
+	v.type = FILTERVAL_NUMBER;
+	v.number = b ? 1 : 0;
+}
+
+// formats a number or a version in a caller's buffer, so that it can be matched against a pattern.
+static void _toText(FilterValue &v, UTF16CHAR *buf)
+{
+	if (v.type == FILTERVAL_TEXT)
+		return;
+	char a[32];
+	if (v.type == FILTERVAL_VERSION)
+		snprintf(a, sizeof(a), "%u.%u.%u.%u", VERSION_KEY_MAJOR(v.number), VERSION_KEY_MINOR(v.number), VERSION_KEY_REVISION(v.number), VERSION_KEY_BUILD(v.number));
+	else
+		snprintf(a, sizeof(a), "%llu", (unsigned long long)v.number);
+	size_t n = strlen(a);
+	for (size_t i = 0; i < n; i++)
+		buf[i] = (UTF16CHAR)a[i];
+	v.type = FILTERVAL_TEXT;
+	v.text = buf;
+	v.textLen = (uint32_t)n;
+}
+
+static bool _toVersion(const FilterValue &v, uint64_t *key)
+{
+	if (v.type == FILTERVAL_VERSION)
+		*key = v.number;
+	else if (v.type == FILTERVAL_NUMBER && v.number <= 0xFFFF)
+		*key = v.number << 48;
+	else if (v.type == FILTERVAL_TEXT)
+		return parseVersionKey(v.text, v.textLen, key) == ERROR_SUCCESS;
+	else
+		return false;
+	return true;
+}
+
+static bool _toNumber(const FilterValue &v, uint64_t *number)
+{
+	if (v.type == FILTERVAL_NUMBER)
+	{
+		*number = v.number;
+		return true;
+	}
+	if (v.type != FILTERVAL_TEXT || v.textLen == 0 || v.textLen > 19)
+		return false;
+	uint64_t n = 0;
+	for (uint32_t i = 0; i < v.textLen; i++)
+	{
+		if (v.text[i] < '0' || v.text[i] > '9')
+			return false;
+		n = n * 10 + (v.text[i] - '0');
+	}
+	*number = n;
+	return true;
+}
+
+/* _matchWildcard - matches text against a pattern of * and ? wildcards, ignoring the case of ASCII letters. A * that fails to match is retried one character further. Only the last * needs to be retried. So, the cost is linear in most cases and never worse than the product of the two lengths.
+*/
+static bool _matchWildcard(LPCUTF16STR s, size_t sLen, LPCUTF16STR p, size_t pLen)
+{
+	size_t i = 0, j = 0, star = (size_t)-1, mark = 0;
+	while (i < sLen)
+	{
+		if (j < pLen && p[j] == '*')
+		{
+			star = j++;
+			mark = i;
+		}
+		else if (j < pLen && (p[j] == '?' || utf16ToLower(p[j]) == utf16ToLower(s[i])))
+		{
+			i++;
+			j++;
+		}
+		else if (star != (size_t)-1)
+		{
+			j = star + 1;
+			i = ++mark;
+		}
+		else
+			return false;
+	}
+	while (j < pLen && p[j] == '*')
+		j++;
+	return j == pLen;
+}
+
+static bool _compare(int op, FilterValue &a, FilterValue &b, UTF16CHAR (*scratch)[24])
+{
+	if (a.type == FILTERVAL_NULL || b.type == FILTERVAL_NULL)
+		return false;
+	if (op == FILTEROP_MATCH || op == FILTEROP_NOMATCH)
+	{
+		_toText(a, scratch[0]);
+		_toText(b, scratch[1]);
+		return _matchWildcard(a.text, a.textLen, b.text, b.textLen) == (op == FILTEROP_MATCH);
+	}
+	int c;
+	uint64_t x, y;
+	if (a.type == FILTERVAL_VERSION || b.type == FILTERVAL_VERSION)
+	{
+		if (!_toVersion(a, &x) || !_toVersion(b, &y))
+			return false;
+		c = x < y ? -1 : x > y ? 1 : 0;
+	}
+	else if (a.type == FILTERVAL_TEXT && b.type == FILTERVAL_TEXT)
+		c = utf16icmp(a.text, a.textLen, b.text, b.textLen);
+	else
+	{
+		if (!_toNumber(a, &x) || !_toNumber(b, &y))
+			return false;
+		c = x < y ? -1 : x > y ? 1 : 0;
+	}
+	switch (op)
+	{
+	case FILTEROP_EQ: return c == 0;
+	case FILTEROP_NE: return c != 0;
+	case FILTEROP_LT: return c < 0;
+	case FILTEROP_LE: return c <= 0;
+	case FILTEROP_GT: return c > 0;
+	}
+	return c >= 0;
+}
+
+
+/* compile - parses a filter expression. The syntax is described in VersionFilter.h. An empty expression clears the filter, which then accepts every file.
+
+Parameters:
+text - [in] the expression. It need not be null-terminated.
+len - [in] number of characters in text.
+
+Return value:
+ERROR_INVALID_DATA - the expression has a syntax error. errorPosition() tells the offset of the character where parsing stopped. The filter is left empty.
+*/
+uint32_t VersionFilter::compile(LPCUTF16STR text, size_t len)
+{
+	clear();
+	_src = text;
+	_srcLen = len;
+	_pos = 0;
+	_depth = 0;
+	_nesting = 0;
+	skipSpace();
+	if (_pos == _srcLen)
+		return ERROR_SUCCESS;
+	uint32_t errorCode = parseBinary(FILTERLEVEL_OR);
+	skipSpace();
+	if (errorCode == ERROR_SUCCESS && (_pos != _srcLen || _maxStack > VERSIONFILTER_MAX_STACK))
+		errorCode = ERROR_INVALID_DATA;
+	if (errorCode != ERROR_SUCCESS)
+	{
+		size_t errorPos = _pos;
+		clear();
+		_errorPos = errorPos;
+		return errorCode;
+	}
+	_text.assign(text, len);
+	return ERROR_SUCCESS;
+}
+
+/* clear - empties the filter. An empty filter accepts every file. */
+void VersionFilter::clear()
+{
+	_text.clear();
+	_code.clear();
+	_numbers.clear();
+	_strings.clear();
+	_maxStack = 0;
+	_errorPos = 0;
+}
+
+void VersionFilter::skipSpace()
+{
+	while (_pos < _srcLen && (_src[_pos] == ' ' || _src[_pos] == '\t' || _src[_pos] == '\r' || _src[_pos] == '\n'))
+		_pos++;
+}
+
+void VersionFilter::emit(uint8_t op, uint32_t arg, int stackChange)
+{
+	Instruction in = { op, arg };
+	_code.push_back(in);
+	_depth += stackChange;
+	if (_depth > _maxStack)
+		_maxStack = _depth;
+}
+
+/* matchOperator - returns the FILTEROP_ code of a binary operator of a precedence level at the current position, or 0 if there is none. len receives the length of the operator. */
+int VersionFilter::matchOperator(int level, size_t *len)
+{
+	UTF16CHAR c = _pos < _srcLen ? _src[_pos] : 0;
+	UTF16CHAR c2 = _pos + 1 < _srcLen ? _src[_pos + 1] : 0;
+	*len = 2;
+	switch (level)
+	{
+	case FILTERLEVEL_OR:
+		return c == '|' && c2 == '|' ? FILTEROP_ORJUMP : 0;
+	case FILTERLEVEL_AND:
+		return c == '&' && c2 == '&' ? FILTEROP_ANDJUMP : 0;
+	case FILTERLEVEL_COMPARE:
+		if (c == '=' && c2 == '=')
+			return FILTEROP_EQ;
+		if (c == '!' && c2 == '=')
+			return FILTEROP_NE;
+		if (c == '!' && c2 == '~')
+			return FILTEROP_NOMATCH;
+		if (c == '<' && c2 == '=')
+			return FILTEROP_LE;
+		if (c == '>' && c2 == '=')
+			return FILTEROP_GE;
+		*len = 1;
+		return c == '<' ? FILTEROP_LT : c == '>' ? FILTEROP_GT : c == '~' ? FILTEROP_MATCH : 0;
+	case FILTERLEVEL_BITOR:
+		*len = 1;
+		return c == '|' && c2 != '|' ? FILTEROP_BITOR : 0;
+	case FILTERLEVEL_BITAND:
+		*len = 1;
+		return c == '&' && c2 != '&' ? FILTEROP_BITAND : 0;
+	}
+	return 0;
+}
+
+/* parseBinary - parses operands joined by the binary operators of a precedence level and those above it. || and && are compiled to conditional jumps, so that the right side is not evaluated when the left side decides the result. */
+uint32_t VersionFilter::parseBinary(int level)
+{
+	if (level == FILTERLEVEL_UNARY)
+		return parseUnary();
+	uint32_t errorCode = parseBinary(level + 1);
+	while (errorCode == ERROR_SUCCESS)
+	{
+		skipSpace();
+		size_t len;
+		int op = matchOperator(level, &len);
+		if (!op)
+			break;
+		_pos += len;
+		if (op == FILTEROP_ORJUMP || op == FILTEROP_ANDJUMP)
+		{
+			size_t jump = _code.size();
+			emit((uint8_t)op, 0, -1);
+			errorCode = parseBinary(level + 1);
+			emit(FILTEROP_BOOL, 0, 0);
+			_code[jump].arg = (uint32_t)_code.size();
+		}
+		else
+		{
+			errorCode = parseBinary(level + 1);
+			emit((uint8_t)op, 0, -1);
+		}
+	}
+	return errorCode;
+}
+
+/* parseUnary - parses a negation, a parenthesized expression or an operand. */
+uint32_t VersionFilter::parseUnary()
+{
+	skipSpace();
+	if (_pos == _srcLen)
+		return ERROR_INVALID_DATA;
+	UTF16CHAR c = _src[_pos];
+	if (c != '!' && c != '(')
+		return parseOperand();
+	if (++_nesting > VERSIONFILTER_MAX_NESTING)
+		return ERROR_INVALID_DATA;
+	_pos++;
+	uint32_t errorCode;
+	if (c == '!')
+	{
+		errorCode = parseUnary();
+		emit(FILTEROP_NOT, 0, 0);
+	}
+	else
+	{
+		errorCode = parseBinary(FILTERLEVEL_OR);
+		skipSpace();
+		if (errorCode == ERROR_SUCCESS && (_pos == _srcLen || _src[_pos++] != ')'))
+			errorCode = ERROR_INVALID_DATA;
+	}
+	_nesting--;
+	return errorCode;
+}
+
+/* parseOperand - parses a string, a number, a version, a constant or an attribute name. */
+uint32_t VersionFilter::parseOperand()
+{
+	UTF16CHAR c = _src[_pos];
+	if (c == '"' || c == '\'')
+	{
+		std::u16string s;
+		size_t i = _pos + 1;
+		for (; i < _srcLen && _src[i] != c; i++)
+		{
+			if (_src[i] == '\\' && i + 1 < _srcLen)
+				i++;
+			s.push_back(_src[i]);
+		}
+		if (i == _srcLen)
+			return ERROR_INVALID_DATA;
+		_pos = i + 1;
+		_strings.push_back(s);
+		emit(FILTEROP_TEXT, (uint32_t)_strings.size() - 1, 1);
+		return ERROR_SUCCESS;
+	}
+	if (c >= '0' && c <= '9')
+	{
+		size_t start = _pos;
+		uint64_t n = 0;
+		if (c == '0' && _pos + 1 < _srcLen && (_src[_pos + 1] == 'x' || _src[_pos + 1] == 'X'))
+		{
+			_pos += 2;
+			size_t digits = 0;
+			for (; _pos < _srcLen; _pos++, digits++)
+			{
+				UTF16CHAR d = _src[_pos];
+				int v = d >= '0' && d <= '9' ? d - '0' : d >= 'a' && d <= 'f' ? d - 'a' + 10 : d >= 'A' && d <= 'F' ? d - 'A' + 10 : -1;
+				if (v < 0)
+					break;
+				n = (n << 4) | v;
+			}
+			if (digits == 0 || digits > 16)
+				return ERROR_INVALID_DATA;
+			_numbers.push_back(n);
+			emit(FILTEROP_NUMBER, (uint32_t)_numbers.size() - 1, 1);
+			return ERROR_SUCCESS;
+		}
+		bool dotted = false;
+		while (_pos < _srcLen && ((_src[_pos] >= '0' && _src[_pos] <= '9') || _src[_pos] == '.'))
+			dotted |= _src[_pos++] == '.';
+		if (dotted)
+		{
+			if (parseVersionKey(_src + start, _pos - start, &n) != ERROR_SUCCESS)
+			{
+				_pos = start;
+				return ERROR_INVALID_DATA;
+			}
+			_numbers.push_back(n);
+			emit(FILTEROP_VERSION, (uint32_t)_numbers.size() - 1, 1);
+			return ERROR_SUCCESS;
+		}
+		if (_pos - start > 19)
+		{
+			_pos = start;
+			return ERROR_INVALID_DATA;
+		}
+		for (size_t i = start; i < _pos; i++)
+			n = n * 10 + (_src[i] - '0');
+		_numbers.push_back(n);
+		emit(FILTEROP_NUMBER, (uint32_t)_numbers.size() - 1, 1);
+		return ERROR_SUCCESS;
+	}
+	if (!_isIdentChar(c, true))
+		return ERROR_INVALID_DATA;
+	size_t start = _pos;
+	while (_pos < _srcLen && _isIdentChar(_src[_pos], false))
+		_pos++;
+	LPCUTF16STR name = _src + start;
+	size_t nameLen = _pos - start;
+	for (size_t i = 0; i < sizeof(_filterConstants) / sizeof(_filterConstants[0]); i++)
+	{
+		if (_equalsAscii(name, nameLen, _filterConstants[i].name))
+		{
+			_numbers.push_back(_filterConstants[i].value);
+			emit(FILTEROP_NUMBER, (uint32_t)_numbers.size() - 1, 1);
+			return ERROR_SUCCESS;
+		}
+	}
+	// the version numbers are compared as keys. read them from the fixed-length block rather than formatting and parsing them again.
+	if (utf16icmp(name, nameLen, u"FileVersion", 11) == 0)
+		emit(FILTEROP_FILEVERSION, 0, 1);
+	else if (utf16icmp(name, nameLen, u"ProductVersion", 14) == 0)
+		emit(FILTEROP_PRODUCTVERSION, 0, 1);
+	else
+	{
+		_strings.push_back(std::u16string(name, nameLen));
+		emit(FILTEROP_ATTRIB, (uint32_t)_strings.size() - 1, 1);
+	}
+	return ERROR_SUCCESS;
+}
+
+/* evaluate - runs the filter against a version resource. An empty filter returns true. String attributes are read from the first translation. A resource that is not loaded has no attributes. So, every attribute is null.
+
+Parameters:
+vr - [in] the version resource of a file.
+
+Return value:
+true if the file passes the filter.
+*/
+bool VersionFilter::evaluate(const VersionResource &vr) const
+{
+	if (_code.empty())
+		return true;
+	FilterValue stack[VERSIONFILTER_MAX_STACK];
+	UTF16CHAR scratch[2][24];
+	int sp = -1;
+	for (size_t pc = 0; pc < _code.size(); pc++)
+	{
+		const Instruction &in = _code[pc];
+		switch (in.op)
+		{
+		case FILTEROP_NUMBER:
+		case FILTEROP_VERSION:
+			stack[++sp].type = in.op == FILTEROP_NUMBER ? FILTERVAL_NUMBER : FILTERVAL_VERSION;
+			stack[sp].number = _numbers[in.arg];
+			break;
+		case FILTEROP_TEXT:
+			stack[++sp].type = FILTERVAL_TEXT;
+			stack[sp].text = _strings[in.arg].c_str();
+			stack[sp].textLen = (uint32_t)_strings[in.arg].size();
+			break;
+		case FILTEROP_ATTRIB:
+		{
+			FilterValue &v = stack[++sp];
+			VersionAttribValue value;
+			v.type = FILTERVAL_NULL;
+			if (vr.queryAttribute(_strings[in.arg].c_str(), _strings[in.arg].size(), 0, value) != ERROR_SUCCESS)
+				break;
+			if (value.type == VAT_NUMBER)
+			{
+				v.type = FILTERVAL_NUMBER;
+				v.number = value.number;
+			}
+			else if (value.type == VAT_FILETIME)
+			{
+				v.type = FILTERVAL_NUMBER;
+				v.number = value.fileTime;
+			}
+			else if (value.type == VAT_TEXT)
+			{
+				// the text points into the resource. FileVersion and ProductVersion, the two that are formatted into value.buf, do not come here.
+				v.type = FILTERVAL_TEXT;
+				v.text = value.text;
+				v.textLen = value.textLen;
+			}
+			break;
+		}
+		case FILTEROP_FILEVERSION:
+		case FILTEROP_PRODUCTVERSION:
+		{
+			FilterValue &v = stack[++sp];
+			uint64_t fileKey, productKey;
+			v.type = FILTERVAL_NULL;
+			if (vr.queryVersionKeys(&fileKey, &productKey) == ERROR_SUCCESS)
+			{
+				v.type = FILTERVAL_VERSION;
+				v.number = in.op == FILTEROP_FILEVERSION ? fileKey : productKey;
+			}
+			break;
+		}
+		case FILTEROP_NOT:
+			_setBool(stack[sp], !_isTrue(stack[sp]));
+			break;
+		case FILTEROP_BITOR:
+		case FILTEROP_BITAND:
+		{
+			FilterValue &a = stack[sp - 1], &b = stack[sp--];
+			if (a.type == FILTERVAL_NUMBER && b.type == FILTERVAL_NUMBER)
+				a.number = in.op == FILTEROP_BITOR ? a.number | b.number : a.number & b.number;
+			else
+				a.type = FILTERVAL_NULL;
+			break;
+		}
+		case FILTEROP_ANDJUMP:
+		case FILTEROP_ORJUMP:
+			if (_isTrue(stack[sp]) == (in.op == FILTEROP_ORJUMP))
+			{
+				_setBool(stack[sp], in.op == FILTEROP_ORJUMP);
+				pc = in.arg - 1;
+			}
+			else
+				sp--;
+			break;
+		case FILTEROP_BOOL:
+			_setBool(stack[sp], _isTrue(stack[sp]));
+			break;
+		default:
+		{
+			FilterValue &a = stack[sp - 1], &b = stack[sp--];
+			_setBool(a, _compare(in.op, a, b, scratch));
+			break;
+		}
+		}
+	}
+	return _isTrue(stack[0]);
+}
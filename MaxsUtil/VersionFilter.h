@@ -0,0 +1,81 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "VersionResource.h"
+#include <vector>
+
+
+// deepest nesting of parentheses and unary operators a filter may have. it bounds the recursion of the compiler.
+#define VERSIONFILTER_MAX_NESTING 64
+// most values a filter may have on its evaluation stack at once. evaluation uses a fixed array of this size.
+#define VERSIONFILTER_MAX_STACK 32
+
+/* VersionFilter is a boolean expression over version attributes. compile() parses the text once into a short program for a stack machine. evaluate() runs the program against a loaded VersionResource without allocating. Attributes are read straight from the decoded resource (FileVersion and ProductVersion from the fixed-length block as version keys, the others with queryAttribute). So, a scanner can reject a file before making a row of it. A compiled filter is not changed by evaluate. Threads can share one.
+
+Syntax:
+ expr: operand, or expr op expr. From the lowest precedence up, the operators are ||, &&, the comparisons (== != < <= > >= ~ !~), and the bitwise | and &. ! negates. Parentheses group.
+ operand: an attribute name (e.g., FileFlags or CompanyName), a string in double or single quotes, a decimal or 0x hex number, a version with 2 to 4 parts (e.g., 10.2), or a constant (VS_FF_DEBUG, VS_FF_PRERELEASE, VS_FF_PATCHED, VS_FF_PRIVATEBUILD, VS_FF_INFOINFERRED, VS_FF_SPECIALBUILD, VFT_APP, VFT_DLL, VFT_DRV, VFT_FONT, VFT_VXD, VFT_STATIC_LIB).
+ a ~ b is true if text a matches the wildcard pattern b (* for any run of characters, ? for one). !~ is its negation. Text comparisons ignore the case of ASCII letters.
+ If either side is a version, both are compared as versions. A number n then means version n.0.0.0, and text is parsed as a version. Otherwise, numbers compare as numbers and text as text.
+ An attribute the file does not have is null. A comparison with null, including != and !~, is false. In a boolean context, null, 0 and empty text are false.
+Example: CompanyName ~ "Contoso*" && FileVersion >= 10.2 && !(FileFlags & VS_FF_DEBUG)
+*/
+class VersionFilter
+{
+public:
+	VersionFilter() : _maxStack(0), _errorPos(0), _src(NULL), _srcLen(0), _pos(0), _depth(0), _nesting(0) {}
+
+	uint32_t compile(LPCUTF16STR text, size_t len);
+	void clear();
+	bool isEmpty() const { return _code.empty(); }
+	bool evaluate(const VersionResource &vr) const;
+	const std::u16string &text() const { return _text; }
+	size_t errorPosition() const { return _errorPos; }
+
+protected:
+	struct Instruction
+	{
+		uint8_t op; // FILTEROP_*
+		uint32_t arg; // index of a literal or a name, or a jump target.
+	};
+
+	std::u16string _text; // the source of the compiled filter.
+	std::vector<Instruction> _code;
+	std::vector<uint64_t> _numbers; // number and version literals.
+	std::vector<std::u16string> _strings; // text literals and attribute names.
+	int _maxStack; // deepest the evaluation stack gets.
+	size_t _errorPos; // offset in the source where compile failed.
+
+	// compiler state. valid during compile only.
+	LPCUTF16STR _src;
+	size_t _srcLen, _pos;
+	int _depth, _nesting;
+
+	uint32_t parseBinary(int level);
+	uint32_t parseUnary();
+	uint32_t parseOperand();
+	int matchOperator(int level, size_t *len);
+	void skipSpace();
+	void emit(uint8_t op, uint32_t arg, int stackChange);
+};
@@ -0,0 +1,492 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "VersionIndex.h"
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <errno.h>
+#endif
+
+
+// the hash table is kept at most half full.
+#define VERSIONINDEX_MIN_BUCKETS 16
+#define VERSIONINDEX_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+
+/* _isPersistentResult - tells if the result of loading a file's version resource depends on the file's content alone. A result like that can be remembered until the file changes. A sharing violation or an access error is not remembered. */
+static bool _isPersistentResult(uint32_t errorCode)
+{
+	switch (errorCode)
+	{
+	case ERROR_SUCCESS:
+	case ERROR_HANDLE_EOF:
+	case ERROR_BAD_EXE_FORMAT:
+	case ERROR_RESOURCE_DATA_NOT_FOUND:
+	case ERROR_RESOURCE_TYPE_NOT_FOUND:
+	case ERROR_RESOURCE_NAME_NOT_FOUND:
+	case ERROR_RESOURCE_LANG_NOT_FOUND:
+		return true;
+	}
+	return false;
+}
+
+/* hashPath - FNV-1a hash of a pathname. */
+uint32_t VersionIndex::hashPath(const pathstring &path)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < path.size(); i++)
+	{
+		hash ^= (uint32_t)path[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* getFileStamp - reads the size, modification time and file id of a file.
+
+Parameters:
+path - [in] pathname of the file.
+stamp - [out] receives the file's stamp.
+
+Return value:
+ERROR_FILE_NOT_FOUND if the file does not exist or is not a regular file.
+*/
+uint32_t VersionIndex::getFileStamp(LPCPATHSTR path, VersionFileStamp &stamp)
+{
+#ifdef _WIN32
+	// no access right is needed to read the file's attributes. so, the query works on a file locked by a running process, too.
+	HANDLE hfile = CreateFileW(path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+	if (hfile == INVALID_HANDLE_VALUE)
+		return GetLastError();
+	BY_HANDLE_FILE_INFORMATION fi;
+	BOOL ok = GetFileInformationByHandle(hfile, &fi);
+	uint32_t errorCode = ok ? ERROR_SUCCESS : GetLastError();
+	CloseHandle(hfile);
+	if (!ok)
+		return errorCode;
+	if (fi.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		return ERROR_FILE_NOT_FOUND;
+	stamp.size = ((uint64_t)fi.nFileSizeHigh << 32) | fi.nFileSizeLow;
+	stamp.modifiedTime = ((uint64_t)fi.ftLastWriteTime.dwHighDateTime << 32) | fi.ftLastWriteTime.dwLowDateTime;
+	stamp.fileId = ((uint64_t)fi.nFileIndexHigh << 32) | fi.nFileIndexLow;
+	stamp.device = fi.dwVolumeSerialNumber;
+#else//#ifdef _WIN32
+	struct stat st;
+	if (stat(path, &st) != 0)
+		return errno == EACCES ? ERROR_ACCESS_DENIED : ERROR_FILE_NOT_FOUND;
+	if (!S_ISREG(st.st_mode))
+		return ERROR_FILE_NOT_FOUND;
+	stamp.size = (uint64_t)st.st_size;
+	stamp.modifiedTime = (uint64_t)st.st_mtim.tv_sec * 1000000000u + (uint64_t)st.st_mtim.tv_nsec;
+	stamp.fileId = (uint64_t)st.st_ino;
+	stamp.device = (uint64_t)st.st_dev;
+#endif//#ifdef _WIN32
+	return ERROR_SUCCESS;
+}
+
+/* open - opens an index file. A missing file is not an error. The index starts out empty, and flush() creates the file. A file that is not a valid index (e.g., one written by an incompatible version) is treated the same way and is replaced on the next flush.
+
+Parameters:
+indexPath - [in] pathname of the index file.
+*/
+uint32_t VersionIndex::open(LPCPATHSTR indexPath)
+{
+	close();
+	_indexPath = indexPath;
+	uint32_t errorCode = mapIndex();
+	if (errorCode != ERROR_SUCCESS)
+		_indexPath.clear();
+	return errorCode;
+}
+
+/* close - closes the index without saving pending changes. Call flush() first to keep them. The counters are reset. */
+void VersionIndex::close()
+{
+	_file.close();
+	_header = NULL;
+	_buckets = NULL;
+	_pending.clear();
+	_indexPath.clear();
+	_dirty = false;
+	_hits = _misses = _stale = 0;
+}
+
+/* mapIndex - maps the index file and validates its header. */
+uint32_t VersionIndex::mapIndex()
+{
+	_header = NULL;
+	_buckets = NULL;
+	uint32_t errorCode = _file.open(_indexPath.c_str());
+	if (errorCode == ERROR_FILE_NOT_FOUND || errorCode == ERROR_HANDLE_EOF)
+		return ERROR_SUCCESS;
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	const VERSIONINDEX_HEADER *header = (const VERSIONINDEX_HEADER*)_file.data();
+	if (_file.size() < sizeof(VERSIONINDEX_HEADER) ||
+		header->signature != VERSIONINDEX_SIGNATURE ||
+		header->formatVersion != VERSIONINDEX_FORMAT_VERSION ||
+		header->pathCharSize != sizeof(PATHCHAR) ||
+		header->fileSize != _file.size() ||
+		header->bucketCount == 0 ||
+		(header->bucketCount & (header->bucketCount - 1)) != 0 ||
+		sizeof(VERSIONINDEX_HEADER) + (uint64_t)header->bucketCount * sizeof(uint32_t) > _file.size())
+	{
+		// not an index we can use. start over.
+		_file.close();
+		return ERROR_SUCCESS;
+	}
+	_header = header;
+	_buckets = (const uint32_t*)(header + 1);
+	return ERROR_SUCCESS;
+}
+
+/* findMapped - looks up a pathname in the mapped index. Returns NULL if the pathname is not in it. */
+const VERSIONINDEX_ENTRY *VersionIndex::findMapped(const pathstring &path, uint32_t hash) const
+{
+	if (!_header)
+		return NULL;
+	uint32_t mask = _header->bucketCount - 1;
+	for (uint32_t i = 0; i <= mask; i++)
+	{
+		uint32_t offset = _buckets[(hash + i) & mask];
+		if (offset == 0)
+			break;
+		if ((uint64_t)offset + sizeof(VERSIONINDEX_ENTRY) > _file.size())
+			break; // corrupt bucket.
+		const VERSIONINDEX_ENTRY *entry = (const VERSIONINDEX_ENTRY*)(_file.data() + offset);
+		if (entry->hash != hash || entry->pathLen != path.size())
+			continue;
+		if ((uint64_t)offset + sizeof(VERSIONINDEX_ENTRY) + (uint64_t)entry->pathLen * sizeof(PATHCHAR) + entry->dataLen > _file.size())
+			break;
+		if (memcmp(entryPath(entry), path.c_str(), path.size() * sizeof(PATHCHAR)) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+/* lookup - finds the entry of a file and returns the cached result if the file has not changed since the entry was made.
+
+Parameters:
+path - [in] pathname of the file.
+stamp - [in] current stamp of the file. See getFileStamp.
+errorCode - [out] receives the cached result of loading the file's version resource.
+data - [out] receives the version resource if errorCode is ERROR_SUCCESS.
+
+Return value:
+true if a valid entry was found. false if there is no entry or if the entry is stale.
+*/
+bool VersionIndex::lookup(const pathstring &path, const VersionFileStamp &stamp, uint32_t *errorCode, std::vector<uint8_t> &data)
+{
+	{
+		// an entry made since the index was opened takes precedence over the mapped one.
+		std::lock_guard<std::mutex> guard(_lock);
+		std::unordered_map<pathstring, PendingEntry>::const_iterator it = _pending.find(path);
+		if (it != _pending.end())
+		{
+			const PendingEntry &pe = it->second;
+			if (pe.removed || pe.stamp != stamp)
+			{
+				if (!pe.removed)
+					_stale++;
+				_misses++;
+				return false;
+			}
+			*errorCode = pe.errorCode;
+			data = pe.data;
+			_hits++;
+			return true;
+		}
+	}
+	const VERSIONINDEX_ENTRY *entry = findMapped(path, hashPath(path));
+	if (entry && entry->stamp == stamp)
+	{
+		*errorCode = entry->errorCode;
+		const uint8_t *p = entryData(entry);
+		data.assign(p, p + entry->dataLen);
+		_hits++;
+		return true;
+	}
+	if (entry)
+		_stale++;
+	_misses++;
+	return false;
+}
+
+/* store - adds or replaces the entry of a file. The entry is written to the index file by the next flush.
+
+Parameters:
+path - [in] pathname of the file.
+stamp - [in] the file's stamp at the time the version resource was read.
+errorCode - [in] result of loading the version resource.
+data - [in] the version resource, or NULL if errorCode is not ERROR_SUCCESS.
+dataLen - [in] byte length of data.
+*/
+void VersionIndex::store(const pathstring &path, const VersionFileStamp &stamp, uint32_t errorCode, const void *data, size_t dataLen)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	PendingEntry &pe = _pending[path];
+	pe.stamp = stamp;
+	pe.errorCode = errorCode;
+	pe.removed = false;
+	if (data)
+		pe.data.assign((const uint8_t*)data, (const uint8_t*)data + dataLen);
+	else
+		pe.data.clear();
+	_dirty = true;
+}
+
+/* invalidate - removes the entry of a file. The next lookup of the file misses, and the next flush drops the entry from the index file. */
+void VersionIndex::invalidate(const pathstring &path)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	PendingEntry &pe = _pending[path];
+	pe.removed = true;
+	pe.data.clear();
+	_dirty = true;
+}
+
+/* load - loads the version resource of a file through the index. If the index has a valid entry for the file, the resource is assigned from the entry, and the file is not opened. Otherwise, the resource is read from the file, and the result is entered in the index.
+
+Parameters:
+path - [in] pathname of the file.
+vr - [out] receives the version resource.
+
+Return value:
+same as VersionResource::load.
+*/
+uint32_t VersionIndex::load(LPCPATHSTR path, VersionResource &vr)
+{
+	VersionFileStamp stamp;
+	if (getFileStamp(path, stamp) != ERROR_SUCCESS)
+		return vr.load(path); // let the loader report the error.
+	return load(path, stamp, vr);
+}
+
+/* load - the same as load(path, vr) for a caller who has already read the file's stamp (e.g., VersionCache).
+*/
+uint32_t VersionIndex::load(LPCPATHSTR path, const VersionFileStamp &stamp, VersionResource &vr)
+{
+	pathstring key(path);
+	uint32_t errorCode;
+	std::vector<uint8_t> data;
+	if (lookup(key, stamp, &errorCode, data))
+	{
+		if (errorCode == ERROR_SUCCESS)
+			return vr.assign(data.data(), data.size());
+		vr.close();
+		return errorCode;
+	}
+	errorCode = vr.load(path);
+	if (_isPersistentResult(errorCode))
+	{
+		if (errorCode == ERROR_SUCCESS)
+			store(key, stamp, errorCode, vr.data(), vr.size());
+		else
+			store(key, stamp, errorCode, NULL, 0);
+	}
+	return errorCode;
+}
+
+/* getStats - returns the hit and miss counters and the number of entries. */
+void VersionIndex::getStats(VersionIndexStats &stats)
+{
+	stats.hits = _hits;
+	stats.misses = _misses;
+	stats.stale = _stale;
+	std::lock_guard<std::mutex> guard(_lock);
+	uint32_t entries = _header ? _header->entryCount : 0;
+	std::unordered_map<pathstring, PendingEntry>::const_iterator it;
+	for (it = _pending.begin(); it != _pending.end(); it++)
+	{
+		bool mapped = findMapped(it->first, hashPath(it->first)) != NULL;
+		if (it->second.removed)
+		{
+			if (mapped)
+				entries--;
+		}
+		else if (!mapped)
+			entries++;
+	}
+	stats.entries = entries;
+}
+
+/* flush - saves new and changed entries to the index file. The file is rewritten, and the entries replaced or invalidated since the last flush are dropped. Nothing is written if there has been no change. */
+uint32_t VersionIndex::flush()
+{
+	if (!isOpen())
+		return ERROR_INVALID_PARAMETER;
+	if (!_dirty)
+		return ERROR_SUCCESS;
+	return rewrite(false);
+}
+
+/* compact - rewrites the index file keeping only the entries of files which still exist and have not changed. Every file in the index is checked. So, it takes a while for a large index. Use it now and then to keep an index of a changing tree from growing. */
+uint32_t VersionIndex::compact()
+{
+	if (!isOpen())
+		return ERROR_INVALID_PARAMETER;
+	return rewrite(true);
+}
+
+/* rewrite - writes the live entries to a temporary file, and replaces the index file with it.
+
+Parameters:
+dropChanged - [in] true to check every entry against its file and drop the ones for files that have changed or are gone.
+*/
+uint32_t VersionIndex::rewrite(bool dropChanged)
+{
+	// a record to write. it points into the mapping or into _pending.
+	struct Item
+	{
+		LPCPATHSTR path;
+		uint32_t pathLen;
+		uint32_t hash;
+		const VersionFileStamp *stamp;
+		uint32_t errorCode;
+		const uint8_t *data;
+		uint32_t dataLen;
+		uint32_t offset;
+	};
+	std::vector<Item> items;
+	std::unordered_map<pathstring, PendingEntry>::const_iterator it;
+	for (it = _pending.begin(); it != _pending.end(); it++)
+	{
+		if (it->second.removed)
+			continue;
+		Item item = { it->first.c_str(), (uint32_t)it->first.size(), hashPath(it->first), &it->second.stamp, it->second.errorCode, it->second.data.data(), (uint32_t)it->second.data.size(), 0 };
+		items.push_back(item);
+	}
+	if (_header)
+	{
+		// every non-empty bucket refers to a distinct entry.
+		for (uint32_t i = 0; i < _header->bucketCount; i++)
+		{
+			uint32_t offset = _buckets[i];
+			if (offset == 0 || (uint64_t)offset + sizeof(VERSIONINDEX_ENTRY) > _file.size())
+				continue;
+			const VERSIONINDEX_ENTRY *entry = (const VERSIONINDEX_ENTRY*)(_file.data() + offset);
+			if ((uint64_t)offset + sizeof(VERSIONINDEX_ENTRY) + (uint64_t)entry->pathLen * sizeof(PATHCHAR) + entry->dataLen > _file.size())
+				continue;
+			pathstring path(entryPath(entry), entry->pathLen);
+			if (_pending.find(path) != _pending.end())
+				continue; // replaced or invalidated.
+			if (dropChanged)
+			{
+				VersionFileStamp stamp;
+				if (getFileStamp(path.c_str(), stamp) != ERROR_SUCCESS || stamp != entry->stamp)
+					continue;
+			}
+			Item item = { entryPath(entry), entry->pathLen, entry->hash, &entry->stamp, entry->errorCode, entryData(entry), entry->dataLen, 0 };
+			items.push_back(item);
+		}
+	}
+
+	// lay out the file.
+	uint32_t bucketCount = VERSIONINDEX_MIN_BUCKETS;
+	while (bucketCount < items.size() * 2)
+		bucketCount <<= 1;
+	uint64_t fileSize = VERSIONINDEX_ALIGN(sizeof(VERSIONINDEX_HEADER) + (size_t)bucketCount * sizeof(uint32_t));
+	std::vector<uint32_t> buckets(bucketCount, 0);
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		Item &item = items[i];
+		if (fileSize > 0xFFFFFFFF)
+			return ERROR_NOT_ENOUGH_MEMORY; // offsets are 32 bits wide.
+		item.offset = (uint32_t)fileSize;
+		fileSize += VERSIONINDEX_ALIGN(sizeof(VERSIONINDEX_ENTRY) + item.pathLen * sizeof(PATHCHAR) + item.dataLen);
+		uint32_t j = item.hash & (bucketCount - 1);
+		while (buckets[j])
+			j = (j + 1) & (bucketCount - 1);
+		buckets[j] = item.offset;
+	}
+
+	pathstring tempPath = _indexPath;
+#ifdef _WIN32
+	tempPath += L".tmp";
+	FILE *fp = _wfopen(tempPath.c_str(), L"wb");
+	if (!fp)
+		return GetLastError();
+#else//#ifdef _WIN32
+	tempPath += ".tmp";
+	FILE *fp = fopen(tempPath.c_str(), "wb");
+	if (!fp)
+		return errno == EACCES ? ERROR_ACCESS_DENIED : ERROR_PATH_NOT_FOUND;
+#endif//#ifdef _WIN32
+	VERSIONINDEX_HEADER header = { VERSIONINDEX_SIGNATURE, VERSIONINDEX_FORMAT_VERSION, sizeof(PATHCHAR), bucketCount, (uint32_t)items.size(), fileSize };
+	static const uint8_t padding[8] = { 0 };
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+		fwrite(buckets.data(), sizeof(uint32_t), bucketCount, fp) == bucketCount;
+	size_t written = sizeof(header) + bucketCount * sizeof(uint32_t);
+	if (ok && VERSIONINDEX_ALIGN(written) != written)
+		ok = fwrite(padding, VERSIONINDEX_ALIGN(written) - written, 1, fp) == 1;
+	for (size_t i = 0; ok && i < items.size(); i++)
+	{
+		const Item &item = items[i];
+		VERSIONINDEX_ENTRY entry = { item.hash, item.pathLen, *item.stamp, item.errorCode, item.dataLen };
+		size_t len = sizeof(entry) + item.pathLen * sizeof(PATHCHAR) + item.dataLen;
+		ok = fwrite(&entry, sizeof(entry), 1, fp) == 1 &&
+			fwrite(item.path, sizeof(PATHCHAR), item.pathLen, fp) == item.pathLen &&
+			(item.dataLen == 0 || fwrite(item.data, item.dataLen, 1, fp) == 1) &&
+			(VERSIONINDEX_ALIGN(len) == len || fwrite(padding, VERSIONINDEX_ALIGN(len) - len, 1, fp) == 1);
+	}
+	if (fclose(fp) != 0)
+		ok = false;
+	if (!ok)
+	{
+#ifdef _WIN32
+		DeleteFileW(tempPath.c_str());
+#else
+		remove(tempPath.c_str());
+#endif
+		return ERROR_WRITE_FAULT;
+	}
+
+	// the items point into the old mapping. it can go now. the mapping must be closed before the file can be replaced on Windows.
+	items.clear();
+	_file.close();
+	_header = NULL;
+	_buckets = NULL;
+	uint32_t errorCode = ERROR_SUCCESS;
+#ifdef _WIN32
+	if (!MoveFileExW(tempPath.c_str(), _indexPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		errorCode = GetLastError();
+		DeleteFileW(tempPath.c_str());
+	}
+#else
+	if (rename(tempPath.c_str(), _indexPath.c_str()) != 0)
+	{
+		errorCode = ERROR_ACCESS_DENIED;
+		remove(tempPath.c_str());
+	}
+#endif
+	if (errorCode == ERROR_SUCCESS)
+	{
+		// the pending entries are in the file now.
+		_pending.clear();
+		_dirty = false;
+	}
+	uint32_t mapError = mapIndex();
+	return errorCode != ERROR_SUCCESS ? errorCode : mapError;
+}
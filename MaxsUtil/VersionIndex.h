@@ -0,0 +1,149 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "MappedFile.h"
+#include "VersionResource.h"
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+
+/* VersionFileStamp identifies a particular state of a file. An index entry is reused only if all four members still match. The file id is the inode number on Linux and the NTFS file index on Windows. The device is st_dev on Linux and the volume serial number on Windows. The modification time is in nanoseconds since 1970 on Linux and in FILETIME units on Windows.
+*/
+struct VersionFileStamp
+{
+	uint64_t size;
+	uint64_t modifiedTime;
+	uint64_t fileId;
+	uint64_t device;
+
+	bool operator==(const VersionFileStamp &other) const
+	{
+		return size == other.size && modifiedTime == other.modifiedTime && fileId == other.fileId && device == other.device;
+	}
+	bool operator!=(const VersionFileStamp &other) const { return !(*this == other); }
+};
+
+/* layout of an index file. All numbers are little-endian.
+
+VERSIONINDEX_HEADER
+uint32_t buckets[bucketCount] - hash table of entry offsets. 0 marks an empty bucket. Collisions are resolved by linear probing.
+VERSIONINDEX_ENTRY records - each followed by the pathname (pathLen PATHCHARs) and the version resource (dataLen bytes), and padded to an 8-byte boundary.
+*/
+#define VERSIONINDEX_SIGNATURE 0x4956584D // 'MXVI'
+#define VERSIONINDEX_FORMAT_VERSION 1
+
+#pragma pack(push, 1)
+struct VERSIONINDEX_HEADER
+{
+	uint32_t signature;
+	uint16_t formatVersion;
+	uint16_t pathCharSize; // sizeof(PATHCHAR) of the platform that wrote the index.
+	uint32_t bucketCount; // a power of 2.
+	uint32_t entryCount;
+	uint64_t fileSize;
+};
+struct VERSIONINDEX_ENTRY
+{
+	uint32_t hash; // hash of the pathname.
+	uint32_t pathLen; // number of PATHCHARs in the pathname.
+	VersionFileStamp stamp;
+	uint32_t errorCode; // result of VersionResource::load. ERROR_SUCCESS if a version resource follows the pathname.
+	uint32_t dataLen; // byte length of the version resource.
+};
+#pragma pack(pop)
+
+/* VersionIndexStats are counters of index use since the index was opened. A stale lookup found an entry whose file has changed since. It is counted as a miss as well.
+*/
+struct VersionIndexStats
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t stale;
+	uint32_t entries;
+
+	double hitRate() const { return hits + misses ? (double)hits / (double)(hits + misses) : 0.0; }
+};
+
+/* VersionIndex is a persistent cache of version resources. It maps a file's pathname, size, modification time and file id to the file's VS_VERSIONINFO block, or to the reason the file has none. A repeated scan of a mostly unchanged tree then reads the version data of an unchanged file from the index instead of opening the file and walking its resource section. Files that are not executable are remembered, too. So, they are not opened again either.
+
+The index file is memory-mapped, and lookups are served from the mapping. New and changed entries are kept in memory until flush() rewrites the file. The rewrite drops entries replaced or invalidated since the index was opened, so that the file does not grow with stale records. compact() additionally drops entries of files that have changed or no longer exist.
+
+lookup, store, invalidate and load are safe to call from multiple threads. open, close, flush and compact are not. Call them while no other thread uses the index.
+*/
+class VersionIndex
+{
+public:
+	VersionIndex() : _header(NULL), _buckets(NULL), _dirty(false), _hits(0), _misses(0), _stale(0) {}
+	~VersionIndex() { close(); }
+
+	uint32_t open(LPCPATHSTR indexPath);
+	void close();
+	uint32_t flush();
+	uint32_t compact();
+
+	bool isOpen() const { return !_indexPath.empty(); }
+	LPCPATHSTR indexPath() const { return _indexPath.c_str(); }
+
+	uint32_t load(LPCPATHSTR path, VersionResource &vr);
+	uint32_t load(LPCPATHSTR path, const VersionFileStamp &stamp, VersionResource &vr);
+	bool lookup(const pathstring &path, const VersionFileStamp &stamp, uint32_t *errorCode, std::vector<uint8_t> &data);
+	void store(const pathstring &path, const VersionFileStamp &stamp, uint32_t errorCode, const void *data, size_t dataLen);
+	void invalidate(const pathstring &path);
+	void getStats(VersionIndexStats &stats);
+
+	static uint32_t getFileStamp(LPCPATHSTR path, VersionFileStamp &stamp);
+
+protected:
+	// an entry added or replaced since the index was opened.
+	struct PendingEntry
+	{
+		VersionFileStamp stamp;
+		uint32_t errorCode;
+		bool removed; // set by invalidate.
+		std::vector<uint8_t> data;
+	};
+
+	pathstring _indexPath;
+	MappedFile _file; // the index file as of the last open or flush.
+	const VERSIONINDEX_HEADER *_header;
+	const uint32_t *_buckets;
+	std::unordered_map<pathstring, PendingEntry> _pending; // protected by _lock.
+	std::mutex _lock;
+	bool _dirty;
+	std::atomic<uint64_t> _hits, _misses, _stale;
+
+	uint32_t mapIndex();
+	const VERSIONINDEX_ENTRY *findMapped(const pathstring &path, uint32_t hash) const;
+	uint32_t rewrite(bool dropChanged);
+
+	static uint32_t hashPath(const pathstring &path);
+	static LPCPATHSTR entryPath(const VERSIONINDEX_ENTRY *entry) { return (LPCPATHSTR)(entry + 1); }
+	static const uint8_t *entryData(const VERSIONINDEX_ENTRY *entry) { return (const uint8_t*)(entryPath(entry) + entry->pathLen); }
+
+private:
+	VersionIndex(const VersionIndex&);
+	VersionIndex& operator=(const VersionIndex&);
+};
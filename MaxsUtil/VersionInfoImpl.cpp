@@ -22,76 +22,8 @@
 */
 #include "stdafx.h"
 #include "VersionInfoImpl.h"
-
-
-/* fixed-length integer attributes available from the FixedFileInfo block of a version info resource */
-enum VI_FIXEDFILEATTRIBUTE {
-	VIFFA_Unknown,
-	VIFFA_FileVersion,
-	VIFFA_ProductVersion,
-	VIFFA_Signature,
-	VIFFA_StrucVersion,
-	VIFFA_FileVersionMS,
-	VIFFA_FileVersionLS,
-	VIFFA_ProductVersionMS,
-	VIFFA_ProductVersionLS,
-	VIFFA_FileFlagsMask,
-	VIFFA_FileFlags,
-	VIFFA_FileOS,
-	VIFFA_FileType,
-	VIFFA_FileSubtype,
-	VIFFA_FileDate,
-	VIFFA_Max
-};
-
-LPCWSTR VIFixedFileAttrbs[] = {
-	L"FileVersion",
-	L"ProductVersion",
-	L"Signature",
-	L"StrucVersion",
-	L"FileVersionMS",
-	L"FileVersionLS",
-	L"ProductVersionMS",
-	L"ProductVersionLS",
-	L"FileFlagsMask",
-	L"FileFlags",
-	L"FileOS",
-	L"FileType",
-	L"FileSubtype",
-	L"FileDate",
-};
-
-/* variable-length string attributes stored in a StringFileInfo block */
-enum VI_STRINGFILEATTRIBUTE {
-	VISFA_Unknown,
-	VISFA_Comments,
-	VISFA_CompanyName,
-	VISFA_FileDescription,
-	VISFA_FileVersion,
-	VISFA_InternalName,
-	VISFA_LegalCopyright,
-	VISFA_LegalTrademarks,
-	VISFA_OriginalFilename,
-	VISFA_ProductName,
-	VISFA_ProductVersion,
-	VISFA_PrivateBuild,
-	VISFA_SpecialBuild,
-};
-
-LPCWSTR VIStringFileAttribs[] = {
-	L"Comments",
-	L"CompanyName",
-	L"FileDescription",
-	L"FileVersion",
-	L"InternalName",
-	L"LegalCopyright",
-	L"LegalTrademarks",
-	L"OriginalFilename",
-	L"ProductName",
-	L"ProductVersion",
-	L"PrivateBuild",
-	L"SpecialBuild",
-};
+#include "VersionScanner.h"
+#include "CabinetFile.h"
 
 
 /* get_File - [propget] returns a pathname identifying a file for which version info is queried.
@@ -111,13 +43,22 @@ STDMETHODIMP VersionInfoImpl::get_File(/* [retval][out] */ BSTR *Value)
 /* put_File - [propput] accepts a pathname to a file for which vesion info is queried.
 
 Parameters:
-NewValue - [in] a pathname of a file. Version queries will be made against a version resource from this file.
+NewValue - [in] a pathname of a file. Version queries will be made against a version resource from this file. The file can also be a Windows Installer package (.msi). Its ProductVersion property is reported as both the file and the product version, and the ProductName, ProductVersion, Manufacturer (also as CompanyName), ProductCode and UpgradeCode properties as string attributes in the language of its ProductLanguage property. A file in a cabinet is named by the pathname of the cabinet and the pathname of the file in it, separated by a vertical bar, e.g., 'C:\Build\setup.cab|bin\app.dll'. The file is read from the cabinet without being extracted.
 */
 STDMETHODIMP VersionInfoImpl::put_File(/* [in] */ BSTR NewValue)
 {
 	_file.assignW(NewValue);
 	/* a new path is assigned. it's time to clear cached version info structure and language settings associated with the previous file. the resetting is necessary because it prevents the obsolete version data from charading as the new file's. it's important because one can use a VersionInfo instance on one file now and re-assign it to another file later. */
-	_vi.free();
+	// the resource list points into the mapping of the image, and the image into the mapping of _vi or _imageFile. release them in that order.
+	_resources.clear();
+	_image.clear();
+	_imageFile.close();
+	_imageRead = false;
+	_vi.close();
+	_digest.clear();
+	_codeViewRead = false;
+	_assemblyRead = false;
+	_resourcesRead = false;
 	_langId = _codepage = 0;
 	return S_OK;
 }
@@ -196,339 +137,1726 @@ STDMETHODIMP VersionInfoImpl::QueryTranslation(/* [in] */ short TranslationIndex
 	return S_OK;
 }
 
-/* get_VersionString - [propget] returns a file version number string. Generates an interface error if the file does not have a version resource. The VersionString property does not depend on Language and CodePage. The version property is backed by the fixed-length attributes of the dwFileVersionMS and dwFileVersionLS members of the FixedFileInfo structure.
+/* ScanDirectory - [method] walks a directory tree and reads version attributes of every executable file in it. Subdirectories are listed and files are parsed in parallel by a pool of worker threads. A file that is not a PE image is skipped.
 
 Parameters:
-Value - [retval][out] contains a version string of form <major>.<minor>.<revision>.<build>, If the file has a version resource. If not, an interface error of ERROR_RESOURCE_DATA_NOT_FOUND is returned.
+RootPath - [in] a pathname of the directory to scan.
+Recursive - [in, optional] VARIANT_TRUE (default) to scan subdirectories as well. VARIANT_FALSE to scan the files in RootPath only.
+Attributes - [in, optional] names of the attributes to read from each file. Pass an array of strings or a comma-separated list, e.g., 'FileVersion,ProductName'. If not specified, FileVersion, ProductName, ProductVersion and FileDescription are read. The names SHA256 and CRC32 add the SHA-256 (64 hex digits) and the CRC-32 of the whole file, and CheckSum, ComputedCheckSum, AuthenticodeHash, SignedHash, PdbPath, PdbGuid, PdbAge, SymbolKey, AssemblyName, AssemblyVersion, Culture and PublicKeyToken the values of the properties of those names. They are computed in the same pass that reads the version resource.
+Result - [retval][out] receives a 2-D array of VARIANTs. There is a row for each executable file found. Column 0 is the pathname of the file. Column 1 is a status code, 0 if the version resource was read, or an HRESULT explaining why it could not be (e.g., 0x80070715 for a file with no version resource). Columns 2 and after hold the values of the requested attributes in the order they were given. An attribute the file does not define is VT_EMPTY. The rows are sorted by pathname.
+
+Remarks:
+String attributes are read from the StringFileInfo table of the first translation of each file. The Language and CodePage properties are not used.
+If IndexFile is set, files that have not changed since they were last indexed are not opened. Their version resources are read from the index instead. The index file is updated when the scan completes.
+If RangeRead is set, files are read with positioned reads of their headers and version resources instead of being mapped. BytesRead then tells the total bytes the scan has read.
+If Filter is set, a file the filter rejects has no row. The filter is evaluated on the decoded version resource before a row is made.
+Files that are not executables are sorted out before they are mapped: by the extension first, e.g., .pdb, .txt or .png, and then by their first 64 bytes. A misnamed executable (e.g., a DLL saved as .txt) is therefore not scanned. ScanStatistics tells how many files each stage has sorted out.
 */
-STDMETHODIMP VersionInfoImpl::get_VersionString(/* [retval][out] */ BSTR *Value)
+STDMETHODIMP VersionInfoImpl::ScanDirectory(/* [in] */ BSTR RootPath, /* [in, optional] */ VARIANT *Recursive, /* [in, optional] */ VARIANT *Attributes, /* [retval][out] */ VARIANT *Result)
 {
-	VariantAutoRel var;
-	HRESULT hr = QueryAttribute(bstring(L"FileVersion"), var);
-	if (hr == S_OK)
-	{
-		*Value = var._v.bstrVal;
-		var.init();
-	}
-	return hr;
+	if (!RootPath || *RootPath == 0)
+		return E_INVALIDARG;
+	bool recursive;
+	HRESULT hr = parseRecursive(Recursive, &recursive);
+	if (hr != S_OK)
+		return hr;
+	std::vector<std::u16string> names;
+	hr = parseAttributeNames(Attributes, names);
+	if (hr != S_OK)
+		return hr;
+
+	std::vector<VersionScanRow> rows;
+	VersionScanner scanner;
+	scanner.setAttributes(names);
+	if (_index.isOpen())
+		scanner.setIndex(&_index);
+	scanner.setRangeRead(_vi.rangeRead());
+	if (!_filter.isEmpty())
+		scanner.setFilter(&_filter);
+	uint32_t errorCode = scanner.scan(RootPath, recursive, rows);
+	scanner.getClassifyStats(_scanStats);
+	_bytesRead = 0;
+	for (size_t i = 0; i < rows.size(); i++)
+		_bytesRead += rows[i].bytesRead;
+	// save what the scan has learned. a failure to write the index does not fail the scan.
+	_index.flush();
+	if (errorCode != ERROR_SUCCESS)
+		return HRESULT_FROM_WIN32(errorCode);
+	return rowsToArray(rows, names.size(), Result);
 }
 
-/* get_MajorVersion - [propget] returns the major version number of the file, or an interface error if the file has no version resource.
+/* WatchDirectory - [method] scans a directory tree the way ScanDirectory does, and keeps watching it. A background thread receives change notifications of the tree, and re-reads only the files that are created, written, renamed or removed. So, QueryWatched returns a current result without scanning the tree again, and the cost of keeping it current follows the number of changes, not the size of the tree. A watch started earlier by the same VersionInfo is stopped first.
 
 Parameters:
-Value - [retval][out] contains the major version number which is the high word part of the dwFileVersionMS member of the FixedFileInfo structure. If the file has no version resource, an interface error of ERROR_RESOURCE_DATA_NOT_FOUND is returned.
+RootPath - [in] a pathname of the directory to watch.
+Recursive - [in, optional] VARIANT_TRUE (default) to watch subdirectories as well.
+Attributes - [in, optional] names of the attributes to read from each file. See ScanDirectory.
+
+Remarks:
+Changes are applied in batches, a fraction of a second after the tree becomes quiet. Read WatchGeneration to tell if anything has changed since the last query. If the system drops notifications, the tree is scanned again in full.
+RangeRead and Filter apply to the files read by the watch. IndexFile does not.
 */
-STDMETHODIMP VersionInfoImpl::get_MajorVersion(/* [retval][out] */ long *Value)
+STDMETHODIMP VersionInfoImpl::WatchDirectory(/* [in] */ BSTR RootPath, /* [in, optional] */ VARIANT *Recursive, /* [in, optional] */ VARIANT *Attributes)
 {
-	long v;
-	HRESULT hr = queryVersionNumber(&v);
-	if (hr == S_OK)
-		*Value = HIWORD(v);
-	return hr;
+	if (!RootPath || *RootPath == 0)
+		return E_INVALIDARG;
+	bool recursive;
+	HRESULT hr = parseRecursive(Recursive, &recursive);
+	if (hr != S_OK)
+		return hr;
+	std::vector<std::u16string> names;
+	hr = parseAttributeNames(Attributes, names);
+	if (hr != S_OK)
+		return hr;
+	_watcher.stop();
+	_watcher.setAttributes(names);
+	_watcher.setRangeRead(_vi.rangeRead());
+	_watcher.setFilter(_filter);
+	return HRESULT_FROM_WIN32(_watcher.start(RootPath, recursive));
 }
 
-/* get_MajorVersion - [propget] returns the minor version number of the file, or an interface error if the file has no version resource.
+/* QueryWatched - [method] returns the current result of the watch started by WatchDirectory. The result is read from memory. No file is opened.
 
 Parameters:
-Value - [retval][out] contains the minor version number which is the low word part of the dwFileVersionMS member of the FixedFileInfo structure. If the file has no version resource, an interface error of ERROR_RESOURCE_DATA_NOT_FOUND is returned.
+Path - [in, optional] a pathname of a file or a subdirectory in the watched tree. It must begin with RootPath as it was passed to WatchDirectory. Only the row of the file, or the rows of the files under the subdirectory, are returned. If it is omitted, all rows are returned.
+Result - [retval][out] receives a 2-D array of VARIANTs in the layout of ScanDirectory.
+
+Remarks:
+If no watch has been started, an interface error of E_UNEXPECTED is returned. After StopWatching, the result of the last update is returned.
 */
-STDMETHODIMP VersionInfoImpl::get_MinorVersion(/* [retval][out] */ long *Value)
+STDMETHODIMP VersionInfoImpl::QueryWatched(/* [in, optional] */ VARIANT *Path, /* [retval][out] */ VARIANT *Result)
 {
-	long v;
-	HRESULT hr = queryVersionNumber(&v);
-	if (hr == S_OK)
-		*Value = LOWORD(v);
-	return hr;
+	if (_watcher.rootPath().empty())
+		return E_UNEXPECTED;
+	std::wstring under;
+	if (Path && Path->vt != VT_ERROR && Path->vt != VT_EMPTY)
+	{
+		VariantAutoRel var;
+		HRESULT hr = VariantChangeType(var, Path, 0, VT_BSTR);
+		if (hr != S_OK)
+			return hr;
+		under.assign(var._v.bstrVal ? var._v.bstrVal : L"");
+	}
+	std::vector<VersionScanRow> rows;
+	_watcher.snapshot(rows, under);
+	return rowsToArray(rows, _watcher.attributes().size(), Result);
+}
+
+/* StopWatching - [method] stops the watch started by WatchDirectory. The last result stays available to QueryWatched.
+*/
+STDMETHODIMP VersionInfoImpl::StopWatching()
+{
+	_watcher.stop();
+	return S_OK;
 }
 
-/* _getFixedFileAttributeId - a helper to find an enumeration ordinal of VI_FIXEDFILEATTRIBUTE corresponding to an attribute of the FixedFileInfo block. For example, the function returns VIFFA_ProductVersion for an attribute name of 'ProductVersion'.
+/* get_WatchGeneration - [propget] returns a number that increases every time the watch applies a batch of changes. A dashboard can poll it, and call QueryWatched only when it changes.
 
 Parameters:
-attribName - [in] contains an attribute name for which an VI_FIXEDFILEATTRIBUTE ordinal is searched.
+Value - [retval][out] contains the generation. It is 0 if no watch has been started.
 */
-VI_FIXEDFILEATTRIBUTE _getFixedFileAttributeId(LPCWSTR attribName)
+STDMETHODIMP VersionInfoImpl::get_WatchGeneration(/* [retval][out] */ long *Value)
 {
-	for (int i = 0; i < ARRAYSIZE(VIFixedFileAttrbs); i++)
-	{
-		if (0 == _wcsicmp(attribName, VIFixedFileAttrbs[i]))
-			return (VI_FIXEDFILEATTRIBUTE)(i+1);
-	}
-	// attribName is not a fixed-length attribute. perhaps, it's a string attribute.
-	return VIFFA_Unknown;
+	*Value = (long)_watcher.generation();
+	return S_OK;
 }
 
-/* _getStringFileAttributeId - a helper to find an ordinal corresponding to a string attribute of StringFileInfo.
+/* get_Filter - [propget] returns the filter expression in use, or an empty string if there is none.
 
 Parameters:
-attribName - [in] contains an attribute name for which an VI_STRINGFILEATTRIBUTE ordinal is searched.
+Value - [retval][out] contains the expression.
 */
-VI_STRINGFILEATTRIBUTE _getStringFileAttributeId(LPCWSTR attribName)
+STDMETHODIMP VersionInfoImpl::get_Filter(/* [retval][out] */ BSTR *Value)
 {
-	for (int i = 0; i < ARRAYSIZE(VIStringFileAttribs); i++)
-	{
-		if (0 == _wcsicmp(attribName, VIStringFileAttribs[i]))
-			return (VI_STRINGFILEATTRIBUTE)(i + 1);
-	}
-	return VISFA_Unknown;
+	bstring v((LPCWSTR)_filter.text().c_str());
+	*Value = v.detach();
+	return S_OK;
 }
 
-/* QueryAttribute - [method] tries to find a version attribute and returns its value. If the file has no version resource, an interface error of ERROR_RESOURCE_DATA_NOT_FOUND is generated. If the file defines a version resource, but if the particular attribute does not exist, an interface error of ERROR_RESOURCE_TYPE_NOT_FOUND is generated.
+/* put_Filter - [propput] sets an expression that selects the files ScanDirectory, ExportDirectory and WatchDirectory return. The expression is compiled once, here. The scanner then evaluates it on the decoded version resource of each file, before making a row. So, a rejected file costs no strings or VARIANTs. A watch started earlier keeps the filter it was started with.
 
 Parameters:
-Name - [in] contains the name of an attribute to search the version info for.
-Value - [retval][out] contains the value of the queried attribute. The data type of the value returned depends on the queried attribute. A query for a fixed-length attribute returns the value as an integer (i.e., Value->vt==VT_I4). A query for a string attribute returns the value as a character string (i.e., Value->vt==VT_BSTR).
+NewValue - [in] a filter expression, e.g., 'CompanyName ~ "Contoso*" && FileVersion >= 10.2 && !(FileFlags & VS_FF_DEBUG)'. An empty string removes the filter.
+
+Remarks:
+The operators are || && ! == != < <= > >= ~ (wildcard match) !~ & and |. Operands are attribute names, quoted strings, numbers, versions like 10.2, and the VS_FF_ and VFT_ constants of winver.h. If either side of a comparison is a version, both are compared as versions. An attribute a file does not have makes any comparison with it false. See VersionFilter.h for details.
+If the expression has a syntax error, an interface error of E_INVALIDARG is returned, and the filter is removed.
 */
-STDMETHODIMP VersionInfoImpl::QueryAttribute(/* [in] */ BSTR Name, /* [retval][out] */ VARIANT *Value)
+STDMETHODIMP VersionInfoImpl::put_Filter(/* [in] */ BSTR NewValue)
 {
-	if (!Name || *Name == 0)
+	if (_filter.compile((LPCUTF16STR)(NewValue ? NewValue : L""), NewValue ? SysStringLen(NewValue) : 0) != ERROR_SUCCESS)
 		return E_INVALIDARG;
+	return S_OK;
+}
 
-	HRESULT hr;
-	bstring value;
-	UINT dataLen = 0;
-	VI_FIXEDFILEATTRIBUTE ffa = _getFixedFileAttributeId(Name);
-	if (ffa != VIFFA_Unknown)
-	{
-		// a fixed-length attribute from the FixedFileInfo block is being requested for.
-		// retrieve the block.
-		VS_FIXEDFILEINFO* pVSFFI = NULL;
-		hr = queryAttribData(L"\\", (LPVOID*)&pVSFFI, &dataLen);
-		if (hr == S_OK)
-		{
-			if (ffa == VIFFA_FileVersion)
-			{
-				// return the file version as a BSTR in a <major>.<minor>.<revision>.<build> format.
-				value.format(L"%d.%d.%d.%d", HIWORD(pVSFFI->dwFileVersionMS), LOWORD(pVSFFI->dwFileVersionMS), HIWORD(pVSFFI->dwFileVersionLS), LOWORD(pVSFFI->dwFileVersionLS)
-				);
-				Value->vt = VT_BSTR;
-				Value->bstrVal = value.detach();
-			}
-			else if (ffa == VIFFA_ProductVersion)
-			{
-				// return the product version as a BSTR in a <major>.<minor>.<revision>.<build> format.
-				value.format(L"%d.%d.%d.%d", HIWORD(pVSFFI->dwProductVersionMS), LOWORD(pVSFFI->dwProductVersionMS), HIWORD(pVSFFI->dwProductVersionLS), LOWORD(pVSFFI->dwProductVersionLS)
-				);
-				Value->vt = VT_BSTR;
-				Value->bstrVal = value.detach();
-			}
-			else if (ffa == VIFFA_Signature)
-			{
-				hr = queryAttribData(L"\\", (LPVOID*)&pVSFFI, &dataLen);
-				if (hr == S_OK)
-				{
-					Value->vt = VT_I4;
-					Value->lVal = pVSFFI->dwSignature;
-				}
-			}
-			else if (ffa == VIFFA_StrucVersion)
-			{
-				Value->vt = VT_I4;
-				Value->lVal = pVSFFI->dwStrucVersion;
-			}
-			else if (ffa == VIFFA_FileVersionMS)
-			{
-				Value->vt = VT_I4;
-				Value->lVal = pVSFFI->dwFileVersionMS;
-			}
-			else if (ffa == VIFFA_FileVersionLS)
-			{
-				Value->vt = VT_I4;
-				Value->lVal = pVSFFI->dwFileVersionLS;
-			}
-			else if (ffa == VIFFA_ProductVersionMS)
-			{
-				Value->vt = VT_I4;
-				Value->lVal = pVSFFI->dwProductVersionMS;
-			}
-			else if (ffa == VIFFA_ProductVersionLS)
-			{
-				Value->vt = VT_I4;
-				Value->lVal = pVSFFI->dwProductVersionLS;
-			}
-			else if (ffa == VIFFA_FileFlagsMask)
-			{
-				Value->vt = VT_I4;
-				Value->lVal = pVSFFI->dwFileFlagsMask;
-			}
-			else if (ffa == VIFFA_FileFlags)
-			{
-				Value->vt = VT_I4;
-				Value->lVal = pVSFFI->dwFileFlags;
-			}
-			else if (ffa == VIFFA_FileOS)
-			{
-				Value->vt = VT_I4;
-				Value->lVal = pVSFFI->dwFileOS;
-			}
-			else if (ffa == VIFFA_FileType)
-			{
-				Value->vt = VT_I4;
-				Value->lVal = pVSFFI->dwFileType;
-			}
-			else if (ffa == VIFFA_FileSubtype)
-			{
-				Value->vt = VT_I4;
-				Value->lVal = pVSFFI->dwFileSubtype;
-			}
-			else if (ffa == VIFFA_FileDate)
-			{
-				// convert the file date in FILETIME to OLE date.
-				if (pVSFFI->dwFileDateMS && pVSFFI->dwFileDateLS)
-				{
-					FILETIME ft;
-					ft.dwHighDateTime = pVSFFI->dwFileDateMS;
-					ft.dwLowDateTime = pVSFFI->dwFileDateLS;
-					SYSTEMTIME st;
-					FileTimeToSystemTime(&ft, &st);
-					if (SystemTimeToVariantTime(&st, &Value->date))
-						Value->vt = VT_DATE;
-					else
-						hr = S_FALSE;
-				}
-				else
-					hr = S_FALSE;
-			}
-			else
-				hr = E_INVALIDARG;
-		}
+/* ExportDirectory - [method] scans a directory tree the way ScanDirectory does, and writes the rows to a file as they are read instead of returning them. Memory use stays the same however many files the tree has. Each worker thread formats its rows into a buffer of its own, and a full buffer is written to the file in one call.
+
+Parameters:
+RootPath - [in] a pathname of the directory to scan.
+OutputPath - [in] a pathname of the file to write. An existing file is replaced. Pass '-' to write to the standard output.
+Format - [in, optional] 'csv', 'jsonl' or 'columnar'. If not specified, the format is chosen by the extension of OutputPath: .jsonl or .json for JSON Lines, .mxvc for columnar, and CSV otherwise.
+Recursive - [in, optional] VARIANT_TRUE (default) to scan subdirectories as well.
+Attributes - [in, optional] names of the attributes to read from each file. See ScanDirectory.
+RowCount - [retval][out] receives the number of rows written.
+
+Remarks:
+The columns are Path, Error (a Win32 error code, 0 if the version resource was read) and the requested attributes. Text is encoded in UTF-8. A file time is written as an ISO 8601 UTC time in CSV and JSON Lines. The rows are not sorted. The columnar format stores the rows in groups of 4096. A column of a group is dictionary-encoded, so that a value repeated across files is stored once. See VersionExporter.h for the layout.
+IndexFile, RangeRead and Filter apply as they do to ScanDirectory, and so does the sorting out of files that are not executables. BytesRead is not updated. ScanStatistics is.
+*/
+STDMETHODIMP VersionInfoImpl::ExportDirectory(/* [in] */ BSTR RootPath, /* [in] */ BSTR OutputPath, /* [in, optional] */ VARIANT *Format, /* [in, optional] */ VARIANT *Recursive, /* [in, optional] */ VARIANT *Attributes, /* [retval][out] */ double *RowCount)
+{
+	if (!RootPath || *RootPath == 0 || !OutputPath || *OutputPath == 0)
+		return E_INVALIDARG;
+	VERSIONEXPORT_FORMAT format;
+	HRESULT hr = parseExportFormat(Format, OutputPath, &format);
+	if (hr != S_OK)
+		return hr;
+	bool recursive;
+	hr = parseRecursive(Recursive, &recursive);
+	if (hr != S_OK)
+		return hr;
+	std::vector<std::u16string> names;
+	hr = parseAttributeNames(Attributes, names);
+	if (hr != S_OK)
+		return hr;
+
+	VersionExporter exporter(format);
+	uint32_t errorCode = exporter.open(OutputPath);
+	if (errorCode != ERROR_SUCCESS)
+		return HRESULT_FROM_WIN32(errorCode);
+	VersionScanner scanner;
+	scanner.setAttributes(names);
+	if (_index.isOpen())
+		scanner.setIndex(&_index);
+	scanner.setRangeRead(_vi.rangeRead());
+	if (!_filter.isEmpty())
+		scanner.setFilter(&_filter);
+	errorCode = scanner.scan(RootPath, recursive, exporter);
+	scanner.getClassifyStats(_scanStats);
+	exporter.close();
+	_index.flush();
+	if (errorCode != ERROR_SUCCESS)
+		return HRESULT_FROM_WIN32(errorCode);
+	*RowCount = (double)exporter.rowsWritten();
+	return S_OK;
+}
+
+/* parseExportFormat - converts the Format argument of ExportDirectory to an export format. A missing argument selects a format by the extension of the output pathname. */
+HRESULT VersionInfoImpl::parseExportFormat(VARIANT *Format, LPCWSTR outputPath, VERSIONEXPORT_FORMAT *format)
+{
+	LPCWSTR name = NULL;
+	VariantAutoRel var;
+	if (Format && Format->vt != VT_ERROR && Format->vt != VT_EMPTY)
+	{
+		HRESULT hr = VariantChangeType(var, Format, 0, VT_BSTR);
+		if (FAILED(hr))
+			return hr;
+		name = var._v.bstrVal ? var._v.bstrVal : L"";
 	}
 	else
 	{
-		// the caller wants a variable-length text attribute, e.g., ProductName.
-		// before we can make the query, we need a valid language-codepage translation. so, make sure we have one.
-		ensureLangCp();
-		// build a path for the attribute. it's in form "\StringFileInfo\<LangId><CodePage>\<Attribute>".
-		bstring sfi;
-		sfi.format(L"\\StringFileInfo\\%04X%04X\\%s", _langId, _codepage, Name);
-		// retrieve the value of the attribute.
-		LPCWSTR attribData = NULL;
-		hr = queryAttribData(sfi, (LPVOID*)&attribData, &dataLen);
-		if (hr == S_OK)
-		{
-			// dataLen has the number of characters of the string in attribData including a termination null.
-			value.assignW(attribData, dataLen - 1);
-			Value->vt = VT_BSTR;
-			Value->bstrVal = value.detach();
-		}
+		LPCWSTR ext = wcsrchr(outputPath, '.');
+		if (ext && !wcschr(ext, '\\') && !wcschr(ext, '/'))
+			name = ext + 1;
 	}
-	return hr;
+	*format = VEF_CSV;
+	if (!name || _wcsicmp(name, L"csv") == 0)
+		return S_OK;
+	if (_wcsicmp(name, L"jsonl") == 0 || _wcsicmp(name, L"json") == 0)
+		*format = VEF_JSONL;
+	else if (_wcsicmp(name, L"columnar") == 0 || _wcsicmp(name, L"mxvc") == 0)
+		*format = VEF_COLUMNAR;
+	else if (Format && Format->vt != VT_ERROR && Format->vt != VT_EMPTY)
+		return E_INVALIDARG;
+	return S_OK;
 }
 
-/* ensureLangCp - makes sure we have a valid language and codepage. If the automation user has not set them, adopt the first entry in the translation block. */
-HRESULT VersionInfoImpl::ensureLangCp()
+/* parseRecursive - converts the Recursive argument of ScanDirectory or WatchDirectory to a bool. A missing argument is true. */
+HRESULT VersionInfoImpl::parseRecursive(VARIANT *Recursive, bool *recursive)
 {
-	if (_langId != 0 && _codepage != 0)
-		return S_FALSE;
-	DWORD defLangCp = queryLangCp(NULL);
-	_langId = LOWORD(defLangCp);
-	_codepage = HIWORD(defLangCp);
+	*recursive = true;
+	if (!Recursive || Recursive->vt == VT_ERROR || Recursive->vt == VT_EMPTY)
+		return S_OK;
+	VariantAutoRel var;
+	HRESULT hr = VariantChangeType(var, Recursive, 0, VT_BOOL);
+	if (FAILED(hr))
+		return hr;
+	*recursive = var._v.boolVal != VARIANT_FALSE;
 	return S_OK;
 }
 
-/* queryAttribData - retrieves the value of an attribute from the file's version resource.
+/* get_CheckSum - [propget] returns the image checksum stored in the optional header of the file. It is 0 if the linker was not asked to set it (see /RELEASE).
 
 Parameters:
-subblockPath - [in] contains a path into the version resource specifying the location of an attribute. Basically, there are three kinds of paths.
+Value - [retval][out] contains the checksum.
+*/
+STDMETHODIMP VersionInfoImpl::get_CheckSum(/* [retval][out] */ long *Value)
+{
+	HRESULT hr = queryImageDigest();
+	if (hr != S_OK)
+		return hr;
+	*Value = (long)_digest.storedChecksum();
+	return S_OK;
+}
 
-1) '\<Attribute>' - use this form of path to get a fixed-length attribute in the FixedFileInfo block.
-2) '\VarFileInfo\Translation' - use this path to retrieve the translation block containing entries of langId and codepage pairs.
-3) '\StringFileInfo\<LangId+CodePage>\<Attribute> - us this form of path to find a variable-length string attribute from a language-dependent StringFileInfo block.
+/* get_ComputedCheckSum - [propget] computes the image checksum of the file the way ImageHlp CheckSumMappedFile does. If CheckSum is not 0, the two are equal unless the file has been altered since the checksum was set.
 
-Remarks:
-A version info structure retrieved from the file's resource section is cached in class member _vi. It's to avoid repeating allocating space and reading the data from the resource on the file.
-The caller should not try to free the data returned in attribData. It belongs to the data in cache and cannot be de-allocated.
+Parameters:
+Value - [retval][out] contains the checksum.
 */
-HRESULT VersionInfoImpl::queryAttribData(LPCWSTR subblockPath, LPVOID* attribData, UINT *attribLen)
+STDMETHODIMP VersionInfoImpl::get_ComputedCheckSum(/* [retval][out] */ long *Value)
 {
-	HRESULT hr = S_OK;
-	// retrieve the entire version info structure by calling win32 GetFileVersionInfo.
-	if (_vi.length() == 0)
-		hr = queryVersionInfo(_vi);
-	if (hr == S_OK)
-	{
-		// get to the requested subblock in the version structure.
-		if (!VerQueryValue((LPVOID)_vi._b, subblockPath, attribData, attribLen))
-			hr = HRESULT_FROM_WIN32(ERROR_RESOURCE_DATA_NOT_FOUND); // No version info is available for this library file.
-	}
-	return hr;
+	HRESULT hr = queryImageDigest();
+	if (hr != S_OK)
+		return hr;
+	*Value = (long)_digest.computedChecksum();
+	return S_OK;
 }
 
-/* queryLangCp - retreives a language-codepage pair at a given index from the translation subblock. If no index is supplied, the method returns the first pair it finds.
+/* get_AuthenticodeHash - [propget] computes the Authenticode SHA-256 of the image. The hash leaves out the checksum and the signature. So, it is the same before and after the file is signed, and a build can record it when the binary is made.
 
 Parameters:
-langIndex - [optional, in] an index to a langId+codepage entry in the translation block of the version resource. If the parameter is not defined (i.e., set to NULL), the first translation entry is returned.
+Value - [retval][out] contains the hash as 64 lowercase hex digits.
 */
-DWORD VersionInfoImpl::queryLangCp(VARIANT *langIndex)
+STDMETHODIMP VersionInfoImpl::get_AuthenticodeHash(/* [retval][out] */ BSTR *Value)
 {
-	UINT dataLen = 0;
-	DWORD *langList = NULL;
-	HRESULT hr = queryAttribData(L"\\VarFileInfo\\Translation", (LPVOID*)&langList, &dataLen);
+	HRESULT hr = queryImageDigest();
 	if (hr != S_OK)
-		return { 0 }; // a corrupted version info?
-	// langIndex contains a one-based index to a lang-code element in the Translation table.
-	int j = 0;
-	if (langIndex)
+		return hr;
+	UTF16CHAR text[SHA256_DIGEST_SIZE * 2];
+	FileHasher::formatSha256(_digest.imageHash(), text);
+	*Value = SysAllocStringLen((LPCWSTR)text, SHA256_DIGEST_SIZE * 2);
+	return *Value ? S_OK : E_OUTOFMEMORY;
+}
+
+/* get_SignedHash - [propget] returns the Authenticode SHA-256 recorded in the signature of the image. It equals AuthenticodeHash unless the file has been altered since it was signed. The signature and its certificates are not verified. Use WinVerifyTrust for that.
+
+Parameters:
+Value - [retval][out] contains the hash as 64 lowercase hex digits, or an empty string if the image is not signed, or is signed with SHA-1 only.
+*/
+STDMETHODIMP VersionInfoImpl::get_SignedHash(/* [retval][out] */ BSTR *Value)
+{
+	HRESULT hr = queryImageDigest();
+	if (hr != S_OK)
+		return hr;
+	UTF16CHAR text[SHA256_DIGEST_SIZE * 2];
+	UINT len = 0;
+	if (_digest.hasSignedHash())
 	{
-		if (langIndex->vt == VT_I4)
-			j = langIndex->lVal - 1;
-		else if (langIndex->vt == VT_I2)
-			j = langIndex->iVal - 1;
+		FileHasher::formatSha256(_digest.signedHash(), text);
+		len = SHA256_DIGEST_SIZE * 2;
 	}
-	// get the language and code page entry at j.
-	if (0 <= j && j < (int)(dataLen / sizeof(DWORD)))
+	*Value = SysAllocStringLen((LPCWSTR)text, len);
+	return *Value ? S_OK : E_OUTOFMEMORY;
+}
+
+/* queryImageDigest - computes the image checksum and Authenticode hash of _image into _digest, unless they have been computed already. The whole file is read, through the mapping the other image queries share.
+*/
+HRESULT VersionInfoImpl::queryImageDigest()
+{
+	if (_file.length() == 0)
+		return E_UNEXPECTED;
+	if (_digest.isLoaded())
+		return S_OK;
+	HRESULT hr = queryImage();
+	if (FAILED(hr))
+		return hr;
+	return HRESULT_FROM_WIN32(_digest.compute(_image));
+}
+
+/* get_PdbPath - [propget] returns the pathname of the PDB file recorded in the CodeView record of the debug directory. It is the pathname the linker wrote the PDB to, or the file name alone if the build asked for it (see /PDBALTPATH).
+
+Parameters:
+Value - [retval][out] contains the pathname, or an empty string if the image has no CodeView record.
+*/
+STDMETHODIMP VersionInfoImpl::get_PdbPath(/* [retval][out] */ BSTR *Value)
+{
+	HRESULT hr = queryCodeView();
+	if (FAILED(hr))
+		return hr;
+	std::u16string path;
+	if (hr == S_OK)
+		appendUtf16(path, _codeView.pdbPath.c_str(), _codeView.pdbPath.length());
+	*Value = SysAllocStringLen((LPCWSTR)path.c_str(), (UINT)path.length());
+	return *Value ? S_OK : E_OUTOFMEMORY;
+}
+
+/* get_PdbGuid - [propget] returns the signature of the PDB file that matches the image. A debugger loads a PDB only if the signature and the age are the same as those recorded in the image.
+
+Parameters:
+Value - [retval][out] contains the signature in the registry form of a GUID, e.g., {6B29FC40-CA47-1067-B31D-00DD010662DA}, or an empty string if the image has no CodeView record, or an old one of a PDB 2.0 file, whose signature is a time stamp (see SymbolKey).
+*/
+STDMETHODIMP VersionInfoImpl::get_PdbGuid(/* [retval][out] */ BSTR *Value)
+{
+	HRESULT hr = queryCodeView();
+	if (FAILED(hr))
+		return hr;
+	UTF16CHAR text[38];
+	UINT len = 0;
+	if (hr == S_OK && _codeView.format == PE_CODEVIEW_RSDS)
 	{
-		return langList[j];
+		PEImage::formatGuid(_codeView.guid, text);
+		len = ARRAYSIZE(text);
 	}
-	// Subscript out of range
-	return { 0 };
+	*Value = SysAllocStringLen((LPCWSTR)text, len);
+	return *Value ? S_OK : E_OUTOFMEMORY;
+}
+
+/* get_PdbAge - [propget] returns the age of the PDB file that matches the image. The linker increments it each time it updates the PDB.
+
+Parameters:
+Value - [retval][out] contains the age, or 0 if the image has no CodeView record.
+*/
+STDMETHODIMP VersionInfoImpl::get_PdbAge(/* [retval][out] */ long *Value)
+{
+	HRESULT hr = queryCodeView();
+	if (FAILED(hr))
+		return hr;
+	*Value = hr == S_OK ? (long)_codeView.age : 0;
+	return S_OK;
 }
 
-/* queryVersionInfo - retrieves the entire version info structure from the file's resource section. Note that the method uses a BSTR to pass the binary structure. So, the allocation passed back in the output parameter, strVerInfo, is binary and may not be 2-byte aligned. To read the content, typecast it to LPVOID and pass it to Win32 VerQueryValue().
+/* get_SymbolKey - [propget] returns the name of the directory a symbol server stores the PDB of the image in: the signature and the age in hex digits. The PDB is found at <symbol store>\<pdb name>\<SymbolKey>\<pdb name>.
 
 Parameters:
-strVerInfo - [out] contains an entire version info structure retrieved from the file's resource section when the method returns control. The version info is read with a call to Win32 GetFileVersionInfo. make sure that strVerInfo has not allocated a string before the call is made. This method does not free an existing allocation. It would simply overwrite with a new allocation, causing the older allocation to leak.
+Value - [retval][out] contains the key, e.g., 6B29FC40CA471067B31D00DD010662DA2, or an empty string if the image has no CodeView record.
 */
-HRESULT VersionInfoImpl::queryVersionInfo(bstring& strVerInfo)
+STDMETHODIMP VersionInfoImpl::get_SymbolKey(/* [retval][out] */ BSTR *Value)
+{
+	HRESULT hr = queryCodeView();
+	if (FAILED(hr))
+		return hr;
+	std::u16string key;
+	if (hr == S_OK)
+		PEImage::formatSymbolKey(_codeView, key);
+	*Value = SysAllocStringLen((LPCWSTR)key.c_str(), (UINT)key.length());
+	return *Value ? S_OK : E_OUTOFMEMORY;
+}
+
+/* queryCodeView - reads the CodeView record of the debug directory of the image into _codeView, unless it has been read already. Only the pages of the headers and the debug directory are touched.
+
+Return value:
+S_OK if the image has a CodeView record. S_FALSE if it has none.
+*/
+HRESULT VersionInfoImpl::queryCodeView()
 {
 	if (_file.length() == 0)
 		return E_UNEXPECTED;
-	DWORD dwHandle;
-	DWORD cbVerInfo = GetFileVersionInfoSize(_file, &dwHandle);
-	if (cbVerInfo == 0)
-	{
-		DWORD errorCode = GetLastError();
-		/* resource-related error codes: 
-		0x714 - ERROR_RESOURCE_DATA_NOT_FOUND
-		0x715 - ERROR_RESOURCE_TYPE_NOT_FOUND
-		0x716 - ERROR_RESOURCE_NAME_NOT_FOUND
-		0x717 - ERROR_RESOURCE_LANG_NOT_FOUND
-		*/
-		return HRESULT_FROM_WIN32(errorCode);
+	if (!_codeViewRead)
+	{
+		HRESULT hr = queryImage();
+		if (FAILED(hr))
+			return hr;
+		_codeViewError = _image.findCodeView(_codeView);
+		_codeViewRead = true;
 	}
-	LPBYTE pbVerInfo = (LPBYTE)strVerInfo.byteAlloc(cbVerInfo);
-	if (!GetFileVersionInfo(_file, dwHandle, cbVerInfo, pbVerInfo))
-		return HRESULT_FROM_WIN32(GetLastError());
-	return S_OK;
+	if (_codeViewError == ERROR_NOT_FOUND)
+		return S_FALSE;
+	return HRESULT_FROM_WIN32(_codeViewError);
 }
 
-/* queryVersionNumber - retrieves the major+minor version of the file from the FixedFileInfo block of the version info resource. HIWORD(*Value) is the major version number, while LOWORD(*Value) the minor version number. If the file has no version resource, the method returns an ERROR_RESOURCE_* error code.
+/* queryImage - attaches _image to a mapping of the whole file, unless it is attached already. The version resource is read first, and the mapping _vi has read it through is used. So, the file is opened, mapped and its headers are validated once for the version attributes and the image queries together. The file is mapped here only if _vi holds no mapping of it: in range-read mode, for a file served by an index, or for a file without a version resource.
+*/
+HRESULT VersionInfoImpl::queryImage()
+{
+	if (_file.length() == 0)
+		return E_UNEXPECTED;
+	if (!_imageRead)
+	{
+		if (!_vi.isLoaded())
+			queryVersionInfo();
+		// a loaded _vi is not reloaded until another file is assigned. so, its mapping outlives _image.
+		const MappedFile *mapped = &_vi.mappedFile();
+		_imageError = ERROR_SUCCESS;
+		if (!_vi.isLoaded() || !mapped->isOpen())
+		{
+			_imageError = _imageFile.open(_file);
+			mapped = &_imageFile;
+		}
+		if (_imageError == ERROR_SUCCESS)
+			_imageError = _image.attach(mapped->data(), mapped->size());
+		_imageRead = true;
+	}
+	return HRESULT_FROM_WIN32(_imageError);
+}
+
+/* get_AssemblyName - [propget] returns the name of a .NET assembly as recorded in its metadata, e.g., System.Xml. The metadata is read from the mapped image. No runtime is loaded.
 
 Parameters:
-Value - [out] contains the value of VS_FIXEDFILEINFO::dwFileVersionMS, a fixed-length file version attribute, if the file has a version resource. If the file has no version resource, an appropriate error is returned. See queryVersionInfo for likely error codes.
+Value - [retval][out] contains the name, or an empty string if the file is not a .NET assembly.
 */
-HRESULT VersionInfoImpl::queryVersionNumber(long *Value)
+STDMETHODIMP VersionInfoImpl::get_AssemblyName(/* [retval][out] */ BSTR *Value)
 {
-	HRESULT hr = S_OK;
-	if (_vi.length() == 0)
-		hr = queryVersionInfo(_vi);
+	return returnAssemblyString(_assembly.name, Value);
+}
+
+/* get_AssemblyVersion - [propget] returns the version of a .NET assembly, the one the runtime binds references to, e.g., 4.0.0.0. It is often different from the file version of the version resource.
+
+Parameters:
+Value - [retval][out] contains the version, or an empty string if the file is not a .NET assembly.
+*/
+STDMETHODIMP VersionInfoImpl::get_AssemblyVersion(/* [retval][out] */ BSTR *Value)
+{
+	HRESULT hr = queryAssembly();
+	if (FAILED(hr))
+		return hr;
+	std::u16string version;
+	if (hr == S_OK)
+		ClrMetadata::formatVersion(_assembly.version, version);
+	*Value = SysAllocStringLen((LPCWSTR)version.c_str(), (UINT)version.length());
+	return *Value ? S_OK : E_OUTOFMEMORY;
+}
+
+/* get_Culture - [propget] returns the culture of a .NET assembly, e.g., de-DE for a satellite assembly of German resources.
+
+Parameters:
+Value - [retval][out] contains the culture name, or an empty string if the assembly is culture-neutral, or the file is not a .NET assembly.
+*/
+STDMETHODIMP VersionInfoImpl::get_Culture(/* [retval][out] */ BSTR *Value)
+{
+	return returnAssemblyString(_assembly.culture, Value);
+}
+
+/* get_PublicKeyToken - [propget] returns the public key token of a strong-named .NET assembly, the last 8 bytes of the SHA-1 of its public key in reverse order.
+
+Parameters:
+Value - [retval][out] contains the token in 16 lowercase hex digits, e.g., b77a5c561934e089, or an empty string if the assembly is not strong-named, or the file is not a .NET assembly.
+*/
+STDMETHODIMP VersionInfoImpl::get_PublicKeyToken(/* [retval][out] */ BSTR *Value)
+{
+	HRESULT hr = queryAssembly();
+	if (FAILED(hr))
+		return hr;
+	UTF16CHAR text[CLI_PUBLIC_KEY_TOKEN_SIZE * 2];
+	UINT len = 0;
+	if (hr == S_OK && _assembly.hasPublicKeyToken)
+	{
+		ClrMetadata::formatPublicKeyToken(_assembly.publicKeyToken, text);
+		len = ARRAYSIZE(text);
+	}
+	*Value = SysAllocStringLen((LPCWSTR)text, len);
+	return *Value ? S_OK : E_OUTOFMEMORY;
+}
+
+/* returnAssemblyString - reads the assembly identity, and returns one of its UTF-8 strings as a BSTR.
+
+Parameters:
+text - [in] a string member of _assembly.
+Value - [out] receives the string, or an empty string if the file is not a .NET assembly.
+*/
+HRESULT VersionInfoImpl::returnAssemblyString(const std::string &text, BSTR *Value)
+{
+	HRESULT hr = queryAssembly();
+	if (FAILED(hr))
+		return hr;
+	std::u16string s;
 	if (hr == S_OK)
+		appendUtf16(s, text.c_str(), text.length());
+	*Value = SysAllocStringLen((LPCWSTR)s.c_str(), (UINT)s.length());
+	return *Value ? S_OK : E_OUTOFMEMORY;
+}
+
+/* queryAssembly - reads the assembly identity from the Assembly table of the CLI metadata of the image into _assembly, unless it has been read already. The metadata is located through _image, the image the CodeView and resource queries read, too.
+
+Return value:
+S_OK if the file is a .NET assembly. S_FALSE if it is not.
+*/
+HRESULT VersionInfoImpl::queryAssembly()
+{
+	if (_file.length() == 0)
+		return E_UNEXPECTED;
+	if (!_assemblyRead)
 	{
-		UINT cbVSFFI = 0;
-		VS_FIXEDFILEINFO *pVSFFI = NULL;
-		if (!VerQueryValue((LPVOID)_vi._b, L"\\", (LPVOID*)&pVSFFI, &cbVSFFI))
-			return HRESULT_FROM_WIN32(ERROR_RESOURCE_TYPE_NOT_FOUND); // FixedFileInfo is not available for this file. the resource section must be corrupt.
-		*Value = pVSFFI->dwFileVersionMS;
+		HRESULT hr = queryImage();
+		if (FAILED(hr))
+			return hr;
+		ClrMetadata metadata;
+		_assemblyError = metadata.attach(_image);
+		if (_assemblyError == ERROR_SUCCESS)
+			_assemblyError = metadata.readAssembly(_assembly);
+		_assemblyRead = true;
 	}
-	return hr;
+	if (_assemblyError == ERROR_NOT_FOUND)
+		return S_FALSE;
+	return HRESULT_FROM_WIN32(_assemblyError);
 }
 
+/* QueryResources - [method] lists all resources of the file. The resource directory is walked once, on the first call of QueryResources, QueryResource, QueryString, QueryIcon or Manifest after a file is assigned. The other calls look resources up in the list.
+
+Parameters:
+Result - [retval][out] receives a 2-D array of VARIANTs with a row per resource and these columns: the type, the name, the language id, and the size of the data in bytes. A type or a name is a VT_I4 id, or a VT_BSTR if it is a string, e.g., 16 and 1 for the version resource, or 23 and "INDEX.HTML" for an HTML page.
+*/
+STDMETHODIMP VersionInfoImpl::QueryResources(/* [retval][out] */ VARIANT *Result)
+{
+	HRESULT hr = queryResources();
+	if (FAILED(hr))
+		return hr;
+	size_t rowCount = _resources.count();
+	SAFEARRAYBOUND sab[2] = { { (ULONG)rowCount, 0 }, { 4, 0 } };
+	SAFEARRAY *psa = SafeArrayCreate(VT_VARIANT, 2, sab);
+	if (!psa)
+		return E_OUTOFMEMORY;
+	VARIANT *cells;
+	hr = SafeArrayAccessData(psa, (void**)&cells);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	// the elements are stored in column-major order. element (i,j) is at cells[j*rows+i].
+	for (size_t i = 0; i < rowCount && hr == S_OK; i++)
+	{
+		const ResourceEntry &re = _resources.entry(i);
+		const ResourceId *ids[2] = { &re.type, &re.name };
+		for (int j = 0; j < 2; j++)
+		{
+			VARIANT *cell = cells + j * rowCount + i;
+			if (ids[j]->isNamed())
+			{
+				cell->bstrVal = SysAllocStringLen((LPCWSTR)ids[j]->name, ids[j]->nameLen);
+				if (!cell->bstrVal)
+				{
+					hr = E_OUTOFMEMORY;
+					break;
+				}
+				cell->vt = VT_BSTR;
+			}
+			else
+			{
+				cell->vt = VT_I4;
+				cell->lVal = (LONG)ids[j]->id;
+			}
+		}
+		cells[2 * rowCount + i].vt = VT_I4;
+		cells[2 * rowCount + i].lVal = re.langId;
+		cells[3 * rowCount + i].vt = VT_I4;
+		cells[3 * rowCount + i].lVal = (LONG)re.size;
+	}
+	SafeArrayUnaccessData(psa);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	Result->vt = VT_ARRAY | VT_VARIANT;
+	Result->parray = psa;
+	return S_OK;
+}
+
+/* QueryResource - [method] returns the data of a resource. It replaces a LoadLibraryEx(LOAD_LIBRARY_AS_DATAFILE), FindResourceEx and LoadResource sequence.
+
+Parameters:
+Type - [in] the resource type, an integer id (e.g., 24 for a manifest), or a string. A string of the form "#24" is taken as an id.
+Name - [in] the resource name, an integer id or a string, like Type.
+Language - [in, optional] the preferred language id. If the resource is not available in the language, or the argument is omitted, the first language of the resource is used.
+Data - [retval][out] receives an array of bytes (VT_ARRAY|VT_UI1).
+
+Remarks:
+If the file has no such resource, an interface error of HRESULT_FROM_WIN32(ERROR_RESOURCE_NAME_NOT_FOUND) is returned.
+*/
+STDMETHODIMP VersionInfoImpl::QueryResource(/* [in] */ VARIANT Type, /* [in] */ VARIANT Name, /* [in, optional] */ VARIANT *Language, /* [retval][out] */ VARIANT *Data)
+{
+	HRESULT hr = queryResources();
+	if (FAILED(hr))
+		return hr;
+	std::u16string typeName, name;
+	ResourceId typeId, nameId;
+	hr = variantToResourceId(&Type, typeName, typeId);
+	if (FAILED(hr))
+		return hr;
+	hr = variantToResourceId(&Name, name, nameId);
+	if (FAILED(hr))
+		return hr;
+	uint16_t langId = 0;
+	if (Language && Language->vt != VT_ERROR && Language->vt != VT_EMPTY)
+	{
+		VariantAutoRel var;
+		hr = VariantChangeType(var, Language, 0, VT_I4);
+		if (FAILED(hr))
+			return hr;
+		langId = (uint16_t)var._v.lVal;
+	}
+	const ResourceEntry *re = _resources.find(typeId, nameId, langId);
+	if (!re)
+		return HRESULT_FROM_WIN32(ERROR_RESOURCE_NAME_NOT_FOUND);
+	if (!re->data)
+		return HRESULT_FROM_WIN32(ERROR_RESOURCE_DATA_NOT_FOUND);
+	return createByteArray(re->data, re->size, Data);
+}
+
+/* QueryString - [method] returns a string of a string table (RT_STRING), the string LoadString loads. The language of the Language property is preferred. If it is 0 or the string is not available in it, the first language of the string is used.
+
+Parameters:
+Id - [in] the string id.
+Value - [retval][out] contains the string.
+
+Remarks:
+If the file has no string of the id, an interface error of HRESULT_FROM_WIN32(ERROR_RESOURCE_NAME_NOT_FOUND) is returned.
+*/
+STDMETHODIMP VersionInfoImpl::QueryString(/* [in] */ long Id, /* [retval][out] */ BSTR *Value)
+{
+	HRESULT hr = queryResources();
+	if (FAILED(hr))
+		return hr;
+	if (Id < 0 || Id > 0xFFFF)
+		return E_INVALIDARG;
+	LPCUTF16STR text;
+	uint16_t len;
+	uint32_t errorCode = _resources.findString((uint32_t)Id, (uint16_t)_langId, &text, &len);
+	if (errorCode != ERROR_SUCCESS)
+		return HRESULT_FROM_WIN32(errorCode);
+	*Value = SysAllocStringLen((LPCWSTR)text, len);
+	return *Value ? S_OK : E_OUTOFMEMORY;
+}
+
+/* QueryIcon - [method] assembles an icon of the file into the bytes of an .ico file, with all the sizes and color depths the file has for it. A client can save them to a file, or make an icon of them (e.g., new System.Drawing.Icon(new MemoryStream(data)) in C#).
+
+Parameters:
+Name - [in, optional] the name of the icon group (RT_GROUP_ICON), an integer id or a string. If it is omitted, the first icon of the file is returned. That is the icon the shell shows for an executable.
+Data - [retval][out] receives an array of bytes (VT_ARRAY|VT_UI1).
+
+Remarks:
+If the file has no such icon, an interface error of HRESULT_FROM_WIN32(ERROR_RESOURCE_NAME_NOT_FOUND) is returned.
+*/
+STDMETHODIMP VersionInfoImpl::QueryIcon(/* [in, optional] */ VARIANT *Name, /* [retval][out] */ VARIANT *Data)
+{
+	HRESULT hr = queryResources();
+	if (FAILED(hr))
+		return hr;
+	ResourceId groupType = ResourceId::fromId(PE_RT_GROUP_ICON);
+	const ResourceEntry *group;
+	if (Name && Name->vt != VT_ERROR && Name->vt != VT_EMPTY)
+	{
+		std::u16string name;
+		ResourceId nameId;
+		hr = variantToResourceId(Name, name, nameId);
+		if (FAILED(hr))
+			return hr;
+		group = _resources.find(groupType, nameId, (uint16_t)_langId);
+	}
+	else
+		group = _resources.findFirst(groupType);
+	if (!group)
+		return HRESULT_FROM_WIN32(ERROR_RESOURCE_NAME_NOT_FOUND);
+	std::vector<uint8_t> ico;
+	uint32_t errorCode = _resources.buildIcon(*group, ico);
+	if (errorCode != ERROR_SUCCESS)
+		return HRESULT_FROM_WIN32(errorCode);
+	return createByteArray(ico.data(), ico.size(), Data);
+}
+
+/* get_Manifest - [propget] returns the application manifest of the file (RT_MANIFEST), e.g., to check the requestedExecutionLevel or the dependent assemblies it declares.
+
+Parameters:
+Value - [retval][out] contains the XML text of the manifest, or an empty string if the file has none.
+*/
+STDMETHODIMP VersionInfoImpl::get_Manifest(/* [retval][out] */ BSTR *Value)
+{
+	HRESULT hr = queryResources();
+	if (FAILED(hr))
+		return hr;
+	std::u16string text;
+	const ResourceEntry *re = _resources.findFirst(ResourceId::fromId(PE_RT_MANIFEST));
+	if (re && re->data)
+	{
+		// a manifest is UTF-8 text. skip the byte order mark if the tool that made it wrote one.
+		const char *xml = (const char*)re->data;
+		size_t len = re->size;
+		if (len >= 3 && memcmp(xml, "\xEF\xBB\xBF", 3) == 0)
+		{
+			xml += 3;
+			len -= 3;
+		}
+		appendUtf16(text, xml, len);
+	}
+	*Value = SysAllocStringLen((LPCWSTR)text.c_str(), (UINT)text.length());
+	return *Value ? S_OK : E_OUTOFMEMORY;
+}
+
+/* queryResources - lists the resources of the image, unless they have been listed already. The resource directory is walked in _image, the image the version resource was found in. The list refers to the resource data in place in its mapping.
+
+Return value:
+S_OK if the file has a resource section. S_FALSE if it has none. The list is empty then.
+*/
+HRESULT VersionInfoImpl::queryResources()
+{
+	if (_file.length() == 0)
+		return E_UNEXPECTED;
+	if (!_resourcesRead)
+	{
+		HRESULT hr = queryImage();
+		if (FAILED(hr))
+			return hr;
+		_resourcesError = _resources.load(_image);
+		if (_resourcesError != ERROR_SUCCESS)
+			_resources.clear();
+		_resourcesRead = true;
+	}
+	if (_resourcesError == ERROR_RESOURCE_DATA_NOT_FOUND)
+		return S_FALSE;
+	return HRESULT_FROM_WIN32(_resourcesError);
+}
+
+/* variantToResourceId - converts a resource type or name argument to a ResourceId. An integer is an id. So is a string of the form "#123", the way the Win32 resource functions take it. Another string is a name.
+
+Parameters:
+Id - [in] the argument.
+name - [out] holds the text of a name. The ResourceId points into it.
+rid - [out] receives the id.
+*/
+HRESULT VersionInfoImpl::variantToResourceId(VARIANT *Id, std::u16string &name, ResourceId &rid)
+{
+	VariantAutoRel var;
+	HRESULT hr = VariantCopyInd(var, Id);
+	if (FAILED(hr))
+		return hr;
+	if (var._v.vt != VT_BSTR)
+	{
+		hr = VariantChangeType(var, var, 0, VT_I4);
+		if (FAILED(hr))
+			return hr;
+		if (var._v.lVal <= 0 || var._v.lVal > 0xFFFF)
+			return E_INVALIDARG;
+		rid = ResourceId::fromId((uint32_t)var._v.lVal);
+		return S_OK;
+	}
+	LPCWSTR s = var._v.bstrVal ? var._v.bstrVal : L"";
+	if (*s == '#' && s[1])
+	{
+		LPWSTR end;
+		unsigned long id = wcstoul(s + 1, &end, 10);
+		if (*end || id == 0 || id > 0xFFFF)
+			return E_INVALIDARG;
+		rid = ResourceId::fromId((uint32_t)id);
+		return S_OK;
+	}
+	if (!*s || wcslen(s) > 0xFFFF)
+		return E_INVALIDARG;
+	name.assign((LPCUTF16STR)s, wcslen(s));
+	rid = ResourceId::fromName(name.c_str(), name.length());
+	return S_OK;
+}
+
+/* createByteArray - copies bytes to a VT_ARRAY|VT_UI1 VARIANT. */
+HRESULT VersionInfoImpl::createByteArray(const uint8_t *data, size_t len, VARIANT *Result)
+{
+	SAFEARRAY *psa = SafeArrayCreateVector(VT_UI1, 0, (ULONG)len);
+	if (!psa)
+		return E_OUTOFMEMORY;
+	void *p;
+	HRESULT hr = SafeArrayAccessData(psa, &p);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	memcpy(p, data, len);
+	SafeArrayUnaccessData(psa);
+	Result->vt = VT_ARRAY | VT_UI1;
+	Result->parray = psa;
+	return S_OK;
+}
+
+/* rowsToArray - converts scan rows to the 2-D array ScanDirectory and QueryWatched return.
+
+Parameters:
+rows - [in] rows of a scan.
+attributeCount - [in] number of attribute values in a row.
+Result - [retval][out] receives the array.
+*/
+HRESULT VersionInfoImpl::rowsToArray(const std::vector<VersionScanRow> &rows, size_t attributeCount, VARIANT *Result)
+{
+	// the result is a 2-D array of rows by columns. the first two columns are the pathname and status.
+	SAFEARRAYBOUND sab[2] = { { (ULONG)rows.size(), 0 }, { (ULONG)attributeCount + 2, 0 } };
+	SAFEARRAY *psa = SafeArrayCreate(VT_VARIANT, 2, sab);
+	if (!psa)
+		return E_OUTOFMEMORY;
+	VARIANT *cells;
+	HRESULT hr = SafeArrayAccessData(psa, (void**)&cells);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	// the elements are stored in column-major order. element (i,j) is at cells[j*rows+i].
+	size_t rowCount = rows.size();
+	for (size_t i = 0; i < rowCount && hr != E_OUTOFMEMORY; i++)
+	{
+		const VersionScanRow &row = rows[i];
+		VARIANT *cell = cells + i;
+		cell->bstrVal = SysAllocStringLen(row.path.c_str(), (UINT)row.path.length());
+		if (!cell->bstrVal)
+		{
+			hr = E_OUTOFMEMORY;
+			break;
+		}
+		cell->vt = VT_BSTR;
+		cell += rowCount;
+		cell->vt = VT_I4;
+		cell->lVal = HRESULT_FROM_WIN32(row.errorCode);
+		for (size_t j = 0; j < row.values.size(); j++)
+		{
+			cell += rowCount;
+			const VersionAttribData &data = row.values[j];
+			if (attribValueToVariant(data.type, data.number, data.fileTime, (LPCWSTR)data.text.c_str(), (UINT)data.text.length(), cell) == E_OUTOFMEMORY)
+			{
+				hr = E_OUTOFMEMORY;
+				break;
+			}
+		}
+	}
+	SafeArrayUnaccessData(psa);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	Result->vt = VT_ARRAY | VT_VARIANT;
+	Result->parray = psa;
+	return S_OK;
+}
+
+/* parseAttributeNames - converts the Attributes argument of ScanDirectory or the Names argument of QueryAttributes to a list of attribute names.
+
+Parameters:
+Attributes - [in, optional] an array of strings (e.g., a VBScript array or a C# string[]), or a BSTR of comma-separated names. If the argument is missing, a default list of FileVersion, ProductName, ProductVersion and FileDescription is used.
+names - [out] receives the attribute names. Leading and trailing blanks are removed from each name. A blank item (e.g., the gap in 'FileVersion,,ProductName') is kept as an empty name, so that the values a caller gets back stay in the positions of the names it passed. E_INVALIDARG is returned if all items are blank.
+*/
+HRESULT VersionInfoImpl::parseAttributeNames(VARIANT *Attributes, std::vector<std::u16string> &names)
+{
+	if (!Attributes || Attributes->vt == VT_ERROR || Attributes->vt == VT_EMPTY)
+	{
+		names.push_back(u"FileVersion");
+		names.push_back(u"ProductName");
+		names.push_back(u"ProductVersion");
+		names.push_back(u"FileDescription");
+		return S_OK;
+	}
+	VariantAutoRel var;
+	HRESULT hr = VariantCopyInd(var, Attributes);
+	if (hr != S_OK)
+		return hr;
+	std::vector<std::wstring> items;
+	if (var._v.vt == VT_BSTR)
+	{
+		// split a comma-separated list.
+		LPCWSTR p = var._v.bstrVal ? var._v.bstrVal : L"";
+		for (;;)
+		{
+			LPCWSTR q = wcschr(p, ',');
+			if (!q)
+			{
+				items.push_back(std::wstring(p));
+				break;
+			}
+			items.push_back(std::wstring(p, q - p));
+			p = q + 1;
+		}
+	}
+	else if ((var._v.vt & VT_ARRAY) && ((var._v.vt & ~VT_ARRAY) == VT_BSTR || (var._v.vt & ~VT_ARRAY) == VT_VARIANT))
+	{
+		SAFEARRAY *psa = var._v.parray;
+		if (!psa || SafeArrayGetDim(psa) != 1)
+			return E_INVALIDARG;
+		LONG lbound, ubound;
+		SafeArrayGetLBound(psa, 1, &lbound);
+		SafeArrayGetUBound(psa, 1, &ubound);
+		for (LONG i = lbound; i <= ubound; i++)
+		{
+			VariantAutoRel item;
+			if ((var._v.vt & ~VT_ARRAY) == VT_BSTR)
+			{
+				BSTR bs = NULL;
+				hr = SafeArrayGetElement(psa, &i, &bs);
+				item._v.vt = VT_BSTR;
+				item._v.bstrVal = bs;
+			}
+			else
+			{
+				VariantAutoRel elem;
+				hr = SafeArrayGetElement(psa, &i, (VARIANT*)elem);
+				if (hr == S_OK)
+					hr = VariantChangeType(item, elem, 0, VT_BSTR);
+			}
+			if (hr != S_OK)
+				return hr;
+			items.push_back(std::wstring(item._v.bstrVal ? item._v.bstrVal : L""));
+		}
+	}
+	else
+		return DISP_E_TYPEMISMATCH;
+	bool named = false;
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		std::wstring &item = items[i];
+		size_t first = item.find_first_not_of(L" \t");
+		if (first == std::wstring::npos)
+		{
+			names.push_back(std::u16string());
+			continue;
+		}
+		size_t last = item.find_last_not_of(L" \t");
+		names.push_back(std::u16string((LPCUTF16STR)item.c_str() + first, last - first + 1));
+		named = true;
+	}
+	if (!named)
+		return E_INVALIDARG;
+	return S_OK;
+}
+
+/* get_IndexFile - [propget] returns the pathname of the index file in use, or an empty string if no index is used.
+
+Parameters:
+Value - [retval][out] contains the pathname of the index file.
+*/
+STDMETHODIMP VersionInfoImpl::get_IndexFile(/* [retval][out] */ BSTR *Value)
+{
+	bstring v(_index.isOpen() ? (LPCWSTR)_index.indexPath() : L"");
+	*Value = v.detach();
+	return S_OK;
+}
+
+/* put_IndexFile - [propput] starts using an index file. An index is a persistent cache of version resources. An entry is keyed by a file's pathname, size, last write time and file id, and is used only as long as all of them stay the same. So, a repeated inventory of a mostly unchanged tree reads only the files that have changed. The index is saved when ScanDirectory completes, when another index file is assigned, and when the VersionInfo object is released.
+
+Parameters:
+NewValue - [in] a pathname of an index file. If the file does not exist, it is created on the first save. An empty string stops using an index.
+*/
+STDMETHODIMP VersionInfoImpl::put_IndexFile(/* [in] */ BSTR NewValue)
+{
+	// save the entries of the index in use before switching.
+	_index.flush();
+	_index.close();
+	if (!NewValue || *NewValue == 0)
+		return S_OK;
+	return HRESULT_FROM_WIN32(_index.open(NewValue));
+}
+
+/* get_IndexHitRate - [propget] returns the fraction of file lookups the index has answered since IndexFile was assigned. A lookup misses if the file is new to the index or has changed since it was indexed.
+
+Parameters:
+Value - [retval][out] contains the hit rate, a value between 0 and 1. If no lookup has been made, 0 is returned. If no index is in use, an interface error of E_UNEXPECTED is returned.
+*/
+STDMETHODIMP VersionInfoImpl::get_IndexHitRate(/* [retval][out] */ double *Value)
+{
+	if (!_index.isOpen())
+		return E_UNEXPECTED;
+	VersionIndexStats stats;
+	_index.getStats(stats);
+	*Value = stats.hitRate();
+	return S_OK;
+}
+
+/* CompactIndex - [method] rewrites the index file dropping the entries of files which have changed or no longer exist. Every indexed file is checked. Use it once in a while to keep an index of a changing tree from growing. If no index is in use, an interface error of E_UNEXPECTED is returned.
+*/
+STDMETHODIMP VersionInfoImpl::CompactIndex()
+{
+	if (!_index.isOpen())
+		return E_UNEXPECTED;
+	return HRESULT_FROM_WIN32(_index.compact());
+}
+
+/* get_RangeRead - [propget] returns VARIANT_TRUE if files are read in range-read mode.
+
+Parameters:
+Value - [retval][out] contains VARIANT_TRUE or VARIANT_FALSE (default).
+*/
+STDMETHODIMP VersionInfoImpl::get_RangeRead(/* [retval][out] */ VARIANT_BOOL *Value)
+{
+	*Value = _vi.rangeRead() ? VARIANT_TRUE : VARIANT_FALSE;
+	return S_OK;
+}
+
+/* put_RangeRead - [propput] selects how a file is read. By default, a file is mapped into memory, and the pages the parser touches are brought in by the system. On a network share, each page fault is a round trip to the server, and the system may read ahead well beyond the parts that are needed. In range-read mode, the DOS and NT headers, the section table, the resource directory entries on the path to the version resource, and the version resource itself are fetched with positioned reads. A typical executable takes a few reads of about 2 KB in total. The mode applies to the File property and to ScanDirectory.
+
+Parameters:
+NewValue - [in] VARIANT_TRUE to use range reads. VARIANT_FALSE to map files.
+*/
+STDMETHODIMP VersionInfoImpl::put_RangeRead(/* [in] */ VARIANT_BOOL NewValue)
+{
+	_vi.setRangeRead(NewValue != VARIANT_FALSE);
+	return S_OK;
+}
+
+/* get_BytesRead - [propget] returns the number of bytes read from the file by the last version resource load, or the total read from all files by the last ScanDirectory. Only reads made in range-read mode are counted. A file served from the cache or the index reads no bytes.
+
+Parameters:
+Value - [retval][out] contains the byte count.
+*/
+STDMETHODIMP VersionInfoImpl::get_BytesRead(/* [retval][out] */ double *Value)
+{
+	*Value = (double)_bytesRead;
+	return S_OK;
+}
+
+/* get_ScanStatistics - [propget] returns counters of the stages that sorted out the files of the last ScanDirectory or ExportDirectory. A file with an extension of a data format (e.g., .pdb or .png) is rejected without being opened. A file with an extension of an executable or a package (e.g., .dll or .msi) is parsed. Any other file has its first 64 bytes read, and is parsed only if they start an executable or a compound file. The counters show how much I/O the stages have saved.
+
+Parameters:
+Value - [retval][out] receives an array of 13 numbers (VT_R8): the number of files found, files rejected by extension, files accepted by extension, files whose first bytes were read, files those bytes rejected, the total size of the latter in bytes, files parsed, and parsed files that turned out not to be executables, followed by the files whose first bytes were read by what they are: executables, compound files, cabinets, zip archives, and others.
+
+Remarks:
+If IndexFile or RangeRead is set, a file of an unknown extension is parsed without a look at its first bytes, because the parse costs no more than the look. The counters of the first bytes are 0 then.
+*/
+STDMETHODIMP VersionInfoImpl::get_ScanStatistics(/* [retval][out] */ VARIANT *Value)
+{
+	const FileClassifyStats &s = _scanStats;
+	double values[] = { (double)s.files, (double)s.rejectedByName, (double)s.acceptedByName, (double)s.sniffed, (double)s.rejectedByMagic, (double)s.bytesSkipped, (double)s.parsed, (double)s.parseRejected,
+		(double)s.kinds[FK_EXECUTABLE], (double)s.kinds[FK_PACKAGE], (double)s.kinds[FK_CABINET], (double)s.kinds[FK_ZIP], (double)s.kinds[FK_OTHER] };
+	SAFEARRAY *psa = SafeArrayCreateVector(VT_R8, 0, ARRAYSIZE(values));
+	if (!psa)
+		return E_OUTOFMEMORY;
+	double *data;
+	HRESULT hr = SafeArrayAccessData(psa, (void**)&data);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	memcpy(data, values, sizeof(values));
+	SafeArrayUnaccessData(psa);
+	Value->vt = VT_ARRAY | VT_R8;
+	Value->parray = psa;
+	return S_OK;
+}
+
+/* get_FileVersionKey - [propget] returns the file version as a version key. A version key is a 64-bit unsigned integer (VT_UI8) with the major version in the top 16 bits and the build number in the bottom 16 bits, i.e., (dwFileVersionMS << 32) | dwFileVersionLS of the FixedFileInfo structure. Keys sort and compare in version order. So, a client can compare versions without parsing VersionString.
+
+Parameters:
+Value - [retval][out] contains the key. If the file has no version resource, an interface error of ERROR_RESOURCE_DATA_NOT_FOUND is returned.
+*/
+STDMETHODIMP VersionInfoImpl::get_FileVersionKey(/* [retval][out] */ VARIANT *Value)
+{
+	return queryVersionKey(false, Value);
+}
+
+/* get_ProductVersionKey - [propget] returns the product version as a version key. See get_FileVersionKey.
+
+Parameters:
+Value - [retval][out] contains the key, (dwProductVersionMS << 32) | dwProductVersionLS. If the file has no version resource, an interface error of ERROR_RESOURCE_DATA_NOT_FOUND is returned.
+*/
+STDMETHODIMP VersionInfoImpl::get_ProductVersionKey(/* [retval][out] */ VARIANT *Value)
+{
+	return queryVersionKey(true, Value);
+}
+
+/* MakeVersionKey - [method] converts a version string to a version key so that it can be compared with FileVersionKey or passed to CompareVersions.
+
+Parameters:
+Version - [in] up to 4 numbers separated by periods, e.g., '10.0.19041'. missing parts are zero.
+Key - [retval][out] receives the key as a VT_UI8. If the string is not a version number, an interface error of ERROR_INVALID_DATA is returned.
+*/
+STDMETHODIMP VersionInfoImpl::MakeVersionKey(/* [in] */ BSTR Version, /* [retval][out] */ VARIANT *Key)
+{
+	uint64_t key;
+	uint32_t errorCode = parseVersionKey((LPCUTF16STR)(Version ? Version : L""), SysStringLen(Version), &key);
+	if (errorCode != ERROR_SUCCESS)
+		return HRESULT_FROM_WIN32(errorCode);
+	Key->vt = VT_UI8;
+	Key->ullVal = key;
+	return S_OK;
+}
+
+/* CompareVersions - [method] compares each of an array of versions with a version. Use it to pick out files older or newer than a given release, e.g., 10.0.19041.
+
+Parameters:
+Versions - [in] an array of version keys (e.g., a C# ulong[] of FileVersionKey values) or version strings.
+Version - [in] a version key or a version string to compare with.
+Results - [retval][out] receives an array of integers (VT_I4), one for each element of Versions. An element is -1 if the version is older than Version, 0 if it is the same, and 1 if it is newer.
+*/
+STDMETHODIMP VersionInfoImpl::CompareVersions(/* [in] */ VARIANT Versions, /* [in] */ VARIANT Version, /* [retval][out] */ VARIANT *Results)
+{
+	uint64_t key;
+	HRESULT hr = variantToVersionKey(&Version, &key);
+	if (hr != S_OK)
+		return hr;
+	std::vector<uint64_t> keys;
+	hr = parseVersionKeys(&Versions, keys);
+	if (hr != S_OK)
+		return hr;
+	std::vector<int8_t> comparisons(keys.size());
+	compareVersionKeys(keys.data(), keys.size(), key, comparisons.data());
+	std::vector<int32_t> values(comparisons.begin(), comparisons.end());
+	return createIntArray(values.data(), values.size(), Results);
+}
+
+/* RankVersions - [method] sorts an array of versions, and returns the order as an array of indices into it. The versions are not moved. Versions that are the same keep the order they were given in. The first index points to the oldest version, and the last index to the newest. The versions are ranked by a radix sort, which takes a small fraction of a second for a million of them.
+
+Parameters:
+Versions - [in] an array of version keys (e.g., a C# ulong[] of FileVersionKey values) or version strings.
+Order - [retval][out] receives an array of integers (VT_I4). It has the zero-based indices of the elements of Versions in ascending version order.
+*/
+STDMETHODIMP VersionInfoImpl::RankVersions(/* [in] */ VARIANT Versions, /* [retval][out] */ VARIANT *Order)
+{
+	std::vector<uint64_t> keys;
+	HRESULT hr = parseVersionKeys(&Versions, keys);
+	if (hr != S_OK)
+		return hr;
+	std::vector<uint32_t> order(keys.size());
+	rankVersionKeys(keys.data(), keys.size(), order.data());
+	return createIntArray((const int32_t*)order.data(), order.size(), Order);
+}
+
+/* SortVersions - [method] sorts an array of versions, and returns the sorted versions as version keys. Use it instead of RankVersions if the order of the versions is all that is needed, and not where they came from. Like RankVersions, it sorts a million versions in a small fraction of a second.
+
+Parameters:
+Versions - [in] an array of version keys (e.g., a C# ulong[] of FileVersionKey values) or version strings.
+Sorted - [retval][out] receives an array of version keys (VT_UI8) in ascending version order. It has as many elements as Versions.
+*/
+STDMETHODIMP VersionInfoImpl::SortVersions(/* [in] */ VARIANT Versions, /* [retval][out] */ VARIANT *Sorted)
+{
+	std::vector<uint64_t> keys;
+	HRESULT hr = parseVersionKeys(&Versions, keys);
+	if (hr != S_OK)
+		return hr;
+	sortVersionKeys(keys.data(), keys.size());
+	return createKeyArray(keys.data(), keys.size(), Sorted);
+}
+
+/* FindVersionRange - [method] finds the oldest and the newest of an array of versions without sorting it. If there is more than one oldest or newest version, the first one is picked.
+
+Parameters:
+Versions - [in] an array of version keys (e.g., a C# ulong[] of FileVersionKey values) or version strings. If the array is empty, an interface error of E_INVALIDARG is returned.
+Range - [retval][out] receives an array of two integers (VT_I4). The first is the zero-based index of the oldest version in Versions, and the second is that of the newest.
+*/
+STDMETHODIMP VersionInfoImpl::FindVersionRange(/* [in] */ VARIANT Versions, /* [retval][out] */ VARIANT *Range)
+{
+	std::vector<uint64_t> keys;
+	HRESULT hr = parseVersionKeys(&Versions, keys);
+	if (hr != S_OK)
+		return hr;
+	if (keys.empty())
+		return E_INVALIDARG;
+	size_t minIndex, maxIndex;
+	findVersionKeyRange(keys.data(), keys.size(), &minIndex, &maxIndex);
+	int32_t range[2] = { (int32_t)minIndex, (int32_t)maxIndex };
+	return createIntArray(range, ARRAYSIZE(range), Range);
+}
+
+/* CountVersionsBelow - [method] counts the versions of an array that are older than a version. Use it to tell how many files of an inventory fall short of a release without making an array of comparisons with CompareVersions.
+
+Parameters:
+Versions - [in] an array of version keys (e.g., a C# ulong[] of FileVersionKey values) or version strings.
+Version - [in] a version key or a version string to compare with.
+Count - [retval][out] receives the number of elements of Versions older than Version.
+*/
+STDMETHODIMP VersionInfoImpl::CountVersionsBelow(/* [in] */ VARIANT Versions, /* [in] */ VARIANT Version, /* [retval][out] */ long *Count)
+{
+	uint64_t key;
+	HRESULT hr = variantToVersionKey(&Version, &key);
+	if (hr != S_OK)
+		return hr;
+	std::vector<uint64_t> keys;
+	hr = parseVersionKeys(&Versions, keys);
+	if (hr != S_OK)
+		return hr;
+	*Count = (long)countVersionKeysBelow(keys.data(), keys.size(), key);
+	return S_OK;
+}
+
+/* get_CacheBudget - [propget] returns the number of bytes the process-wide cache of version resources may use. The cache is shared by all VersionInfo objects of the process. A file one of them has read is served to the others from the cache as long as the file has not changed. The cache is not used by ScanDirectory.
+
+Parameters:
+Value - [retval][out] contains the budget in bytes. 0 means the cache is disabled. The default is 16 MB.
+*/
+STDMETHODIMP VersionInfoImpl::get_CacheBudget(/* [retval][out] */ double *Value)
+{
+	*Value = (double)VersionCache::instance().budget();
+	return S_OK;
+}
+
+/* put_CacheBudget - [propput] changes the byte budget of the process-wide cache. When the cached version resources take more memory than the budget, the least recently used ones are evicted. The change affects all VersionInfo objects of the process.
+
+Parameters:
+NewValue - [in] the new budget in bytes. 0 disables the cache and empties it. A negative value is an error of E_INVALIDARG.
+*/
+STDMETHODIMP VersionInfoImpl::put_CacheBudget(/* [in] */ double NewValue)
+{
+	if (NewValue < 0)
+		return E_INVALIDARG;
+	VersionCache::instance().setBudget((uint64_t)NewValue);
+	return S_OK;
+}
+
+/* get_CacheStatistics - [propget] returns counters of the process-wide cache.
+
+Parameters:
+Value - [retval][out] receives an array of five numbers (VT_R8): the number of hits, misses and evictions since the process started, the estimated bytes the cached resources take, and the number of cached resources.
+*/
+STDMETHODIMP VersionInfoImpl::get_CacheStatistics(/* [retval][out] */ VARIANT *Value)
+{
+	VersionCacheStats stats;
+	VersionCache::instance().getStats(stats);
+	double values[] = { (double)stats.hits, (double)stats.misses, (double)stats.evictions, (double)stats.residentBytes, (double)stats.entries };
+	SAFEARRAY *psa = SafeArrayCreateVector(VT_R8, 0, ARRAYSIZE(values));
+	if (!psa)
+		return E_OUTOFMEMORY;
+	double *data;
+	HRESULT hr = SafeArrayAccessData(psa, (void**)&data);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	memcpy(data, values, sizeof(values));
+	SafeArrayUnaccessData(psa);
+	Value->vt = VT_ARRAY | VT_R8;
+	Value->parray = psa;
+	return S_OK;
+}
+
+/* queryVersionKey - reads the file or product version of the current file as a version key. */
+HRESULT VersionInfoImpl::queryVersionKey(bool product, VARIANT *Value)
+{
+	HRESULT hr = S_OK;
+	if (!_vi.isLoaded())
+		hr = queryVersionInfo();
+	if (hr != S_OK)
+		return hr;
+	uint64_t fileKey, productKey;
+	uint32_t errorCode = _vi.queryVersionKeys(&fileKey, &productKey);
+	if (errorCode != ERROR_SUCCESS)
+		return HRESULT_FROM_WIN32(errorCode);
+	Value->vt = VT_UI8;
+	Value->ullVal = product ? productKey : fileKey;
+	return S_OK;
+}
+
+/* variantToVersionKey - converts a version string or a number to a version key.
+
+Parameters:
+Version - [in] a BSTR holding a version string, or a number which is taken as a version key.
+key - [out] receives the version key.
+*/
+HRESULT VersionInfoImpl::variantToVersionKey(VARIANT *Version, uint64_t *key)
+{
+	VariantAutoRel var;
+	HRESULT hr = VariantCopyInd(var, Version);
+	if (hr != S_OK)
+		return hr;
+	if (var._v.vt == VT_BSTR)
+		return HRESULT_FROM_WIN32(parseVersionKey((LPCUTF16STR)(var._v.bstrVal ? var._v.bstrVal : L""), SysStringLen(var._v.bstrVal), key));
+	if (var._v.vt != VT_UI8)
+	{
+		hr = VariantChangeType(var, var, 0, VT_UI8);
+		if (hr != S_OK)
+			return hr;
+	}
+	*key = var._v.ullVal;
+	return S_OK;
+}
+
+/* parseVersionKeys - converts the Versions argument of CompareVersions, RankVersions and the other version array methods to an array of version keys. An array of VT_UI8 or VT_I8 is copied as is. The elements of an array of BSTRs or VARIANTs are converted one by one.
+
+Parameters:
+Versions - [in] a one-dimensional array of version keys or version strings.
+keys - [out] receives the version keys.
+*/
+HRESULT VersionInfoImpl::parseVersionKeys(VARIANT *Versions, std::vector<uint64_t> &keys)
+{
+	VariantAutoRel var;
+	HRESULT hr = VariantCopyInd(var, Versions);
+	if (hr != S_OK)
+		return hr;
+	if (!(var._v.vt & VT_ARRAY))
+		return DISP_E_TYPEMISMATCH;
+	VARTYPE vt = var._v.vt & ~VT_ARRAY;
+	if (vt != VT_UI8 && vt != VT_I8 && vt != VT_BSTR && vt != VT_VARIANT)
+		return DISP_E_TYPEMISMATCH;
+	SAFEARRAY *psa = var._v.parray;
+	if (!psa || SafeArrayGetDim(psa) != 1)
+		return E_INVALIDARG;
+	size_t count = psa->rgsabound[0].cElements;
+	keys.resize(count);
+	void *data;
+	hr = SafeArrayAccessData(psa, &data);
+	if (hr != S_OK)
+		return hr;
+	if (vt == VT_UI8 || vt == VT_I8)
+	{
+		// the fast path. keys from a C# ulong[] or long[] need no conversion.
+		memcpy(keys.data(), data, count * sizeof(uint64_t));
+	}
+	else
+	{
+		for (size_t i = 0; i < count && hr == S_OK; i++)
+		{
+			if (vt == VT_BSTR)
+			{
+				BSTR bs = ((BSTR*)data)[i];
+				hr = HRESULT_FROM_WIN32(parseVersionKey((LPCUTF16STR)(bs ? bs : L""), SysStringLen(bs), &keys[i]));
+			}
+			else
+				hr = variantToVersionKey((VARIANT*)data + i, &keys[i]);
+		}
+	}
+	SafeArrayUnaccessData(psa);
+	return hr;
+}
+
+/* createIntArray - creates a one-dimensional array of VT_I4 integers and returns it in a VARIANT. */
+HRESULT VersionInfoImpl::createIntArray(const int32_t *values, size_t count, VARIANT *Result)
+{
+	SAFEARRAY *psa = SafeArrayCreateVector(VT_I4, 0, (ULONG)count);
+	if (!psa)
+		return E_OUTOFMEMORY;
+	void *data;
+	HRESULT hr = SafeArrayAccessData(psa, &data);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	if (count)
+		memcpy(data, values, count * sizeof(int32_t));
+	SafeArrayUnaccessData(psa);
+	Result->vt = VT_ARRAY | VT_I4;
+	Result->parray = psa;
+	return S_OK;
+}
+
+/* createKeyArray - creates a one-dimensional array of VT_UI8 version keys and returns it in a VARIANT. */
+HRESULT VersionInfoImpl::createKeyArray(const uint64_t *keys, size_t count, VARIANT *Result)
+{
+	SAFEARRAY *psa = SafeArrayCreateVector(VT_UI8, 0, (ULONG)count);
+	if (!psa)
+		return E_OUTOFMEMORY;
+	void *data;
+	HRESULT hr = SafeArrayAccessData(psa, &data);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	if (count)
+		memcpy(data, keys, count * sizeof(uint64_t));
+	SafeArrayUnaccessData(psa);
+	Result->vt = VT_ARRAY | VT_UI8;
+	Result->parray = psa;
+	return S_OK;
+}
+
+/* get_VersionString - [propget] returns a file version number string. Generates an interface error if the file does not have a version resource. The VersionString property does not depend on Language and CodePage. The version property is backed by the fixed-length attributes of the dwFileVersionMS and dwFileVersionLS members of the FixedFileInfo structure.
+
+Parameters:
+Value - [retval][out] contains a version string of form <major>.<minor>.<revision>.<build>, If the file has a version resource. If not, an interface error of ERROR_RESOURCE_DATA_NOT_FOUND is returned.
+*/
+STDMETHODIMP VersionInfoImpl::get_VersionString(/* [retval][out] */ BSTR *Value)
+{
+	VariantAutoRel var;
+	HRESULT hr = QueryAttribute(bstring(L"FileVersion"), var);
+	if (hr == S_OK)
+	{
+		*Value = var._v.bstrVal;
+		var.init();
+	}
+	return hr;
+}
+
+/* get_MajorVersion - [propget] returns the major version number of the file, or an interface error if the file has no version resource.
+
+Parameters:
+Value - [retval][out] contains the major version number which is the high word part of the dwFileVersionMS member of the FixedFileInfo structure. If the file has no version resource, an interface error of ERROR_RESOURCE_DATA_NOT_FOUND is returned.
+*/
+STDMETHODIMP VersionInfoImpl::get_MajorVersion(/* [retval][out] */ long *Value)
+{
+	long v;
+	HRESULT hr = queryVersionNumber(&v);
+	if (hr == S_OK)
+		*Value = HIWORD(v);
+	return hr;
+}
+
+/* get_MajorVersion - [propget] returns the minor version number of the file, or an interface error if the file has no version resource.
+
+Parameters:
+Value - [retval][out] contains the minor version number which is the low word part of the dwFileVersionMS member of the FixedFileInfo structure. If the file has no version resource, an interface error of ERROR_RESOURCE_DATA_NOT_FOUND is returned.
+*/
+STDMETHODIMP VersionInfoImpl::get_MinorVersion(/* [retval][out] */ long *Value)
+{
+	long v;
+	HRESULT hr = queryVersionNumber(&v);
+	if (hr == S_OK)
+		*Value = LOWORD(v);
+	return hr;
+}
+
+/* QueryAttribute - [method] tries to find a version attribute and returns its value. If the file has no version resource, an interface error of ERROR_RESOURCE_DATA_NOT_FOUND is generated. If the file defines a version resource, but if the particular attribute does not exist, an interface error of ERROR_RESOURCE_TYPE_NOT_FOUND is generated.
+
+Parameters:
+Name - [in] contains the name of an attribute to search the version info for.
+Value - [retval][out] contains the value of the queried attribute. The data type of the value returned depends on the queried attribute. A query for a fixed-length attribute returns the value as an integer (i.e., Value->vt==VT_I4). A query for a string attribute returns the value as a character string (i.e., Value->vt==VT_BSTR).
+*/
+STDMETHODIMP VersionInfoImpl::QueryAttribute(/* [in] */ BSTR Name, /* [retval][out] */ VARIANT *Value)
+{
+	if (!Name || *Name == 0)
+		return E_INVALIDARG;
+
+	HRESULT hr = S_OK;
+	if (!_vi.isLoaded())
+		hr = queryVersionInfo();
+	if (hr != S_OK)
+		return hr;
+	// a string attribute is read from the StringFileInfo block of the current language and codepage. make sure we have a valid language-codepage translation.
+	ensureLangCp();
+	// fixed-length attributes and string attributes are both resolved by the version resource.
+	VersionAttribValue value;
+	uint32_t errorCode = _vi.queryAttribute((LPCUTF16STR)Name, wcslen(Name), VERSION_LANGCP(_langId, _codepage), value);
+	if (errorCode != ERROR_SUCCESS)
+		return HRESULT_FROM_WIN32(errorCode);
+	return attribValueToVariant(value.type, value.number, value.fileTime, (LPCWSTR)value.text, value.textLen, Value);
+}
+
+/* QueryAttributes - [method] returns the values of several attributes in one call. A client calling through a proxy (e.g., a .NET application in another apartment) pays one round trip per file instead of one per attribute.
+
+Parameters:
+Names - [in] names of the attributes. Pass an array of strings or a comma-separated list, e.g., 'FileVersion,ProductName,ProductVersion'. An empty value selects FileVersion, ProductName, ProductVersion and FileDescription.
+Values - [retval][out] receives an array of VARIANTs with a value for each name in the order the names were given. See QueryAttribute for the types of the values. An attribute the file does not define is VT_EMPTY, and so is the value of a blank name. If the file has no version resource, no array is returned, and an interface error of ERROR_RESOURCE_DATA_NOT_FOUND or ERROR_RESOURCE_TYPE_NOT_FOUND is generated.
+*/
+STDMETHODIMP VersionInfoImpl::QueryAttributes(/* [in] */ VARIANT Names, /* [retval][out] */ VARIANT *Values)
+{
+	std::vector<std::u16string> names;
+	HRESULT hr = parseAttributeNames(&Names, names);
+	if (hr != S_OK)
+		return hr;
+	if (!_vi.isLoaded())
+		hr = queryVersionInfo();
+	if (hr != S_OK)
+		return hr;
+	ensureLangCp();
+	SAFEARRAY *psa = SafeArrayCreateVector(VT_VARIANT, 0, (ULONG)names.size());
+	if (!psa)
+		return E_OUTOFMEMORY;
+	VARIANT *values;
+	hr = SafeArrayAccessData(psa, (void**)&values);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		VersionAttribValue value;
+		if (names[i].empty())
+			continue; // a blank name keeps its place. leave it empty.
+		if (_vi.queryAttribute(names[i].c_str(), names[i].size(), VERSION_LANGCP(_langId, _codepage), value) != ERROR_SUCCESS)
+			continue; // not defined by the file. leave it empty.
+		if (attribValueToVariant(value.type, value.number, value.fileTime, (LPCWSTR)value.text, value.textLen, values + i) == E_OUTOFMEMORY)
+		{
+			hr = E_OUTOFMEMORY;
+			break;
+		}
+	}
+	SafeArrayUnaccessData(psa);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	Values->vt = VT_ARRAY | VT_VARIANT;
+	Values->parray = psa;
+	return S_OK;
+}
+
+/* QueryTranslations - [method] returns string attributes of all translations of the file in one call. It replaces a loop of QueryTranslation, Language, CodePage and QueryAttribute calls, e.g., for a localization audit of many files. The version resource is decoded once, and each string of each StringFileInfo table is visited once.
+
+Parameters:
+Attributes - [in, optional] names of the string attributes. Pass an array of strings or a comma-separated list, e.g., 'ProductName,CompanyName'. If not specified, every string attribute any of the tables defines is returned, in the order the names first appear.
+Result - [retval][out] receives a 2-D array of VARIANTs. There is a row for each translation: the entries of the translation block in their order, followed by the StringFileInfo tables the translation block does not list. Column 0 is the translation code in the form QueryTranslation returns (VT_UI4). Columns 1 and after hold the values of the attributes (VT_BSTR) in the order they were given. An attribute the translation does not define is VT_EMPTY, and so is the column of a blank name.
+
+Remarks:
+The names are looked up in the StringFileInfo tables only. FileVersion and ProductVersion are the strings of each table, not the fixed-length version numbers QueryAttribute returns, and a name of a FixedFileInfo member (e.g., FileFlags) is always VT_EMPTY.
+If the file has no version resource, no array is returned, and an interface error of ERROR_RESOURCE_DATA_NOT_FOUND or ERROR_RESOURCE_TYPE_NOT_FOUND is generated.
+*/
+STDMETHODIMP VersionInfoImpl::QueryTranslations(/* [in, optional] */ VARIANT *Attributes, /* [retval][out] */ VARIANT *Result)
+{
+	HRESULT hr = S_OK;
+	if (!_vi.isLoaded())
+		hr = queryVersionInfo();
+	if (hr != S_OK)
+		return hr;
+	std::vector<std::u16string> names;
+	if (Attributes && Attributes->vt != VT_ERROR && Attributes->vt != VT_EMPTY)
+		hr = parseAttributeNames(Attributes, names);
+	else
+		_vi.queryStringNames(names);
+	if (hr != S_OK)
+		return hr;
+	std::vector<uint32_t> langCps;
+	std::vector<VersionStringRef> cells;
+	uint32_t errorCode = _vi.queryStringMatrix(names, langCps, cells);
+	if (errorCode != ERROR_SUCCESS)
+		return HRESULT_FROM_WIN32(errorCode);
+
+	size_t rowCount = langCps.size(), colCount = names.size();
+	SAFEARRAYBOUND sab[2] = { { (ULONG)rowCount, 0 }, { (ULONG)(colCount + 1), 0 } };
+	SAFEARRAY *psa = SafeArrayCreate(VT_VARIANT, 2, sab);
+	if (!psa)
+		return E_OUTOFMEMORY;
+	VARIANT *values;
+	hr = SafeArrayAccessData(psa, (void**)&values);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	// the elements are stored in column-major order. element (i,j) is at values[j*rows+i].
+	for (size_t i = 0; i < rowCount && hr == S_OK; i++)
+	{
+		values[i].vt = VT_UI4;
+		values[i].ulVal = langCps[i];
+		for (size_t j = 0; j < colCount; j++)
+		{
+			const VersionStringRef &cell = cells[i * colCount + j];
+			if (!cell.text || names[j].empty())
+				continue; // not defined by the translation, or a blank name. leave it empty.
+			if (attribValueToVariant(VAT_TEXT, 0, 0, (LPCWSTR)cell.text, cell.textLen, values + (j + 1) * rowCount + i) == E_OUTOFMEMORY)
+			{
+				hr = E_OUTOFMEMORY;
+				break;
+			}
+		}
+	}
+	SafeArrayUnaccessData(psa);
+	if (hr != S_OK)
+	{
+		SafeArrayDestroy(psa);
+		return hr;
+	}
+	Result->vt = VT_ARRAY | VT_VARIANT;
+	Result->parray = psa;
+	return S_OK;
+}
+
+/* attribValueToVariant - converts the value of a version attribute to a VARIANT. A number becomes VT_I4, text becomes VT_BSTR, and a file time becomes VT_DATE. S_FALSE is returned if the attribute has no value (e.g., the resource does not define a file date). Value is left VT_EMPTY in that case.
+
+Parameters:
+type - [in] a VERSION_ATTRIB_TYPE value.
+number - [in] a VAT_NUMBER value.
+fileTime - [in] a VAT_FILETIME value.
+text - [in] a VAT_TEXT value. It need not be null-terminated.
+textLen - [in] number of characters in text.
+Value - [out] receives the converted value.
+*/
+HRESULT VersionInfoImpl::attribValueToVariant(int type, uint32_t number, uint64_t fileTime, LPCWSTR text, UINT textLen, VARIANT *Value)
+{
+	if (type == VAT_NUMBER)
+	{
+		Value->vt = VT_I4;
+		Value->lVal = (long)number;
+	}
+	else if (type == VAT_TEXT)
+	{
+		Value->bstrVal = SysAllocStringLen(text, textLen);
+		if (!Value->bstrVal)
+			return E_OUTOFMEMORY;
+		Value->vt = VT_BSTR;
+	}
+	else if (type == VAT_FILETIME)
+	{
+		// convert the file date in FILETIME to OLE date.
+		FILETIME ft;
+		ft.dwHighDateTime = (DWORD)(fileTime >> 32);
+		ft.dwLowDateTime = (DWORD)fileTime;
+		SYSTEMTIME st;
+		if (!FileTimeToSystemTime(&ft, &st) || !SystemTimeToVariantTime(&st, &Value->date))
+			return S_FALSE;
+		Value->vt = VT_DATE;
+	}
+	else
+		return S_FALSE;
+	return S_OK;
+}
+
+/* ensureLangCp - makes sure we have a valid language and codepage. If the automation user has not set them, adopt the first entry in the translation block. */
+HRESULT VersionInfoImpl::ensureLangCp()
+{
+	if (_langId != 0 && _codepage != 0)
+		return S_FALSE;
+	DWORD defLangCp = queryLangCp(NULL);
+	_langId = LOWORD(defLangCp);
+	_codepage = HIWORD(defLangCp);
+	return S_OK;
+}
+
+/* queryLangCp - retreives a language-codepage pair at a given index from the translation subblock. If no index is supplied, the method returns the first pair it finds.
+
+Parameters:
+langIndex - [optional, in] an index to a langId+codepage entry in the translation block of the version resource. If the parameter is not defined (i.e., set to NULL), the first translation entry is returned.
+*/
+DWORD VersionInfoImpl::queryLangCp(VARIANT *langIndex)
+{
+	if (!_vi.isLoaded() && queryVersionInfo() != S_OK)
+		return { 0 };
+	// langIndex contains a one-based index to a lang-code element in the Translation table.
+	int j = 0;
+	if (langIndex)
+	{
+		if (langIndex->vt == VT_I4)
+			j = langIndex->lVal - 1;
+		else if (langIndex->vt == VT_I2)
+			j = langIndex->iVal - 1;
+	}
+	// get the language and code page entry at j. the translation table is decoded only once per file.
+	uint32_t langCp;
+	if (_vi.queryTranslation(j, &langCp) != ERROR_SUCCESS)
+		return { 0 }; // Subscript out of range, or a corrupted version info?
+	return langCp;
+}
+
+/* queryVersionInfo - locates the version info structure in the file's resource section and makes it available to queries through class member _vi. The file is memory-mapped, and the structure is read in place. Only the PE headers, the resource directory and the version data are paged in, no matter how large the image is.
+
+Remarks:
+An installer package is read as a compound file. Only the string pool, the Property table and the strings of the properties are read (see MsiPackage). A file in a cabinet is decompressed in memory as far as its version resource (see CabinetFile).
+If the file is neither, the method lets Win32 GetFileVersionInfo have a try. That keeps the error code reported for a non-executable file the same as the system's. If the system does find version info, the structure is copied into _vi.
+*/
+HRESULT VersionInfoImpl::queryVersionInfo()
+{
+	if (_file.length() == 0)
+		return E_UNEXPECTED;
+	// a file another VersionInfo has read is served from the process-wide cache. if an index is in use, an unchanged file is served from it without being opened.
+	uint32_t errorCode = VersionCache::instance().load(_file, _vi, _index.isOpen() ? &_index : NULL);
+	_bytesRead = _vi.bytesRead();
+	// the system cannot read a file in a cabinet. it has no say on it.
+	if (errorCode == ERROR_BAD_EXE_FORMAT && !CabinetFile::splitPath(_file))
+	{
+		DWORD dwHandle;
+		DWORD cbVerInfo = GetFileVersionInfoSize(_file, &dwHandle);
+		if (cbVerInfo == 0)
+		{
+			/* resource-related error codes: 
+			0x714 - ERROR_RESOURCE_DATA_NOT_FOUND
+			0x715 - ERROR_RESOURCE_TYPE_NOT_FOUND
+			0x716 - ERROR_RESOURCE_NAME_NOT_FOUND
+			0x717 - ERROR_RESOURCE_LANG_NOT_FOUND
+			*/
+			return HRESULT_FROM_WIN32(GetLastError());
+		}
+		bstring strVerInfo;
+		LPBYTE pbVerInfo = (LPBYTE)strVerInfo.byteAlloc(cbVerInfo);
+		if (!pbVerInfo)
+			return E_OUTOFMEMORY;
+		if (!GetFileVersionInfo(_file, dwHandle, cbVerInfo, pbVerInfo))
+			return HRESULT_FROM_WIN32(GetLastError());
+		errorCode = _vi.assign(pbVerInfo, cbVerInfo);
+	}
+	return HRESULT_FROM_WIN32(errorCode);
+}
+
+/* queryVersionNumber - retrieves the major+minor version of the file from the FixedFileInfo block of the version info resource. HIWORD(*Value) is the major version number, while LOWORD(*Value) the minor version number. If the file has no version resource, the method returns an ERROR_RESOURCE_* error code.
+
+Parameters:
+Value - [out] contains the value of VS_FIXEDFILEINFO::dwFileVersionMS, a fixed-length file version attribute, if the file has a version resource. If the file has no version resource, an appropriate error is returned. See queryVersionInfo for likely error codes.
+*/
+HRESULT VersionInfoImpl::queryVersionNumber(long *Value)
+{
+	HRESULT hr = S_OK;
+	if (!_vi.isLoaded())
+		hr = queryVersionInfo();
+	if (hr == S_OK)
+	{
+		const VERSION_FIXEDFILEINFO *pVSFFI = _vi.fixedInfo();
+		if (!pVSFFI)
+			return HRESULT_FROM_WIN32(ERROR_RESOURCE_TYPE_NOT_FOUND); // FixedFileInfo is not available for this file. the resource section must be corrupt.
+		*Value = pVSFFI->dwFileVersionMS;
+	}
+	return hr;
+}
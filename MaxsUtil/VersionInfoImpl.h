@@ -23,18 +23,31 @@
 #pragma once
 #include "IDispatchImpl.h"
 #include "MaxsUtil_h.h"
+#include "VersionResource.h"
+#include "VersionIndex.h"
+#include "VersionCache.h"
+#include "VersionWatcher.h"
+#include "VersionExporter.h"
+#include "PEDigest.h"
+#include "ClrMetadata.h"
+#include "ResourceTable.h"
 
 
-// implements the IVersionInfo interface of the VersionInfo coclass.
+// implements the IVersionInfo2 interface of the VersionInfo coclass. IVersionInfo2 extends IVersionInfo, which is frozen as published in version 1.0 of the type library. the object answers a query for either one with the same vtable.
 class VersionInfoImpl :
-	public IDispatchWithObjectSafetyImpl<IVersionInfo, &IID_IVersionInfo, &LIBID_MaxsUtilLib>
+	public IDispatchWithObjectSafetyImpl<IVersionInfo2, &IID_IVersionInfo2, &LIBID_MaxsUtilLib>
 {
 public:
-	VersionInfoImpl() : _langId(0), _codepage(0) {}
-	~VersionInfoImpl() {}
+	VersionInfoImpl() : _langId(0), _codepage(0), _bytesRead(0), _imageRead(false), _imageError(ERROR_SUCCESS), _codeViewRead(false), _codeViewError(ERROR_SUCCESS), _assemblyRead(false), _assemblyError(ERROR_SUCCESS), _resourcesRead(false), _resourcesError(ERROR_SUCCESS), _scanStats() {}
+	~VersionInfoImpl() { _watcher.stop(); _index.flush(); }
 
 	// IUnknown methods
-	DELEGATE_IUNKNOWN_TO_IDISPATCHWITHOBJECTSAFETYIMPL(IVersionInfo, &IID_IVersionInfo, &LIBID_MaxsUtilLib)
+	STDMETHOD(QueryInterface)(REFIID riid, LPVOID* ppvObj) { return IDispatchWithObjectSafetyImpl<IVersionInfo2, &IID_IVersionInfo2, &LIBID_MaxsUtilLib>::QueryInterface(toVersionInfo2(riid), ppvObj); }
+	DELEGATE_IUNKNOWN_REF_TO_IDISPATCHWITHOBJECTSAFETYIMPL(IVersionInfo2, &IID_IVersionInfo2, &LIBID_MaxsUtilLib)
+
+	// IObjectSafety methods
+	STDMETHOD(GetInterfaceSafetyOptions)(/* [in] */ REFIID riid, /* [out] */ DWORD *pdwSupportedOptions, /* [out] */ DWORD *pdwEnabledOptions) { return IDispatchWithObjectSafetyImpl<IVersionInfo2, &IID_IVersionInfo2, &LIBID_MaxsUtilLib>::GetInterfaceSafetyOptions(toVersionInfo2(riid), pdwSupportedOptions, pdwEnabledOptions); }
+	STDMETHOD(SetInterfaceSafetyOptions)(/* [in] */ REFIID riid, /* [in] */ DWORD dwOptionSetMask, /* [in] */ DWORD dwEnabledOptions) { return IDispatchWithObjectSafetyImpl<IVersionInfo2, &IID_IVersionInfo2, &LIBID_MaxsUtilLib>::SetInterfaceSafetyOptions(toVersionInfo2(riid), dwOptionSetMask, dwEnabledOptions); }
 
 	// IVersionInfo methods
 	STDMETHOD(get_File)(/* [retval][out] */ BSTR *Value);
@@ -49,16 +62,103 @@ public:
 	STDMETHOD(put_CodePage)(/* [in] */ short NewValue);
 	STDMETHOD(QueryTranslation)(/* [in] */ short TranslationIndex, /* [retval][out] */ VARIANT *LangCode);
 
+	// IVersionInfo2 methods
+	STDMETHOD(QueryAttributes)(/* [in] */ VARIANT Names, /* [retval][out] */ VARIANT *Values);
+	STDMETHOD(ScanDirectory)(/* [in] */ BSTR RootPath, /* [in, optional] */ VARIANT *Recursive, /* [in, optional] */ VARIANT *Attributes, /* [retval][out] */ VARIANT *Result);
+	STDMETHOD(get_IndexFile)(/* [retval][out] */ BSTR *Value);
+	STDMETHOD(put_IndexFile)(/* [in] */ BSTR NewValue);
+	STDMETHOD(get_IndexHitRate)(/* [retval][out] */ double *Value);
+	STDMETHOD(CompactIndex)();
+	STDMETHOD(get_RangeRead)(/* [retval][out] */ VARIANT_BOOL *Value);
+	STDMETHOD(put_RangeRead)(/* [in] */ VARIANT_BOOL NewValue);
+	STDMETHOD(get_BytesRead)(/* [retval][out] */ double *Value);
+	STDMETHOD(get_FileVersionKey)(/* [retval][out] */ VARIANT *Value);
+	STDMETHOD(get_ProductVersionKey)(/* [retval][out] */ VARIANT *Value);
+	STDMETHOD(MakeVersionKey)(/* [in] */ BSTR Version, /* [retval][out] */ VARIANT *Key);
+	STDMETHOD(CompareVersions)(/* [in] */ VARIANT Versions, /* [in] */ VARIANT Version, /* [retval][out] */ VARIANT *Results);
+	STDMETHOD(RankVersions)(/* [in] */ VARIANT Versions, /* [retval][out] */ VARIANT *Order);
+	STDMETHOD(SortVersions)(/* [in] */ VARIANT Versions, /* [retval][out] */ VARIANT *Sorted);
+	STDMETHOD(FindVersionRange)(/* [in] */ VARIANT Versions, /* [retval][out] */ VARIANT *Range);
+	STDMETHOD(CountVersionsBelow)(/* [in] */ VARIANT Versions, /* [in] */ VARIANT Version, /* [retval][out] */ long *Count);
+	STDMETHOD(get_CacheBudget)(/* [retval][out] */ double *Value);
+	STDMETHOD(put_CacheBudget)(/* [in] */ double NewValue);
+	STDMETHOD(get_CacheStatistics)(/* [retval][out] */ VARIANT *Value);
+	STDMETHOD(WatchDirectory)(/* [in] */ BSTR RootPath, /* [in, optional] */ VARIANT *Recursive, /* [in, optional] */ VARIANT *Attributes);
+	STDMETHOD(QueryWatched)(/* [in, optional] */ VARIANT *Path, /* [retval][out] */ VARIANT *Result);
+	STDMETHOD(StopWatching)();
+	STDMETHOD(get_WatchGeneration)(/* [retval][out] */ long *Value);
+	STDMETHOD(get_Filter)(/* [retval][out] */ BSTR *Value);
+	STDMETHOD(put_Filter)(/* [in] */ BSTR NewValue);
+	STDMETHOD(ExportDirectory)(/* [in] */ BSTR RootPath, /* [in] */ BSTR OutputPath, /* [in, optional] */ VARIANT *Format, /* [in, optional] */ VARIANT *Recursive, /* [in, optional] */ VARIANT *Attributes, /* [retval][out] */ double *RowCount);
+	STDMETHOD(get_CheckSum)(/* [retval][out] */ long *Value);
+	STDMETHOD(get_ComputedCheckSum)(/* [retval][out] */ long *Value);
+	STDMETHOD(get_AuthenticodeHash)(/* [retval][out] */ BSTR *Value);
+	STDMETHOD(get_SignedHash)(/* [retval][out] */ BSTR *Value);
+	STDMETHOD(get_PdbPath)(/* [retval][out] */ BSTR *Value);
+	STDMETHOD(get_PdbGuid)(/* [retval][out] */ BSTR *Value);
+	STDMETHOD(get_PdbAge)(/* [retval][out] */ long *Value);
+	STDMETHOD(get_SymbolKey)(/* [retval][out] */ BSTR *Value);
+	STDMETHOD(get_AssemblyName)(/* [retval][out] */ BSTR *Value);
+	STDMETHOD(get_AssemblyVersion)(/* [retval][out] */ BSTR *Value);
+	STDMETHOD(get_Culture)(/* [retval][out] */ BSTR *Value);
+	STDMETHOD(get_PublicKeyToken)(/* [retval][out] */ BSTR *Value);
+	STDMETHOD(QueryResources)(/* [retval][out] */ VARIANT *Result);
+	STDMETHOD(QueryResource)(/* [in] */ VARIANT Type, /* [in] */ VARIANT Name, /* [in, optional] */ VARIANT *Language, /* [retval][out] */ VARIANT *Data);
+	STDMETHOD(QueryString)(/* [in] */ long Id, /* [retval][out] */ BSTR *Value);
+	STDMETHOD(QueryIcon)(/* [in, optional] */ VARIANT *Name, /* [retval][out] */ VARIANT *Data);
+	STDMETHOD(get_Manifest)(/* [retval][out] */ BSTR *Value);
+	STDMETHOD(QueryTranslations)(/* [in, optional] */ VARIANT *Attributes, /* [retval][out] */ VARIANT *Result);
+	STDMETHOD(get_ScanStatistics)(/* [retval][out] */ VARIANT *Value);
+
 protected:
 	bstring _file; // pathname of a file with a version resource.
-	bstring _vi; // a version resource structure from win32 GetFileVersionInfo().
+	VersionResource _vi; // the version resource of _file. it is shared through VersionCache, or mapped in place from the file, on first access.
+	VersionIndex _index; // optional persistent cache of version resources. see put_IndexFile.
 	short _langId; // langauge (e.g., 1033 for english)
 	short _codepage; // codepage (e.g., 1200 for unicode)
+	uint64_t _bytesRead; // bytes read by the last file load or directory scan in range-read mode. see get_BytesRead.
+	VersionWatcher _watcher; // the live index of WatchDirectory.
+	VersionFilter _filter; // selects the files of ScanDirectory, ExportDirectory and WatchDirectory. see put_Filter.
+	PEDigest _digest; // the checksum and Authenticode hash of _file. computed on first access.
+	MappedFile _imageFile; // _file mapped for the image queries if _vi holds no mapping of it, e.g., in range-read mode or for a file served by an index.
+	PEImage _image; // the headers of _file, attached to the mapping of _vi or to _imageFile on first access. the image queries share it. it stays attached until another file is assigned, because the entries of _resources point into the mapping.
+	bool _imageRead;
+	uint32_t _imageError; // the result of attaching _image.
+	PECodeView _codeView; // the CodeView record of _file. read on first access.
+	bool _codeViewRead;
+	uint32_t _codeViewError; // the result of reading _codeView. ERROR_NOT_FOUND if the image has no CodeView record.
+	ClrAssemblyIdentity _assembly; // the identity of _file if it is a .NET assembly. read on first access.
+	bool _assemblyRead;
+	uint32_t _assemblyError; // the result of reading _assembly. ERROR_NOT_FOUND if _file is not an assembly.
+	ResourceTable _resources; // all resources of _file. listed on first access. the entries point into the mapping _image is attached to.
+	bool _resourcesRead;
+	uint32_t _resourcesError;
+	FileClassifyStats _scanStats; // counters of the file classifier of the last ScanDirectory or ExportDirectory.
 
 	DWORD queryLangCp(VARIANT *langIndex);
 	HRESULT queryVersionNumber(long *Value);
-	HRESULT queryAttribData(LPCWSTR subblockPath, LPVOID* attribData, UINT *attribLen);
-	HRESULT queryVersionInfo(bstring& strVerInfo);
+	HRESULT queryVersionInfo();
 	HRESULT ensureLangCp();
+	HRESULT queryVersionKey(bool product, VARIANT *Value);
+	HRESULT queryImageDigest();
+	HRESULT queryImage();
+	HRESULT queryCodeView();
+	HRESULT queryAssembly();
+	HRESULT returnAssemblyString(const std::string &text, BSTR *Value);
+	HRESULT queryResources();
+
+	// IVersionInfo2 derives from IVersionInfo. so, a pointer to IVersionInfo2 serves as one to IVersionInfo.
+	static REFIID toVersionInfo2(REFIID riid) { return IsEqualIID(riid, IID_IVersionInfo) ? IID_IVersionInfo2 : riid; }
+	static HRESULT attribValueToVariant(int type, uint32_t number, uint64_t fileTime, LPCWSTR text, UINT textLen, VARIANT *Value);
+	static HRESULT parseAttributeNames(VARIANT *Attributes, std::vector<std::u16string> &names);
+	static HRESULT variantToVersionKey(VARIANT *Version, uint64_t *key);
+	static HRESULT parseVersionKeys(VARIANT *Versions, std::vector<uint64_t> &keys);
+	static HRESULT createIntArray(const int32_t *values, size_t count, VARIANT *Result);
+	static HRESULT createKeyArray(const uint64_t *keys, size_t count, VARIANT *Result);
+	static HRESULT parseRecursive(VARIANT *Recursive, bool *recursive);
+	static HRESULT parseExportFormat(VARIANT *Format, LPCWSTR outputPath, VERSIONEXPORT_FORMAT *format);
+	static HRESULT variantToResourceId(VARIANT *Id, std::u16string &name, ResourceId &rid);
+	static HRESULT createByteArray(const uint8_t *data, size_t len, VARIANT *Result);
+	static HRESULT rowsToArray(const std::vector<VersionScanRow> &rows, size_t attributeCount, VARIANT *Result);
 };
 
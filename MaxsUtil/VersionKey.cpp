@@ -0,0 +1,315 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "VersionKey.h"
+#include <vector>
+#include <algorithm>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define VERSIONKEY_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define VERSIONKEY_AVX2
+#else//#ifdef _MSC_VER
+// gcc and clang compile AVX2 intrinsics only in functions marked for the instruction set. the functions are called after a run-time check of the processor.
+#define VERSIONKEY_AVX2 __attribute__((target("avx2")))
+#endif//#ifdef _MSC_VER
+#endif//#if defined(_M_X64) ...
+
+// below this many keys, a comparison sort beats the fixed cost of the radix sort histograms.
+#define VERSIONKEY_RADIX_MIN 256
+
+
+/* parseVersionKey - converts a version string to a version key. The string has up to 4 numbers separated by periods (e.g., '10.0.19041'), or by commas as in a resource script (e.g., '1, 2, 0, 5'). Missing parts are zero. So, '10.0' is the same as '10.0.0.0'.
+
+Parameters:
+text - [in] the version string. it need not be null-terminated.
+len - [in] number of characters in text.
+key - [out] receives the version key.
+
+Return value:
+ERROR_INVALID_DATA - the string is not a version number, or a part is greater than 65535.
+*/
+uint32_t parseVersionKey(LPCUTF16STR text, size_t len, uint64_t *key)
+{
+	uint64_t k = 0;
+	int part = 0;
+	size_t i = 0;
+	for (;;)
+	{
+		while (i < len && text[i] == ' ')
+			i++;
+		if (i == len || text[i] < '0' || text[i] > '9')
+			return ERROR_INVALID_DATA;
+		uint32_t n = 0;
+		while (i < len && text[i] >= '0' && text[i] <= '9')
+		{
+			n = n * 10 + (text[i++] - '0');
+			if (n > 0xFFFF)
+				return ERROR_INVALID_DATA;
+		}
+		k |= (uint64_t)n << (48 - 16 * part);
+		while (i < len && text[i] == ' ')
+			i++;
+		if (i == len)
+			break;
+		if ((text[i] != '.' && text[i] != ',') || ++part == 4)
+			return ERROR_INVALID_DATA;
+		i++;
+	}
+	*key = k;
+	return ERROR_SUCCESS;
+}
+
+#ifdef VERSIONKEY_X86
+/* _hasAvx2 - checks that the processor supports AVX2 and that the system saves the YMM registers. */
+static bool _hasAvx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	// OSXSAVE and AVX must be set, and XCR0 must enable the XMM and YMM states.
+	if ((info[2] & 0x18000000) != 0x18000000 || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & 0x20) != 0;
+#else//#ifdef _MSC_VER
+	return __builtin_cpu_supports("avx2") != 0;
+#endif//#ifdef _MSC_VER
+}
+
+static bool _useAvx2()
+{
+	static const bool hasAvx2 = _hasAvx2();
+	return hasAvx2;
+}
+
+/* AVX2 has signed 64-bit comparison only. flipping the sign bit of both operands makes a signed comparison give the unsigned order. */
+#define VERSIONKEY_SIGN 0x8000000000000000ull
+
+/* _spreadBits - _spreadBits[m] has byte k set to 1 if bit k of m is set. it turns a 4-bit lane mask into 4 result bytes. */
+static const uint32_t _spreadBits[16] = {
+	0x00000000, 0x00000001, 0x00000100, 0x00000101, 0x00010000, 0x00010001, 0x00010100, 0x00010101,
+	0x01000000, 0x01000001, 0x01000100, 0x01000101, 0x01010000, 0x01010001, 0x01010100, 0x01010101,
+};
+
+/* _compareAvx2 - compares keys 4 at a time, and returns the number of keys processed. the caller does the rest. */
+VERSIONKEY_AVX2 static size_t _compareAvx2(const uint64_t *keys, size_t count, uint64_t key, int8_t *results)
+{
+	const __m256i sign = _mm256_set1_epi64x((long long)VERSIONKEY_SIGN);
+	const __m256i k = _mm256_xor_si256(_mm256_set1_epi64x((long long)key), sign);
+	size_t i;
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		__m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), sign);
+		int gt = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, k)));
+		int lt = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(k, v)));
+		// a key is either above or below or equal. so, the 1s and the -1s (0xFF) never meet in a byte.
+		uint32_t packed = _spreadBits[gt] | (_spreadBits[lt] * 0xFF);
+		memcpy(results + i, &packed, sizeof(packed));
+	}
+	return i;
+}
+
+/* _countBelowAvx2 - counts keys less than key in the first multiple of 4 keys. *processed receives the number of keys looked at. */
+VERSIONKEY_AVX2 static size_t _countBelowAvx2(const uint64_t *keys, size_t count, uint64_t key, size_t *processed)
+{
+	const __m256i sign = _mm256_set1_epi64x((long long)VERSIONKEY_SIGN);
+	const __m256i k = _mm256_xor_si256(_mm256_set1_epi64x((long long)key), sign);
+	// lanes of acc count down by 1 for every key below. a compare result is -1 for true.
+	__m256i acc = _mm256_setzero_si256();
+	size_t i;
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		__m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), sign);
+		acc = _mm256_add_epi64(acc, _mm256_cmpgt_epi64(k, v));
+	}
+	uint64_t lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, acc);
+	*processed = i;
+	return (size_t)(0 - (lanes[0] + lanes[1] + lanes[2] + lanes[3]));
+}
+
+/* _rangeAvx2 - finds the smallest and largest keys in the first multiple of 4 keys. count must be at least 4. */
+VERSIONKEY_AVX2 static size_t _rangeAvx2(const uint64_t *keys, size_t count, uint64_t *minKey, uint64_t *maxKey)
+{
+	const __m256i sign = _mm256_set1_epi64x((long long)VERSIONKEY_SIGN);
+	__m256i vmin = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)keys), sign);
+	__m256i vmax = vmin;
+	size_t i;
+	for (i = 4; i + 4 <= count; i += 4)
+	{
+		__m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), sign);
+		vmin = _mm256_blendv_epi8(vmin, v, _mm256_cmpgt_epi64(vmin, v));
+		vmax = _mm256_blendv_epi8(vmax, v, _mm256_cmpgt_epi64(v, vmax));
+	}
+	uint64_t lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, _mm256_xor_si256(vmin, sign));
+	*minKey = (std::min)((std::min)(lanes[0], lanes[1]), (std::min)(lanes[2], lanes[3]));
+	_mm256_storeu_si256((__m256i*)lanes, _mm256_xor_si256(vmax, sign));
+	*maxKey = (std::max)((std::max)(lanes[0], lanes[1]), (std::max)(lanes[2], lanes[3]));
+	return i;
+}
+#endif//#ifdef VERSIONKEY_X86
+
+/* compareVersionKeys - compares each key of an array with a given key.
+
+Parameters:
+keys - [in] an array of version keys.
+count - [in] number of keys in the array.
+key - [in] the key to compare with.
+results - [out] an array of count elements. receives -1, 0 or 1 for each key that is less than, equal to, or greater than key.
+*/
+void compareVersionKeys(const uint64_t *keys, size_t count, uint64_t key, int8_t *results)
+{
+	size_t i = 0;
+#ifdef VERSIONKEY_X86
+	if (_useAvx2())
+		i = _compareAvx2(keys, count, key, results);
+#endif//#ifdef VERSIONKEY_X86
+	for (; i < count; i++)
+		results[i] = (int8_t)((keys[i] > key) - (keys[i] < key));
+}
+
+/* countVersionKeysBelow - returns the number of keys in an array that are less than a given key, e.g., the number of files older than 10.0.19041. */
+size_t countVersionKeysBelow(const uint64_t *keys, size_t count, uint64_t key)
+{
+	size_t i = 0, n = 0;
+#ifdef VERSIONKEY_X86
+	if (_useAvx2())
+		n = _countBelowAvx2(keys, count, key, &i);
+#endif//#ifdef VERSIONKEY_X86
+	for (; i < count; i++)
+		n += keys[i] < key;
+	return n;
+}
+
+/* findVersionKeyRange - finds the oldest and the newest versions in an array of keys.
+
+Parameters:
+keys - [in] an array of version keys.
+count - [in] number of keys in the array.
+minIndex - [out] receives the index of the first smallest key. 0 if the array is empty.
+maxIndex - [out] receives the index of the first largest key. 0 if the array is empty.
+*/
+void findVersionKeyRange(const uint64_t *keys, size_t count, size_t *minIndex, size_t *maxIndex)
+{
+	*minIndex = *maxIndex = 0;
+	if (count == 0)
+		return;
+	uint64_t minKey = keys[0], maxKey = keys[0];
+	size_t i = 1;
+#ifdef VERSIONKEY_X86
+	if (count >= 4 && _useAvx2())
+		i = _rangeAvx2(keys, count, &minKey, &maxKey);
+#endif//#ifdef VERSIONKEY_X86
+	for (; i < count; i++)
+	{
+		if (keys[i] < minKey)
+			minKey = keys[i];
+		if (keys[i] > maxKey)
+			maxKey = keys[i];
+	}
+	// the values are known. locate them.
+	while (keys[*minIndex] != minKey)
+		(*minIndex)++;
+	while (keys[*maxIndex] != maxKey)
+		(*maxIndex)++;
+}
+
+/* _radixSort - sorts items by a 64-bit key in 8 passes of 8-bit digits, least significant first. The counts of all digits are taken in one pass over the items. A digit which is the same in all keys does not change the order, and its pass is skipped. Version keys of a set of files share most of their high-order digits (few majors, fewer minors). So, a typical sort makes 3 or 4 passes.
+*/
+template<class T, class KeyOf>
+static void _radixSort(T *items, size_t count, KeyOf keyOf)
+{
+	std::vector<size_t> counts(8 * 256, 0);
+	for (size_t i = 0; i < count; i++)
+	{
+		uint64_t k = keyOf(items[i]);
+		for (int d = 0; d < 8; d++)
+			counts[d * 256 + (size_t)((k >> (8 * d)) & 0xFF)]++;
+	}
+	std::vector<T> temp(count);
+	T *src = items, *dst = temp.data();
+	uint64_t first = keyOf(items[0]);
+	for (int d = 0; d < 8; d++)
+	{
+		size_t *c = counts.data() + d * 256;
+		if (c[(first >> (8 * d)) & 0xFF] == count)
+			continue;
+		// turn the counts into starting positions.
+		size_t pos = 0;
+		for (int j = 0; j < 256; j++)
+		{
+			size_t n = c[j];
+			c[j] = pos;
+			pos += n;
+		}
+		for (size_t i = 0; i < count; i++)
+			dst[c[(keyOf(src[i]) >> (8 * d)) & 0xFF]++] = src[i];
+		std::swap(src, dst);
+	}
+	if (src != items)
+		memcpy(items, src, count * sizeof(T));
+}
+
+/* sortVersionKeys - sorts an array of version keys in ascending order. */
+void sortVersionKeys(uint64_t *keys, size_t count)
+{
+	if (count < VERSIONKEY_RADIX_MIN)
+		std::sort(keys, keys + count);
+	else
+		_radixSort(keys, count, [](uint64_t k) { return k; });
+}
+
+/* rankVersionKeys - orders the indices of an array of version keys by the keys, oldest first. The keys are not moved. The sort is stable. So, files of the same version keep the order they were given in.
+
+Parameters:
+keys - [in] an array of version keys.
+count - [in] number of keys in the array. must be less than 4G.
+order - [out] an array of count elements. receives the indices of the keys in ascending order of the keys. order[0] is the oldest, and order[count-1] is the newest.
+*/
+void rankVersionKeys(const uint64_t *keys, size_t count, uint32_t *order)
+{
+	struct RankItem
+	{
+		uint64_t key;
+		uint32_t index;
+	};
+	std::vector<RankItem> items(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		items[i].key = keys[i];
+		items[i].index = (uint32_t)i;
+	}
+	if (count < VERSIONKEY_RADIX_MIN)
+		std::stable_sort(items.begin(), items.end(), [](const RankItem &a, const RankItem &b) { return a.key < b.key; });
+	else
+		_radixSort(items.data(), count, [](const RankItem &item) { return item.key; });
+	for (size_t i = 0; i < count; i++)
+		order[i] = items[i].index;
+}
@@ -0,0 +1,42 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+
+
+/* a version key packs a 4-part version number into 64 bits, <major> in the top 16 bits and <build> in the bottom 16. It is the dwFileVersionMS (or dwProductVersionMS) member of VS_FIXEDFILEINFO shifted left by 32 and or'ed with the LS member. Two keys compare the same way as the versions they stand for. So, versions can be sorted and compared as plain unsigned integers.
+*/
+#define VERSION_KEY(ms, ls) (((uint64_t)(uint32_t)(ms) << 32) | (uint64_t)(uint32_t)(ls))
+#define VERSION_KEY_MAJOR(key) ((uint16_t)((key) >> 48))
+#define VERSION_KEY_MINOR(key) ((uint16_t)((key) >> 32))
+#define VERSION_KEY_REVISION(key) ((uint16_t)((key) >> 16))
+#define VERSION_KEY_BUILD(key) ((uint16_t)(key))
+
+uint32_t parseVersionKey(LPCUTF16STR text, size_t len, uint64_t *key);
+
+/* batch operations on arrays of version keys. On an x86 or x64 processor that supports AVX2, compareVersionKeys, countVersionKeysBelow and findVersionKeyRange process 4 keys per instruction. Otherwise, they fall back to scalar loops. The sort functions use a radix sort, which makes the cost linear in the number of keys. */
+void compareVersionKeys(const uint64_t *keys, size_t count, uint64_t key, int8_t *results);
+size_t countVersionKeysBelow(const uint64_t *keys, size_t count, uint64_t key);
+void findVersionKeyRange(const uint64_t *keys, size_t count, size_t *minIndex, size_t *maxIndex);
+void sortVersionKeys(uint64_t *keys, size_t count);
+void rankVersionKeys(const uint64_t *keys, size_t count, uint32_t *order);
@@ -0,0 +1,896 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "VersionResource.h"
+#include "PEImage.h"
+#include "PEProbe.h"
+#include "MsiPackage.h"
+#include "CabinetFile.h"
+#include <string.h>
+#include <algorithm>
+
+
+static const UTF16CHAR VS_VERSION_INFO_KEY[] = u"VS_VERSION_INFO";
+static const UTF16CHAR STRINGFILEINFO_KEY[] = u"StringFileInfo";
+static const UTF16CHAR VARFILEINFO_KEY[] = u"VarFileInfo";
+static const UTF16CHAR TRANSLATION_KEY[] = u"Translation";
+#define KEYLEN(key) (sizeof(key) / sizeof(UTF16CHAR) - 1)
+
+/* _formatVersion - formats a pair of version DWORDs as <major>.<minor>.<revision>.<build> in a VersionAttribValue's own buffer. */
+static void _formatVersion(uint32_t ms, uint32_t ls, VersionAttribValue &value)
+{
+	uint16_t parts[4] = { (uint16_t)(ms >> 16), (uint16_t)ms, (uint16_t)(ls >> 16), (uint16_t)ls };
+	UTF16CHAR *p = value.buf;
+	for (int i = 0; i < 4; i++)
+	{
+		if (i > 0)
+			*p++ = '.';
+		UTF16CHAR digits[5];
+		int n = 0;
+		uint16_t v = parts[i];
+		do
+		{
+			digits[n++] = (UTF16CHAR)('0' + v % 10);
+			v /= 10;
+		} while (v);
+		while (n)
+			*p++ = digits[--n];
+	}
+	value.type = VAT_TEXT;
+	value.text = value.buf;
+	value.textLen = (uint32_t)(p - value.buf);
+}
+
+/* the attributes QueryAttribute knows by name. a FixedFileInfo attribute comes with an extractor which reads it from the VS_FIXEDFILEINFO block. a StringFileInfo attribute has none and is looked up in the string table of a translation. FileVersion and ProductVersion are in both places. the FixedFileInfo values are used for them, as the system's own version property does.
+*/
+struct VersionAttribDesc
+{
+	LPCUTF16STR name;
+	uint32_t nameLen;
+	void (*extract)(const VERSION_FIXEDFILEINFO *ffi, const VersionAttribDesc &desc, VersionAttribValue &value);
+	uint8_t field1, field2; // byte offsets of the VS_FIXEDFILEINFO members the extractor reads.
+};
+
+inline uint32_t _fixedField(const VERSION_FIXEDFILEINFO *ffi, uint8_t offset)
+{
+	return *(const uint32_t*)((const uint8_t*)ffi + offset);
+}
+static void _extractNumber(const VERSION_FIXEDFILEINFO *ffi, const VersionAttribDesc &desc, VersionAttribValue &value)
+{
+	value.type = VAT_NUMBER;
+	value.number = _fixedField(ffi, desc.field1);
+}
+static void _extractVersion(const VERSION_FIXEDFILEINFO *ffi, const VersionAttribDesc &desc, VersionAttribValue &value)
+{
+	_formatVersion(_fixedField(ffi, desc.field1), _fixedField(ffi, desc.field2), value);
+}
+static void _extractFileTime(const VERSION_FIXEDFILEINFO *ffi, const VersionAttribDesc &desc, VersionAttribValue &value)
+{
+	uint32_t ms = _fixedField(ffi, desc.field1), ls = _fixedField(ffi, desc.field2);
+	// a file date of zero means the resource does not specify one.
+	if (ms && ls)
+	{
+		value.type = VAT_FILETIME;
+		value.fileTime = ((uint64_t)ms << 32) | ls;
+	}
+	else
+		value.type = VAT_EMPTY;
+}
+
+#define VIFIELD(member) (uint8_t)offsetof(VERSION_FIXEDFILEINFO, member)
+#define VIFIXED(name, extract, field1, field2) { u"" #name, sizeof(#name) - 1, extract, field1, field2 }
+#define VINUMBER(name) VIFIXED(name, _extractNumber, VIFIELD(dw##name), 0)
+#define VISTRING(name) { u"" #name, sizeof(#name) - 1, NULL, 0, 0 }
+
+static constexpr VersionAttribDesc VIAttribDescs[] = {
+	// FixedFileInfo
+	VIFIXED(FileVersion, _extractVersion, VIFIELD(dwFileVersionMS), VIFIELD(dwFileVersionLS)),
+	VIFIXED(ProductVersion, _extractVersion, VIFIELD(dwProductVersionMS), VIFIELD(dwProductVersionLS)),
+	VINUMBER(Signature),
+	VINUMBER(StrucVersion),
+	VINUMBER(FileVersionMS),
+	VINUMBER(FileVersionLS),
+	VINUMBER(ProductVersionMS),
+	VINUMBER(ProductVersionLS),
+	VINUMBER(FileFlagsMask),
+	VINUMBER(FileFlags),
+	VINUMBER(FileOS),
+	VINUMBER(FileType),
+	VINUMBER(FileSubtype),
+	VIFIXED(FileDate, _extractFileTime, VIFIELD(dwFileDateMS), VIFIELD(dwFileDateLS)),
+	// StringFileInfo
+	VISTRING(Comments),
+	VISTRING(CompanyName),
+	VISTRING(FileDescription),
+	VISTRING(InternalName),
+	VISTRING(LegalCopyright),
+	VISTRING(LegalTrademarks),
+	VISTRING(OriginalFilename),
+	VISTRING(ProductName),
+	VISTRING(PrivateBuild),
+	VISTRING(SpecialBuild),
+};
+#define VIATTRIB_COUNT (sizeof(VIAttribDescs) / sizeof(VIAttribDescs[0]))
+
+/* the attribute names are mapped to VIAttribDescs by a perfect hash built at compile time. the hash is a case-insensitive FNV-1a with a seed. the compiler tries seeds until every known name lands in a slot of its own. so, a lookup costs one hash, one table read and one name comparison no matter how many names there are. the name comparison rejects names not in the table.
+*/
+#define VIATTRIB_HASH_BITS 7
+#define VIATTRIB_HASH_SLOTS (1 << VIATTRIB_HASH_BITS)
+
+constexpr uint32_t _attribHash(LPCUTF16STR name, size_t nameLen, uint32_t seed)
+{
+	uint32_t h = seed;
+	for (size_t i = 0; i < nameLen; i++)
+	{
+		UTF16CHAR c = name[i];
+		if (c >= 'A' && c <= 'Z')
+			c = (UTF16CHAR)(c + ('a' - 'A'));
+		h = (h ^ c) * 16777619u;
+	}
+	return h >> (32 - VIATTRIB_HASH_BITS);
+}
+
+struct VersionAttribHashTable
+{
+	uint32_t seed;
+	uint8_t slots[VIATTRIB_HASH_SLOTS]; // 1-based index into VIAttribDescs. 0 marks an empty slot.
+};
+
+constexpr VersionAttribHashTable _buildAttribHashTable()
+{
+	VersionAttribHashTable table = {};
+	for (uint32_t seed = 2166136261u; ; seed++)
+	{
+		for (size_t i = 0; i < VIATTRIB_HASH_SLOTS; i++)
+			table.slots[i] = 0;
+		size_t i = 0;
+		for (; i < VIATTRIB_COUNT; i++)
+		{
+			uint32_t h = _attribHash(VIAttribDescs[i].name, VIAttribDescs[i].nameLen, seed);
+			if (table.slots[h])
+				break; // collision. try the next seed.
+			table.slots[h] = (uint8_t)(i + 1);
+		}
+		if (i == VIATTRIB_COUNT)
+		{
+			table.seed = seed;
+			return table;
+		}
+	}
+}
+
+static constexpr VersionAttribHashTable VIAttribHashTable = _buildAttribHashTable();
+
+/* _findAttribDesc - looks up the descriptor of a known attribute. Returns NULL if the name is not known, e.g., a custom string attribute.
+
+Parameters:
+name - [in] attribute name. Case does not matter.
+nameLen - [in] number of characters in name.
+*/
+static const VersionAttribDesc *_findAttribDesc(LPCUTF16STR name, size_t nameLen)
+{
+	uint8_t slot = VIAttribHashTable.slots[_attribHash(name, nameLen, VIAttribHashTable.seed)];
+	if (slot == 0)
+		return NULL;
+	const VersionAttribDesc *desc = VIAttribDescs + slot - 1;
+	if (desc->nameLen != nameLen || utf16icmp(name, nameLen, desc->name, nameLen) != 0)
+		return NULL;
+	return desc;
+}
+
+/* _attribId - returns a non-zero id for a known attribute name, or 0 for any other name. */
+inline uint8_t _attribId(LPCUTF16STR name, size_t nameLen)
+{
+	const VersionAttribDesc *desc = _findAttribDesc(name, nameLen);
+	return desc ? (uint8_t)(desc - VIAttribDescs + 1) : 0;
+}
+
+/* _parseLangCp - decodes the 8-digit hex key of a StringFileInfo table (e.g., '040904B0') as a translation code. Returns false if the key is not 8 hex digits. */
+static bool _parseLangCp(LPCUTF16STR key, size_t keyLen, uint32_t *langCp)
+{
+	if (keyLen != 8)
+		return false;
+	uint32_t v = 0;
+	for (size_t i = 0; i < 8; i++)
+	{
+		UTF16CHAR c = utf16ToLower(key[i]);
+		if (c >= '0' && c <= '9')
+			v = (v << 4) | (uint32_t)(c - '0');
+		else if (c >= 'a' && c <= 'f')
+			v = (v << 4) | (uint32_t)(c - 'a' + 10);
+		else
+			return false;
+	}
+	*langCp = VERSION_LANGCP(v >> 16, v & 0xFFFF);
+	return true;
+}
+
+/* _align4 - rounds a pointer into a version block up to the next 32-bit boundary. The alignment is relative to the start of the block, not to the address space, because the block may sit at an odd address in a heap copy. */
+inline const uint8_t *_align4(const uint8_t *base, const uint8_t *p)
+{
+	return base + (((size_t)(p - base) + 3) & ~(size_t)3);
+}
+
+/* load - maps a file and locates its version resource. If the file is a PE image and has a VS_VERSIONINFO resource, the method returns ERROR_SUCCESS, and the query methods become available. The mapping stays open until close() is called or another file is loaded. In the range-read mode, the version resource is read into memory, and the file is not kept open.
+
+Parameters:
+path - [in] pathname of an executable file, e.g., a .dll or .exe, or of an installer package (.msi). A file in a cabinet is named as 'archive.cab|inner\path.dll'.
+
+Return value:
+ERROR_BAD_EXE_FORMAT - the file is neither a PE image nor an installer package.
+ERROR_RESOURCE_DATA_NOT_FOUND - the image has no resource section, or the version data is malformed.
+ERROR_RESOURCE_TYPE_NOT_FOUND - the image has resources but no version resource.
+other - a system error code from opening and mapping the file.
+*/
+uint32_t VersionResource::load(LPCPATHSTR path)
+{
+	close();
+	_bytesRead = 0;
+	size_t separator = CabinetFile::splitPath(path);
+	if (separator)
+		return loadCabinet(path, separator);
+	if (_rangeRead)
+		return loadRange(path);
+	uint32_t errorCode = _file.open(path);
+	if (errorCode == ERROR_HANDLE_EOF)
+		return ERROR_BAD_EXE_FORMAT; // an empty file is not an executable.
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	PEImage pe;
+	errorCode = pe.attach(_file.data(), _file.size());
+	if (errorCode == ERROR_BAD_EXE_FORMAT && CompoundFile::hasSignature(_file.data(), _file.size()))
+	{
+		close();
+		return loadPackage(path);
+	}
+	if (errorCode == ERROR_SUCCESS)
+	{
+		const uint8_t *data;
+		uint32_t dataLen;
+		errorCode = pe.findResource(PE_RT_VERSION, PE_VS_VERSION_INFO, 0, &data, &dataLen);
+		if (errorCode == ERROR_SUCCESS)
+			errorCode = attachBlock(data, dataLen);
+	}
+	if (errorCode != ERROR_SUCCESS)
+		close();
+	return errorCode;
+}
+
+/* loadRange - the range-read version of load. The version resource is read into _copy with positioned reads. The file is closed when the method returns.
+*/
+uint32_t VersionResource::loadRange(LPCPATHSTR path)
+{
+	PEProbe probe;
+	uint32_t errorCode = probe.findResource(path, PE_RT_VERSION, PE_VS_VERSION_INFO, 0, _copy);
+	_bytesRead = probe.bytesRead();
+	if (errorCode == ERROR_HANDLE_EOF)
+		return ERROR_BAD_EXE_FORMAT; // an empty file is not an executable.
+	if (errorCode == ERROR_BAD_EXE_FORMAT)
+	{
+		errorCode = loadPackage(path);
+		_bytesRead += probe.bytesRead();
+		return errorCode;
+	}
+	if (errorCode == ERROR_SUCCESS)
+		errorCode = attachBlock(_copy.data(), _copy.size());
+	if (errorCode != ERROR_SUCCESS)
+		close();
+	return errorCode;
+}
+
+/* loadCabinet - reads the version resource of a file in a cabinet into _copy. Only the blocks of the folder up to the end of the version resource are read and decompressed.
+
+Parameters:
+path - [in] pathname of the cabinet, a vertical bar, and the pathname of the file in the cabinet.
+separator - [in] position of the vertical bar.
+
+Return value:
+ERROR_BAD_FORMAT - the file is not a cabinet.
+ERROR_FILE_NOT_FOUND - the cabinet has no such file.
+ERROR_NOT_SUPPORTED - the file spans cabinets, or it is compressed with a method other than MSZIP.
+ERROR_INVALID_DATA - the compressed data is corrupt.
+*/
+uint32_t VersionResource::loadCabinet(LPCPATHSTR path, size_t separator)
+{
+	std::u16string name;
+#ifdef _WIN32
+	name.assign((LPCUTF16STR)path + separator + 1);
+#else//#ifdef _WIN32
+	appendUtf16(name, path + separator + 1, strlen(path + separator + 1));
+#endif//#ifdef _WIN32
+	CabinetFile cab;
+	size_t index = 0;
+	uint32_t errorCode = cab.open(pathstring(path, separator).c_str());
+	if (errorCode == ERROR_SUCCESS)
+		errorCode = cab.findFile(name.c_str(), name.size(), &index);
+	if (errorCode == ERROR_SUCCESS)
+		errorCode = cab.selectFile(index);
+	if (errorCode == ERROR_SUCCESS)
+	{
+		PEProbe probe;
+		errorCode = probe.findResource(cab, PE_RT_VERSION, PE_VS_VERSION_INFO, 0, _copy);
+		if (errorCode == ERROR_HANDLE_EOF)
+			errorCode = ERROR_BAD_EXE_FORMAT; // an empty file is not an executable.
+	}
+	_bytesRead = cab.bytesRead();
+	if (errorCode == ERROR_SUCCESS)
+		errorCode = attachBlock(_copy.data(), _copy.size());
+	if (errorCode != ERROR_SUCCESS)
+		close();
+	return errorCode;
+}
+
+/* loadPackage - reads the product properties of an installer package into _copy as a version block. Only the sectors of the string pool, the Property table and the strings compared are read. The file is closed when the method returns.
+
+Return value:
+ERROR_BAD_EXE_FORMAT - the file is not an installer package.
+*/
+uint32_t VersionResource::loadPackage(LPCPATHSTR path)
+{
+	MsiPackage msi;
+	uint32_t errorCode = msi.open(path);
+	if (errorCode == ERROR_SUCCESS)
+		errorCode = msi.buildVersionBlock(_copy);
+	_bytesRead = msi.bytesRead();
+	if (errorCode == ERROR_BAD_FORMAT || errorCode == ERROR_FILE_NOT_FOUND || errorCode == ERROR_HANDLE_EOF)
+		errorCode = ERROR_BAD_EXE_FORMAT; // not a compound file, a truncated one, or one of another kind (e.g., a .doc).
+	if (errorCode == ERROR_SUCCESS)
+		errorCode = attachBlock(_copy.data(), _copy.size());
+	if (errorCode != ERROR_SUCCESS)
+		close();
+	return errorCode;
+}
+
+/* assign - copies a version block obtained elsewhere (e.g., from Win32 GetFileVersionInfo) and makes it available for queries.
+
+Parameters:
+data - [in] start of a VS_VERSIONINFO structure.
+len - [in] byte length of the data.
+*/
+uint32_t VersionResource::assign(const void *data, size_t len)
+{
+	close();
+	_bytesRead = 0;
+	_copy.assign((const uint8_t*)data, (const uint8_t*)data + len);
+	uint32_t errorCode = attachBlock(_copy.data(), _copy.size());
+	if (errorCode != ERROR_SUCCESS)
+		close();
+	return errorCode;
+}
+
+/* assignShared - makes a shared version block available for queries. The block is not copied. Its decoded table is used as is.
+
+Parameters:
+block - [in] a block made by share(), e.g., one from VersionCache.
+*/
+uint32_t VersionResource::assignShared(const SharedVersionBlockPtr &block)
+{
+	close();
+	_bytesRead = 0;
+	if (!block || block->data.empty())
+		return ERROR_INVALID_PARAMETER;
+	_shared = block;
+	_vi = _shared->data.data();
+	_viLen = (uint32_t)_shared->data.size();
+	return ERROR_SUCCESS;
+}
+
+/* share - copies the loaded version block into a SharedVersionBlock and decodes its attribute table, so that the block can be handed to other VersionResources. The resource switches over to the shared copy. The file mapping stays open until the resource is closed, so that the owner can go on reading other parts of the image through mappedFile() without opening the file again. Returns an empty pointer if nothing is loaded.
+*/
+SharedVersionBlockPtr VersionResource::share()
+{
+	if (!_vi)
+		return SharedVersionBlockPtr();
+	if (_shared)
+		return _shared;
+	std::shared_ptr<SharedVersionBlock> block = std::make_shared<SharedVersionBlock>();
+	block->data.assign(_vi, _vi + _viLen);
+	// the table holds offsets from the start of the block. so, it is valid for the copy, too.
+	table();
+	block->table = _table;
+	// switch over without close(). it would release the mapping, and reset the count of the load that just happened.
+	_shared = block;
+	_vi = _shared->data.data();
+	_table.clear();
+	_copy.clear();
+	return _shared;
+}
+
+/* close - releases the file mapping or the copied data. */
+void VersionResource::close()
+{
+	_vi = NULL;
+	_viLen = 0;
+	_table.clear();
+	_file.close();
+	_copy.clear();
+	_shared.reset();
+}
+
+/* attachBlock - verifies that data starts with a VS_VERSIONINFO node, and sets the node as the root of subsequent queries. */
+uint32_t VersionResource::attachBlock(const uint8_t *data, size_t len)
+{
+	_vi = data;
+	_viLen = (uint32_t)len;
+	VersionBlock root;
+	if (!parseBlock(data, data + len, root) ||
+		utf16icmp(root.key, root.keyLen, VS_VERSION_INFO_KEY, sizeof(VS_VERSION_INFO_KEY) / sizeof(UTF16CHAR) - 1) != 0)
+	{
+		_vi = NULL;
+		_viLen = 0;
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	}
+	// wLength of the root may be smaller than the resource size. the rest is padding.
+	_viLen = (uint32_t)(root.end - root.start);
+	return ERROR_SUCCESS;
+}
+
+/* parseBlock - decodes the header of a node in the version tree. Returns false if the node does not fit within limit or is otherwise malformed.
+
+Parameters:
+p - [in] start of the node.
+limit - [in] end of the enclosing node. The node must not extend past it.
+block - [out] receives the decoded header.
+*/
+bool VersionResource::parseBlock(const uint8_t *p, const uint8_t *limit, VersionBlock &block) const
+{
+	const size_t cbHeader = 3 * sizeof(uint16_t);
+	if (p + cbHeader > limit)
+		return false;
+	uint16_t wLength, wValueLength, wType;
+	memcpy(&wLength, p, sizeof(uint16_t));
+	memcpy(&wValueLength, p + 2, sizeof(uint16_t));
+	memcpy(&wType, p + 4, sizeof(uint16_t));
+	if (wLength < cbHeader || p + wLength > limit)
+		return false;
+	block.start = p;
+	block.end = p + wLength;
+	block.type = wType;
+	block.key = (LPCUTF16STR)(p + cbHeader);
+	// the key is a null-terminated string. it must end within the node.
+	size_t maxKeyLen = (wLength - cbHeader) / sizeof(UTF16CHAR);
+	size_t n = 0;
+	while (n < maxKeyLen && block.key[n])
+		n++;
+	if (n == maxKeyLen)
+		return false;
+	block.keyLen = n;
+	block.value = _align4(_vi, p + cbHeader + (n + 1) * sizeof(UTF16CHAR));
+	if (block.value > block.end)
+		block.value = block.end;
+	// wValueLength counts characters for a text value and bytes for a binary value. some resource compilers get it wrong. so, clip it to the node.
+	size_t cbValue = wType == VERSION_BLOCK_TYPE_TEXT ? wValueLength * sizeof(UTF16CHAR) : wValueLength;
+	if (block.value + cbValue > block.end)
+		cbValue = block.end - block.value;
+	block.valueLen = (uint32_t)cbValue;
+	block.children = _align4(_vi, block.value + cbValue);
+	if (block.children > block.end)
+		block.children = block.end;
+	return true;
+}
+
+/* findChild - searches the immediate children of a node for one with a given key. The comparison is case-insensitive as it is with VerQueryValue.
+
+Parameters:
+parent - [in] the node whose children are searched.
+key - [in] the key to look for. It need not be null-terminated.
+keyLen - [in] number of characters in key.
+child - [out] receives the matching child node.
+*/
+bool VersionResource::findChild(const VersionBlock &parent, LPCUTF16STR key, size_t keyLen, VersionBlock &child) const
+{
+	const uint8_t *p = parent.children;
+	while (p < parent.end)
+	{
+		if (!parseBlock(p, parent.end, child))
+			return false;
+		if (utf16icmp(child.key, child.keyLen, key, keyLen) == 0)
+			return true;
+		const uint8_t *next = _align4(_vi, child.end);
+		if (next <= p)
+			return false;
+		p = next;
+	}
+	return false;
+}
+
+/* queryValue - retrieves a value from the version resource. This is a replacement for Win32 VerQueryValue. It accepts the same subblock paths.
+
+Parameters:
+subblockPath - [in] path to a value. There are three kinds of paths.
+  1) '\' - the VS_FIXEDFILEINFO structure.
+  2) '\VarFileInfo\Translation' - the array of language and codepage pairs.
+  3) '\StringFileInfo\<LangId+CodePage>\<Attribute>' - a string attribute, e.g., '\StringFileInfo\040904B0\ProductName'.
+value - [out] receives a pointer to the value. The pointer refers to the resource data and remains valid until the resource is closed.
+valueLen - [out] receives the length of the value. For a text value, it is the number of characters excluding the terminating null. For a binary value, it is the number of bytes.
+
+Return value:
+ERROR_RESOURCE_DATA_NOT_FOUND - no version resource has been loaded, or the path does not exist.
+*/
+uint32_t VersionResource::queryValue(LPCUTF16STR subblockPath, const void **value, uint32_t *valueLen) const
+{
+	if (!_vi)
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	VersionBlock block;
+	if (!parseBlock(_vi, _vi + _viLen, block))
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	LPCUTF16STR p = subblockPath;
+	while (*p)
+	{
+		if (*p == '\\')
+		{
+			p++;
+			continue;
+		}
+		LPCUTF16STR p0 = p;
+		while (*p && *p != '\\')
+			p++;
+		VersionBlock child;
+		if (!findChild(block, p0, p - p0, child))
+			return ERROR_RESOURCE_DATA_NOT_FOUND;
+		block = child;
+	}
+	if (block.start == _vi)
+	{
+		// the root value is the fixed-length file info.
+		if (block.valueLen < sizeof(VERSION_FIXEDFILEINFO))
+			return ERROR_RESOURCE_DATA_NOT_FOUND;
+	}
+	*value = block.value;
+	if (block.type == VERSION_BLOCK_TYPE_TEXT)
+	{
+		LPCUTF16STR s = (LPCUTF16STR)block.value;
+		uint32_t n = 0, maxLen = block.valueLen / sizeof(UTF16CHAR);
+		while (n < maxLen && s[n])
+			n++;
+		*valueLen = n;
+	}
+	else
+		*valueLen = block.valueLen;
+	return ERROR_SUCCESS;
+}
+
+/* fixedInfo - returns the VS_FIXEDFILEINFO structure of the resource, or NULL if it is not available or has a bad signature. */
+const VERSION_FIXEDFILEINFO *VersionResource::fixedInfo() const
+{
+	if (!_vi || !table().fixedInfoOffset)
+		return NULL;
+	const VERSION_FIXEDFILEINFO *ffi = (const VERSION_FIXEDFILEINFO*)(_vi + table().fixedInfoOffset);
+	if (ffi->dwSignature != VERSION_FIXEDFILEINFO_SIGNATURE)
+		return NULL;
+	return ffi;
+}
+
+/* queryVersionKeys - returns the file and product versions as version keys (see VersionKey.h). A key orders versions as a plain 64-bit integer. So, the caller can compare and sort versions without formatting and re-parsing them.
+
+Parameters:
+fileVersionKey - [out, optional] receives dwFileVersionMS and dwFileVersionLS packed in 64 bits.
+productVersionKey - [out, optional] receives dwProductVersionMS and dwProductVersionLS packed in 64 bits.
+
+Return value:
+ERROR_RESOURCE_DATA_NOT_FOUND - no resource is loaded, or it has no VS_FIXEDFILEINFO.
+*/
+uint32_t VersionResource::queryVersionKeys(uint64_t *fileVersionKey, uint64_t *productVersionKey) const
+{
+	const VERSION_FIXEDFILEINFO *ffi = fixedInfo();
+	if (!ffi)
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	if (fileVersionKey)
+		*fileVersionKey = VERSION_KEY(ffi->dwFileVersionMS, ffi->dwFileVersionLS);
+	if (productVersionKey)
+		*productVersionKey = VERSION_KEY(ffi->dwProductVersionMS, ffi->dwProductVersionLS);
+	return ERROR_SUCCESS;
+}
+
+/* queryTranslation - retrieves a language-codepage pair from the VarFileInfo\Translation block.
+
+Parameters:
+index - [in] zero-based index of a translation entry.
+langCp - [out] receives the translation code. The low word is a language id, and the high word is a codepage.
+
+Return value:
+ERROR_RESOURCE_DATA_NOT_FOUND - the resource has no translation block.
+ERROR_INVALID_PARAMETER - the index is out of range.
+*/
+uint32_t VersionResource::queryTranslation(int index, uint32_t *langCp) const
+{
+	if (!_vi || !table().translationOffset)
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	const VersionAttribTable &t = table();
+	if (index < 0 || (uint32_t)index >= t.translationCount)
+		return ERROR_INVALID_PARAMETER;
+	memcpy(langCp, _vi + t.translationOffset + index * sizeof(uint32_t), sizeof(uint32_t));
+	return ERROR_SUCCESS;
+}
+
+/* queryStringAttribute - retrieves a string attribute from the StringFileInfo table of a translation. The attribute is looked up in the decoded table. No path string is built, and the tree is not walked again.
+
+Parameters:
+name - [in] name of the attribute, e.g., 'ProductName'. It need not be null-terminated.
+nameLen - [in] number of characters in name.
+langCp - [in] translation code selecting a StringFileInfo table. Pass 0 to use the first entry of the translation block.
+text - [out] receives a pointer to the string value in the resource data. It is not null-terminated.
+textLen - [out] receives the number of characters in text.
+*/
+uint32_t VersionResource::queryStringAttribute(LPCUTF16STR name, size_t nameLen, uint32_t langCp, LPCUTF16STR *text, uint32_t *textLen) const
+{
+	if (!_vi)
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	if (langCp == 0 && queryTranslation(0, &langCp) != ERROR_SUCCESS)
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	int t = findTable(langCp);
+	if (t < 0)
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	const VersionAttribTable &tab = table();
+	uint8_t id = _attribId(name, nameLen);
+	for (uint32_t i = tab.tableFirst[t]; i < tab.tableFirst[t + 1]; i++)
+	{
+		if (id ? tab.attribId[i] != id :
+			(tab.keyLen[i] != nameLen || utf16icmp((LPCUTF16STR)(_vi + tab.keyOffset[i]), nameLen, name, nameLen) != 0))
+			continue;
+		*text = (LPCUTF16STR)(_vi + tab.valueOffset[i]);
+		*textLen = tab.valueLen[i];
+		return ERROR_SUCCESS;
+	}
+	return ERROR_RESOURCE_DATA_NOT_FOUND;
+}
+
+/* queryStringMatrix - reads string attributes of all translations at once. It replaces a loop of queryTranslation and queryStringAttribute calls, which searches the tables for a translation and compares the names again for each attribute. The names are resolved once, to attribute ids or to a short list of custom names. Then each string of each table is visited once, and is put in the column of its name.
+
+Parameters:
+names - [in] names of the attributes, e.g., 'ProductName' and 'CompanyName'. Case does not matter. Each name is looked up in the StringFileInfo tables only. So, FileVersion and ProductVersion are the strings of the tables, which may differ from language to language, not the fixed-length numbers queryAttribute returns.
+langCps - [out] receives the translation codes of the rows: the entries of the translation block in their order, followed by the StringFileInfo tables the translation block does not list. A translation with no table has a row of empty cells.
+cells - [out] receives a row of names.size() cells for each translation. The value of name j in translation i is cells[i*names.size()+j].
+
+Return value:
+ERROR_RESOURCE_DATA_NOT_FOUND - no version resource is loaded.
+*/
+uint32_t VersionResource::queryStringMatrix(const std::vector<std::u16string> &names, std::vector<uint32_t> &langCps, std::vector<VersionStringRef> &cells) const
+{
+	langCps.clear();
+	cells.clear();
+	if (!_vi)
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	const VersionAttribTable &tab = table();
+	for (uint32_t i = 0; i < tab.translationCount; i++)
+	{
+		uint32_t langCp;
+		memcpy(&langCp, _vi + tab.translationOffset + i * sizeof(uint32_t), sizeof(uint32_t));
+		if (std::find(langCps.begin(), langCps.end(), langCp) == langCps.end())
+			langCps.push_back(langCp);
+	}
+	for (size_t t = 0; t < tab.tableLangCp.size(); t++)
+	{
+		if (std::find(langCps.begin(), langCps.end(), tab.tableLangCp[t]) == langCps.end())
+			langCps.push_back(tab.tableLangCp[t]);
+	}
+
+	// map a known name to its column by id. keep the other names in a list. a name given twice is filled in its first column, and copied to the others at the end.
+	size_t colCount = names.size();
+	int idColumn[VIATTRIB_COUNT + 1];
+	for (size_t i = 0; i <= VIATTRIB_COUNT; i++)
+		idColumn[i] = -1;
+	std::vector<size_t> customColumns, copyColumns;
+	std::vector<size_t> firstColumn(colCount);
+	for (size_t j = 0; j < colCount; j++)
+	{
+		firstColumn[j] = j;
+		for (size_t k = 0; k < j; k++)
+		{
+			if (names[k].size() == names[j].size() && utf16icmp(names[k].c_str(), names[k].size(), names[j].c_str(), names[j].size()) == 0)
+			{
+				firstColumn[j] = k;
+				break;
+			}
+		}
+		if (firstColumn[j] != j)
+		{
+			copyColumns.push_back(j);
+			continue;
+		}
+		uint8_t id = _attribId(names[j].c_str(), names[j].size());
+		if (id)
+			idColumn[id] = (int)j;
+		else
+			customColumns.push_back(j);
+	}
+
+	VersionStringRef empty = { NULL, 0 };
+	cells.assign(langCps.size() * colCount, empty);
+	for (size_t r = 0; r < langCps.size(); r++)
+	{
+		int t = findTable(langCps[r]);
+		if (t < 0)
+			continue;
+		VersionStringRef *row = cells.data() + r * colCount;
+		for (uint32_t i = tab.tableFirst[t]; i < tab.tableFirst[t + 1]; i++)
+		{
+			int col = -1;
+			if (tab.attribId[i])
+				col = idColumn[tab.attribId[i]];
+			else
+			{
+				LPCUTF16STR key = (LPCUTF16STR)(_vi + tab.keyOffset[i]);
+				for (size_t k = 0; k < customColumns.size(); k++)
+				{
+					const std::u16string &name = names[customColumns[k]];
+					if (tab.keyLen[i] == name.size() && utf16icmp(key, tab.keyLen[i], name.c_str(), name.size()) == 0)
+					{
+						col = (int)customColumns[k];
+						break;
+					}
+				}
+			}
+			// the first string of a name wins, as it does with queryStringAttribute.
+			if (col < 0 || row[col].text)
+				continue;
+			row[col].text = (LPCUTF16STR)(_vi + tab.valueOffset[i]);
+			row[col].textLen = tab.valueLen[i];
+		}
+		for (size_t k = 0; k < copyColumns.size(); k++)
+			row[copyColumns[k]] = row[firstColumn[copyColumns[k]]];
+	}
+	return ERROR_SUCCESS;
+}
+
+/* queryStringNames - lists the names of the string attributes the StringFileInfo tables define, each name once, in the order they first appear. Pass the list to queryStringMatrix to read every string of every translation.
+
+Parameters:
+names - [out] receives the names.
+*/
+void VersionResource::queryStringNames(std::vector<std::u16string> &names) const
+{
+	names.clear();
+	if (!_vi)
+		return;
+	const VersionAttribTable &tab = table();
+	for (size_t i = 0; i < tab.keyOffset.size(); i++)
+	{
+		LPCUTF16STR key = (LPCUTF16STR)(_vi + tab.keyOffset[i]);
+		size_t k = 0;
+		for (; k < names.size(); k++)
+		{
+			if (names[k].size() == tab.keyLen[i] && utf16icmp(names[k].c_str(), names[k].size(), key, tab.keyLen[i]) == 0)
+				break;
+		}
+		if (k == names.size())
+			names.push_back(std::u16string(key, tab.keyLen[i]));
+	}
+}
+
+/* findTable - returns the index of the StringFileInfo table of a translation, or -1 if the resource has no such table. */
+int VersionResource::findTable(uint32_t langCp) const
+{
+	const VersionAttribTable &t = table();
+	for (size_t i = 0; i < t.tableLangCp.size(); i++)
+	{
+		if (t.tableLangCp[i] == langCp)
+			return (int)i;
+	}
+	return -1;
+}
+
+/* table - returns the decoded table of the resource. The tree is decoded on the first call. */
+const VersionAttribTable &VersionResource::table() const
+{
+	if (_shared)
+		return _shared->table;
+	if (!_table.decoded)
+		decodeTable();
+	return _table;
+}
+
+/* decodeTable - walks the VS_VERSIONINFO tree and lists the fixed file info, the translations and the strings of all StringFileInfo tables in _table. A malformed node ends the walk of its parent. What has been decoded until then stays usable.
+*/
+void VersionResource::decodeTable() const
+{
+	_table.clear();
+	_table.decoded = true;
+	_table.tableFirst.push_back(0);
+	VersionBlock root;
+	if (!_vi || !parseBlock(_vi, _vi + _viLen, root))
+		return;
+	if (root.valueLen >= sizeof(VERSION_FIXEDFILEINFO))
+		_table.fixedInfoOffset = (uint32_t)(root.value - _vi);
+	VersionBlock info, child, str;
+	for (const uint8_t *p = root.children; p < root.end && parseBlock(p, root.end, info); p = _align4(_vi, info.end))
+	{
+		if (utf16icmp(info.key, info.keyLen, VARFILEINFO_KEY, KEYLEN(VARFILEINFO_KEY)) == 0)
+		{
+			if (!_table.translationOffset && findChild(info, TRANSLATION_KEY, KEYLEN(TRANSLATION_KEY), child))
+			{
+				_table.translationOffset = (uint32_t)(child.value - _vi);
+				_table.translationCount = child.valueLen / sizeof(uint32_t);
+			}
+			continue;
+		}
+		if (utf16icmp(info.key, info.keyLen, STRINGFILEINFO_KEY, KEYLEN(STRINGFILEINFO_KEY)) != 0)
+			continue;
+		// a StringTable for each translation.
+		for (const uint8_t *q = info.children; q < info.end && parseBlock(q, info.end, child); q = _align4(_vi, child.end))
+		{
+			uint32_t langCp;
+			if (!_parseLangCp(child.key, child.keyLen, &langCp))
+				continue;
+			for (const uint8_t *r = child.children; r < child.end && parseBlock(r, child.end, str); r = _align4(_vi, str.end))
+			{
+				LPCUTF16STR s = (LPCUTF16STR)str.value;
+				uint32_t n = 0, maxLen = str.valueLen / sizeof(UTF16CHAR);
+				while (n < maxLen && s[n])
+					n++;
+				_table.keyOffset.push_back((uint32_t)((const uint8_t*)str.key - _vi));
+				_table.keyLen.push_back((uint16_t)str.keyLen);
+				_table.valueOffset.push_back((uint32_t)(str.value - _vi));
+				_table.valueLen.push_back((uint16_t)n);
+				_table.attribId.push_back(_attribId(str.key, str.keyLen));
+			}
+			_table.tableLangCp.push_back(langCp);
+			_table.tableFirst.push_back((uint32_t)_table.keyOffset.size());
+		}
+	}
+}
+
+/* clear - empties the table. The columns keep their capacity. */
+void VersionAttribTable::clear()
+{
+	decoded = false;
+	fixedInfoOffset = translationOffset = translationCount = 0;
+	tableLangCp.clear();
+	tableFirst.clear();
+	keyOffset.clear();
+	keyLen.clear();
+	valueOffset.clear();
+	valueLen.clear();
+	attribId.clear();
+}
+
+/* queryAttribute - looks up a version attribute by name and returns its value. A name of a FixedFileInfo member (e.g., 'FileVersionMS') returns a number. FileVersion and ProductVersion return the fixed-length version numbers formatted as <major>.<minor>.<revision>.<build>. FileDate returns a file time. Any other name is looked up in the StringFileInfo table of the given translation.
+
+Parameters:
+name - [in] name of the attribute. It need not be null-terminated.
+nameLen - [in] number of characters in name.
+langCp - [in] translation code of the StringFileInfo table to search for a string attribute. Pass 0 to use the first translation.
+value - [out] receives the value. See VersionAttribValue for how long the value remains valid.
+
+Return value:
+ERROR_RESOURCE_DATA_NOT_FOUND - no version resource is loaded, the FixedFileInfo block is missing, or the string attribute does not exist.
+*/
+uint32_t VersionResource::queryAttribute(LPCUTF16STR name, size_t nameLen, uint32_t langCp, VersionAttribValue &value) const
+{
+	value.type = VAT_EMPTY;
+	value.number = 0;
+	value.fileTime = 0;
+	const VersionAttribDesc *desc = _findAttribDesc(name, nameLen);
+	if (!desc || !desc->extract)
+	{
+		// the caller wants a variable-length text attribute, e.g., ProductName.
+		uint32_t errorCode = queryStringAttribute(name, nameLen, langCp, &value.text, &value.textLen);
+		if (errorCode == ERROR_SUCCESS)
+			value.type = VAT_TEXT;
+		return errorCode;
+	}
+	// a fixed-length attribute from the FixedFileInfo block is being requested for.
+	if (!_vi || !table().fixedInfoOffset)
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	desc->extract((const VERSION_FIXEDFILEINFO*)(_vi + table().fixedInfoOffset), *desc, value);
+	return ERROR_SUCCESS;
+}
@@ -0,0 +1,224 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "MappedFile.h"
+#include "VersionKey.h"
+#include <vector>
+#include <memory>
+
+
+/* the fixed-length part of a version resource. the layout is identical to VS_FIXEDFILEINFO of winver.h. */
+#pragma pack(push, 1)
+struct VERSION_FIXEDFILEINFO
+{
+	uint32_t dwSignature;
+	uint32_t dwStrucVersion;
+	uint32_t dwFileVersionMS;
+	uint32_t dwFileVersionLS;
+	uint32_t dwProductVersionMS;
+	uint32_t dwProductVersionLS;
+	uint32_t dwFileFlagsMask;
+	uint32_t dwFileFlags;
+	uint32_t dwFileOS;
+	uint32_t dwFileType;
+	uint32_t dwFileSubtype;
+	uint32_t dwFileDateMS;
+	uint32_t dwFileDateLS;
+};
+#pragma pack(pop)
+
+#define VERSION_FIXEDFILEINFO_SIGNATURE 0xFEEF04BD
+#define VERSION_BLOCK_TYPE_TEXT 1
+
+// packs a language id and a codepage into a translation code the way the VarFileInfo\Translation block stores them.
+#define VERSION_LANGCP(langId, codepage) ((uint32_t)(uint16_t)(langId) | ((uint32_t)(uint16_t)(codepage) << 16))
+#define VERSION_LANGCP_LANGID(langCp) ((uint16_t)((langCp) & 0xFFFF))
+#define VERSION_LANGCP_CODEPAGE(langCp) ((uint16_t)((langCp) >> 16))
+
+/* data types of version attribute values */
+enum VERSION_ATTRIB_TYPE {
+	VAT_EMPTY = 0, // the attribute exists but has no value (e.g., a zero FileDate).
+	VAT_NUMBER, // a 32-bit member of VS_FIXEDFILEINFO.
+	VAT_TEXT, // a string from StringFileInfo, or a version number formatted as <major>.<minor>.<revision>.<build>.
+	VAT_FILETIME, // a 64-bit file time (100-ns intervals since 1601-01-01).
+};
+
+/* VersionAttribValue receives the value of an attribute from VersionResource::queryAttribute. No allocation is made for it. A text value points into the resource data, or into buf if it was formatted from numbers. So, the value is valid only while the VersionResource is loaded.
+*/
+struct VersionAttribValue
+{
+	VERSION_ATTRIB_TYPE type;
+	uint32_t number; // VAT_NUMBER
+	uint64_t fileTime; // VAT_FILETIME
+	LPCUTF16STR text; // VAT_TEXT. not null-terminated.
+	uint32_t textLen; // number of characters in text.
+	UTF16CHAR buf[24]; // space for formatting a version number. the longest is '65535.65535.65535.65535'.
+};
+
+/* VersionAttribData is an owning copy of a VersionAttribValue. Use it to keep a value after the resource is closed. */
+struct VersionAttribData
+{
+	VersionAttribData() : type(VAT_EMPTY), number(0), fileTime(0) {}
+	VersionAttribData(const VersionAttribValue &src) : type(src.type), number(src.number), fileTime(src.fileTime)
+	{
+		if (src.type == VAT_TEXT)
+			text.assign(src.text, src.textLen);
+	}
+	// assign and clear keep the capacity of text. so, a row reused from file to file does not allocate for every value.
+	void assign(const VersionAttribValue &src)
+	{
+		type = src.type;
+		number = src.number;
+		fileTime = src.fileTime;
+		if (src.type == VAT_TEXT)
+			text.assign(src.text, src.textLen);
+		else
+			text.clear();
+	}
+	void clear()
+	{
+		type = VAT_EMPTY;
+		number = 0;
+		fileTime = 0;
+		text.clear();
+	}
+	VERSION_ATTRIB_TYPE type;
+	uint32_t number;
+	uint64_t fileTime;
+	std::u16string text;
+};
+
+/* VersionStringRef is a cell of the matrix VersionResource::queryStringMatrix makes. The text points into the resource data, and is valid only while the VersionResource is loaded. It is NULL if the translation does not define the attribute. */
+struct VersionStringRef
+{
+	LPCUTF16STR text; // not null-terminated.
+	uint32_t textLen;
+};
+
+/* VersionBlock describes one node of the VS_VERSIONINFO tree. Every node (VS_VERSIONINFO, StringFileInfo, StringTable, String, VarFileInfo and Var) has the same header of wLength, wValueLength and wType followed by a key, a value and child nodes, each aligned on a 32-bit boundary. The members point into the resource data.
+*/
+struct VersionBlock
+{
+	const uint8_t *start; // the wLength field of the node.
+	const uint8_t *end; // one past the last byte of the node (start + wLength).
+	LPCUTF16STR key; // name of the node, e.g., 'StringFileInfo' or 'ProductName'.
+	size_t keyLen; // number of characters in key, excluding the null.
+	const uint8_t *value; // value of the node. it may be empty.
+	uint32_t valueLen; // byte length of the value.
+	uint16_t type; // 1 for text, 0 for binary.
+	const uint8_t *children; // the first child node. equals end if there are none.
+};
+
+
+/* VersionAttribTable is the decoded form of a version resource. The tree is walked once, and the strings of all StringFileInfo tables are listed in flat columns (a struct of arrays). Keys and values are not copied. The columns hold their offsets from the start of the VS_VERSIONINFO block. The strings of one table are consecutive. tableFirst[i] is the index of the first string of table i, and tableFirst[i+1] is one past its last string. So, tableFirst has one more element than there are tables.
+*/
+struct VersionAttribTable
+{
+	bool decoded;
+	uint32_t fixedInfoOffset; // offset of VS_FIXEDFILEINFO, or 0 if the resource has none.
+	uint32_t translationOffset; // offset of the VarFileInfo\Translation array.
+	uint32_t translationCount; // number of language-codepage pairs in the array.
+	// StringFileInfo tables
+	std::vector<uint32_t> tableLangCp; // translation code of the table, decoded from its 8-digit hex key.
+	std::vector<uint32_t> tableFirst;
+	// strings of all tables
+	std::vector<uint32_t> keyOffset;
+	std::vector<uint16_t> keyLen; // number of characters.
+	std::vector<uint32_t> valueOffset;
+	std::vector<uint16_t> valueLen; // number of characters excluding the terminating null.
+	std::vector<uint8_t> attribId; // a non-zero id if the key is a known attribute name. it saves comparing the key.
+
+	VersionAttribTable() : decoded(false), fixedInfoOffset(0), translationOffset(0), translationCount(0) {}
+	void clear();
+};
+
+/* SharedVersionBlock is a copy of a VS_VERSIONINFO block together with its decoded attribute table. It is made by VersionResource::share and is not changed afterwards. So, any number of VersionResources on any number of threads can read it at the same time. VersionCache keeps them.
+*/
+struct SharedVersionBlock
+{
+	std::vector<uint8_t> data;
+	VersionAttribTable table;
+};
+typedef std::shared_ptr<const SharedVersionBlock> SharedVersionBlockPtr;
+
+
+/* VersionResource reads the version resource (RT_VERSION) of a PE file and answers VerQueryValue-style queries on it. The file is memory-mapped, and the VS_VERSIONINFO tree is read in place. Only the pages holding the headers, the resource directory and the version data are touched. So, the cost does not grow with the image size. The first attribute or translation query decodes the tree into a VersionAttribTable. Subsequent queries are lookups in the table. They make no allocation and build no path. A version block obtained by other means (e.g., Win32 GetFileVersionInfo) can be assigned instead of a file.
+
+On a network share, mapping is not the cheapest way. A page fault in a view is a round trip to the server, and the system may read ahead well past what the parser touches. setRangeRead(true) makes load() fetch the headers, the resource directories and the version data with a few positioned reads instead (see PEProbe), and bytesRead() tells how many bytes it took.
+
+A Windows Installer package (.msi) has no version resource. load() reads its Property table instead (see MsiPackage) and presents ProductVersion, ProductName, Manufacturer and ProductCode as a version block of its own making. The package is read with positioned reads in either mode.
+
+A file in a cabinet is named by the pathname of the cabinet and the pathname of the file in it, separated by a vertical bar, e.g., 'setup.cab|bin\app.dll'. load() walks the image in the cabinet with PEProbe (see CabinetFile). The folder of the file is decompressed as far as the version resource, and nothing is written to disk.
+*/
+class VersionResource
+{
+public:
+	VersionResource() : _vi(NULL), _viLen(0), _rangeRead(false), _bytesRead(0) {}
+	~VersionResource() { close(); }
+
+	uint32_t load(LPCPATHSTR path);
+	uint32_t assign(const void *data, size_t len);
+	uint32_t assignShared(const SharedVersionBlockPtr &block);
+	SharedVersionBlockPtr share();
+	void close();
+
+	void setRangeRead(bool rangeRead) { _rangeRead = rangeRead; }
+	bool rangeRead() const { return _rangeRead; }
+	uint64_t bytesRead() const { return _bytesRead; }
+
+	bool isLoaded() const { return _vi != NULL; }
+	const uint8_t *data() const { return _vi; }
+	uint32_t size() const { return _viLen; }
+	const MappedFile &mappedFile() const { return _file; } // open while a file loaded by mapping stays loaded, even after share(). closed in the range-read mode, and for a package or a file in a cabinet.
+
+	uint32_t queryValue(LPCUTF16STR subblockPath, const void **value, uint32_t *valueLen) const;
+	const VERSION_FIXEDFILEINFO *fixedInfo() const;
+	uint32_t queryVersionKeys(uint64_t *fileVersionKey, uint64_t *productVersionKey) const;
+	uint32_t queryTranslation(int index, uint32_t *langCp) const;
+	uint32_t queryAttribute(LPCUTF16STR name, size_t nameLen, uint32_t langCp, VersionAttribValue &value) const;
+	uint32_t queryStringAttribute(LPCUTF16STR name, size_t nameLen, uint32_t langCp, LPCUTF16STR *text, uint32_t *textLen) const;
+	uint32_t queryStringMatrix(const std::vector<std::u16string> &names, std::vector<uint32_t> &langCps, std::vector<VersionStringRef> &cells) const;
+	void queryStringNames(std::vector<std::u16string> &names) const;
+
+	bool parseBlock(const uint8_t *p, const uint8_t *limit, VersionBlock &block) const;
+	bool findChild(const VersionBlock &parent, LPCUTF16STR key, size_t keyLen, VersionBlock &child) const;
+
+protected:
+	MappedFile _file; // mapping of the file the version data was found in.
+	std::vector<uint8_t> _copy; // holds the version data passed to assign().
+	SharedVersionBlockPtr _shared; // the block passed to assignShared(). its table is used instead of _table.
+	const uint8_t *_vi; // the VS_VERSIONINFO node. points into _file, _copy or _shared.
+	uint32_t _viLen;
+	bool _rangeRead; // true to read the resource with positioned reads instead of mapping the file.
+	uint64_t _bytesRead; // bytes the last load read from the file. counted in the range-read mode, and for a package or a file in a cabinet.
+	mutable VersionAttribTable _table; // decoded on the first query. the columns keep their capacity from one file to the next.
+
+	uint32_t attachBlock(const uint8_t *data, size_t len);
+	uint32_t loadRange(LPCPATHSTR path);
+	uint32_t loadPackage(LPCPATHSTR path);
+	uint32_t loadCabinet(LPCPATHSTR path, size_t separator);
+	const VersionAttribTable &table() const;
+	void decodeTable() const;
+	int findTable(uint32_t langCp) const;
+};
@@ -0,0 +1,412 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "VersionScanner.h"
+#include "WorkStealingPool.h"
+#include "DirectoryWalker.h"
+#include <algorithm>
+
+
+// files found in a directory are handed to the pool in batches of this size. a batch is big enough to amortize the task overhead and small enough to let idle workers share a huge flat directory.
+#define SCAN_FILE_BATCH_SIZE 64
+// version parsing mostly waits on I/O, especially on a network share. so, run more workers than there are processors.
+#define SCAN_WORKERS_PER_PROCESSOR 2
+// sources of the pseudo-attributes a scan can return in place of a version attribute.
+#define SCAN_DIGEST_NONE 0
+#define SCAN_DIGEST_SHA256 1
+#define SCAN_DIGEST_CRC32 2
+#define SCAN_DIGEST_CHECKSUM 3
+#define SCAN_DIGEST_COMPUTED_CHECKSUM 4
+#define SCAN_DIGEST_AUTHENTICODE_HASH 5
+#define SCAN_DIGEST_SIGNED_HASH 6
+#define SCAN_DIGEST_PDB_PATH 7
+#define SCAN_DIGEST_PDB_GUID 8
+#define SCAN_DIGEST_PDB_AGE 9
+#define SCAN_DIGEST_SYMBOL_KEY 10
+#define SCAN_DIGEST_ASSEMBLY_NAME 11
+#define SCAN_DIGEST_ASSEMBLY_VERSION 12
+#define SCAN_DIGEST_CULTURE 13
+#define SCAN_DIGEST_PUBLIC_KEY_TOKEN 14
+
+
+/* readFile - reads the requested attributes of a file into a row. The row keeps the capacity of its strings, so that a row reused from file to file does not allocate for every value.
+
+Return value:
+false if the file is not a PE image, or the filter rejects it. Such a file produces no row. If a filter is set, a file whose version resource cannot be read is rejected, too. Its attributes would all be null, and a negated predicate (e.g., !(FileFlags & VS_FF_DEBUG)) would accept it.
+*/
+bool VersionScanner::readFile(const pathstring &path, VersionScanRow &row)
+{
+	if (!_classifier.accept(path.c_str()))
+		return false;
+	VersionResource vr;
+	vr.setRangeRead(_rangeRead);
+	uint32_t errorCode = _index ? _index->load(path.c_str(), vr) : vr.load(path.c_str());
+	_classifier.countParse(errorCode != ERROR_BAD_EXE_FORMAT);
+	if (errorCode == ERROR_BAD_EXE_FORMAT)
+		return false;
+	// the filter reads the decoded resource directly. a rejected file costs no copies.
+	if (_filter && (errorCode != ERROR_SUCCESS || !_filter->evaluate(vr)))
+		return false;
+	row.path = path;
+	row.errorCode = errorCode;
+	row.bytesRead = vr.bytesRead();
+	if (errorCode != ERROR_SUCCESS)
+	{
+		row.values.clear();
+		return true;
+	}
+	row.values.resize(_names.size());
+	for (size_t i = 0; i < _names.size(); i++)
+	{
+		if (_digests[i] != SCAN_DIGEST_NONE)
+			continue;
+		VersionAttribValue value;
+		if (vr.queryAttribute(_names[i].c_str(), _names[i].size(), 0, value) == ERROR_SUCCESS)
+			row.values[i].assign(value);
+		else
+			row.values[i].clear();
+	}
+	if (_hashFiles || _digestImages || _readCodeView || _readAssembly)
+		readDigests(path, vr, row);
+	return true;
+}
+
+/* _mapWholeFile - returns a mapping of a whole file for the digest, symbol and assembly columns. The mapping the version resource was read from is used if it is open. A file the version resource was not mapped for (e.g., one served by the index) is mapped into file here. In range-read mode, the file is mapped only if a column needs the image. NULL is returned otherwise, and SHA256 and CRC32 read the file in chunks instead. */
+static const MappedFile *_mapWholeFile(const pathstring &path, const VersionResource &vr, bool needImage, MappedFile &file)
+{
+	if (vr.mappedFile().isOpen())
+		return &vr.mappedFile();
+	if (vr.rangeRead() && !needImage)
+		return NULL;
+	if (file.open(path.c_str()) != ERROR_SUCCESS)
+		return NULL;
+	return &file;
+}
+
+/* readDigests - fills the digest, symbol and assembly columns of a row. The whole-file digests, the image digests, the CodeView record and the assembly metadata are all computed from one mapping of the file, the one VersionResource has just read the version resource through. So, each byte is read from the disk once. A column is left VAT_EMPTY if the file cannot be read, SignedHash is left VAT_EMPTY if the file has no SHA-256 signature, the symbol columns are left VAT_EMPTY if the image has no CodeView record, and the assembly columns if the image is not a .NET assembly.
+*/
+void VersionScanner::readDigests(const pathstring &path, const VersionResource &vr, VersionScanRow &row)
+{
+	MappedFile file;
+	bool needImage = _digestImages || _readCodeView || _readAssembly;
+	const MappedFile *mapped = _mapWholeFile(path, vr, needImage, file);
+	FileDigest digest;
+	bool fileValid = _hashFiles && (mapped ? _hasher.hashData(path.c_str(), mapped->data(), mapped->size(), digest) : _hasher.hashFile(path.c_str(), digest)) == ERROR_SUCCESS;
+	PEImage pe;
+	bool peValid = needImage && mapped && pe.attach(mapped->data(), mapped->size()) == ERROR_SUCCESS;
+	PEDigest image;
+	bool imageValid = _digestImages && peValid && image.compute(pe) == ERROR_SUCCESS;
+	PECodeView codeView;
+	bool codeViewValid = _readCodeView && peValid && pe.findCodeView(codeView) == ERROR_SUCCESS;
+	ClrMetadata metadata;
+	ClrAssemblyIdentity assembly;
+	bool assemblyValid = _readAssembly && peValid && metadata.attach(pe) == ERROR_SUCCESS && metadata.readAssembly(assembly) == ERROR_SUCCESS;
+	UTF16CHAR text[SHA256_DIGEST_SIZE * 2];
+	for (size_t i = 0; i < _names.size(); i++)
+	{
+		VersionAttribData &data = row.values[i];
+		uint8_t source = _digests[i];
+		if (source == SCAN_DIGEST_NONE)
+			continue;
+		data.clear();
+		const uint8_t *hash = NULL;
+		if (source >= SCAN_DIGEST_ASSEMBLY_NAME)
+		{
+			if (!assemblyValid)
+				continue;
+			if (source == SCAN_DIGEST_PUBLIC_KEY_TOKEN)
+			{
+				if (!assembly.hasPublicKeyToken)
+					continue;
+				UTF16CHAR token[CLI_PUBLIC_KEY_TOKEN_SIZE * 2];
+				ClrMetadata::formatPublicKeyToken(assembly.publicKeyToken, token);
+				data.text.assign(token, CLI_PUBLIC_KEY_TOKEN_SIZE * 2);
+			}
+			else if (source == SCAN_DIGEST_ASSEMBLY_VERSION)
+				ClrMetadata::formatVersion(assembly.version, data.text);
+			else
+			{
+				const std::string &text = source == SCAN_DIGEST_ASSEMBLY_NAME ? assembly.name : assembly.culture;
+				appendUtf16(data.text, text.c_str(), text.length());
+			}
+			data.type = VAT_TEXT;
+			continue;
+		}
+		if (source >= SCAN_DIGEST_PDB_PATH)
+		{
+			if (!codeViewValid)
+				continue;
+			if (source == SCAN_DIGEST_PDB_AGE)
+			{
+				data.type = VAT_NUMBER;
+				data.number = codeView.age;
+				continue;
+			}
+			if (source == SCAN_DIGEST_PDB_GUID && codeView.format != PE_CODEVIEW_RSDS)
+				continue;
+			data.type = VAT_TEXT;
+			if (source == SCAN_DIGEST_PDB_PATH)
+				appendUtf16(data.text, codeView.pdbPath.c_str(), codeView.pdbPath.length());
+			else if (source == SCAN_DIGEST_PDB_GUID)
+			{
+				UTF16CHAR guid[38];
+				PEImage::formatGuid(codeView.guid, guid);
+				data.text.assign(guid, 38);
+			}
+			else
+				PEImage::formatSymbolKey(codeView, data.text);
+			continue;
+		}
+		if (source == SCAN_DIGEST_SHA256 || source == SCAN_DIGEST_CRC32)
+		{
+			if (!fileValid)
+				continue;
+			if (source == SCAN_DIGEST_SHA256)
+				hash = digest.sha256;
+			else
+			{
+				data.type = VAT_NUMBER;
+				data.number = digest.crc32;
+			}
+		}
+		else if (imageValid)
+		{
+			if (source == SCAN_DIGEST_CHECKSUM || source == SCAN_DIGEST_COMPUTED_CHECKSUM)
+			{
+				data.type = VAT_NUMBER;
+				data.number = source == SCAN_DIGEST_CHECKSUM ? image.storedChecksum() : image.computedChecksum();
+			}
+			else if (source == SCAN_DIGEST_AUTHENTICODE_HASH)
+				hash = image.imageHash();
+			else if (image.hasSignedHash())
+				hash = image.signedHash();
+		}
+		if (hash)
+		{
+			FileHasher::formatSha256(hash, text);
+			data.type = VAT_TEXT;
+			data.text.assign(text, SHA256_DIGEST_SIZE * 2);
+		}
+	}
+}
+
+/* setAttributes - sets the names of the attributes to read from each file. Besides the version attributes, a name can be one of these pseudo-attributes.
+SHA256 - the SHA-256 of the file as 64 lowercase hex digits.
+CRC32 - the CRC-32 of the file as a number.
+CheckSum - the image checksum stored in the optional header.
+ComputedCheckSum - the image checksum computed from the file. It equals CheckSum if the file has not been altered since the checksum was set.
+AuthenticodeHash - the Authenticode SHA-256 of the image as 64 lowercase hex digits.
+SignedHash - the Authenticode SHA-256 recorded in the image's signature. It equals AuthenticodeHash if the file has not been altered since it was signed.
+PdbPath - the pathname of the PDB file recorded in the CodeView record of the debug directory.
+PdbGuid - the signature of the PDB in the registry form of a GUID, e.g., {6B29FC40-CA47-1067-B31D-00DD010662DA}. Empty for a PDB 2.0 record, whose signature is a time stamp.
+PdbAge - the age of the PDB as a number.
+SymbolKey - the signature and the age in hex digits, the name of the directory a symbol server stores the PDB in.
+AssemblyName - the name of a .NET assembly from its metadata, e.g., System.Xml.
+AssemblyVersion - the version of the assembly, e.g., 4.0.0.0. It may differ from FileVersion.
+Culture - the culture of the assembly, e.g., de-DE. Empty for a culture-neutral assembly.
+PublicKeyToken - the token of the public key of a strong-named assembly as 16 lowercase hex digits, e.g., b77a5c561934e089.
+
+Parameters:
+names - [in] attribute names. Case is not significant.
+*/
+void VersionScanner::setAttributes(const std::vector<std::u16string> &names)
+{
+	static const struct { const UTF16CHAR *name; uint8_t source; } digestNames[] = {
+		{ u"SHA256", SCAN_DIGEST_SHA256 },
+		{ u"CRC32", SCAN_DIGEST_CRC32 },
+		{ u"CheckSum", SCAN_DIGEST_CHECKSUM },
+		{ u"ComputedCheckSum", SCAN_DIGEST_COMPUTED_CHECKSUM },
+		{ u"AuthenticodeHash", SCAN_DIGEST_AUTHENTICODE_HASH },
+		{ u"SignedHash", SCAN_DIGEST_SIGNED_HASH },
+		{ u"PdbPath", SCAN_DIGEST_PDB_PATH },
+		{ u"PdbGuid", SCAN_DIGEST_PDB_GUID },
+		{ u"PdbAge", SCAN_DIGEST_PDB_AGE },
+		{ u"SymbolKey", SCAN_DIGEST_SYMBOL_KEY },
+		{ u"AssemblyName", SCAN_DIGEST_ASSEMBLY_NAME },
+		{ u"AssemblyVersion", SCAN_DIGEST_ASSEMBLY_VERSION },
+		{ u"Culture", SCAN_DIGEST_CULTURE },
+		{ u"PublicKeyToken", SCAN_DIGEST_PUBLIC_KEY_TOKEN },
+	};
+	_names = names;
+	_digests.assign(names.size(), SCAN_DIGEST_NONE);
+	_hashFiles = _digestImages = _readCodeView = _readAssembly = false;
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		for (size_t j = 0; j < sizeof(digestNames) / sizeof(digestNames[0]); j++)
+		{
+			if (utf16icmp(names[i].c_str(), names[i].size(), digestNames[j].name, utf16len(digestNames[j].name)) == 0)
+			{
+				_digests[i] = digestNames[j].source;
+				break;
+			}
+		}
+		if (_digests[i] == SCAN_DIGEST_SHA256 || _digests[i] == SCAN_DIGEST_CRC32)
+			_hashFiles = true;
+		else if (_digests[i] >= SCAN_DIGEST_ASSEMBLY_NAME)
+			_readAssembly = true;
+		else if (_digests[i] >= SCAN_DIGEST_PDB_PATH)
+			_readCodeView = true;
+		else if (_digests[i] != SCAN_DIGEST_NONE)
+			_digestImages = true;
+	}
+}
+
+/* scanFile - reads a file and either hands the row to the sink or appends it to a worker's result list. */
+void VersionScanner::scanFile(const pathstring &path, int worker)
+{
+	if (_sink)
+	{
+		VersionScanRow &row = _scratch[worker];
+		if (readFile(path, row))
+			_sink->writeRow(worker, row);
+		return;
+	}
+	std::vector<VersionScanRow> &rows = _results[worker];
+	rows.push_back(VersionScanRow());
+	if (!readFile(path, rows.back()))
+		rows.pop_back();
+}
+
+/* scan - walks a directory and reads the version attributes set by setAttributes from every executable file in it. The rows are sorted by pathname.
+
+Parameters:
+rootPath - [in] pathname of the directory to scan.
+recursive - [in] true to descend into subdirectories.
+rows - [out] receives a row per executable file.
+
+Return value:
+ERROR_SUCCESS if the root directory could be read. Subdirectories that cannot be read are skipped.
+*/
+uint32_t VersionScanner::scan(LPCPATHSTR rootPath, bool recursive, std::vector<VersionScanRow> &rows)
+{
+	int workerCount = this->workerCount();
+	_results.clear();
+	_results.resize(workerCount);
+	_classifier.reset();
+	uint32_t errorCode = walk(rootPath, recursive, workerCount);
+	if (errorCode == ERROR_SUCCESS)
+		collectResults(rows);
+	_results.clear();
+	return errorCode;
+}
+
+/* scan - walks a directory like the other overload does, but passes each row to a sink as soon as it is read rather than collecting the rows. Memory use does not grow with the number of files. The rows reach the sink unsorted.
+
+Parameters:
+rootPath - [in] pathname of the directory to scan.
+recursive - [in] true to descend into subdirectories.
+sink - [in] receives the rows.
+
+Return value:
+ERROR_SUCCESS if the root directory could be read and the sink accepted all rows. Otherwise, the first error of the walk or the sink.
+*/
+uint32_t VersionScanner::scan(LPCPATHSTR rootPath, bool recursive, VersionScanSink &sink)
+{
+	int workerCount = this->workerCount();
+	uint32_t errorCode = sink.begin(_names, workerCount);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	_scratch.resize(workerCount);
+	_classifier.reset();
+	_sink = &sink;
+	errorCode = walk(rootPath, recursive, workerCount);
+	_sink = NULL;
+	_scratch.clear();
+	uint32_t errorCode2 = sink.end();
+	return errorCode != ERROR_SUCCESS ? errorCode : errorCode2;
+}
+
+/* walk - walks a directory tree with a DirectoryWalker on a WorkStealingPool. Each file found is passed to scanFile.
+
+Parameters:
+rootPath - [in] pathname of the directory to scan.
+recursive - [in] true to descend into subdirectories.
+workerCount - [in] number of workers to run.
+*/
+uint32_t VersionScanner::walk(LPCPATHSTR rootPath, bool recursive, int workerCount)
+{
+	WorkStealingPool pool(workerCount);
+	DirectoryWalker walker;
+	walker.setBatchSize(SCAN_FILE_BATCH_SIZE);
+	return walker.walk(rootPath, recursive, pool, [this](const pathstring *files, size_t count, int worker)
+	{
+		for (size_t i = 0; i < count; i++)
+			scanFile(files[i], worker);
+	});
+}
+
+/* scanFiles - reads the version attributes set by setAttributes from each of a list of files. A watcher uses it to re-read the files that have changed. A short list is read on the calling thread. A long one is split into batches run on a WorkStealingPool. Files that are not PE images, or no longer exist, produce no row. The rows are sorted by pathname.
+
+Parameters:
+paths - [in] pathnames of the files.
+rows - [out] receives a row per executable file.
+*/
+void VersionScanner::scanFiles(const std::vector<pathstring> &paths, std::vector<VersionScanRow> &rows)
+{
+	_results.clear();
+	if (paths.size() <= SCAN_FILE_BATCH_SIZE)
+	{
+		_results.resize(1);
+		for (size_t i = 0; i < paths.size(); i++)
+			scanFile(paths[i], 0);
+	}
+	else
+	{
+		int workerCount = this->workerCount();
+		_results.resize(workerCount);
+		WorkStealingPool pool(workerCount);
+		for (size_t i = 0; i < paths.size(); i += SCAN_FILE_BATCH_SIZE)
+		{
+			size_t first = i, last = std::min(paths.size(), i + SCAN_FILE_BATCH_SIZE);
+			pool.submit([this, &paths, first, last](int worker)
+			{
+				for (size_t j = first; j < last; j++)
+					scanFile(paths[j], worker);
+			});
+		}
+		pool.wait();
+	}
+	collectResults(rows);
+}
+
+/* workerCount - returns the number of workers to run. */
+int VersionScanner::workerCount() const
+{
+	return _workerCount > 0 ? _workerCount : WorkStealingPool::defaultWorkerCount() * SCAN_WORKERS_PER_PROCESSOR;
+}
+
+/* collectResults - moves the rows of all workers to a single list sorted by pathname. */
+void VersionScanner::collectResults(std::vector<VersionScanRow> &rows)
+{
+	size_t total = 0;
+	for (size_t i = 0; i < _results.size(); i++)
+		total += _results[i].size();
+	rows.clear();
+	rows.reserve(total);
+	for (size_t i = 0; i < _results.size(); i++)
+	{
+		for (size_t j = 0; j < _results[i].size(); j++)
+			rows.push_back(std::move(_results[i][j]));
+	}
+	_results.clear();
+	std::sort(rows.begin(), rows.end(), [](const VersionScanRow &a, const VersionScanRow &b) { return a.path < b.path; });
+}
@@ -0,0 +1,96 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "VersionResource.h"
+#include "VersionIndex.h"
+#include "FileHasher.h"
+#include "PEDigest.h"
+#include "VersionFilter.h"
+#include "ClrMetadata.h"
+#include "FileClassifier.h"
+#include <vector>
+
+
+/* VersionScanRow is a row of scan results: a file and the values of the requested attributes in the order the names were given. */
+struct VersionScanRow
+{
+	pathstring path;
+	uint32_t errorCode; // ERROR_SUCCESS, or the reason the file's version info could not be read (e.g., ERROR_RESOURCE_TYPE_NOT_FOUND).
+	std::vector<VersionAttribData> values; // empty if errorCode is not ERROR_SUCCESS. an attribute the file does not have is VAT_EMPTY.
+	uint64_t bytesRead; // bytes read from the file in range-read mode. 0 if it was served by the index.
+};
+
+/* VersionScanSink receives the rows of VersionScanner::scan as they are produced, instead of having them collected in memory. The scanner calls begin once, writeRow for every row, and end once. writeRow is called from the worker threads. Calls with different worker indices run concurrently. Calls with the same index do not. The row passed to writeRow is reused after the call returns. Rows arrive in no particular order.
+*/
+class VersionScanSink
+{
+public:
+	virtual ~VersionScanSink() {}
+	virtual uint32_t begin(const std::vector<std::u16string> &names, int workerCount) = 0;
+	virtual void writeRow(int worker, const VersionScanRow &row) = 0;
+	virtual uint32_t end() = 0;
+};
+
+/* VersionScanner walks a directory tree and reads version attributes of every executable in it. A DirectoryWalker runs directories and batches of files as tasks of a WorkStealingPool. So, the walk of one subtree and the parsing of files found in another proceed in parallel. A file that is not a PE image is skipped. A FileClassifier tells most of those by their extensions or their first bytes, so that they are not mapped (see FileClassifier). The other files produce a row each, even if they have no version resource, so that a caller can tell the two cases apart. If an index is set, an unchanged file is looked up in it rather than opened. In range-read mode, files are read with positioned reads of the header and version resource parts rather than mapped (see VersionResource::setRangeRead). If a filter is set, a file it rejects produces no row. The pseudo-attributes SHA256 and CRC32 return digests of the whole file (see FileHasher), CheckSum, ComputedCheckSum, AuthenticodeHash and SignedHash the integrity values of the image (see PEDigest and setAttributes), PdbPath, PdbGuid, PdbAge and SymbolKey the CodeView record of the debug directory (see PEImage::findCodeView), and AssemblyName, AssemblyVersion, Culture and PublicKeyToken the identity of a .NET assembly (see ClrMetadata). They are computed right after the version resource is read, from the mapping it was read through. So, a scan that asks for them opens and reads each file once. In range-read mode, the file is mapped for the image columns, and SHA256 and CRC32 alone read it in chunks.
+*/
+class VersionScanner
+{
+public:
+	VersionScanner() : _hashFiles(false), _digestImages(false), _readCodeView(false), _readAssembly(false), _workerCount(0), _index(NULL), _rangeRead(false), _filter(NULL), _sink(NULL) {}
+
+	void setAttributes(const std::vector<std::u16string> &names);
+	void setWorkerCount(int workerCount) { _workerCount = workerCount; }
+	// with an index or positioned reads, a full parse of a non-executable is as cheap as a look at its head. the magic stage is skipped then.
+	void setIndex(VersionIndex *index) { _index = index; _classifier.setSniffing(!_index && !_rangeRead); }
+	void setRangeRead(bool rangeRead) { _rangeRead = rangeRead; _classifier.setSniffing(!_index && !_rangeRead); }
+	void setFilter(const VersionFilter *filter) { _filter = filter; }
+	uint32_t scan(LPCPATHSTR rootPath, bool recursive, std::vector<VersionScanRow> &rows);
+	uint32_t scan(LPCPATHSTR rootPath, bool recursive, VersionScanSink &sink);
+	void scanFiles(const std::vector<pathstring> &paths, std::vector<VersionScanRow> &rows);
+	void getClassifyStats(FileClassifyStats &stats) const { _classifier.getStats(stats); }
+
+protected:
+	std::vector<std::u16string> _names; // attributes to read from each file.
+	std::vector<uint8_t> _digests; // SCAN_DIGEST_* of each name. SCAN_DIGEST_NONE for a version attribute.
+	bool _hashFiles; // true if a name asks for SHA256 or CRC32.
+	bool _digestImages; // true if a name asks for a checksum or an Authenticode hash.
+	bool _readCodeView; // true if a name asks for the PDB of the image.
+	bool _readAssembly; // true if a name asks for the identity of a .NET assembly.
+	FileHasher _hasher;
+	int _workerCount; // 0 selects a default based on the number of processors.
+	VersionIndex *_index; // optional. if set, version resources of unchanged files are read from it.
+	bool _rangeRead; // true to read files with positioned reads instead of mapping them.
+	const VersionFilter *_filter; // optional. a file the filter rejects produces no row.
+	FileClassifier _classifier; // rejects files that are not executables before they are mapped. its counters cover the last scan, or every scanFiles call since.
+	std::vector<std::vector<VersionScanRow> > _results; // one row list per worker. workers append without locking.
+	VersionScanSink *_sink; // set while scan streams rows to a sink.
+	std::vector<VersionScanRow> _scratch; // one reusable row per worker for streaming.
+
+	int workerCount() const;
+	uint32_t walk(LPCPATHSTR rootPath, bool recursive, int workerCount);
+	void scanFile(const pathstring &path, int worker);
+	bool readFile(const pathstring &path, VersionScanRow &row);
+	void readDigests(const pathstring &path, const VersionResource &vr, VersionScanRow &row);
+	void collectResults(std::vector<VersionScanRow> &rows);
+};
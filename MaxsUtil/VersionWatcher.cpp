@@ -0,0 +1,572 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "VersionWatcher.h"
+#include "DirectoryWalker.h"
+#include <chrono>
+#ifndef _WIN32
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+
+// kinds of a path returned by _pathType.
+#define PATHTYPE_MISSING 0
+#define PATHTYPE_FILE 1
+#define PATHTYPE_DIRECTORY 2
+#define PATHTYPE_OTHER 3 // a symbolic link, a reparse point or a device. not indexed.
+
+static int _pathType(const pathstring &path)
+{
+#ifdef _WIN32
+	DWORD attribs = GetFileAttributesW(path.c_str());
+	if (attribs == INVALID_FILE_ATTRIBUTES)
+		return PATHTYPE_MISSING;
+	if (attribs & FILE_ATTRIBUTE_REPARSE_POINT)
+		return PATHTYPE_OTHER;
+	return (attribs & FILE_ATTRIBUTE_DIRECTORY) ? PATHTYPE_DIRECTORY : PATHTYPE_FILE;
+#else//#ifdef _WIN32
+	struct stat st;
+	if (lstat(path.c_str(), &st) != 0)
+		return PATHTYPE_MISSING;
+	return S_ISREG(st.st_mode) ? PATHTYPE_FILE : S_ISDIR(st.st_mode) ? PATHTYPE_DIRECTORY : PATHTYPE_OTHER;
+#endif//#ifdef _WIN32
+}
+
+// appends a name to a directory pathname.
+static pathstring _join(const pathstring &dirPath, const PATHCHAR *name, size_t nameLen)
+{
+	pathstring path(dirPath);
+	if (path.empty() || path.back() != PATHSEPARATOR)
+		path += PATHSEPARATOR;
+	path.append(name, nameLen);
+	return path;
+}
+
+// tells if path is dirPath or is under it.
+static bool _isUnder(const pathstring &path, const pathstring &dirPath)
+{
+	if (path.compare(0, dirPath.size(), dirPath) != 0)
+		return false;
+	return path.size() == dirPath.size() || path[dirPath.size()] == PATHSEPARATOR || (!dirPath.empty() && dirPath.back() == PATHSEPARATOR);
+}
+
+
+VersionWatcher::VersionWatcher() : _recursive(true), _rangeRead(false), _stopping(false), _generation(0), _events(0), _filesParsed(0), _batches(0), _rescans(0), _watchErrors(0)
+{
+#ifdef _WIN32
+	_dir = INVALID_HANDLE_VALUE;
+	_stopEvent = NULL;
+	ZeroMemory(&_ov, sizeof(_ov));
+	_requestPending = false;
+#else//#ifdef _WIN32
+	_inotify = -1;
+	_stopPipe[0] = _stopPipe[1] = -1;
+#endif//#ifdef _WIN32
+}
+
+/* start - subscribes to change notifications of a directory tree, scans the tree, and starts a thread that keeps the index current. A watch already running is stopped first. The subscription is made before the scan. So, a file changed while the scan runs is read again afterwards rather than missed.
+
+Parameters:
+rootPath - [in] pathname of the directory to watch.
+recursive - [in] true to watch subdirectories as well.
+
+Return value:
+ERROR_SUCCESS if the watch has started. A system error code if the directory cannot be read or watched.
+*/
+uint32_t VersionWatcher::start(LPCPATHSTR rootPath, bool recursive)
+{
+	stop();
+	_root = rootPath;
+	// drop a trailing separator, but not the one of a root directory, e.g., '/' or 'C:\'.
+	while (_root.size() > 1 && _root.back() == PATHSEPARATOR && !(_root.size() == 3 && _root[1] == ':'))
+		_root.pop_back();
+	_recursive = recursive;
+	_events = _filesParsed = 0;
+	_batches = _rescans = _watchErrors = 0;
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+		_rows.clear();
+	}
+	uint32_t errorCode = subscribe();
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	std::vector<VersionScanRow> rows;
+	VersionScanner scanner;
+	scanner.setAttributes(_names);
+	scanner.setRangeRead(_rangeRead);
+	if (!_filter.isEmpty())
+		scanner.setFilter(&_filter);
+	errorCode = scanner.scan(_root.c_str(), _recursive, rows);
+	if (errorCode != ERROR_SUCCESS)
+	{
+		unsubscribe();
+		return errorCode;
+	}
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+		// the rows are sorted. so, each goes to the end of the map.
+		for (size_t i = 0; i < rows.size(); i++)
+			_rows.emplace_hint(_rows.end(), rows[i].path, std::move(rows[i]));
+	}
+	_stopping = false;
+	_thread = std::thread(&VersionWatcher::run, this);
+	publish();
+	return ERROR_SUCCESS;
+}
+
+/* stop - stops the watcher thread and cancels the subscription. The index keeps its last state. */
+void VersionWatcher::stop()
+{
+	if (_thread.joinable())
+	{
+		_stopping = true;
+#ifdef _WIN32
+		SetEvent(_stopEvent);
+#else//#ifdef _WIN32
+		// the pipe is empty. so, the write cannot block or fail.
+		char c = 0;
+		ssize_t cb = write(_stopPipe[1], &c, 1);
+		(void)cb;
+#endif//#ifdef _WIN32
+		_thread.join();
+	}
+	unsubscribe();
+}
+
+/* waitForChange - waits until the index changes.
+
+Parameters:
+generation - [in] a generation the caller has seen. See generation().
+timeoutMs - [in] maximum wait in milliseconds.
+
+Return value:
+true if the generation has moved past the one given. false on a timeout.
+*/
+bool VersionWatcher::waitForChange(uint64_t generation, uint32_t timeoutMs)
+{
+	std::unique_lock<std::mutex> lock(_lock);
+	return _changed.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&]() { return _generation != generation; });
+}
+
+/* snapshot - copies rows of the index. The rows are sorted by pathname.
+
+Parameters:
+rows - [out] receives the rows.
+under - [in, optional] pathname of a file or a subdirectory of the tree. Only the row of the file, or the rows of the files under the subdirectory, are copied. If it is empty, all rows are copied.
+*/
+void VersionWatcher::snapshot(std::vector<VersionScanRow> &rows, const pathstring &under) const
+{
+	rows.clear();
+	std::lock_guard<std::mutex> guard(_lock);
+	RowMap::const_iterator it = under.empty() ? _rows.begin() : _rows.lower_bound(under);
+	for (; it != _rows.end() && (under.empty() || _isUnder(it->first, under)); it++)
+		rows.push_back(it->second);
+}
+
+/* getStats - returns the counters of the watch and the number of rows in the index. */
+void VersionWatcher::getStats(VersionWatchStats &stats) const
+{
+	stats.events = _events;
+	stats.filesParsed = _filesParsed;
+	stats.batches = _batches;
+	stats.rescans = _rescans;
+	stats.watchErrors = _watchErrors;
+	std::lock_guard<std::mutex> guard(_lock);
+	stats.files = (uint32_t)_rows.size();
+}
+
+/* run - the watcher thread. It collects changed pathnames into a batch, and applies the batch once the tree has settled. */
+void VersionWatcher::run()
+{
+	typedef std::chrono::steady_clock clock;
+	DirtyMap dirty;
+	bool overflow = false;
+	clock::time_point first, last;
+	while (!_stopping)
+	{
+		// wait for a notification, or until the pending batch is due.
+		int timeoutMs = -1;
+		if (!dirty.empty() || overflow)
+		{
+			clock::time_point due = std::min(last + std::chrono::milliseconds(VERSIONWATCH_SETTLE_MS), first + std::chrono::milliseconds(VERSIONWATCH_MAX_DELAY_MS));
+			long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(due - clock::now()).count();
+			timeoutMs = ms > 0 ? (int)ms : 0;
+		}
+		size_t len = 0;
+		bool received = true;
+#ifdef _WIN32
+		HANDLE handles[2] = { _ov.hEvent, _stopEvent };
+		DWORD waitResult = WaitForMultipleObjects(2, handles, FALSE, timeoutMs < 0 ? INFINITE : (DWORD)timeoutMs);
+		if (waitResult == WAIT_TIMEOUT)
+			received = false;
+		else if (waitResult != WAIT_OBJECT_0)
+			break; // stopped.
+		else
+		{
+			_requestPending = false;
+			DWORD cb = 0;
+			if (!GetOverlappedResult(_dir, &_ov, &cb, FALSE) && GetLastError() != ERROR_NOTIFY_ENUM_DIR)
+				break; // the directory is gone.
+			len = cb; // 0 means that the notifications did not fit in the buffer.
+		}
+#else//#ifdef _WIN32
+		struct pollfd fds[2] = { { _inotify, POLLIN, 0 }, { _stopPipe[0], POLLIN, 0 } };
+		int n = poll(fds, 2, timeoutMs);
+		if (n < 0 && errno != EINTR)
+			break;
+		if (fds[1].revents)
+			break; // stopped.
+		if (n <= 0)
+			received = false;
+		else
+		{
+			ssize_t cb = read(_inotify, _buf.data(), _buf.size());
+			if (cb < 0)
+			{
+				if (errno == EAGAIN || errno == EINTR)
+					continue;
+				break;
+			}
+			len = (size_t)cb;
+		}
+#endif//#ifdef _WIN32
+		if (!received)
+		{
+			if (dirty.empty() && !overflow)
+				continue;
+			if (overflow)
+				rescan();
+			else
+				apply(dirty);
+			dirty.clear();
+			overflow = false;
+			continue;
+		}
+		clock::time_point now = clock::now();
+		if (dirty.empty() && !overflow)
+			first = now;
+		last = now;
+		if (!readEvents(_buf.data(), len, dirty))
+			overflow = true;
+#ifdef _WIN32
+		if (!requestChanges())
+			break;
+#endif//#ifdef _WIN32
+	}
+}
+
+/* apply - re-reads the files of a batch of changed pathnames, and updates the index. A pathname that no longer exists is removed from the index together with everything under it. A new directory is read in full.
+
+Parameters:
+dirty - [in] the changed pathnames and their VERSIONWATCH_DIRTY flags.
+*/
+void VersionWatcher::apply(const DirtyMap &dirty)
+{
+	std::vector<pathstring> files, removed;
+	DirtyMap::const_iterator it;
+	for (it = dirty.begin(); it != dirty.end(); it++)
+	{
+		int type = _pathType(it->first);
+		if (type == PATHTYPE_FILE)
+			files.push_back(it->first);
+		else if (type == PATHTYPE_DIRECTORY)
+		{
+			if ((it->second & VERSIONWATCH_DIRTY_TREE) && _recursive)
+				listTree(it->first, files);
+		}
+		else if (type == PATHTYPE_MISSING)
+			removed.push_back(it->first);
+	}
+	std::vector<VersionScanRow> rows;
+	VersionScanner scanner;
+	scanner.setAttributes(_names);
+	scanner.setRangeRead(_rangeRead);
+	if (!_filter.isEmpty())
+		scanner.setFilter(&_filter);
+	scanner.scanFiles(files, rows);
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+		// a changed path that is no longer an executable (or no longer a file) loses its row. one that is gets a new row below.
+		for (it = dirty.begin(); it != dirty.end(); it++)
+			_rows.erase(it->first);
+		for (size_t i = 0; i < files.size(); i++)
+			_rows.erase(files[i]);
+		for (size_t i = 0; i < removed.size(); i++)
+		{
+			RowMap::iterator first = _rows.lower_bound(removed[i]), last = first;
+			while (last != _rows.end() && _isUnder(last->first, removed[i]))
+				last++;
+			_rows.erase(first, last);
+		}
+		for (size_t i = 0; i < rows.size(); i++)
+		{
+			pathstring path = rows[i].path;
+			_rows[path] = std::move(rows[i]);
+		}
+		_filesParsed += files.size();
+		_batches++;
+		_generation++;
+	}
+	_changed.notify_all();
+}
+
+/* rescan - scans the whole tree again, and replaces the index. It is run when the system has dropped notifications. */
+void VersionWatcher::rescan()
+{
+#ifndef _WIN32
+	// watches of directories created during the overflow may be missing. adding a watch again is harmless.
+	addWatches(_root);
+#endif//#ifndef _WIN32
+	std::vector<VersionScanRow> rows;
+	VersionScanner scanner;
+	scanner.setAttributes(_names);
+	scanner.setRangeRead(_rangeRead);
+	if (!_filter.isEmpty())
+		scanner.setFilter(&_filter);
+	scanner.scan(_root.c_str(), _recursive, rows);
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+		_rows.clear();
+		for (size_t i = 0; i < rows.size(); i++)
+			_rows.emplace_hint(_rows.end(), rows[i].path, std::move(rows[i]));
+		_rescans++;
+		_generation++;
+	}
+	_changed.notify_all();
+}
+
+/* listTree - appends the pathnames of all files under a directory. */
+void VersionWatcher::listTree(const pathstring &dirPath, std::vector<pathstring> &files) const
+{
+	std::vector<pathstring> subdirs;
+	if (DirectoryWalker::listDirectory(dirPath, files, subdirs) != ERROR_SUCCESS)
+		return;
+	for (size_t i = 0; i < subdirs.size(); i++)
+		listTree(subdirs[i], files);
+}
+
+/* publish - starts a new generation, and wakes the threads waiting for a change. */
+void VersionWatcher::publish()
+{
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+		_generation++;
+	}
+	_changed.notify_all();
+}
+
+#ifdef _WIN32
+/* subscribe - opens the root directory, and makes the first request for change notifications. The system records changes from then on. */
+uint32_t VersionWatcher::subscribe()
+{
+	_dir = CreateFileW(_root.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	if (_dir == INVALID_HANDLE_VALUE)
+		return GetLastError();
+	_stopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	_ov.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	_buf.resize(VERSIONWATCH_BUFFER_SIZE);
+	if (!_stopEvent || !_ov.hEvent || !requestChanges())
+	{
+		uint32_t errorCode = GetLastError();
+		unsubscribe();
+		return errorCode;
+	}
+	return ERROR_SUCCESS;
+}
+
+/* unsubscribe - cancels an outstanding request, and closes the directory. */
+void VersionWatcher::unsubscribe()
+{
+	if (_dir != INVALID_HANDLE_VALUE)
+	{
+		if (_requestPending)
+		{
+			// the system writes to _buf until the request completes. wait for the cancellation to finish.
+			DWORD cb;
+			CancelIoEx(_dir, &_ov);
+			GetOverlappedResult(_dir, &_ov, &cb, TRUE);
+			_requestPending = false;
+		}
+		CloseHandle(_dir);
+		_dir = INVALID_HANDLE_VALUE;
+	}
+	if (_ov.hEvent)
+		CloseHandle(_ov.hEvent);
+	if (_stopEvent)
+		CloseHandle(_stopEvent);
+	ZeroMemory(&_ov, sizeof(_ov));
+	_stopEvent = NULL;
+}
+
+/* requestChanges - asks for the next set of change notifications. */
+bool VersionWatcher::requestChanges()
+{
+	ResetEvent(_ov.hEvent);
+	const DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE;
+	_requestPending = ReadDirectoryChangesW(_dir, _buf.data(), (DWORD)_buf.size(), _recursive ? TRUE : FALSE, filter, NULL, &_ov, NULL) != FALSE;
+	return _requestPending;
+}
+
+/* readEvents - adds the pathnames named by a buffer of FILE_NOTIFY_INFORMATION records to a batch. Returns false if notifications have been dropped (an empty buffer). */
+bool VersionWatcher::readEvents(const uint8_t *buf, size_t len, DirtyMap &dirty)
+{
+	if (len == 0)
+		return false;
+	const FILE_NOTIFY_INFORMATION *fni = (const FILE_NOTIFY_INFORMATION*)buf;
+	for (;;)
+	{
+		_events++;
+		pathstring path = _join(_root, fni->FileName, fni->FileNameLength / sizeof(WCHAR));
+		int flags = VERSIONWATCH_DIRTY_PATH;
+		// a directory that appears may hold files already. one that is only modified reports changes of its files, which are reported separately.
+		if (fni->Action == FILE_ACTION_ADDED || fni->Action == FILE_ACTION_RENAMED_NEW_NAME)
+			flags |= VERSIONWATCH_DIRTY_TREE;
+		dirty[path] |= flags;
+		if (fni->NextEntryOffset == 0)
+			break;
+		fni = (const FILE_NOTIFY_INFORMATION*)((const uint8_t*)fni + fni->NextEntryOffset);
+	}
+	return true;
+}
+#else//#ifdef _WIN32
+// events that make a path dirty. IN_CLOSE_WRITE rather than IN_MODIFY reports a write, so that a file being copied in is read once it is complete.
+#define VERSIONWATCH_INOTIFY_MASK (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+/* subscribe - creates an inotify instance, and watches the root directory and, if the watch is recursive, all directories under it. */
+uint32_t VersionWatcher::subscribe()
+{
+	_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (_inotify < 0)
+		return errnoToWin32(errno);
+	if (pipe(_stopPipe) != 0)
+	{
+		uint32_t errorCode = errnoToWin32(errno);
+		unsubscribe();
+		return errorCode;
+	}
+	_buf.resize(VERSIONWATCH_BUFFER_SIZE);
+	uint32_t errorCode = addWatches(_root);
+	if (errorCode != ERROR_SUCCESS)
+		unsubscribe();
+	return errorCode;
+}
+
+/* unsubscribe - closes the inotify instance, which removes all watches. */
+void VersionWatcher::unsubscribe()
+{
+	if (_inotify >= 0)
+		close(_inotify);
+	for (int i = 0; i < 2; i++)
+	{
+		if (_stopPipe[i] >= 0)
+			close(_stopPipe[i]);
+		_stopPipe[i] = -1;
+	}
+	_inotify = -1;
+	_watches.clear();
+}
+
+/* addWatches - watches a directory and, if the watch is recursive, the directories under it. A directory that cannot be watched is counted in the watchErrors statistic. Returns the error of watching dirPath itself. */
+uint32_t VersionWatcher::addWatches(const pathstring &dirPath)
+{
+	int wd = inotify_add_watch(_inotify, dirPath.c_str(), VERSIONWATCH_INOTIFY_MASK);
+	if (wd < 0)
+	{
+		uint32_t errorCode = errno == ENOTDIR ? ERROR_PATH_NOT_FOUND : errnoToWin32(errno);
+		_watchErrors++;
+		return errorCode;
+	}
+	_watches[wd] = dirPath;
+	if (!_recursive)
+		return ERROR_SUCCESS;
+	std::vector<pathstring> files, subdirs;
+	DirectoryWalker::listDirectory(dirPath, files, subdirs);
+	for (size_t i = 0; i < subdirs.size(); i++)
+		addWatches(subdirs[i]);
+	return ERROR_SUCCESS;
+}
+
+/* removeWatches - removes the watches of a directory that has been moved away or deleted, and of the directories under it. */
+void VersionWatcher::removeWatches(const pathstring &dirPath)
+{
+	std::unordered_map<int, pathstring>::iterator it = _watches.begin();
+	while (it != _watches.end())
+	{
+		if (_isUnder(it->second, dirPath))
+		{
+			inotify_rm_watch(_inotify, it->first);
+			it = _watches.erase(it);
+		}
+		else
+			it++;
+	}
+}
+
+/* readEvents - adds the pathnames named by a buffer of inotify events to a batch, and watches new directories. Returns false if the event queue has overflowed. */
+bool VersionWatcher::readEvents(const uint8_t *buf, size_t len, DirtyMap &dirty)
+{
+	bool complete = true;
+	for (size_t pos = 0; pos + sizeof(struct inotify_event) <= len; )
+	{
+		const struct inotify_event *ev = (const struct inotify_event*)(buf + pos);
+		pos += sizeof(struct inotify_event) + ev->len;
+		_events++;
+		if (ev->mask & IN_Q_OVERFLOW)
+		{
+			complete = false;
+			continue;
+		}
+		std::unordered_map<int, pathstring>::iterator it = _watches.find(ev->wd);
+		if (it == _watches.end())
+			continue;
+		if (ev->mask & IN_IGNORED)
+		{
+			_watches.erase(it);
+			continue;
+		}
+		// an event of the watched directory itself (e.g., IN_DELETE_SELF) has no name. its parent reports the change.
+		if (ev->len == 0 || ev->name[0] == 0)
+			continue;
+		pathstring path = _join(it->second, ev->name, strlen(ev->name));
+		int flags = VERSIONWATCH_DIRTY_PATH;
+		if (ev->mask & IN_ISDIR)
+		{
+			if (!_recursive)
+				continue;
+			if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+			{
+				addWatches(path);
+				flags |= VERSIONWATCH_DIRTY_TREE;
+			}
+			else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+				removeWatches(path);
+		}
+		dirty[path] |= flags;
+	}
+	return complete;
+}
+#endif//#ifdef _WIN32
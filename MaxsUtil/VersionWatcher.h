@@ -0,0 +1,130 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "VersionScanner.h"
+#include <map>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+
+// a batch of changes is applied once no change has been reported for this long. a file being copied in reports many writes. the wait lets them settle into one re-read.
+#define VERSIONWATCH_SETTLE_MS 200
+// a batch is applied after this long even if changes keep coming, so that a busy tree still gets updated.
+#define VERSIONWATCH_MAX_DELAY_MS 2000
+// size of the buffer change notifications are read into.
+#define VERSIONWATCH_BUFFER_SIZE (64 * 1024)
+
+// flags of a path with pending changes.
+#define VERSIONWATCH_DIRTY_PATH 1 // the path was created, written, renamed or removed. check it.
+#define VERSIONWATCH_DIRTY_TREE 2 // a directory appeared at the path. read all files under it.
+
+/* VersionWatchStats are counters of a watch since it was started. */
+struct VersionWatchStats
+{
+	uint64_t events; // change notifications received.
+	uint64_t filesParsed; // files re-read because of changes. the initial scan is not counted.
+	uint32_t batches; // batches of changes applied.
+	uint32_t rescans; // full rescans made because the system dropped notifications.
+	uint32_t watchErrors; // directories that could not be watched (e.g., the inotify watch limit was reached).
+	uint32_t files; // rows in the index.
+};
+
+/* VersionWatcher keeps an in-memory index of the version attributes of the executables in a directory tree current. start() subscribes to change notifications of the tree, and scans it once with VersionScanner. Then, a watcher thread collects the pathnames of files that are created, written, renamed or removed, and re-reads only those files. So, the cost of keeping the index current follows the churn in the tree, not its size. Queries (snapshot) are answered from memory. After stop(), the index keeps its last state.
+
+Notifications come from inotify on Linux and from ReadDirectoryChangesW on Windows. inotify watches one directory at a time. So, a watch is placed on every directory of the tree, and on a new directory as soon as it appears. If the system reports that notifications have been dropped (a queue overflow), the tree is scanned again in full.
+
+Changes are applied in batches. A batch is applied when the tree has been quiet for VERSIONWATCH_SETTLE_MS, or VERSIONWATCH_MAX_DELAY_MS after its first change. generation() increases with every batch. waitForChange() lets a caller block until the next one.
+
+snapshot, generation, waitForChange and getStats are safe to call from any thread while the watch runs. start and stop are not.
+*/
+class VersionWatcher
+{
+public:
+	VersionWatcher();
+	~VersionWatcher() { stop(); }
+
+	void setAttributes(const std::vector<std::u16string> &names) { _names = names; }
+	void setRangeRead(bool rangeRead) { _rangeRead = rangeRead; }
+	void setFilter(const VersionFilter &filter) { _filter = filter; }
+	uint32_t start(LPCPATHSTR rootPath, bool recursive);
+	void stop();
+
+	bool isWatching() const { return _thread.joinable(); }
+	const pathstring &rootPath() const { return _root; }
+	uint64_t generation() const { return _generation; }
+	bool waitForChange(uint64_t generation, uint32_t timeoutMs);
+	void snapshot(std::vector<VersionScanRow> &rows, const pathstring &under = pathstring()) const;
+	void getStats(VersionWatchStats &stats) const;
+	const std::vector<std::u16string> &attributes() const { return _names; }
+
+protected:
+	typedef std::map<pathstring, VersionScanRow> RowMap; // sorted by pathname. so, the rows of a subtree are contiguous.
+	typedef std::map<pathstring, int> DirtyMap; // pathname to VERSIONWATCH_DIRTY flags.
+
+	pathstring _root;
+	bool _recursive;
+	std::vector<std::u16string> _names;
+	bool _rangeRead;
+	VersionFilter _filter; // a file the filter rejects is not indexed.
+	RowMap _rows; // protected by _lock.
+	mutable std::mutex _lock;
+	std::condition_variable _changed; // signaled when _generation changes.
+	std::thread _thread;
+	std::atomic<bool> _stopping;
+	std::atomic<uint64_t> _generation;
+	std::atomic<uint64_t> _events, _filesParsed;
+	std::atomic<uint32_t> _batches, _rescans, _watchErrors;
+	std::vector<uint8_t> _buf; // receives change notifications.
+#ifdef _WIN32
+	HANDLE _dir; // the root directory opened for ReadDirectoryChangesW.
+	HANDLE _stopEvent;
+	OVERLAPPED _ov;
+	bool _requestPending; // a ReadDirectoryChangesW request is outstanding on _ov.
+
+	bool requestChanges();
+#else//#ifdef _WIN32
+	int _inotify;
+	int _stopPipe[2]; // stop() writes to it to wake the watcher thread.
+	std::unordered_map<int, pathstring> _watches; // watch descriptor to directory. used by the watcher thread only once it runs.
+
+	uint32_t addWatches(const pathstring &dirPath);
+	void removeWatches(const pathstring &dirPath);
+#endif//#ifdef _WIN32
+
+	uint32_t subscribe();
+	void unsubscribe();
+	void run();
+	bool readEvents(const uint8_t *buf, size_t len, DirtyMap &dirty);
+	void apply(const DirtyMap &dirty);
+	void rescan();
+	void listTree(const pathstring &dirPath, std::vector<pathstring> &files) const;
+	void publish();
+
+private:
+	VersionWatcher(const VersionWatcher&);
+	VersionWatcher& operator=(const VersionWatcher&);
+};
@@ -0,0 +1,542 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "VersionWriter.h"
+#include "VersionCache.h"
+#include <string.h>
+
+
+static const UTF16CHAR STRINGFILEINFO_KEY[] = u"StringFileInfo";
+static const UTF16CHAR FILEVERSION_KEY[] = u"FileVersion";
+static const UTF16CHAR PRODUCTVERSION_KEY[] = u"ProductVersion";
+#define KEYLEN(key) (sizeof(key) / sizeof(UTF16CHAR) - 1)
+
+// nodes nest 4 levels deep in a normal resource (VS_VERSIONINFO, StringFileInfo, StringTable and String). the limit guards against a malformed one.
+#define VERSIONWRITER_MAX_DEPTH 8
+// the pages of a grown image are compared with those of the file, and only the pages that differ are written.
+#define VERSIONWRITER_PAGE_SIZE 4096
+
+inline uint32_t _alignUp(uint32_t n, uint32_t alignment)
+{
+	return (n + alignment - 1) & ~(alignment - 1);
+}
+
+inline bool _keyEquals(const std::u16string &key, LPCUTF16STR name, size_t nameLen)
+{
+	return utf16icmp(key.c_str(), key.size(), name, nameLen) == 0;
+}
+
+/* _parseTableKey - decodes the 8-digit hex key of a StringTable (e.g., '040904b0') to a translation code. */
+static bool _parseTableKey(const std::u16string &key, uint32_t *langCp)
+{
+	if (key.size() != 8)
+		return false;
+	uint32_t n = 0;
+	for (size_t i = 0; i < 8; i++)
+	{
+		UTF16CHAR c = utf16ToLower(key[i]);
+		if (c >= '0' && c <= '9')
+			n = (n << 4) | (uint32_t)(c - '0');
+		else if (c >= 'a' && c <= 'f')
+			n = (n << 4) | (uint32_t)(c - 'a' + 10);
+		else
+			return false;
+	}
+	// the language is in the high half of the key, and the codepage in the low half.
+	*langCp = VERSION_LANGCP(n >> 16, n & 0xFFFF);
+	return true;
+}
+
+/* _setText - replaces the value of a node with a null-terminated text. */
+static void _setText(VersionNode &node, LPCUTF16STR text, size_t textLen)
+{
+	node.type = VERSION_BLOCK_TYPE_TEXT;
+	node.value.resize((textLen + 1) * sizeof(UTF16CHAR));
+	if (textLen)
+		memcpy(node.value.data(), text, textLen * sizeof(UTF16CHAR));
+	memset(node.value.data() + textLen * sizeof(UTF16CHAR), 0, sizeof(UTF16CHAR));
+}
+
+/* _put16 - appends a little-endian 16-bit value. */
+inline void _put16(std::vector<uint8_t> &out, uint16_t v)
+{
+	out.push_back((uint8_t)v);
+	out.push_back((uint8_t)(v >> 8));
+}
+
+/* _pad4 - pads the output to a 32-bit boundary. node offsets are relative to the start of the VS_VERSIONINFO block, which is where out starts. */
+inline void _pad4(std::vector<uint8_t> &out)
+{
+	while (out.size() & 3)
+		out.push_back(0);
+}
+
+/* open - reads the version resource of a PE file into an editable tree. The file is not kept open. It is opened again for writing when commit() is called.
+
+Parameters:
+path - [in] pathname of an executable file.
+
+Return value:
+same as VersionResource::load.
+*/
+uint32_t VersionWriter::open(LPCPATHSTR path)
+{
+	close();
+	VersionResource vr;
+	uint32_t errorCode = vr.load(path);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	VersionBlock root;
+	if (!vr.parseBlock(vr.data(), vr.data() + vr.size(), root) || !parseNode(vr, root, _root, 0))
+	{
+		_root = VersionNode();
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	}
+	_path = path;
+	return ERROR_SUCCESS;
+}
+
+/* close - discards the tree and any edits that have not been committed. */
+void VersionWriter::close()
+{
+	_path.clear();
+	_root = VersionNode();
+	_modified = false;
+	_rebuilt = false;
+}
+
+/* parseNode - copies a node and its descendants from the resource into a VersionNode. */
+bool VersionWriter::parseNode(const VersionResource &vr, const VersionBlock &block, VersionNode &node, int depth)
+{
+	if (depth >= VERSIONWRITER_MAX_DEPTH)
+		return false;
+	node.key.assign(block.key, block.keyLen);
+	node.type = block.type;
+	node.value.assign(block.value, block.value + block.valueLen);
+	const uint8_t *base = vr.data();
+	const uint8_t *p = block.children;
+	VersionBlock child;
+	while (p < block.end && vr.parseBlock(p, block.end, child))
+	{
+		node.children.push_back(VersionNode());
+		if (!parseNode(vr, child, node.children.back(), depth + 1))
+			return false;
+		p = base + (((size_t)(child.end - base) + 3) & ~(size_t)3);
+	}
+	return true;
+}
+
+/* serialize - converts a node and its descendants to the binary form of a version resource. The layout is the one VersionResource::parseBlock reads: a header of wLength, wValueLength and wType, the key, the value and the children, each starting on a 32-bit boundary. Returns false if a node would be longer than the 64 KB a wLength can describe.
+
+Parameters:
+node - [in] the node to serialize, usually the VS_VERSIONINFO node.
+out - [in, out] the output. It must be empty or hold a multiple of 4 bytes, so that the alignment comes out right.
+*/
+bool VersionWriter::serialize(const VersionNode &node, std::vector<uint8_t> &out)
+{
+	size_t start = out.size();
+	size_t valueLen = node.type == VERSION_BLOCK_TYPE_TEXT ? node.value.size() / sizeof(UTF16CHAR) : node.value.size();
+	if (valueLen > 0xFFFF)
+		return false;
+	_put16(out, 0); // wLength is filled in at the end.
+	_put16(out, (uint16_t)valueLen);
+	_put16(out, node.type);
+	for (size_t i = 0; i < node.key.size(); i++)
+		_put16(out, (uint16_t)node.key[i]);
+	_put16(out, 0);
+	_pad4(out);
+	out.insert(out.end(), node.value.begin(), node.value.end());
+	for (size_t i = 0; i < node.children.size(); i++)
+	{
+		_pad4(out);
+		if (!serialize(node.children[i], out))
+			return false;
+	}
+	size_t len = out.size() - start;
+	if (len > 0xFFFF)
+		return false;
+	out[start] = (uint8_t)len;
+	out[start + 1] = (uint8_t)(len >> 8);
+	return true;
+}
+
+/* fixedInfo - returns the VS_FIXEDFILEINFO value of the root node, or NULL if it has none. */
+const VERSION_FIXEDFILEINFO *VersionWriter::fixedInfo() const
+{
+	if (_root.value.size() < sizeof(VERSION_FIXEDFILEINFO))
+		return NULL;
+	const VERSION_FIXEDFILEINFO *ffi = (const VERSION_FIXEDFILEINFO*)_root.value.data();
+	if (ffi->dwSignature != VERSION_FIXEDFILEINFO_SIGNATURE)
+		return NULL;
+	return ffi;
+}
+
+/* getVersionKeys - returns the file and product versions of the edited tree as version keys. See VersionResource::queryVersionKeys. */
+uint32_t VersionWriter::getVersionKeys(uint64_t *fileVersionKey, uint64_t *productVersionKey) const
+{
+	const VERSION_FIXEDFILEINFO *ffi = fixedInfo();
+	if (!ffi)
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	if (fileVersionKey)
+		*fileVersionKey = VERSION_KEY(ffi->dwFileVersionMS, ffi->dwFileVersionLS);
+	if (productVersionKey)
+		*productVersionKey = VERSION_KEY(ffi->dwProductVersionMS, ffi->dwProductVersionLS);
+	return ERROR_SUCCESS;
+}
+
+/* setFileVersion - sets the file version of VS_FIXEDFILEINFO, and replaces the FileVersion string of every string table that has one with the same version in <major>.<minor>.<revision>.<build> form. Call setString afterwards to give the string a different text.
+
+Parameters:
+key - [in] the new version as a version key (see VersionKey.h).
+
+Return value:
+ERROR_RESOURCE_DATA_NOT_FOUND - the resource has no VS_FIXEDFILEINFO.
+*/
+uint32_t VersionWriter::setFileVersion(uint64_t key)
+{
+	return setVersion(key, false);
+}
+
+/* setProductVersion - same as setFileVersion except that it sets the product version and the ProductVersion strings. */
+uint32_t VersionWriter::setProductVersion(uint64_t key)
+{
+	return setVersion(key, true);
+}
+
+uint32_t VersionWriter::setVersion(uint64_t key, bool product)
+{
+	if (!fixedInfo())
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	VERSION_FIXEDFILEINFO *ffi = (VERSION_FIXEDFILEINFO*)_root.value.data();
+	if (product)
+	{
+		ffi->dwProductVersionMS = (uint32_t)(key >> 32);
+		ffi->dwProductVersionLS = (uint32_t)key;
+	}
+	else
+	{
+		ffi->dwFileVersionMS = (uint32_t)(key >> 32);
+		ffi->dwFileVersionLS = (uint32_t)key;
+	}
+	_modified = true;
+	UTF16CHAR text[24];
+	size_t textLen = 0;
+	uint16_t parts[4] = { VERSION_KEY_MAJOR(key), VERSION_KEY_MINOR(key), VERSION_KEY_REVISION(key), VERSION_KEY_BUILD(key) };
+	for (int i = 0; i < 4; i++)
+	{
+		if (i)
+			text[textLen++] = '.';
+		char digits[6];
+		int n = 0;
+		uint16_t v = parts[i];
+		do
+		{
+			digits[n++] = (char)('0' + v % 10);
+			v /= 10;
+		} while (v);
+		while (n)
+			text[textLen++] = (UTF16CHAR)digits[--n];
+	}
+	if (product)
+		setString(PRODUCTVERSION_KEY, KEYLEN(PRODUCTVERSION_KEY), text, textLen, 0, false);
+	else
+		setString(FILEVERSION_KEY, KEYLEN(FILEVERSION_KEY), text, textLen, 0, false);
+	return ERROR_SUCCESS;
+}
+
+/* setString - sets a string of the StringFileInfo block, e.g., ProductName or PrivateBuild.
+
+Parameters:
+name - [in] name of the string. it need not be null-terminated.
+nameLen - [in] number of characters in name.
+value - [in] the new text. it need not be null-terminated.
+valueLen - [in] number of characters in value.
+langCp - [in] translation code (see VERSION_LANGCP) of the string table to change. 0 changes all tables.
+addIfMissing - [in, optional] true (default) to add the string to a table that does not have it. false to change existing strings only.
+
+Return value:
+ERROR_RESOURCE_NAME_NOT_FOUND - the resource has no StringFileInfo block.
+ERROR_RESOURCE_LANG_NOT_FOUND - there is no string table of the translation.
+ERROR_INVALID_PARAMETER - the name is empty.
+*/
+uint32_t VersionWriter::setString(LPCUTF16STR name, size_t nameLen, LPCUTF16STR value, size_t valueLen, uint32_t langCp, bool addIfMissing)
+{
+	if (nameLen == 0)
+		return ERROR_INVALID_PARAMETER;
+	VersionNode *sfi = NULL;
+	for (size_t i = 0; i < _root.children.size() && !sfi; i++)
+	{
+		if (_keyEquals(_root.children[i].key, STRINGFILEINFO_KEY, KEYLEN(STRINGFILEINFO_KEY)))
+			sfi = &_root.children[i];
+	}
+	if (!sfi)
+		return ERROR_RESOURCE_NAME_NOT_FOUND;
+	bool found = false;
+	for (size_t i = 0; i < sfi->children.size(); i++)
+	{
+		VersionNode &table = sfi->children[i];
+		uint32_t tableLangCp;
+		if (!_parseTableKey(table.key, &tableLangCp) || (langCp != 0 && tableLangCp != langCp))
+			continue;
+		found = true;
+		size_t j;
+		for (j = 0; j < table.children.size(); j++)
+		{
+			if (_keyEquals(table.children[j].key, name, nameLen))
+				break;
+		}
+		if (j == table.children.size())
+		{
+			if (!addIfMissing)
+				continue;
+			table.children.push_back(VersionNode());
+			table.children.back().key.assign(name, nameLen);
+		}
+		_setText(table.children[j], value, valueLen);
+		_modified = true;
+	}
+	return found ? ERROR_SUCCESS : ERROR_RESOURCE_LANG_NOT_FOUND;
+}
+
+/* commit - writes the edited tree back to the file, and updates the image checksum. See the class description for how the resource section is rebuilt when the new resource does not fit in the old one's space. rebuilt() tells which way it went.
+
+Return value:
+ERROR_INVALID_PARAMETER - no file is open, or a string is too long for the 64 KB limit of a version resource.
+ERROR_NOT_SUPPORTED - the resource section must grow, but a section that cannot be moved follows it.
+other - a system error code from opening and writing the file.
+*/
+uint32_t VersionWriter::commit()
+{
+	if (!isOpen())
+		return ERROR_INVALID_PARAMETER;
+	std::vector<uint8_t> block;
+	if (!serialize(_root, block))
+		return ERROR_INVALID_PARAMETER;
+	MappedFile file;
+	uint32_t errorCode = file.openForWrite(_path.c_str());
+	if (errorCode == ERROR_HANDLE_EOF)
+		return ERROR_BAD_EXE_FORMAT;
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	PEImage pe;
+	errorCode = pe.attach(file.data(), file.size());
+	const PE_RESOURCE_DATA_ENTRY *de = NULL;
+	if (errorCode == ERROR_SUCCESS)
+		errorCode = pe.findResourceDataEntry(PE_RT_VERSION, PE_VS_VERSION_INFO, 0, &de);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	uint8_t *data = file.writableData();
+	size_t checksumOffset = (const uint8_t*)&pe.optionalHeader()->CheckSum - file.data();
+	size_t offset;
+	if (block.size() <= de->Size && pe.rvaToOffset(de->OffsetToData, de->Size, &offset))
+	{
+		// it fits. overwrite the old resource, and clear what is left of it.
+		memcpy(data + offset, block.data(), block.size());
+		memset(data + offset + block.size(), 0, de->Size - block.size());
+		((PE_RESOURCE_DATA_ENTRY*)(data + ((const uint8_t*)de - file.data())))->Size = (uint32_t)block.size();
+		uint32_t checksum = PEImage::computeChecksum(data, file.size(), checksumOffset);
+		memcpy(data + checksumOffset, &checksum, sizeof(checksum));
+		// readers in this process must not be served the old resource.
+		VersionCache::instance().invalidate(_path.c_str());
+		_rebuilt = false;
+		_modified = false;
+		return ERROR_SUCCESS;
+	}
+
+	std::vector<uint8_t> image;
+	errorCode = growResourceSection(pe, de, block, image);
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	file.close();
+	errorCode = file.openForWrite(_path.c_str(), image.size());
+	if (errorCode != ERROR_SUCCESS)
+		return errorCode;
+	if (file.size() != image.size())
+		return ERROR_WRITE_FAULT;
+	// most of the image is unchanged. writing only the pages that differ keeps the rest of the file cache clean.
+	data = file.writableData();
+	for (size_t pos = 0; pos < image.size(); pos += VERSIONWRITER_PAGE_SIZE)
+	{
+		size_t len = image.size() - pos < VERSIONWRITER_PAGE_SIZE ? image.size() - pos : VERSIONWRITER_PAGE_SIZE;
+		if (memcmp(data + pos, image.data() + pos, len) != 0)
+			memcpy(data + pos, image.data() + pos, len);
+	}
+	VersionCache::instance().invalidate(_path.c_str());
+	_rebuilt = true;
+	_modified = false;
+	return ERROR_SUCCESS;
+}
+
+/* growResourceSection - builds a copy of the image in which the resource section has been grown to hold a new version resource at its end.
+
+Parameters:
+pe - [in] the image, attached to the whole file.
+dataEntry - [in] the data entry of the version resource in the image.
+block - [in] the new version resource.
+image - [out] receives the new image, including an updated checksum.
+*/
+uint32_t VersionWriter::growResourceSection(const PEImage &pe, const PE_RESOURCE_DATA_ENTRY *dataEntry, const std::vector<uint8_t> &block, std::vector<uint8_t> &image)
+{
+	const uint8_t *data = pe.base();
+	size_t size = pe.size();
+	const PE_OPTIONAL_HEADER_COMMON *opt = pe.optionalHeader();
+	uint32_t sectionAlignment = opt->SectionAlignment;
+	uint32_t fileAlignment = opt->FileAlignment;
+	if (sectionAlignment == 0 || fileAlignment == 0 || (sectionAlignment & (sectionAlignment - 1)) || (fileAlignment & (fileAlignment - 1)))
+		return ERROR_BAD_EXE_FORMAT;
+	uint32_t rsrcRva, rsrcLen;
+	if (!pe.getDataDirectory(PE_DIRECTORY_ENTRY_RESOURCE, &rsrcRva, &rsrcLen))
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+
+	// find the section holding the resource directory.
+	const PE_SECTION_HEADER *rs = NULL;
+	for (int i = 0; i < pe.sectionCount() && !rs; i++)
+	{
+		const PE_SECTION_HEADER *sh = pe.section(i);
+		uint32_t span = sh->VirtualSize > sh->SizeOfRawData ? sh->VirtualSize : sh->SizeOfRawData;
+		if (rsrcRva >= sh->VirtualAddress && rsrcRva - sh->VirtualAddress < span)
+			rs = sh;
+	}
+	if (!rs)
+		return ERROR_RESOURCE_DATA_NOT_FOUND;
+	uint64_t rawEnd64 = (uint64_t)rs->PointerToRawData + rs->SizeOfRawData;
+	if (rawEnd64 > size)
+		return ERROR_BAD_EXE_FORMAT;
+	size_t rawEnd = (size_t)rawEnd64;
+
+	// the sections that follow are moved down. make sure that nothing but the relocation directory refers to them.
+	uint32_t relocRva = 0, relocLen = 0;
+	pe.getDataDirectory(PE_DIRECTORY_ENTRY_BASERELOC, &relocRva, &relocLen);
+	uint32_t nextRva = 0;
+	for (int i = 0; i < pe.sectionCount(); i++)
+	{
+		const PE_SECTION_HEADER *sh = pe.section(i);
+		if (sh == rs)
+			continue;
+		if (sh->VirtualAddress < rs->VirtualAddress)
+		{
+			if (sh->SizeOfRawData && sh->PointerToRawData >= rawEnd)
+				return ERROR_NOT_SUPPORTED; // a section is stored after the resource section, but mapped before it.
+			continue;
+		}
+		uint32_t span = sh->VirtualSize > sh->SizeOfRawData ? sh->VirtualSize : sh->SizeOfRawData;
+		if (!(sh->Characteristics & PE_SCN_MEM_DISCARDABLE) || relocRva < sh->VirtualAddress || relocRva - sh->VirtualAddress >= span)
+			return ERROR_NOT_SUPPORTED;
+		if (sh->SizeOfRawData && sh->PointerToRawData < rawEnd)
+			return ERROR_NOT_SUPPORTED;
+		for (int j = 0; j < PE_DIRECTORY_ENTRY_COM_DESCRIPTOR; j++)
+		{
+			uint32_t rva, len;
+			if (j != PE_DIRECTORY_ENTRY_BASERELOC && j != PE_DIRECTORY_ENTRY_SECURITY && pe.getDataDirectory(j, &rva, &len) && rva >= sh->VirtualAddress && rva - sh->VirtualAddress < span)
+				return ERROR_NOT_SUPPORTED;
+		}
+		if (nextRva == 0 || sh->VirtualAddress < nextRva)
+			nextRva = sh->VirtualAddress;
+	}
+
+	// the new resource goes after the last byte in use. the section is grown in whole file alignment units, and the sections that follow are moved in whole section alignment units.
+	uint32_t used = rs->VirtualSize ? rs->VirtualSize : rs->SizeOfRawData;
+	uint64_t newRva64 = (uint64_t)rs->VirtualAddress + _alignUp(used, 8);
+	uint64_t newVirtualSize64 = newRva64 - rs->VirtualAddress + block.size();
+	if (newRva64 + block.size() > 0x7FFFFFFF)
+		return ERROR_NOT_SUPPORTED;
+	uint32_t newRva = (uint32_t)newRva64;
+	uint32_t newVirtualSize = (uint32_t)newVirtualSize64;
+	uint32_t newRawSize = _alignUp(newVirtualSize, fileAlignment);
+	if (newRawSize < rs->SizeOfRawData)
+		newRawSize = rs->SizeOfRawData;
+	uint32_t deltaRaw = newRawSize - rs->SizeOfRawData;
+	uint32_t deltaRva = 0;
+	uint32_t newEnd = _alignUp(rs->VirtualAddress + newVirtualSize, sectionAlignment);
+	if (nextRva && newEnd > nextRva)
+		deltaRva = newEnd - nextRva;
+
+	image.reserve(size + deltaRaw);
+	image.assign(data, data + rawEnd);
+	image.resize(rawEnd + deltaRaw, 0);
+	image.insert(image.end(), data + rawEnd, data + size);
+	memcpy(image.data() + rs->PointerToRawData + (newRva - rs->VirtualAddress), block.data(), block.size());
+	// the headers of the new image are at the same offsets as in the old.
+	uint8_t *out = image.data();
+#define VERSIONWRITER_AT(type, p) ((type*)(out + ((const uint8_t*)(p) - data)))
+
+	// clear the old resource, and point the data entry to the new one.
+	size_t oldOffset;
+	if (pe.rvaToOffset(dataEntry->OffsetToData, dataEntry->Size, &oldOffset))
+		memset(out + oldOffset, 0, dataEntry->Size);
+	PE_RESOURCE_DATA_ENTRY *de = VERSIONWRITER_AT(PE_RESOURCE_DATA_ENTRY, dataEntry);
+	de->OffsetToData = newRva;
+	de->Size = (uint32_t)block.size();
+
+	// update the section table.
+	uint32_t imageEnd = 0;
+	for (int i = 0; i < pe.sectionCount(); i++)
+	{
+		const PE_SECTION_HEADER *sh = pe.section(i);
+		PE_SECTION_HEADER *w = VERSIONWRITER_AT(PE_SECTION_HEADER, sh);
+		if (sh == rs)
+		{
+			w->VirtualSize = newVirtualSize;
+			w->SizeOfRawData = newRawSize;
+		}
+		else if (sh->VirtualAddress > rs->VirtualAddress)
+		{
+			w->VirtualAddress += deltaRva;
+			if (w->PointerToRawData)
+				w->PointerToRawData += deltaRaw;
+		}
+		uint32_t end = w->VirtualAddress + (w->VirtualSize ? w->VirtualSize : w->SizeOfRawData);
+		if (end > imageEnd)
+			imageEnd = end;
+	}
+
+	// update the data directories and the other fields that hold RVAs or file offsets past the resource section.
+	if (relocRva > rs->VirtualAddress)
+		VERSIONWRITER_AT(PE_DATA_DIRECTORY, pe.dataDirectory(PE_DIRECTORY_ENTRY_BASERELOC))->VirtualAddress += deltaRva;
+	const PE_DATA_DIRECTORY *security = pe.dataDirectory(PE_DIRECTORY_ENTRY_SECURITY);
+	if (security && security->Size && security->VirtualAddress >= rawEnd)
+		VERSIONWRITER_AT(PE_DATA_DIRECTORY, security)->VirtualAddress += deltaRaw; // the certificate table is located by file offset, not by RVA.
+	PE_DATA_DIRECTORY *rsrcDir = VERSIONWRITER_AT(PE_DATA_DIRECTORY, pe.dataDirectory(PE_DIRECTORY_ENTRY_RESOURCE));
+	if (newRva + block.size() - rsrcRva > rsrcDir->Size)
+		rsrcDir->Size = (uint32_t)(newRva + block.size() - rsrcRva);
+	uint32_t debugRva, debugLen;
+	const uint8_t *debug;
+	if (pe.getDataDirectory(PE_DIRECTORY_ENTRY_DEBUG, &debugRva, &debugLen) && (debug = pe.rvaToPtr(debugRva, debugLen)) != NULL)
+	{
+		for (uint32_t i = 0; i + sizeof(PE_DEBUG_DIRECTORY) <= debugLen; i += sizeof(PE_DEBUG_DIRECTORY))
+		{
+			PE_DEBUG_DIRECTORY *dd = VERSIONWRITER_AT(PE_DEBUG_DIRECTORY, debug + i);
+			if (dd->PointerToRawData >= rawEnd)
+				dd->PointerToRawData += deltaRaw;
+		}
+	}
+	PE_FILE_HEADER *fh = VERSIONWRITER_AT(PE_FILE_HEADER, pe.fileHeader());
+	if (fh->PointerToSymbolTable >= rawEnd)
+		fh->PointerToSymbolTable += deltaRaw;
+	PE_OPTIONAL_HEADER_COMMON *wopt = VERSIONWRITER_AT(PE_OPTIONAL_HEADER_COMMON, opt);
+	wopt->SizeOfInitializedData += deltaRaw;
+	wopt->SizeOfImage = _alignUp(imageEnd, sectionAlignment);
+	uint32_t checksum = PEImage::computeChecksum(out, image.size(), (const uint8_t*)&opt->CheckSum - data);
+	wopt->CheckSum = checksum;
+#undef VERSIONWRITER_AT
+	return ERROR_SUCCESS;
+}
@@ -0,0 +1,77 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include "MappedFile.h"
+#include "PEImage.h"
+#include "VersionResource.h"
+#include <vector>
+
+
+/* VersionNode is an editable copy of a node of the VS_VERSIONINFO tree (see VersionBlock). Unlike VersionBlock, it owns its key, value and children. */
+struct VersionNode
+{
+	std::u16string key;
+	uint16_t type; // VERSION_BLOCK_TYPE_TEXT or 0 for binary.
+	std::vector<uint8_t> value; // a text value includes the terminating null.
+	std::vector<VersionNode> children;
+
+	VersionNode() : type(0) {}
+};
+
+/* VersionWriter changes the version resource of a PE file without relinking it or running a resource compiler. open() reads the VS_VERSIONINFO tree into VersionNodes. The set methods edit the tree. commit() writes it back.
+
+If the edited resource is no larger than the original, it is written over the original in a writable mapping of the file. Only the pages holding the resource and the headers are touched. If it is larger, the resource section is rebuilt: the new resource is put at the end of the section, its data entry is pointed at it, and the section is grown. Sections that follow the resource section, typically .reloc, are moved down. The file size, the image size, the relocation directory, the certificate table offset, the debug data offsets and the COFF symbol table offset are adjusted accordingly. A section other than a discardable relocation section cannot be moved, because code may refer to it. Growing such an image fails with ERROR_NOT_SUPPORTED. Either way, the image checksum is recomputed. A signed image loses the validity of its signature and must be signed again. commit() also drops the file from the process-wide VersionCache, so that VersionInfo objects read the new resource.
+
+The class does not depend on COM or the Windows headers. It runs on Linux build agents as well.
+*/
+class VersionWriter
+{
+public:
+	VersionWriter() : _modified(false), _rebuilt(false) {}
+
+	uint32_t open(LPCPATHSTR path);
+	void close();
+	bool isOpen() const { return !_path.empty(); }
+	bool isModified() const { return _modified; }
+	bool rebuilt() const { return _rebuilt; }
+
+	uint32_t getVersionKeys(uint64_t *fileVersionKey, uint64_t *productVersionKey) const;
+	uint32_t setFileVersion(uint64_t key);
+	uint32_t setProductVersion(uint64_t key);
+	uint32_t setString(LPCUTF16STR name, size_t nameLen, LPCUTF16STR value, size_t valueLen, uint32_t langCp, bool addIfMissing = true);
+	uint32_t commit();
+
+	static bool serialize(const VersionNode &node, std::vector<uint8_t> &out);
+
+protected:
+	pathstring _path;
+	VersionNode _root; // the VS_VERSIONINFO node.
+	bool _modified; // true if the tree has been edited since open() or the last commit().
+	bool _rebuilt; // true if the last commit() had to grow the resource section.
+
+	static bool parseNode(const VersionResource &vr, const VersionBlock &block, VersionNode &node, int depth);
+	const VERSION_FIXEDFILEINFO *fixedInfo() const;
+	uint32_t setVersion(uint64_t key, bool product);
+	uint32_t growResourceSection(const PEImage &pe, const PE_RESOURCE_DATA_ENTRY *dataEntry, const std::vector<uint8_t> &block, std::vector<uint8_t> &image);
+};
@@ -0,0 +1,170 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "stdafx.h"
+#include "VersionWriterImpl.h"
+
+
+/* get_File - [propget] returns the pathname of the file whose version resource is being edited.
+
+Parameters:
+Value - [retval][out] contains the pathname previously set by a call to put_File. an interface error of E_UNEXPECTED is returned if no pathname is available.
+*/
+STDMETHODIMP VersionWriterImpl::get_File(/* [retval][out] */ BSTR *Value)
+{
+	if (_file.length() == 0)
+		return E_UNEXPECTED;
+	bstring v(_file);
+	*Value = v.detach();
+	return S_OK;
+}
+
+/* put_File - [propput] opens an executable file and reads its version resource for editing. Changes that have not been committed to a previous file are discarded.
+
+Parameters:
+NewValue - [in] a pathname of an executable file. If the file has no version resource, an interface error of ERROR_RESOURCE_DATA_NOT_FOUND or ERROR_RESOURCE_TYPE_NOT_FOUND is returned.
+*/
+STDMETHODIMP VersionWriterImpl::put_File(/* [in] */ BSTR NewValue)
+{
+	_file.assignW(NewValue);
+	_vw.close();
+	if (_file.length() == 0)
+		return S_OK;
+	uint32_t errorCode = _vw.open(_file);
+	if (errorCode != ERROR_SUCCESS)
+	{
+		_file.free();
+		return HRESULT_FROM_WIN32(errorCode);
+	}
+	return S_OK;
+}
+
+/* get_FileVersion - [propget] returns the file version of the fixed file info, including an edit that has not been committed yet.
+
+Parameters:
+Value - [retval][out] contains a version string of form <major>.<minor>.<revision>.<build>.
+*/
+STDMETHODIMP VersionWriterImpl::get_FileVersion(/* [retval][out] */ BSTR *Value)
+{
+	return getVersion(false, Value);
+}
+
+/* put_FileVersion - [propput] sets the file version. Both the dwFileVersionMS and dwFileVersionLS members of the fixed file info and the FileVersion strings of the string tables are changed. A string table that has no FileVersion string is left alone.
+
+Parameters:
+NewValue - [in] up to 4 numbers separated by periods, e.g., '1.2.3.4'. missing parts are zero. If the string is not a version number, an interface error of ERROR_INVALID_DATA is returned.
+*/
+STDMETHODIMP VersionWriterImpl::put_FileVersion(/* [in] */ BSTR NewValue)
+{
+	return putVersion(false, NewValue);
+}
+
+/* get_ProductVersion - [propget] returns the product version of the fixed file info. See get_FileVersion.
+*/
+STDMETHODIMP VersionWriterImpl::get_ProductVersion(/* [retval][out] */ BSTR *Value)
+{
+	return getVersion(true, Value);
+}
+
+/* put_ProductVersion - [propput] sets the product version in the fixed file info and the ProductVersion strings. See put_FileVersion.
+*/
+STDMETHODIMP VersionWriterImpl::put_ProductVersion(/* [in] */ BSTR NewValue)
+{
+	return putVersion(true, NewValue);
+}
+
+/* SetAttribute - [method] sets a string attribute, e.g., CompanyName, LegalCopyright or PrivateBuild. An attribute that a string table does not have is added to it.
+
+Parameters:
+Name - [in] name of the attribute.
+Value - [in] new text of the attribute.
+LangCode - [in, optional] a translation code of language id and codepage, e.g., 0x040904b0, as returned by VersionInfo.QueryTranslation. It selects the string table to change. If it is omitted, all string tables are changed. If the file has no string table of the translation, an interface error of ERROR_RESOURCE_LANG_NOT_FOUND is returned.
+*/
+STDMETHODIMP VersionWriterImpl::SetAttribute(/* [in] */ BSTR Name, /* [in] */ BSTR Value, /* [in, optional] */ VARIANT *LangCode)
+{
+	if (!_vw.isOpen())
+		return E_UNEXPECTED;
+	if (!Name || *Name == 0)
+		return E_INVALIDARG;
+	uint32_t langCp = 0;
+	if (LangCode && LangCode->vt != VT_ERROR && LangCode->vt != VT_EMPTY)
+	{
+		VariantAutoRel var;
+		HRESULT hr = VariantChangeType(var, LangCode, 0, VT_UI4);
+		if (hr != S_OK)
+			return hr;
+		langCp = var._v.ulVal;
+	}
+	uint32_t errorCode = _vw.setString((LPCUTF16STR)Name, SysStringLen(Name), (LPCUTF16STR)(Value ? Value : L""), SysStringLen(Value), langCp);
+	return HRESULT_FROM_WIN32(errorCode);
+}
+
+/* Commit - [method] writes the edited version resource back to the file. If the new resource fits in the space of the old one, it is written in place. If not, the resource section is rebuilt (see SectionRebuilt). The image checksum is updated. A signed file must be signed again after the commit.
+
+Remarks:
+An interface error of ERROR_NOT_SUPPORTED is returned if the resource section needs to grow but is followed by a section other than a discardable relocation section. The file is not changed then.
+*/
+STDMETHODIMP VersionWriterImpl::Commit()
+{
+	if (!_vw.isOpen())
+		return E_UNEXPECTED;
+	return HRESULT_FROM_WIN32(_vw.commit());
+}
+
+/* get_SectionRebuilt - [propget] tells whether the last Commit had to grow the resource section of the file to fit the new version resource.
+
+Parameters:
+Value - [retval][out] VARIANT_TRUE if the resource section was rebuilt. VARIANT_FALSE if the resource was written in place.
+*/
+STDMETHODIMP VersionWriterImpl::get_SectionRebuilt(/* [retval][out] */ VARIANT_BOOL *Value)
+{
+	*Value = _vw.rebuilt() ? VARIANT_TRUE : VARIANT_FALSE;
+	return S_OK;
+}
+
+/* getVersion - formats the file or product version of the fixed file info as a version string. */
+HRESULT VersionWriterImpl::getVersion(bool product, BSTR *Value)
+{
+	if (!_vw.isOpen())
+		return E_UNEXPECTED;
+	uint64_t fileKey, productKey;
+	uint32_t errorCode = _vw.getVersionKeys(&fileKey, &productKey);
+	if (errorCode != ERROR_SUCCESS)
+		return HRESULT_FROM_WIN32(errorCode);
+	uint64_t key = product ? productKey : fileKey;
+	WCHAR buf[24];
+	swprintf_s(buf, ARRAYSIZE(buf), L"%u.%u.%u.%u", VERSION_KEY_MAJOR(key), VERSION_KEY_MINOR(key), VERSION_KEY_REVISION(key), VERSION_KEY_BUILD(key));
+	*Value = SysAllocString(buf);
+	return *Value ? S_OK : E_OUTOFMEMORY;
+}
+
+/* putVersion - parses a version string, and sets it as the file or product version. */
+HRESULT VersionWriterImpl::putVersion(bool product, BSTR NewValue)
+{
+	if (!_vw.isOpen())
+		return E_UNEXPECTED;
+	uint64_t key;
+	uint32_t errorCode = parseVersionKey((LPCUTF16STR)(NewValue ? NewValue : L""), SysStringLen(NewValue), &key);
+	if (errorCode == ERROR_SUCCESS)
+		errorCode = product ? _vw.setProductVersion(key) : _vw.setFileVersion(key);
+	return HRESULT_FROM_WIN32(errorCode);
+}
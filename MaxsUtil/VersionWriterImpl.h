@@ -0,0 +1,56 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "IDispatchImpl.h"
+#include "MaxsUtil_h.h"
+#include "VersionWriter.h"
+
+
+// implements the IVersionWriter interface of the VersionWriter coclass.
+class VersionWriterImpl :
+	public IDispatchWithObjectSafetyImpl<IVersionWriter, &IID_IVersionWriter, &LIBID_MaxsUtilLib>
+{
+public:
+	VersionWriterImpl() {}
+
+	// IUnknown methods
+	DELEGATE_IUNKNOWN_TO_IDISPATCHWITHOBJECTSAFETYIMPL(IVersionWriter, &IID_IVersionWriter, &LIBID_MaxsUtilLib)
+
+	// IVersionWriter methods
+	STDMETHOD(get_File)(/* [retval][out] */ BSTR *Value);
+	STDMETHOD(put_File)(/* [in] */ BSTR NewValue);
+	STDMETHOD(get_FileVersion)(/* [retval][out] */ BSTR *Value);
+	STDMETHOD(put_FileVersion)(/* [in] */ BSTR NewValue);
+	STDMETHOD(get_ProductVersion)(/* [retval][out] */ BSTR *Value);
+	STDMETHOD(put_ProductVersion)(/* [in] */ BSTR NewValue);
+	STDMETHOD(SetAttribute)(/* [in] */ BSTR Name, /* [in] */ BSTR Value, /* [in, optional] */ VARIANT *LangCode);
+	STDMETHOD(Commit)();
+	STDMETHOD(get_SectionRebuilt)(/* [retval][out] */ VARIANT_BOOL *Value);
+
+protected:
+	bstring _file; // pathname of the file being stamped.
+	VersionWriter _vw; // the editable version resource of _file.
+
+	HRESULT getVersion(bool product, BSTR *Value);
+	HRESULT putVersion(bool product, BSTR NewValue);
+};
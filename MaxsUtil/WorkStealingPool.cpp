@@ -0,0 +1,146 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#include "WorkStealingPool.h"
+
+
+// identifies the pool and the queue of the calling worker thread. a thread outside any pool has a null pool.
+static thread_local WorkStealingPool *s_currentPool = NULL;
+static thread_local int s_currentWorker = -1;
+
+
+/* defaultWorkerCount - returns the number of hardware threads, or 2 if the system does not tell. */
+int WorkStealingPool::defaultWorkerCount()
+{
+	int n = (int)std::thread::hardware_concurrency();
+	return n > 0 ? n : 2;
+}
+
+/* WorkStealingPool - starts the worker threads.
+
+Parameters:
+workerCount - [in] number of worker threads. Pass 0 to use one per hardware thread.
+*/
+WorkStealingPool::WorkStealingPool(int workerCount) : _queued(0), _pending(0), _nextQueue(0), _stopping(false)
+{
+	if (workerCount <= 0)
+		workerCount = defaultWorkerCount();
+	for (int i = 0; i < workerCount; i++)
+		_queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue));
+	for (int i = 0; i < workerCount; i++)
+		_threads.push_back(std::thread(&WorkStealingPool::run, this, i));
+}
+
+/* ~WorkStealingPool - waits for outstanding tasks and stops the workers. */
+WorkStealingPool::~WorkStealingPool()
+{
+	wait();
+	{
+		std::lock_guard<std::mutex> lk(_idleLock);
+		_stopping = true;
+	}
+	_workAvailable.notify_all();
+	for (size_t i = 0; i < _threads.size(); i++)
+		_threads[i].join();
+}
+
+/* submit - queues a task. If the caller is a worker of this pool, the task goes to the worker's own queue. Otherwise, the queues are filled round-robin. */
+void WorkStealingPool::submit(Task task)
+{
+	_pending++;
+	int index;
+	if (s_currentPool == this)
+		index = s_currentWorker;
+	else
+		index = (int)(_nextQueue++ % _queues.size());
+	{
+		std::lock_guard<std::mutex> lk(_queues[index]->lock);
+		_queues[index]->tasks.push_back(std::move(task));
+	}
+	{
+		std::lock_guard<std::mutex> lk(_idleLock);
+		_queued++;
+	}
+	_workAvailable.notify_one();
+}
+
+/* wait - blocks until every submitted task, including the ones submitted by tasks, has completed. Do not call it from a task. */
+void WorkStealingPool::wait()
+{
+	std::unique_lock<std::mutex> lk(_idleLock);
+	_allDone.wait(lk, [this] { return _pending == 0; });
+}
+
+/* takeTask - pops the newest task from the worker's own queue. If the queue is empty, steals the oldest task from one of the other queues. */
+bool WorkStealingPool::takeTask(int index, Task &task)
+{
+	size_t n = _queues.size();
+	for (size_t i = 0; i < n; i++)
+	{
+		WorkQueue *q = _queues[(index + i) % n].get();
+		std::lock_guard<std::mutex> lk(q->lock);
+		if (q->tasks.empty())
+			continue;
+		if (i == 0)
+		{
+			task = std::move(q->tasks.back());
+			q->tasks.pop_back();
+		}
+		else
+		{
+			task = std::move(q->tasks.front());
+			q->tasks.pop_front();
+		}
+		return true;
+	}
+	return false;
+}
+
+/* run - the worker thread procedure. */
+void WorkStealingPool::run(int index)
+{
+	s_currentPool = this;
+	s_currentWorker = index;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lk(_idleLock);
+			_workAvailable.wait(lk, [this] { return _queued > 0 || _stopping; });
+			if (_queued == 0)
+				break; // stopping.
+			// claim one of the queued tasks. it's not known yet which queue it'll come from.
+			_queued--;
+		}
+		Task task;
+		// a claimed task is guaranteed to be in some queue. it may take another pass if a peer has just stolen the one we saw.
+		while (!takeTask(index, task))
+			std::this_thread::yield();
+		task(index);
+		if (--_pending == 0)
+		{
+			std::lock_guard<std::mutex> lk(_idleLock);
+			_allDone.notify_all();
+		}
+	}
+	s_currentPool = NULL;
+	s_currentWorker = -1;
+}
@@ -0,0 +1,72 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+#include "portable.h"
+#include <functional>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+
+/* WorkStealingPool runs tasks on a fixed set of worker threads. Each worker owns a queue. A task submitted from a worker goes to the worker's own queue, and the worker pops its newest task first (LIFO), which keeps a depth-first walk of a directory tree local to the thread and its cache. An idle worker steals the oldest task (FIFO) from another worker's queue. Stealing from the old end hands out the big, not-yet-expanded subtrees, so the load spreads with few steals. Tasks may submit more tasks. wait() returns when all of them have completed.
+*/
+class WorkStealingPool
+{
+public:
+	typedef std::function<void(int workerIndex)> Task;
+
+	WorkStealingPool(int workerCount = 0);
+	~WorkStealingPool();
+
+	void submit(Task task);
+	void wait();
+
+	int workerCount() const { return (int)_threads.size(); }
+	static int defaultWorkerCount();
+
+protected:
+	struct WorkQueue
+	{
+		std::mutex lock;
+		std::deque<Task> tasks;
+	};
+	std::vector<std::unique_ptr<WorkQueue> > _queues;
+	std::vector<std::thread> _threads;
+	std::mutex _idleLock; // guards the waits on _workAvailable and _allDone.
+	std::condition_variable _workAvailable, _allDone;
+	size_t _queued; // tasks sitting in the queues. guarded by _idleLock.
+	std::atomic<size_t> _pending; // tasks submitted but not yet completed.
+	std::atomic<unsigned> _nextQueue; // round-robin pointer for tasks submitted from outside the pool.
+	bool _stopping;
+
+	void run(int index);
+	bool takeTask(int index, Task &task);
+
+private:
+	WorkStealingPool(const WorkStealingPool&);
+	WorkStealingPool& operator=(const WorkStealingPool&);
+};
@@ -32,14 +32,28 @@
 #include "VersionInfoImpl.h"
 #include "InputBoxImpl.h"
 #include "ProgressBoxImpl.h"
+#include "VersionWriterImpl.h"
+#include "CabinetWriterImpl.h"
+#include "FileHasherImpl.h"
+#include "DependencyGraphImpl.h"
 
 
 // This is a table of COM classes we want to expose. DllRegisterServer and DllUnregisterServer use the table for registration purposes. If you define a new COM class, make sure it's added to this table, and add the C++ implementation class to DllGetClassObject.
 static CoclassRegInfo s_cri[] =
 {
-	{&CLSID_VersionInfo, L"MaxsUtilLib.VersionInfo", L"Max's VersionInfo", &IID_IVersionInfo, L"VersionInfo",},
+	{&CLSID_VersionInfo, L"MaxsUtilLib.VersionInfo", L"Max's VersionInfo", &IID_IVersionInfo2, L"VersionInfo2",},
 	{&CLSID_InputBox, L"MaxsUtilLib.InputBox", L"Max's InputBox", &IID_IInputBox, L"InputBox",},
 	{&CLSID_ProgressBox, L"MaxsUtilLib.ProgressBox", L"Max's ProgressBox", &IID_IProgressBox, L"ProgressBox",},
+	{&CLSID_VersionWriter, L"MaxsUtilLib.VersionWriter", L"Max's VersionWriter", &IID_IVersionWriter, L"VersionWriter",},
+	{&CLSID_CabinetWriter, L"MaxsUtilLib.CabinetWriter", L"Max's CabinetWriter", &IID_ICabinetWriter, L"CabinetWriter",},
+	{&CLSID_FileHasher, L"MaxsUtilLib.FileHasher", L"Max's FileHasher", &IID_IFileHasher, L"FileHasher",},
+	{&CLSID_DependencyGraph, L"MaxsUtilLib.DependencyGraph", L"Max's DependencyGraph", &IID_IDependencyGraph, L"DependencyGraph",},
+};
+
+// This is a table of interfaces a COM class implements besides its default interface, e.g., an interface a newer one extends. They are registered for marshaling like the default interfaces are.
+static CoclassRegInfo s_iri[] =
+{
+	{&CLSID_NULL, NULL, NULL, &IID_IVersionInfo, L"VersionInfo",},
 };
 
 
@@ -79,6 +93,14 @@ STDAPI DllGetClassObject(REFCLSID rclsid, REFIID riid, LPVOID* ppv)
 		pClassFactory = new IClassFactoryNoAggrImpl<InputBoxImpl>;
 	else if (IsEqualCLSID(rclsid, CLSID_ProgressBox))
 		pClassFactory = new IClassFactoryNoAggrImpl<ProgressBoxImpl>;
+	else if (IsEqualCLSID(rclsid, CLSID_VersionWriter))
+		pClassFactory = new IClassFactoryNoAggrImpl<VersionWriterImpl>;
+	else if (IsEqualCLSID(rclsid, CLSID_CabinetWriter))
+		pClassFactory = new IClassFactoryNoAggrImpl<CabinetWriterImpl>;
+	else if (IsEqualCLSID(rclsid, CLSID_FileHasher))
+		pClassFactory = new IClassFactoryNoAggrImpl<FileHasherImpl>;
+	else if (IsEqualCLSID(rclsid, CLSID_DependencyGraph))
+		pClassFactory = new IClassFactoryNoAggrImpl<DependencyGraphImpl>;
 	else
 		return CLASS_E_CLASSNOTAVAILABLE;
 	if (pClassFactory == NULL)
@@ -114,6 +136,11 @@ STDAPI DllRegisterServer(void)
 		if (FAILED(hr))
 			hr2 = hr;
 	}
+	for (int i = 0; i < ARRAYSIZE(s_iri); i++) {
+		hr = CoclassRegistryHelper(LibInstanceHandle, s_iri + i, &LIBID_MaxsUtilLib).registerInterface(L"MaxsUtil.dll");
+		if (FAILED(hr))
+			hr2 = hr;
+	}
 
 	hr = COMServerLibRegistryHelper(LibInstanceHandle, &LIBID_MaxsUtilLib).registerTypelib(L"Maximilian's Utility Library", L"MaxsUtil.dll");
 	if (FAILED(hr))
@@ -136,6 +163,11 @@ STDAPI DllUnregisterServer(void)
 		if (FAILED(hr))
 			hr2 = hr;
 	}
+	for (int i = 0; i < ARRAYSIZE(s_iri); i++) {
+		hr = CoclassRegistryHelper(LibInstanceHandle, s_iri + i, &LIBID_MaxsUtilLib).unregisterInterface();
+		if (FAILED(hr))
+			hr2 = hr;
+	}
 
 	hr = COMServerLibRegistryHelper(LibInstanceHandle, &LIBID_MaxsUtilLib).unregisterTypelib();
 	if (FAILED(hr))
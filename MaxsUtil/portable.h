@@ -0,0 +1,194 @@
+/*
+  Copyright (c) 2022 Makoto Tanabe <mtanabe.sj@outlook.com>
+  Licensed under the MIT License.
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+#pragma once
+/* portable.h - common definitions for the platform-neutral modules of the library (the memory-mapped file, the PE image parser and the version resource decoder). Those modules do not include stdafx.h and do not use COM types. So, they compile on Linux as well as on Windows. They report errors with Win32 error codes (e.g., ERROR_RESOURCE_DATA_NOT_FOUND). The COM classes convert them to interface errors with HRESULT_FROM_WIN32. On Linux, the subset of the Win32 error codes the modules use is defined here.
+*/
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else//#ifdef _WIN32
+#define ERROR_SUCCESS 0
+#define ERROR_FILE_NOT_FOUND 2
+#define ERROR_PATH_NOT_FOUND 3
+#define ERROR_TOO_MANY_OPEN_FILES 4
+#define ERROR_ACCESS_DENIED 5
+#define ERROR_NOT_ENOUGH_MEMORY 8
+#define ERROR_BAD_FORMAT 11
+#define ERROR_INVALID_DATA 13
+#define ERROR_WRITE_FAULT 29
+#define ERROR_HANDLE_EOF 38
+#define ERROR_NOT_SUPPORTED 50
+#define ERROR_INVALID_PARAMETER 87
+#define ERROR_OPEN_FAILED 110
+#define ERROR_INSUFFICIENT_BUFFER 122
+#define ERROR_MOD_NOT_FOUND 126
+#define ERROR_BAD_EXE_FORMAT 193
+#define ERROR_DIRECTORY 267
+#define ERROR_FILE_INVALID 1006
+#define ERROR_NOT_FOUND 1168
+#define ERROR_CANCELLED 1223
+#define ERROR_CANT_RESOLVE_FILENAME 1921
+#define ERROR_RESOURCE_DATA_NOT_FOUND 1812
+#define ERROR_RESOURCE_TYPE_NOT_FOUND 1813
+#define ERROR_RESOURCE_NAME_NOT_FOUND 1814
+#define ERROR_RESOURCE_LANG_NOT_FOUND 1815
+#endif//#ifdef _WIN32
+
+#ifndef _WIN32
+#include <errno.h>
+/* errnoToWin32 - maps an errno value from a failed file operation to the nearest Win32 error code. */
+inline uint32_t errnoToWin32(int e)
+{
+	switch (e)
+	{
+	case ENOENT: return ERROR_FILE_NOT_FOUND;
+	case ENOTDIR: return ERROR_PATH_NOT_FOUND;
+	case EACCES:
+	case EPERM: return ERROR_ACCESS_DENIED;
+	case ENOMEM: return ERROR_NOT_ENOUGH_MEMORY;
+	case EMFILE:
+	case ENFILE: return ERROR_TOO_MANY_OPEN_FILES;
+	case ELOOP: return ERROR_CANT_RESOLVE_FILENAME;
+	}
+	return ERROR_OPEN_FAILED;
+}
+#endif//#ifndef _WIN32
+
+/* pathnames are wide on Windows and UTF-8 on Linux. PATHCHAR and pathstring follow the platform convention so that the modules can pass a pathname straight to the system without conversion.
+*/
+#ifdef _WIN32
+typedef wchar_t PATHCHAR;
+#define PATHSEPARATOR L'\\'
+#else//#ifdef _WIN32
+typedef char PATHCHAR;
+#define PATHSEPARATOR '/'
+#endif//#ifdef _WIN32
+typedef const PATHCHAR *LPCPATHSTR;
+typedef std::basic_string<PATHCHAR> pathstring;
+
+/* text stored in a Win32 resource is always little-endian UTF-16. wchar_t is 4 bytes wide on Linux. so, the modules use char16_t for resource text. On Windows, a char16_t string can be cast to LPCWSTR.
+*/
+typedef char16_t UTF16CHAR;
+typedef const UTF16CHAR *LPCUTF16STR;
+
+// case-insensitive comparison of ASCII letters in UTF-16 text. resource keys (e.g., 'ProductName' or '040904b0') are always ASCII.
+inline UTF16CHAR utf16ToLower(UTF16CHAR c)
+{
+	return (c >= 'A' && c <= 'Z') ? (UTF16CHAR)(c + ('a' - 'A')) : c;
+}
+inline int utf16icmp(LPCUTF16STR s1, size_t len1, LPCUTF16STR s2, size_t len2)
+{
+	size_t n = len1 < len2 ? len1 : len2;
+	for (size_t i = 0; i < n; i++)
+	{
+		UTF16CHAR c1 = utf16ToLower(s1[i]);
+		UTF16CHAR c2 = utf16ToLower(s2[i]);
+		if (c1 != c2)
+			return c1 < c2 ? -1 : 1;
+	}
+	if (len1 == len2)
+		return 0;
+	return len1 < len2 ? -1 : 1;
+}
+inline size_t utf16len(LPCUTF16STR s)
+{
+	size_t n = 0;
+	while (s[n])
+		n++;
+	return n;
+}
+
+// converts UTF-16 text to UTF-8. an unpaired surrogate becomes U+FFFD.
+inline void appendUtf8(std::string &out, LPCUTF16STR s, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+	{
+		uint32_t c = s[i];
+		if (c < 0x80)
+		{
+			out.push_back((char)c);
+			continue;
+		}
+		if (c >= 0xD800 && c <= 0xDFFF)
+		{
+			if (c <= 0xDBFF && i + 1 < len && s[i + 1] >= 0xDC00 && s[i + 1] <= 0xDFFF)
+				c = 0x10000 + ((c - 0xD800) << 10) + (s[++i] - 0xDC00);
+			else
+				c = 0xFFFD;
+		}
+		if (c < 0x800)
+		{
+			out.push_back((char)(0xC0 | (c >> 6)));
+		}
+		else if (c < 0x10000)
+		{
+			out.push_back((char)(0xE0 | (c >> 12)));
+			out.push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+		}
+		else
+		{
+			out.push_back((char)(0xF0 | (c >> 18)));
+			out.push_back((char)(0x80 | ((c >> 12) & 0x3F)));
+			out.push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+		}
+		out.push_back((char)(0x80 | (c & 0x3F)));
+	}
+}
+
+// converts UTF-8 text to UTF-16. a malformed sequence becomes U+FFFD.
+inline void appendUtf16(std::u16string &out, const char *s, size_t len)
+{
+	const uint8_t *p = (const uint8_t*)s;
+	for (size_t i = 0; i < len;)
+	{
+		uint32_t c = p[i++];
+		int more = c < 0x80 ? 0 : c >= 0xF0 && c < 0xF5 ? 3 : c >= 0xE0 ? 2 : c >= 0xC2 ? 1 : -1;
+		if (more > 0)
+		{
+			c &= 0x3F >> more;
+			for (int k = 0; k < more; k++, i++)
+			{
+				if (i == len || (p[i] & 0xC0) != 0x80)
+				{
+					more = -1;
+					break;
+				}
+				c = (c << 6) | (p[i] & 0x3F);
+			}
+			if (more > 0 && (c < (more == 1 ? 0x80U : more == 2 ? 0x800U : 0x10000U) || (c >= 0xD800 && c <= 0xDFFF)))
+				more = -1;
+		}
+		if (more < 0)
+			c = 0xFFFD;
+		if (c >= 0x10000)
+		{
+			out.push_back((UTF16CHAR)(0xD800 + ((c - 0x10000) >> 10)));
+			out.push_back((UTF16CHAR)(0xDC00 + ((c - 0x10000) & 0x3FF)));
+		}
+		else
+			out.push_back((UTF16CHAR)c);
+	}
+}
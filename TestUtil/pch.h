@@ -16,6 +16,7 @@
 #include <ObjSafe.h>
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <string>
 #include <filesystem>
 #include <tchar.h>
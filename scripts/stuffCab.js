@@ -6,7 +6,7 @@
 
 Usage: stuffCab.js [directory]
 
-This script program uses MaxsUtil.dll, a COM server with utility functions, as well as the FileSystemObject and WScript.Shell automation objects of the system.
+This script program uses MaxsUtil.dll, a COM server with utility functions, as well as the FileSystemObject and WScript.Shell automation objects of the system. The cab is compressed by MaxsUtilLib.CabinetWriter on all processors. Unless directories or extensions are to be excluded, the CabinetWriter lists the directory, too. File names in any language are supported.
 
 CAB format reference:
 https://docs.microsoft.com/en-us/previous-versions/bb417343(v=msdn.10)
@@ -61,95 +61,71 @@ var progress = new ActiveXObject("MaxsUtilLib.ProgressBox");
 progress.Caption = WScript.ScriptName;
 progress.Message = "Scanning directory...";
 progress.Start();
-// the first task is to scan the source directory and count how many files there are in it.
-var fileCount = scanDirectory(params.srcDir, params.includeNested);
-if (progress.Canceled)
-  WScript.Quit(1);
-if (fileCount == 0) {
-	WScript.Echo("No file exists in the directory.");
-	WScript.Quit(2);
-}
-// use the tally to set the upper bound of the progress range.
-progress.Message = "Generating DDF for "+fileCount+" files...";
-progress.UpperBound = fileCount;
-progress.Start(PROGRESSBOXSTARTOPTION_SHOW_PROGRESSBAR);
+var cab = new ActiveXObject("MaxsUtilLib.CabinetWriter");
+var fileCount, unpackedSize;
+if (!params.hasExclusions()) {
+  // with nothing to exclude, the CabinetWriter walks the directory itself. it reads the directories in large batches on all processors, and makes no FileSystemObject call per file.
+  try {
+    cab.AddDirectory(params.srcDir, params.includeNested);
+  } catch(e) {
+    // AddDirectory fails on a file larger than 2GB, or on the 65536th file. a cab cannot hold them.
+    log.write("AddDirectory caught exception", (e.number & 0xFFFF)+"; "+params.srcDir);
+    WScript.Echo("Operation aborted due to a file that cannot be added to a cab.\n\n"+e.message);
+    WScript.Quit(3);
+  }
+  fileCount = cab.FileCount;
+  unpackedSize = cab.BytesTotal;
+  if (fileCount == 0) {
+    WScript.Echo("No file exists in the directory.");
+    WScript.Quit(2);
+  }
+} else {
+  // the first task is to scan the source directory and count how many files there are in it.
+  fileCount = scanDirectory(params.srcDir, params.includeNested);
+  if (progress.Canceled)
+    WScript.Quit(1);
+  if (fileCount == 0) {
+    WScript.Echo("No file exists in the directory.");
+    WScript.Quit(2);
+  }
+  // use the tally to set the upper bound of the progress range.
+  progress.Message = "Listing "+fileCount+" files...";
+  progress.UpperBound = fileCount;
+  progress.Start(PROGRESSBOXSTARTOPTION_SHOW_PROGRESSBAR);
 
-// create a DDF list of file paths and timestamps in ascii. makecab cannot handle unicode.
-var ddfList = fso.CreateTextFile(params.tmpDDF, true, false);
-ddfList.WriteLine(".Set DiskDirectory1=" + params.diskDir);
-ddfList.WriteLine(".Set CabinetName1=" + params.tmpPrefix+params.srcName+".cab");
-ddfList.WriteLine(".Set UniqueFiles=OFF");
-ddfList.WriteLine(".Set Cabinet=ON");
-ddfList.WriteLine(".Set Compress=ON");
-ddfList.WriteLine(".Set MaxDiskSize=0");
-// walk the files in the source directory and add them to the ddf. if the user has elected to include nested directories in the scan, iterate and pick up the files in all nested directories, too.
-var wideNames = 0; // this counter is used to tally non-english filenames. makecab cannot handle multiple languages.
-var unpackedSize = writeDirectoryToDDF(params.srcDir, ddfList, wideNames);
-ddfList.Close();
+  // walk the files in the source directory and add them to a CabinetWriter. if the user has elected to include nested directories in the scan, iterate and pick up the files in all nested directories, too. files and directories on the exclusion lists are left out.
+  unpackedSize = addDirectoryToCab(params.srcDir, cab);
+}
 // check cancelation by the user.
 if (progress.Canceled)
   WScript.Quit(1);
 
-// alert the user if we've encountered international filenames. the user will have to choose between cancel the job and ignore the name problem and march on.
-if (wideNames > 0) {
-	log.write(WScript.ScriptName+" Interrupted.");
-	wsh.Run("Notepad \""+log._path+"\"");
-  if (IDCANCEL == wsh.Popup("Your directory contains file(s) with foreign name(s). Compression tool (MAKECAB) does not support file names with wide characters. Refer to the log for the problem name(s). Either cancel and rename them, or move them out of the directory. Or, choose Retry to ignore and try to continue without the problem file(s).", 0, WScript.ScriptName, MB_RETRYCANCEL|MB_DEFBUTTON2))
-    WScript.Quit(1);
-	log.write(WScript.ScriptName+" Resuming.");
-}
-
-// hide the progress bar since we won't be able to meter the compression progress which is our next and final part of the job.
-progress.HideProgressBar();
-progress.Message = "Compressing "+fileCount+" files ("+getByteCountString(unpackedSize)+" total).";
-progress.Note = "Waiting for the compression to complete. This may take a while.";
-progress.Start(PROGRESSBOXSTARTOPTION_APPEND_TO_NOTE); // put ProgressBox in append mode. we want to keep all text output by makecab by appending new text to the old.
-
-// generate a batch file in %TEMP%. it will prepare the staging area and run compression tool makecab on the ddf we've prepared.
-var cabBatch = fso.CreateTextFile(params.tmpBAT, true);
-cabBatch.WriteLine(params.tmpDrive);
-cabBatch.WriteLine("CD "+params.diskDir);
-cabBatch.WriteLine("DEL "+params.tmpCAB);
-cabBatch.WriteLine("MAKECAB /F "+params.tmpDDF);
-cabBatch.Close();
-
-// start the batch file and wait until makecab finishes packing the files. we will monitor by reading stdout and echo the output on the progress box.
-log.write("MAKECAB Batch Started.");
-var i=0;
+// compress the files. CabinetWriter moves the progress bar and writes the byte counts to the note while it works, and stops if the user hits the cancel button.
+progress.Message = "Compressing "+cab.FileCount+" files ("+getByteCountString(unpackedSize)+" total).";
+progress.Start(PROGRESSBOXSTARTOPTION_SHOW_PROGRESSBAR);
+log.write("Compression Started.");
 try {
-  var proc = wsh.Exec(params.tmpBAT);
-  while(!proc.StdOut.AtEndOfStream) {
-	  var nextline = proc.StdOut.ReadLine();
- 	  log.write("StdOut", nextline);
-	  progress.Note = nextline;
-    WScript.Sleep(0);
-    // if the user has hit the cancel button, kill the batch process and exit.
-	  if (progress.Canceled) {
-      log.write("MAKECAB Canceled");
-      proc.Terminate();
-      log.write(WScript.ScriptName+" Aborted");
-      WScript.Quit(1);
-    }
-    if (i++ == 0) {
-			// this pushes the progress box to the front of the makecab console in z-order.
-      progress.Visible = true;
-    }
-  }
+  cab.Compress(params.tmpCAB, progress);
 } catch(e) {
-	// canceling can cause wscript to throw a pipe-closing error 800700e8.
-	log.write("MAKECAB Batch Aborted", "ErrorCode="+(e.number>0? e.number : (0x100000000+e.number)).toString(16)+"; Message='"+e.message+"'");
-	WScript.Quit(1);
+  if (progress.Canceled) {
+    log.write("Compression Canceled");
+    log.write(WScript.ScriptName+" Aborted");
+    WScript.Quit(1);
+  }
+  log.write("Compression Failed", "ErrorCode="+(e.number>0? e.number : (0x100000000+e.number)).toString(16)+"; Message='"+e.message+"'");
+  WScript.Echo("Compression failed.\n\n"+e.message);
+  WScript.Quit(3);
 }
+log.write("CAB SIZE", cab.CabinetSize);
 progress.Message = "Compression completed";
 
 // we're done. tell the user that and show summary stats. open the log in notepad if the user wants it.
 log.write(WScript.ScriptName+" Stopped.");
 
 if(params.showStats) {
-	var cab = fso.GetFile(params.tmpCAB);
-	var compressionRatio = (100*cab.Size)/unpackedSize;
+	var compressionRatio = (100*cab.CabinetSize)/unpackedSize;
 	if (IDYES == wsh.Popup(
-		"Compression completed.\n\nResult Summary: "+fileCount+" files totalling "+getByteCountString(unpackedSize)+" bytes compressed to " + getByteCountString(cab.Size) + " ("+compressionRatio.toFixed(1) + "%)\n\nDo you want to view the log?",
+		"Compression completed.\n\nResult Summary: "+fileCount+" files totalling "+getByteCountString(unpackedSize)+" bytes compressed to " + getByteCountString(cab.CabinetSize) + " ("+compressionRatio.toFixed(1) + "%)\n\nDo you want to view the log?",
 			0,
 			WScript.ScriptName,
 			MB_YESNO)) {
@@ -173,11 +149,11 @@ wsh.Run(params.destCAB);
 5) excludedDirs : names of directories subject to exclusion from the scan.
 6) excludedExts : extension names of files subject to exclusion from the scan.
 7) destCAB : FQPN of the output cab.
-8) diskDir : FQPN of a staging directory where the cab is generated. It's set to the value of %TEMP%. This is where a ddf and a bat that runs a cab compression tool (makecab.exe) are written and operated on.
+8) diskDir : FQPN of a staging directory where the cab is generated. It's set to the value of %TEMP%. The cab is moved to destCAB when the compression completes.
 
 Before starting a scan, call method configure(). It initializes parameters with saved settings from  the system registry, and collects the source directory and nested scan option from the user by running MaxsUtilLib.InputBox. It saves the new settings in the registry.
 
-While scanning, call method canIncludeDirectory() to decide if a subdirectory can be included in the scan or not. Also, call method canIncludeFile() to decide if a particular file can be included in the ddf.
+While scanning, call method canIncludeDirectory() to decide if a subdirectory can be included in the scan or not. Also, call method canIncludeFile() to decide if a particular file can be included in the cab.
 
 After the scan, call method clean(). It deletes work files used in generating a cab.
 */
@@ -236,11 +212,7 @@ function cabParams() {
 			this.srcName = fso.GetFolder(this.srcDir).Name;
 			this.destCAB = this.srcDir+".cab";
 		}
-		this.tmpDDF = this.tmpDir+this.tmpPrefix+this.srcName+".ddf";
-		this.tmpBAT = this.tmpDir+this.tmpPrefix+this.srcName+".bat";
 		this.tmpCAB = this.tmpDir+this.tmpPrefix+this.srcName+".cab";
-		this.tmpDrive = this.tmpDir.substr(0,2);
-		this.destDrive = this.destCAB.substr(0,2);
 		this.excludedDirs = excludedDirectories.split(",");
 		this.excludedExts = excludedFileExtensions.split(",");
 
@@ -256,19 +228,22 @@ function cabParams() {
 		return true;
 	}
 	this.clean = function() {
-    if (fso.FileExists(this.tmpDir+"setup.inf"))
-      fso.DeleteFile(this.tmpDir+"setup.inf");
-    if (fso.FileExists(this.tmpDir+"setup.rpt"))
-      fso.DeleteFile(this.tmpDir+"setup.rpt");
-		if (fso.FileExists(this.tmpDDF))
-      fso.DeleteFile(this.tmpDDF);
-    if (fso.FileExists(this.tmpBAT))
-      fso.DeleteFile(this.tmpBAT);
 		if (fso.FileExists(this.destCAB))
       fso.DeleteFile(this.destCAB);
     if (fso.FileExists(this.tmpCAB))
 		  fso.MoveFile(this.tmpCAB, this.destCAB);
 	}
+	// returns true if an exclusion list names a directory or an extension.
+	this.hasExclusions = function() {
+		var lists = [this.excludedDirs, this.excludedExts];
+		for (var i=0; i<lists.length; i++) {
+			for (var j=0; j<lists[i].length; j++) {
+				if (lists[i][j].length > 0)
+					return true;
+			}
+		}
+		return false;
+	}
 	this.canIncludeDirectory = function(dir) {
 		var p = dir.Path.toLowerCase();
     for(var i=0; i<this.excludedDirs.length; i++) {
@@ -332,37 +307,6 @@ function scanDirectory(dirPath) {
   return c;
 }
 
-// converts an integer number to a double-digit number as a character string. If the number is less than 10, a 0 is prepended. For example, if numVal=3, the function returns "03". If numVal>100, it truncates the digits higher than the 2nd place. If numVal=123, the function returns "23".
-function getDoubleDigitString(numVal) {
-  var s = "";
-  if(numVal > 99)
-	  numVal = numVal % 100;
-  if(numVal < 10)
-	  s = "0";
-  s = s+numVal.toString();
-  return s
-}
-
-// formats an input date-time value as a timestamp acceptable to ddf. This is the format: '/date=MM/DD/YY /time=hh:mm:ss?' where ? is a for am or p for pm.
-function getDdfTimeStamp(dateTimeVal) {
-  // DDF time stamp: '/date=02/15/07 /time=01:00:00p'
-  var curAmOrPm = "a";
-  var hour2 = dateTimeVal.getHours();
-  if(hour2 > 12) {
-    hour2 -= 12;
-    curAmOrPm = "p";
-  }
-  if(hour2 == 0)
-	  hour2 = 12;
-  var curYear = getDoubleDigitString(dateTimeVal.getYear());
-  var curMonth = getDoubleDigitString(dateTimeVal.getMonth()+1);
-  var curDay = getDoubleDigitString(dateTimeVal.getDate());
-  var curHour = getDoubleDigitString(hour2);
-  var curMinute = getDoubleDigitString(dateTimeVal.getMinutes());
-  var curSecond = "00";
-  return " /date="+curMonth+"/"+curDay+"/"+curYear+" /time="+curHour+":"+curMinute+":"+curSecond+curAmOrPm;
-}
-
 // formats an input number as a byte count, a KB count, a MB count, or a GB count depending on the position of the number's most significant digit. For example, if the input number n has more than 6 digits, the method returns a string of form "x.y MB" where x is the quotient of operation n/1000000, and y the most significant digit of the remainder. If n=1000000, the method returns string "1.0MB".
 function getByteCountString(n) {
 	if(n<1000)
@@ -374,27 +318,15 @@ function getByteCountString(n) {
   return ((n/1000000000).toFixed(1)).toString()+"GB";
 }
 
-// returns true if all characters of txt falls in the extended ASCII range of 0 to 0xff character codes. otherwise, returns false.
-function isTextInAnsiRange(txt) {
-	for(var i=0; i<txt.length; i++) {
-		if(txt.charAt(i)>'')
-		  return false;
-	}
-	return true;
-}
+/* enumerates files in the input directory at dirPath, and adds them to the input CabinetWriter cab. Each file is named in the cab by its pathname relative to the source directory. Iterates into the subdirectories if the includeNested flag is true. Increments the progress indication and displays the name of a currently scanned file in the progress box.
 
-/* enumerates files in the input directory at dirPath, and writes them as ddf entries to the input file ddf. Iterates into the subdirectories if the includeNested flag is true. Increments the progress indication and displays the name of a currently scanned file in the progress box.
-
-Note that if it has an extension name on the exclusion list, a found file is not added to ddf. Also note that if subdirectories are iterated, and if a current subdirectory has a name that matches an item in the exclusion list, that subdirectory will not be scanned.
-
-There is a caveat. Because it does not use a locale directive in the ddf header, the ddf our script generates does not support foreign characters. Only ASCII and extended ASCII characters are supported. A file with a name having a character whose Unicode node occurs outside the 8-bit (0-0xFF) range is automatically rejected. The file will not be added to the cab.
+Note that if it has an extension name on the exclusion list, a found file is not added to the cab. Also note that if subdirectories are iterated, and if a current subdirectory has a name that matches an item in the exclusion list, that subdirectory will not be scanned.
 
 Consult the log for indications for files excluded from the cab. Look for these key words.
 EXCLUDED_DIR : the directory has a name found in an exclusion list, and therefore, was excluded from the scan.
 EXCLUDED_FILE : the file has an extension name found in an exclusion list, and therefore, was removed from the scan.
-NON_ASCII_FILENAME : the file was rejected due to its wide character name.
 */
-function writeDirectoryToDDF(dirPath, ddf) {
+function addDirectoryToCab(dirPath, cab) {
 	if (progress.Canceled)
     return 0;
   var size = 0;
@@ -408,24 +340,11 @@ function writeDirectoryToDDF(dirPath, ddf) {
         log.write("EXCLUDED_DIR", subdir.Path);
 			  continue;
 	    }
-	    size += writeDirectoryToDDF(subdir.Path, ddf);
+	    size += addDirectoryToCab(subdir.Path, cab);
   	  if (progress.Canceled)
         return 0;
     }
   }
-  var relPath = params.getRelativePath(fld.Path);
-  try {
-    ddf.WriteLine(".Set DestinationDir=\""+relPath+"\"");
-  } catch(e) {
-		// WriteLine throws error 5 if relPath has an international name.
-		log.write("writeDirectoryToDDF caught exception", (e.number & 0xFFFF)+"; "+relPath);
-		if(!isTextInAnsiRange(relPath)) {
-			wideNames++;
-			return 0;
-		}
-		WScript.Echo("Operation aborted due to unacceptable file name:\n\n"+relPath);
-		WScript.Quit(3);
-	}
   var fc = fld.Files;
   var ef = new Enumerator(fc);
   for (; !ef.atEnd(); ef.moveNext()) {
@@ -434,15 +353,16 @@ function writeDirectoryToDDF(dirPath, ddf) {
 			log.write("EXCLUDED_FILE", f.Path);
 			continue;
 		}
-	  if(!isTextInAnsiRange(f.Path)) {
-			log.write("NON_ASCII_FILENAME", f.Path);
-			wideNames++;
-			continue;
-		}
 	  var fileSeq = progress.ProgressPos+1;
 	  progress.Note = "File "+fileSeq+": "+f.Name;
-    var tstamp = getDdfTimeStamp(new Date(f.DateLastModified));
-    ddf.WriteLine("\""+f.Path+"\""+tstamp);
+	  try {
+      cab.AddFile(f.Path, params.getRelativePath(f.Path));
+	  } catch(e) {
+			// AddFile fails on a file larger than 2GB, or on the 65536th file. a cab cannot hold them.
+			log.write("addDirectoryToCab caught exception", (e.number & 0xFFFF)+"; "+f.Path);
+			WScript.Echo("Operation aborted due to a file that cannot be added to a cab:\n\n"+f.Path+"\n\n"+e.message);
+			WScript.Quit(3);
+	  }
 	  progress.Increment();
 		if (progress.Canceled)
 	    return 0;